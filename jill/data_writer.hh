@@ -12,6 +12,8 @@
 #ifndef _DATA_WRITER_HH
 #define _DATA_WRITER_HH
 
+#include <string>
+#include <vector>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include "types.hh"
 
@@ -20,6 +22,13 @@ namespace jill {
 
 using timestamp_t = boost::posix_time::ptime;
 
+/** A log message, as log() takes it, for passing to log_batch() */
+struct log_entry {
+        timestamp_t time;
+        std::string source;
+        std::string message;
+};
+
 /**
  * Abstract base class for objects that write (or otherwise consume)
  * multichannel sampled and event data.
@@ -93,6 +102,15 @@ public:
                          std::string source,
                          std::string message) {}
 
+        /**
+         * Write several log messages, in order. The default calls log() for
+         * each; an implementation for which a write has a fixed cost, like
+         * an append to a packet table, should do them all at once.
+         */
+        virtual void log_batch(std::vector<log_entry> const & entries) {
+                for (auto const & e : entries) log(e.time, e.source, e.message);
+        }
+
         /**
          * Request data to be flushed to disk. Implementing classes must flush data
          * to disk on cleanup or at appropriate intervals, but this function is
@@ -100,6 +118,27 @@ public:
          */
         virtual void flush() {}
 
+        /**
+         * Told when the caller is falling behind, and again when it has
+         * caught up. While @a on, an implementation may give up something it
+         * can do without, like compression, to keep up with the data.
+         */
+        virtual void set_degraded(bool on) {}
+
+        /**
+         * Move on to a new file, starting with the next entry. The current
+         * entry, if there is one, is finished in the current file. A writer
+         * with nothing to rotate ignores this.
+         */
+        virtual void rotate() {}
+
+        /**
+         * Called when the caller has nothing to write, so that work which
+         * would otherwise hold up a write, like opening the next file ahead
+         * of rotate(), can be done then instead.
+         */
+        virtual void idle() {}
+
 };
 
 }
@@ -20,17 +20,17 @@ using jill::data_block_t;
 using std::size_t;
 
 block_ringbuffer::block_ringbuffer(std::size_t size)
-        : super(size), _read_ahead_ptr(0)
+        : super(size), _read_ahead_ptr(0), _high_water(0)
 {}
 
 size_t
 block_ringbuffer::push(nframes_t time, dtype_t dtype, char const * id,
-                       size_t size, void const * data)
+                       size_t size, void const * data, size_t keep_free)
 {
         // serialize the data in the buffer such that the header is followed by
         // the two data arrays
         data_block_t header(time, dtype, std::strlen(id), size);
-        if (header.size() > write_space()) {
+        if (header.size() + keep_free > write_space()) {
                 DBG << "ringbuffer full (req=" << header.size() << "; avail=" << write_space() << ")";
                 return 0;
         }
@@ -44,6 +44,14 @@ block_ringbuffer::push(nframes_t time, dtype_t dtype, char const * id,
         // store data
         std::memcpy(dst, data, header.sz_data);
         advance_write_ptr(header.size());
+        /* The reader resets the mark, so raising it is a compare-and-swap
+         * rather than a plain store. It almost never loops: the only other
+         * writer is take_high_water(), once per pass of the writer thread. */
+        const size_t used = read_space();
+        size_t seen = _high_water.load(std::memory_order_relaxed);
+        while (used > seen &&
+               !_high_water.compare_exchange_weak(seen, used, std::memory_order_relaxed))
+                ;
         return header.size();
 }
 
@@ -12,6 +12,8 @@
 #ifndef _BLOCK_RINGBUFFER_HH
 #define _BLOCK_RINGBUFFER_HH
 
+#include <atomic>
+
 #include "../types.hh"
 #include "ringbuffer.hh"
 
@@ -32,6 +34,11 @@ namespace jill { namespace dsp {
  * prebuffer. The peek_ahead() function provides read-ahead access, which can
  * used to detect when a trigger event has occurred, while the peek() and
  * release() functions operate on data at the tail of the queue.
+ *
+ * The buffer also remembers the most it has held. An overrun is reported after
+ * the fact and says nothing about the periods that came close; the high-water
+ * mark is how a writer can tell how much of its headroom the recording is
+ * actually using.
  */
 class block_ringbuffer : public ringbuffer<char>
 {
@@ -66,6 +73,19 @@ public:
                 return read_space() == _read_ahead_ptr;
         }
 
+        /// @return the largest read_space() seen by push() since the last take_high_water()
+        std::size_t high_water() const {
+                return _high_water.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Read the high-water mark and start a new window, which begins at
+         * what the buffer holds now. Call from the reader thread.
+         */
+        std::size_t take_high_water() {
+                return _high_water.exchange(read_space(), std::memory_order_relaxed);
+        }
+
         /**
          * Store a block of data
          *
@@ -74,12 +94,15 @@ public:
          * @param id    a string giving the id (channel) of the block
          * @param size  the number of bytes in the data array
          * @param data  an array of data to write
+         * @param keep_free  refuse the block if it would leave fewer than this
+         *                   many bytes free, holding them for other writes
          *
          * @returns the number of bytes written, or 0 if there wasn't enough
          *          room for all of them. Will not write partial blocks.
          */
         std::size_t push(nframes_t time, dtype_t dtype, char const * id,
-                         std::size_t size, void const * data);
+                         std::size_t size, void const * data,
+                         std::size_t keep_free = 0);
 
         /**
          * Read-ahead access to the buffer. If a block is available, returns a
@@ -113,6 +136,7 @@ public:
 
 private:
         std::size_t _read_ahead_ptr; // the number of bytes ahead of the _read_ptr
+        std::atomic<std::size_t> _high_water; // most bytes held, see take_high_water()
 
 };
 
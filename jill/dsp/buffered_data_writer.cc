@@ -9,13 +9,18 @@
  * (at your option) any later version.
  *
  */
+#include <algorithm>
 #include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
 #include <vector>
-#include <boost/date_time/posix_time/posix_time.hpp>
 #include <filesystem>
 
 #include "../logging.hh"
+#include "../logger.hh"
 #include "../net/zmq.hh"
 #include "buffered_data_writer.hh"
 #include "block_ringbuffer.hh"
@@ -27,6 +32,78 @@ using namespace jill::net;
 using std::size_t;
 using std::string;
 
+namespace {
+
+using writer_stats = buffered_data_writer::writer_stats;
+
+std::uint32_t
+usec(std::chrono::steady_clock::duration d)
+{
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+        return static_cast<std::uint32_t>(std::clamp<std::int64_t>(us, 0, UINT32_MAX));
+}
+
+std::uint64_t
+mean(std::uint64_t total, std::uint64_t n)
+{
+        return n ? total / n : 0;
+}
+
+/* The line that goes in the data log for an interval */
+string
+describe(writer_stats const & s, size_t capacity)
+{
+        std::ostringstream o;
+        o << "buffer high water " << s.high_water << " of " << capacity << " bytes"
+          << ", lag up to " << s.max_lag << " frames"
+          << "; " << s.writes << " blocks in " << s.passes << " passes (at most "
+          << s.max_blocks_per_pass << "), write mean " << mean(s.write_usec, s.writes)
+          << " us, max " << s.max_write_usec << " us"
+          << "; " << s.flushes << " flushes, mean " << mean(s.flush_usec, s.flushes)
+          << " us, max " << s.max_flush_usec << " us";
+        if (s.gaps > 0)
+                o << "; " << s.gaps << " low-priority blocks dropped";
+        if (s.degradations > 0)
+                o << "; past the soft limit " << s.degradations << " times, "
+                  << s.deferred_flushes << " flushes deferred";
+        return o.str();
+}
+
+void
+put_json(std::ostream & o, writer_stats const & s)
+{
+        o << "{\"writes\":" << s.writes
+          << ",\"write_mean_us\":" << mean(s.write_usec, s.writes)
+          << ",\"write_max_us\":" << s.max_write_usec
+          << ",\"flushes\":" << s.flushes
+          << ",\"flush_mean_us\":" << mean(s.flush_usec, s.flushes)
+          << ",\"flush_max_us\":" << s.max_flush_usec
+          << ",\"passes\":" << s.passes
+          << ",\"max_blocks_per_pass\":" << s.max_blocks_per_pass
+          << ",\"max_lag_frames\":" << s.max_lag
+          << ",\"high_water_bytes\":" << s.high_water
+          << ",\"degradations\":" << s.degradations
+          << ",\"deferred_flushes\":" << s.deferred_flushes
+          << ",\"gaps\":" << s.gaps << "}";
+}
+
+/* One JSON object per message, as jack_client publishes its own */
+string
+format_stats(writer_stats const & total, writer_stats const & window, size_t capacity,
+             bool degraded)
+{
+        std::ostringstream o;
+        o << "{\"buffer_bytes\":" << capacity
+          << ",\"degraded\":" << (degraded ? "true" : "false") << ",\"total\":";
+        put_json(o, total);
+        o << ",\"window\":";
+        put_json(o, window);
+        o << "}";
+        return o.str();
+}
+
+}
+
 /*
  * # Notes on buffered data_thread objects
  *
@@ -49,12 +126,26 @@ buffered_data_writer::buffered_data_writer(std::unique_ptr<data_writer> writer,
                                            size_t buffer_size,
                                            std::chrono::milliseconds poll_interval)
         : _state(Stopped),
+          _reset_armed(false),
+          _reset_frame(0),
+          _reset_rotate(false),
           _writer(std::move(writer)),
           _buffer(new block_ringbuffer(buffer_size)),
           _dirty(false),
           _poll_interval(poll_interval),
           _socket(zmq::context::socket(ZMQ_DEALER)),
-          _logger_bound(false)
+          _logger_bound(false),
+          _pass_blocks(0),
+          _log_interval(0),
+          _publish_interval(0),
+          _stats_socket(nullptr),
+          _last_pushed(0),
+          _bytes_written(0),
+          _soft_limit(0),
+          _soft_hold(0),
+          _degraded(false),
+          _reserve(0),
+          _reserve_bytes(0)
 {
         DBG << "buffered_data_writer initializing";
 }
@@ -66,6 +157,7 @@ buffered_data_writer::~buffered_data_writer()
         stop();                 // no more new data; exit writer thread
         join();                 // wait for writer thread to exit
         zmq_close(_socket);
+        if (_stats_socket) zmq_close(_stats_socket);
 }
 
 void
@@ -76,7 +168,48 @@ buffered_data_writer::push(nframes_t time, dtype_t dtype, char const * id,
                 if (_buffer->push(time, dtype, id, size, data) == 0) {
                         xrun();
                 }
+                else {
+                        _last_pushed.store(time, std::memory_order_relaxed);
+                }
+        }
+}
+
+void
+buffered_data_writer::push(nframes_t time, dtype_t dtype, char const * id,
+                           size_t size, void const * data, unsigned tier)
+{
+        if (tier == 0) return push(time, dtype, id, size, data);
+        if (_state == Stopping) return;
+        if (_buffer->push(time, dtype, id, size, data, tier * _reserve_bytes) != 0) {
+                _last_pushed.store(time, std::memory_order_relaxed);
+                return;
         }
+        // dropped to keep room for the tiers above; mark the spot, out of
+        // the reserve it was kept from
+        const gap_t gap{dtype == SAMPLED ? nframes_t(size / sizeof(sample_t)) : 1, dtype};
+        if (_buffer->push(time, GAP, id, sizeof(gap), &gap) == 0) {
+                xrun();
+        }
+}
+
+void
+buffered_data_writer::set_reserve(double fraction)
+{
+        if (fraction < 0 || fraction >= 1)
+                throw std::invalid_argument("reserve must be a fraction of the buffer");
+        _reserve = fraction;
+        _reserve_bytes = size_t(_reserve * _buffer->size());
+}
+
+unsigned
+buffered_data_writer::lowest_tier(double fraction)
+{
+        if (fraction <= 0 || 1 / fraction >= std::numeric_limits<unsigned>::max())
+                return std::numeric_limits<unsigned>::max();
+        unsigned tier = unsigned(1 / fraction);
+        // 1 / fraction is rounded either way; the product is what push() uses
+        while (tier > 0 && tier * fraction >= 1) --tier;
+        return tier;
 }
 
 void
@@ -133,6 +266,23 @@ buffered_data_writer::reset()
 }
 
 
+void
+buffered_data_writer::reset_at(nframes_t frame)
+{
+        _reset_frame.store(frame, std::memory_order_relaxed);
+        _reset_armed.store(true, std::memory_order_release);
+}
+
+
+void
+buffered_data_writer::rotate_at(nframes_t frame)
+{
+        // before arming, so that write() sees it when the split comes
+        _reset_rotate.store(true, std::memory_order_relaxed);
+        reset_at(frame);
+}
+
+
 void
 buffered_data_writer::start()
 {
@@ -181,9 +331,12 @@ buffered_data_writer::request_buffer_size(size_t bytes)
         while ((hdr = _buffer->peek()) != nullptr) {
                 write(hdr);
         }
-        _writer->flush();
-        _dirty = false;
+        flush_writer();
+        // keep the old buffer's mark, then start the new one's from empty
+        end_pass();
         _buffer->resize(bytes);
+        _buffer->take_high_water();
+        _reserve_bytes = size_t(_reserve * _buffer->size());
         return _buffer->size();
 }
 
@@ -196,6 +349,8 @@ buffered_data_writer::thread()
         // _state and the flags are set by start() before this thread is
         // launched, so that a stop() racing with startup cannot be lost
         DBG << "started writer thread";
+        _next_log = stats_clock::now() + _log_interval;
+        _next_publish = stats_clock::now() + _publish_interval;
 
         while (true) {
                 bool had_xrun = true;
@@ -204,6 +359,7 @@ buffered_data_writer::thread()
                 }
                 hdr = _buffer->peek_ahead();
                 if (!hdr) {
+                        end_pass();
                         write_messages();
                         /* if ringbuffer empty and Stopping, exit loop */
                         if (_state == Stopping) {
@@ -214,16 +370,38 @@ buffered_data_writer::thread()
                          * on an idle timer, and flushing an unchanged file
                          * every interval would be pure overhead. */
                         else {
-                                if (_dirty) {
-                                        _writer->flush();
-                                        _dirty = false;
+                                const auto now = stats_clock::now();
+                                relax(now);
+                                if (_dirty && _degraded) {
+                                        for (writer_stats * s : {&_stats, &_log_window, &_publish_window})
+                                                s->deferred_flushes += 1;
+                                }
+                                else if (_dirty) {
+                                        flush_writer();
                                 }
+                                if (!_degraded) _writer->idle();
+                                report(now);
                                 _ready.wait_for(lck, _poll_interval,
                                                 [this]{ return(_state == Stopping || _buffer->peek()); });
                         }
                 }
                 else {
+                        /* Signed, because the newest push can be an event
+                         * stamped a little before a sampled block already
+                         * queued; that is no lag at all */
+                        const auto lag = static_cast<std::int32_t>(
+                                _last_pushed.load(std::memory_order_relaxed) - hdr->time);
+                        // before write(), which may release the block
+                        const bool gap = hdr->dtype == GAP;
+                        const auto t0 = stats_clock::now();
                         write(hdr);
+                        const auto t1 = stats_clock::now();
+                        note_write(t1 - t0, std::max(lag, 0), gap);
+                        check_pressure(t1);
+                        /* here as well as between passes: a writer that
+                         * never catches up never has an idle pass, and
+                         * that is when the reports matter most */
+                        report(t1);
                 }
         }
         _writer->close_entry();
@@ -239,21 +417,49 @@ buffered_data_writer::write(data_block_t const * data)
         if (_reset.compare_exchange_strong(pending_reset, false)) {
                 _writer->close_entry();
         }
-        _writer->write(data, 0, 0);
+        // a difference, so that it holds across the frame counter wrapping
+        if (_reset_armed.load(std::memory_order_acquire) &&
+            std::int32_t(data->time - _reset_frame.load(std::memory_order_relaxed)) >= 0) {
+                _reset_armed.store(false, std::memory_order_relaxed);
+                _writer->close_entry();
+                // between entries, which is where a writer can change files
+                if (_reset_rotate.exchange(false)) _writer->rotate();
+                // at the frame asked for, which this block may be past
+                _writer->new_entry(_reset_frame.load(std::memory_order_relaxed));
+        }
+        write_block(data);
         _buffer->release();
         _dirty = true;
 }
 
 void
-buffered_data_writer::write_messages()
+buffered_data_writer::write_block(data_block_t const * data, nframes_t start, nframes_t stop)
 {
-        using namespace boost::posix_time;
+        _writer->write(data, start, stop);
+        std::size_t bytes = 0;
+        if (data->dtype == SAMPLED) {
+                const nframes_t end = (stop > 0) ? std::min(stop, data->nframes()) : data->nframes();
+                if (end > start) bytes = (end - start) * sizeof(sample_t);
+        }
+        else if (data->dtype == EVENT) {
+                bytes = data->sz_data;
+        }
+        _bytes_written.fetch_add(bytes, std::memory_order_relaxed);
+}
 
-        // only record a limited number of messages on any given pass, in case
-        // there's a huge backlog in the queue
-        static const int max_messages = 100;
+void
+buffered_data_writer::write_messages()
+{
+        /* Only take a limited number of messages on any given pass, in case
+         * there's a huge backlog in the queue, so that data waiting in the
+         * ringbuffer is not held up behind it. The limit used to be 100, when
+         * each message was its own write; they now go to the writer as one
+         * batch, which costs little more than a single message, so a pass can
+         * afford to take many more. */
+        static const std::size_t max_messages = 1000;
         if (!_logger_bound) return;
-        for (int i = 0; i < max_messages; ++i) {
+        _log_batch.clear();
+        while (_log_batch.size() < max_messages) {
                 // expect a three-part message: source, timestamp, message
                 std::vector<std::string> messages = zmq::recv(_socket, ZMQ_DONTWAIT);
                 if (messages.empty()) {
@@ -263,11 +469,22 @@ buffered_data_writer::write_messages()
                         // timer
                         break;
                 }
-                if (messages.size() >= 3) {
-                        _writer->log(from_iso_string(messages[1]), messages[0], messages[2]);
-                        _dirty = true;
+                if (messages.size() < 3) continue;
+                /* One sender with a bad clock field must not cost the rest
+                 * of the batch, which has already been taken off the socket */
+                try {
+                        _log_batch.push_back({decode_log_time(messages[1]),
+                                              std::move(messages[0]), std::move(messages[2])});
+                }
+                catch (std::exception const &) {
+                        LOG << "WARNING: dropped a log message from " << messages[0]
+                            << " with an unreadable timestamp";
                 }
         }
+        if (!_log_batch.empty()) {
+                _writer->log_batch(_log_batch);
+                _dirty = true;
+        }
 }
 
 void
@@ -294,3 +511,126 @@ buffered_data_writer::bind_logger(std::string const & server_name)
                 _logger_bound = true;
         }
 }
+
+void
+buffered_data_writer::report_stats(std::chrono::milliseconds log_interval,
+                                   std::string const & endpoint,
+                                   std::chrono::milliseconds publish_interval)
+{
+        _log_interval = log_interval;
+        _publish_interval = publish_interval;
+        if (endpoint.empty() || publish_interval.count() == 0 || _stats_socket) return;
+        void * socket = zmq::context::socket(ZMQ_PUB);
+        if (zmq::bind(socket, endpoint) < 0) {
+                LOG << "unable to bind to endpoint " << endpoint;
+                zmq::close(socket);
+        }
+        else {
+                INFO << "publishing writer statistics at " << endpoint;
+                _stats_socket = socket;
+        }
+}
+
+void
+buffered_data_writer::flush_writer()
+{
+        const auto t0 = stats_clock::now();
+        _writer->flush();
+        _dirty = false;
+        note_flush(stats_clock::now() - t0);
+}
+
+void
+buffered_data_writer::note_write(stats_clock::duration took, nframes_t lag, bool gap)
+{
+        const std::uint32_t us = usec(took);
+        for (writer_stats * s : {&_stats, &_log_window, &_publish_window}) {
+                s->writes += 1;
+                s->write_usec += us;
+                s->max_write_usec = std::max(s->max_write_usec, us);
+                s->max_lag = std::max(s->max_lag, lag);
+                s->gaps += gap;
+        }
+        _pass_blocks += 1;
+}
+
+void
+buffered_data_writer::note_flush(stats_clock::duration took)
+{
+        const std::uint32_t us = usec(took);
+        for (writer_stats * s : {&_stats, &_log_window, &_publish_window}) {
+                s->flushes += 1;
+                s->flush_usec += us;
+                s->max_flush_usec = std::max(s->max_flush_usec, us);
+        }
+}
+
+void
+buffered_data_writer::end_pass()
+{
+        /* Taking the mark here, once a pass, means each window's figure is the
+         * most the buffer held while that window was open, to within a pass */
+        const size_t high_water = _buffer->take_high_water();
+        for (writer_stats * s : {&_stats, &_log_window, &_publish_window}) {
+                s->high_water = std::max(s->high_water, high_water);
+                if (_pass_blocks > 0) {
+                        s->passes += 1;
+                        s->max_blocks_per_pass = std::max(s->max_blocks_per_pass, _pass_blocks);
+                }
+        }
+        _pass_blocks = 0;
+}
+
+void
+buffered_data_writer::report(stats_clock::time_point now)
+{
+        if (_log_interval.count() > 0 && now >= _next_log) {
+                _writer->log(boost::posix_time::microsec_clock::universal_time(),
+                             "buffered_data_writer", describe(_log_window, _buffer->size()));
+                _dirty = true;
+                _log_window = writer_stats();
+                _next_log = now + _log_interval;
+        }
+        if (_stats_socket && now >= _next_publish) {
+                zmq::send(_stats_socket, format_stats(_stats, _publish_window, _buffer->size(), _degraded));
+                _publish_window = writer_stats();
+                _next_publish = now + _publish_interval;
+        }
+}
+
+void
+buffered_data_writer::set_soft_limit(double soft, std::chrono::milliseconds hold)
+{
+        if (soft < 0 || soft >= 1)
+                throw std::invalid_argument("soft limit must be a fraction of the buffer");
+        _soft_limit = soft;
+        _soft_hold = hold;
+}
+
+void
+buffered_data_writer::check_pressure(stats_clock::time_point now)
+{
+        if (_soft_limit <= 0) return;
+        /* What is waiting to be looked at, not what is held: a triggered
+         * writer keeps its pretrigger in the buffer after it has been read
+         * ahead, and that is not a backlog */
+        const size_t used = _buffer->read_space() - _buffer->read_ahead_space();
+        if (used < _soft_limit * _buffer->size()) return;
+        _degraded_until = now + _soft_hold;
+        if (_degraded) return;
+        _degraded = true;
+        for (writer_stats * s : {&_stats, &_log_window, &_publish_window})
+                s->degradations += 1;
+        _writer->set_degraded(true);
+        LOG << "WARNING: ringbuffer " << used * 100 / _buffer->size()
+            << "% full; deferring flushes until the writer catches up";
+}
+
+void
+buffered_data_writer::relax(stats_clock::time_point now)
+{
+        if (!_degraded || now < _degraded_until) return;
+        _degraded = false;
+        _writer->set_degraded(false);
+        LOG << "ringbuffer below the soft limit again; resuming normal writes";
+}
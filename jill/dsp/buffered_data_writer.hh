@@ -19,6 +19,9 @@
 #include <chrono>
 #include <mutex>
 #include <condition_variable>
+#include <cstdint>
+#include <string>
+#include <vector>
 #include "../data_thread.hh"
 #include "../data_writer.hh"
 
@@ -36,12 +39,35 @@ class block_ringbuffer;
  * reset() to split data into separate entries.
  *
  * This object can also be bound to a ZMQ address for receiving log messages,
- * which it sends to the data writer's `log` method. The buffering here is
- * provided by the ZMQ socket.
+ * which it sends to the data writer's `log_batch` method, everything that
+ * arrived since the last pass at once. The buffering here is provided by the
+ * ZMQ socket.
  */
 class buffered_data_writer : public data_thread {
 
 public:
+        /**
+         * What the writer thread measures about itself. Times are on the
+         * steady clock, in microseconds; lag is in frames.
+         */
+        struct writer_stats {
+                std::uint64_t writes = 0;               // blocks passed to write()
+                std::uint64_t write_usec = 0;           // time spent in write()
+                std::uint32_t max_write_usec = 0;
+                std::uint64_t flushes = 0;              // calls to the writer's flush()
+                std::uint64_t flush_usec = 0;
+                std::uint32_t max_flush_usec = 0;
+                std::uint64_t passes = 0;               // times the buffer was drained
+                std::uint64_t max_blocks_per_pass = 0;
+                /* how far the block being written trailed the newest one
+                 * pushed: the backlog, as the realtime thread sees it */
+                nframes_t max_lag = 0;
+                std::size_t high_water = 0;             // most bytes in the ringbuffer
+                std::uint64_t degradations = 0;         // times past the soft limit
+                std::uint64_t deferred_flushes = 0;     // flushes skipped while degraded
+                std::uint64_t gaps = 0;                 // blocks dropped for a higher tier
+        };
+
         /**
          * Initialize buffered writer
          *
@@ -77,6 +103,66 @@ public:
 
         void push(nframes_t time, dtype_t dtype, char const * id,
                   std::size_t size, void const * data) override;
+
+        /**
+         * Store a block from a channel of priority @a tier, 0 being the
+         * highest and what the overload above uses.
+         *
+         * Each tier below the first keeps a further share of the ringbuffer
+         * free for the ones above it (see set_reserve()). A block that would
+         * eat into that is dropped, and a GAP block is stored in its place so
+         * that the data writer can record where the channel is missing data.
+         * Only a block the buffer has no room for at all, or a tier 0 block
+         * that does not fit, is an xrun. Wait-free.
+         */
+        void push(nframes_t time, dtype_t dtype, char const * id,
+                  std::size_t size, void const * data, unsigned tier);
+
+        /**
+         * Set how much of the ringbuffer each priority tier leaves for the
+         * ones above it, as a fraction of the capacity: tier N is refused
+         * once less than N times this is free. Call before start().
+         */
+        void set_reserve(double fraction);
+
+        /**
+         * The lowest priority tier that can still be stored with a reserve of
+         * @a fraction. Any tier below it would need the whole buffer free, so
+         * every one of its blocks would be a gap.
+         */
+        static unsigned lowest_tier(double fraction);
+
+        /**
+         * Close the current entry before the first block at or after
+         * @a frame, rather than before whatever block the writer thread
+         * happens to reach next, as reset() does, and start the next one at
+         * @a frame. Writers given the same frame split at the same place,
+         * however far behind each is, and whichever block each meets first. A
+         * second call before the writer reaches the first frame replaces
+         * it. Only this class's write() honours it. Wait-free.
+         */
+        void reset_at(nframes_t frame);
+
+        /**
+         * Move the data writer on to a new file (data_writer::rotate()),
+         * splitting the entry as reset_at() does so that the new file starts
+         * with the block at or after @a frame and nothing is lost between
+         * them. A triggered writer does not split a recording for this: its
+         * next recording goes in the new file. Wait-free.
+         */
+        virtual void rotate_at(nframes_t frame);
+
+        /**
+         * Bytes of data handed to the data writer since this was made: not
+         * the pretrigger data a triggered writer lets go unwritten, nor
+         * blocks dropped for a higher tier. A measure of how big the file is
+         * getting that does not have to ask the file. Safe to read from any
+         * thread.
+         */
+        std::uint64_t bytes_written() const {
+                return _bytes_written.load(std::memory_order_relaxed);
+        }
+
         void xrun() override;
         void reset() override;
         void stop() override;
@@ -106,6 +192,53 @@ public:
          */
         void bind_logger(std::string const & server_name);
 
+        /**
+         * Have the writer thread report how it is keeping up.
+         *
+         * Every @a log_interval a line summarizing the interval goes to the
+         * data writer's log, so that a recording carries a record of how close
+         * it came to an overrun. If @a endpoint is not empty, a PUB socket is
+         * bound to it and every @a publish_interval a JSON object with the
+         * totals and the figures for the interval is sent on it. Either
+         * interval may be zero to turn that report off.
+         *
+         * Reports are made by the writer thread, after a block is written
+         * or between passes, so an interval can run over by as long as one
+         * write or one poll interval takes. Call before start().
+         */
+        void report_stats(std::chrono::milliseconds log_interval,
+                          std::string const & endpoint = std::string(),
+                          std::chrono::milliseconds publish_interval = std::chrono::milliseconds(0));
+
+        /**
+         * The totals since start(). Kept by the writer thread without locking,
+         * so only read them once it has been joined.
+         */
+        writer_stats const & stats() const { return _stats; }
+
+        /**
+         * Degrade before the ringbuffer overruns, rather than when it does.
+         *
+         * An overrun drops a whole period on every channel. Long before that,
+         * the ringbuffer filling up says the writer is not keeping pace, and
+         * there are things it can stop doing to catch up. Once the data
+         * waiting in it reach @a soft of its capacity the writer is degraded:
+         * it stops flushing the file between passes, and tells the data
+         * writer, which may stop compressing new datasets (see
+         * data_writer::set_degraded).
+         * It stays degraded until the buffer has been below the limit for
+         * @a hold, so that the flushes it saved are not all spent the moment
+         * the buffer empties. Both changes are logged.
+         *
+         * @param soft  fraction of the ringbuffer's capacity, or 0 to turn
+         *              this off (the default)
+         */
+        void set_soft_limit(double soft,
+                            std::chrono::milliseconds hold = std::chrono::seconds(1));
+
+        /** true while past the soft limit. Safe to read from any thread */
+        bool degraded() const { return _degraded.load(std::memory_order_relaxed); }
+
 protected:
         /**
          * Entry point for deriving classes to handle data pulled off the
@@ -118,6 +251,12 @@ protected:
          */
         virtual void write(data_block_t const * data);
 
+        /**
+         * Pass frames @a start to @a stop of a block to the data writer, as
+         * data_writer::write() takes them, and count the bytes stored.
+         */
+        void write_block(data_block_t const * data, nframes_t start = 0, nframes_t stop = 0);
+
         /**
          * Collect log messages from the zmq socket and write them. Call this
          * when load is low.
@@ -131,6 +270,9 @@ protected:
          * The ringbuffer pointers are the ones worth tuning. */
         std::atomic<state_t> _state;               // thread state
         std::atomic<bool> _reset;                  // flag to reset stream
+        std::atomic<bool> _reset_armed;            // reset at _reset_frame
+        std::atomic<nframes_t> _reset_frame;
+        std::atomic<bool> _reset_rotate;           // and move to a new file
 
         std::unique_ptr<data_writer> _writer;            // output
         std::unique_ptr<block_ringbuffer> _buffer;      // ringbuffer
@@ -151,6 +293,43 @@ private:
         // variables for receiving incoming messages
         void * _socket;
         bool _logger_bound;
+        // the messages taken in one pass, kept to reuse its storage
+        std::vector<log_entry> _log_batch;
+
+        /* Statistics, all touched only by the writer thread (and by
+         * request_buffer_size(), while it holds the lock the thread does) */
+        using stats_clock = std::chrono::steady_clock;
+        void note_write(stats_clock::duration took, nframes_t lag, bool gap);
+        void note_flush(stats_clock::duration took);
+        void end_pass();
+        void report(stats_clock::time_point now);
+        void flush_writer();
+        void check_pressure(stats_clock::time_point now);
+        void relax(stats_clock::time_point now);
+
+        writer_stats _stats;                        // since start()
+        writer_stats _log_window;                   // since the last log line
+        writer_stats _publish_window;               // since the last publication
+        std::uint64_t _pass_blocks;                 // written in the current pass
+        std::chrono::milliseconds _log_interval;
+        std::chrono::milliseconds _publish_interval;
+        stats_clock::time_point _next_log;
+        stats_clock::time_point _next_publish;
+        void * _stats_socket;
+        // time of the newest block pushed; written by the realtime thread
+        std::atomic<nframes_t> _last_pushed;
+        // written by the writer thread, read by anyone
+        std::atomic<std::uint64_t> _bytes_written;
+
+        double _soft_limit;                         // fraction of capacity, or 0
+        std::chrono::milliseconds _soft_hold;
+        stats_clock::time_point _degraded_until;
+        std::atomic<bool> _degraded;
+
+        double _reserve;                            // fraction, per tier
+        /* _reserve of the current capacity. Read by the realtime thread,
+         * written only with it stopped: before start() or on a resize */
+        std::size_t _reserve_bytes;
 
 };
 
@@ -0,0 +1,151 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _PLAYBACK_SCHEDULE_HH
+#define _PLAYBACK_SCHEDULE_HH
+
+#include <array>
+#include <cstddef>
+
+#include "playback_timing.hh"
+
+namespace jill { namespace dsp {
+
+/**
+ * A small, fixed-capacity list of things to start at given JACK frames, kept
+ * in order of start time, for the realtime thread to work through.
+ *
+ * Entries come in two kinds. A scheduled entry has a start frame. An armed
+ * entry has only a delay, and waits for trigger() to say what it is a delay
+ * from -- an onset on a MIDI input, typically, whose frame is not known until
+ * the period it arrives in. trigger() gives every armed entry its start frame
+ * at once, so one onset can release several.
+ *
+ * Frames wrap, so order is taken from frames_until() relative to the start of
+ * the current period rather than from the raw counter. That is consistent as
+ * long as everything in the list is within 2^31 frames of now, which at any
+ * audio rate is more than half a day.
+ *
+ * Nothing here allocates, and every operation is O(N) at worst, so N should
+ * stay small: this is a hand-off for a few imminent starts, not a playlist.
+ *
+ * @tparam T  what to start. Copied in and out, so keep it small.
+ * @tparam N  capacity, shared between scheduled and armed entries
+ */
+template <typename T, std::size_t N>
+class playback_schedule {
+
+public:
+        struct item {
+                T value;
+                nframes_t start;        // for armed entries, the delay
+        };
+
+        playback_schedule() : _nscheduled(0), _narmed(0) {}
+
+        static constexpr std::size_t capacity() { return N; }
+        std::size_t size() const { return _nscheduled + _narmed; }
+        bool full() const { return size() >= N; }
+
+        /** true if nothing has a start frame; armed entries may be waiting */
+        bool empty() const { return _nscheduled == 0; }
+        /** the earliest scheduled entry. Undefined if empty(). */
+        item const & front() const { return _scheduled[0]; }
+
+        std::size_t armed() const { return _narmed; }
+
+        /**
+         * Add an entry to start at @a start. Ties go after what is already
+         * there, so entries for one frame come out in the order they went in.
+         *
+         * @param now  the frame order is reckoned from, normally the start of
+         *             the current period
+         * @return false, without adding it, if the schedule is full
+         */
+        bool schedule(T const & value, nframes_t start, nframes_t now) {
+                if (full()) return false;
+                const auto until = frames_until(start, now);
+                std::size_t i = _nscheduled;
+                for (; i > 0 && frames_until(_scheduled[i - 1].start, now) > until; --i)
+                        _scheduled[i] = _scheduled[i - 1];
+                _scheduled[i] = item{value, start};
+                ++_nscheduled;
+                return true;
+        }
+
+        /**
+         * Add an entry to start @a delay frames after the next trigger().
+         *
+         * @return false, without adding it, if the schedule is full
+         */
+        bool arm(T const & value, nframes_t delay) {
+                if (full()) return false;
+                _armed[_narmed++] = item{value, delay};
+                return true;
+        }
+
+        /** Schedule every armed entry relative to a trigger at @a frame */
+        void trigger(nframes_t frame) {
+                const std::size_t n = _narmed;
+                _narmed = 0;
+                for (std::size_t i = 0; i < n; ++i)
+                        schedule(_armed[i].value, frame + _armed[i].start, frame);
+        }
+
+        /**
+         * Offset into the period starting at @a time at which the earliest
+         * entry is due, or @a nframes if it is not due in this period. An entry
+         * whose time has passed is due at 0; the caller should have taken it
+         * off with pop_late() if lateness matters.
+         */
+        nframes_t next_offset(nframes_t time, nframes_t nframes) const {
+                if (empty()) return nframes;
+                const auto until = frames_until(front().start, time);
+                if (until < 0) return 0;
+                return (nframes_t(until) < nframes) ? nframes_t(until) : nframes;
+        }
+
+        /** Remove the earliest scheduled entry. Undefined if empty(). */
+        item pop() {
+                const item out = _scheduled[0];
+                for (std::size_t i = 1; i < _nscheduled; ++i)
+                        _scheduled[i - 1] = _scheduled[i];
+                --_nscheduled;
+                return out;
+        }
+
+        /**
+         * Remove every scheduled entry whose start is before @a time, calling
+         * @a f on each in order.
+         */
+        template <typename F>
+        void pop_late(nframes_t time, F && f) {
+                while (!empty() && frames_until(front().start, time) < 0)
+                        f(pop());
+        }
+
+        /** Remove everything, armed entries included, calling @a f on each */
+        template <typename F>
+        void clear(F && f) {
+                while (!empty()) f(pop());
+                for (std::size_t i = 0; i < _narmed; ++i) f(_armed[i]);
+                _narmed = 0;
+        }
+
+private:
+        std::array<item, N> _scheduled;
+        std::array<item, N> _armed;
+        std::size_t _nscheduled;
+        std::size_t _narmed;
+};
+
+}} // namespace jill::dsp
+
+#endif
@@ -12,6 +12,7 @@
 #define _PLAYBACK_TIMING_HH
 
 #include <algorithm>
+#include <cstdint>
 #include <optional>
 
 #include "../types.hh"
@@ -95,6 +96,22 @@ posttrigger_offset(nframes_t since_stop, nframes_t interval, nframes_t nframes)
         return offset;
 }
 
+/**
+ * Signed distance from @a now forward to @a frame, taking the counter as
+ * modular: negative when @a frame has already passed.
+ *
+ * This is the comparison the protocol tells clients to use ("by subtraction,
+ * never by magnitude"). It is right whenever the two frames are within 2^31
+ * of each other, about 13 hours at 44.1 kHz, which a scheduled start always
+ * is in practice.
+ */
+inline std::int32_t
+frames_until(nframes_t frame, nframes_t now)
+{
+        // well defined since C++20: the difference modulo 2^32, as signed
+        return static_cast<std::int32_t>(frame - now);
+}
+
 /**
  * How many samples of a stimulus fit in the remainder of the period.
  *
@@ -12,6 +12,9 @@
 #define _PULSE_HH
 
 #include <algorithm>
+#include <cstring>
+#include <memory>
+#include <new>
 
 #include "../types.hh"
 
@@ -69,6 +72,84 @@ render_pulse(sample_t * buf, pulse_shape shape, nframes_t duration)
         }
 }
 
+/**
+ * Add a waveform into a buffer: buf[i] += wave[i] for i in [0, n).
+ *
+ * Written as a plain loop over restrict-qualified pointers so the compiler can
+ * vectorize it; both gcc (from 12, at -O2) and clang do. There is nothing to
+ * gain from intrinsics here, since the destination is wherever the event
+ * landed in the period and so has no alignment to exploit.
+ */
+inline void
+mix_pulse(sample_t * __restrict buf, sample_t const * __restrict wave, nframes_t n)
+{
+        for (nframes_t i = 0; i < n; ++i)
+                buf[i] += wave[i];
+}
+
+/**
+ * A pulse waveform computed once, ahead of time, so that emitting it from the
+ * realtime thread is a single add over the samples it covers.
+ *
+ * Either rendered from one of the standard shapes, or copied from an
+ * arbitrary waveform -- a shaped optogenetic pulse, say, or a whole train --
+ * that the caller has loaded from a file and resampled. The storage is
+ * allocated here, at configuration time, and never touched again except to be
+ * read, so a template may be shared by any number of pulse definitions.
+ */
+class pulse_template {
+
+public:
+        /** Render one of the standard shapes. @see render_pulse */
+        pulse_template(pulse_shape shape, nframes_t duration)
+                : _size(duration), _buf(allocate(duration))
+        {
+                render_pulse(_buf.get(), shape, duration);
+        }
+
+        /** Copy an arbitrary waveform of @a nframes samples */
+        pulse_template(sample_t const * samples, nframes_t nframes)
+                : _size(nframes), _buf(allocate(nframes))
+        {
+                std::memcpy(_buf.get(), samples, nframes * sizeof(sample_t));
+        }
+
+        /* Owns its buffer; nothing needs a copy, and one would mean a second
+         * allocation for a waveform that never changes. */
+        pulse_template(pulse_template const &) = delete;
+        pulse_template & operator=(pulse_template const &) = delete;
+        pulse_template(pulse_template &&) = default;
+        pulse_template & operator=(pulse_template &&) = default;
+
+        /** the number of samples in the waveform */
+        nframes_t size() const { return _size; }
+
+        /** the waveform itself */
+        sample_t const * data() const { return _buf.get(); }
+
+        /** Add the waveform into buf[0, size()). The caller ensures the room. */
+        void mix(sample_t * buf) const { mix_pulse(buf, _buf.get(), _size); }
+
+private:
+        /* Cache-line aligned, so a template never straddles more lines than
+         * its length requires. Zero-length templates still get an allocation,
+         * which keeps data() non-null. */
+        static constexpr std::align_val_t alignment{64};
+        struct aligned_delete {
+                void operator()(sample_t * p) const { ::operator delete[](p, alignment); }
+        };
+        static std::unique_ptr<sample_t[], aligned_delete> allocate(nframes_t n)
+        {
+                auto * p = static_cast<sample_t *>(
+                        ::operator new[](std::max<std::size_t>(n, 1) * sizeof(sample_t), alignment));
+                std::fill(p, p + std::max<std::size_t>(n, 1), 0.0f);
+                return std::unique_ptr<sample_t[], aligned_delete>(p);
+        }
+
+        nframes_t _size;
+        std::unique_ptr<sample_t[], aligned_delete> _buf;
+};
+
 }} // namespace jill::dsp
 
 #endif
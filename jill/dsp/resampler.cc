@@ -0,0 +1,229 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+#include <samplerate.h>
+
+#include "resampler.hh"
+
+using namespace jill::dsp;
+using jill::nframes_t;
+using jill::sample_t;
+
+namespace {
+
+// the width of the partial sums in dot(); taps are padded to a multiple of it
+const unsigned lanes = 8;
+
+struct design {
+        double attenuation;     // stopband, in dB
+        double rolloff;         // passband edge as a fraction of the lower Nyquist
+};
+
+/* 60, 80 and 100 dB of stopband, which starts at the lower of the two Nyquist
+ * frequencies, so that nothing above it folds back into the output. At best
+ * this is still shorter than libsamplerate's best sinc by a wide margin, which
+ * is most of the speedup; the rest is not having to interpolate between
+ * filter taps, since a rational ratio lands on the same phases over and
+ * over. */
+design
+design_for(resample_quality q)
+{
+        switch (q) {
+        case resample_quality::fast:   return {60.0, 0.80};
+        case resample_quality::medium: return {80.0, 0.85};
+        case resample_quality::best:   break;
+        }
+        return {100.0, 0.90};
+}
+
+double
+bessel_i0(double x)
+{
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 64; ++k) {
+                const double f = x / (2.0 * k);
+                term *= f * f;
+                sum += term;
+                if (term < 1e-12 * sum) break;
+        }
+        return sum;
+}
+
+inline float
+dot(float const * __restrict a, float const * __restrict b, unsigned n)
+{
+        float acc[lanes] = {};
+        for (unsigned k = 0; k < n; k += lanes) {
+                for (unsigned j = 0; j < lanes; ++j) {
+                        acc[j] += a[k + j] * b[k + j];
+                }
+        }
+        return ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+}
+
+}
+
+struct polyphase_resampler::bank {
+        unsigned up;
+        unsigned down;
+        unsigned taps;
+        /* phase p occupies [p * taps, (p + 1) * taps), with its taps in
+         * reverse order so that the dot product walks the input forwards */
+        std::vector<float> coeffs;
+
+        bank(unsigned up, unsigned down, resample_quality q);
+};
+
+polyphase_resampler::bank::bank(unsigned up_, unsigned down_, resample_quality q)
+        : up(up_), down(down_)
+{
+        const design d = design_for(q);
+        /* In cycles per sample at the upsampled rate, the passband ends at
+         * rolloff times the lower Nyquist and the stopband starts at the
+         * Nyquist itself; the cutoff is halfway between. Kaiser's formulas
+         * give the window's shape and the length that makes the transition
+         * that narrow. The length is in samples of the upsampled stream, so
+         * a ratio that decimates by more than it interpolates needs more taps
+         * per phase, or the transition would widen with the decimation. */
+        const double nyquist = 0.5 / std::max(up, down);
+        const double fc = 0.5 * (1.0 + d.rolloff) * nyquist;
+        const double width = (1.0 - d.rolloff) * nyquist;
+        const double beta = 0.1102 * (d.attenuation - 8.7);
+        const double length = (d.attenuation - 8.0) / (2.285 * 2.0 * M_PI * width);
+        taps = unsigned(std::ceil(length / up / lanes)) * lanes;
+        const std::size_t n = std::size_t(up) * taps;
+        const double centre = n / 2.0;
+        const double i0beta = bessel_i0(beta);
+
+        std::vector<double> h(n);
+        double sum = 0.0;
+        for (std::size_t m = 0; m < n; ++m) {
+                const double x = m - centre;
+                const double s = (x == 0.0) ? 2.0 * fc : std::sin(2.0 * M_PI * fc * x) / (M_PI * x);
+                const double r = x / centre;
+                const double w = bessel_i0(beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / i0beta;
+                h[m] = s * w;
+                sum += h[m];
+        }
+        // unity gain at DC once the zeros stuffed between inputs are counted
+        const double scale = up / sum;
+
+        coeffs.assign(n, 0.0f);
+        for (unsigned p = 0; p < up; ++p) {
+                for (unsigned j = 0; j < taps; ++j) {
+                        coeffs[std::size_t(p) * taps + j] =
+                                h[p + std::size_t(taps - 1 - j) * up] * scale;
+                }
+        }
+}
+
+resample_quality
+jill::dsp::parse_resample_quality(std::string const & name)
+{
+        if (name == "fast") return resample_quality::fast;
+        if (name == "medium") return resample_quality::medium;
+        if (name == "best") return resample_quality::best;
+        throw std::invalid_argument("unknown resampling quality '" + name
+                                    + "' (expected fast, medium or best)");
+}
+
+char const *
+jill::dsp::to_string(resample_quality q)
+{
+        switch (q) {
+        case resample_quality::fast:   return "fast";
+        case resample_quality::medium: return "medium";
+        case resample_quality::best:   break;
+        }
+        return "best";
+}
+
+int
+jill::dsp::src_converter(resample_quality q)
+{
+        switch (q) {
+        case resample_quality::fast:   return SRC_SINC_FASTEST;
+        case resample_quality::medium: return SRC_SINC_MEDIUM_QUALITY;
+        case resample_quality::best:   break;
+        }
+        return SRC_SINC_BEST_QUALITY;
+}
+
+bool
+polyphase_resampler::supported(nframes_t in_rate, nframes_t out_rate)
+{
+        if (in_rate == 0 || out_rate == 0) return false;
+        const nframes_t g = std::gcd(in_rate, out_rate);
+        return out_rate / g <= max_phases;
+}
+
+polyphase_resampler::polyphase_resampler(nframes_t in_rate, nframes_t out_rate,
+                                         resample_quality quality)
+{
+        if (!supported(in_rate, out_rate)) {
+                throw std::invalid_argument("no polyphase filter for " + std::to_string(in_rate)
+                                            + " to " + std::to_string(out_rate) + " Hz");
+        }
+        const nframes_t g = std::gcd(in_rate, out_rate);
+        const unsigned up = out_rate / g, down = in_rate / g;
+
+        // loaders design banks in parallel, and most of them want the same one
+        static std::mutex lock;
+        static std::map<std::tuple<unsigned, unsigned, resample_quality>,
+                        std::shared_ptr<bank const>> banks;
+        std::lock_guard<std::mutex> guard(lock);
+        auto & b = banks[std::make_tuple(up, down, quality)];
+        if (!b) b = std::make_shared<bank const>(up, down, quality);
+        _bank = b;
+}
+
+unsigned polyphase_resampler::up() const { return _bank->up; }
+unsigned polyphase_resampler::down() const { return _bank->down; }
+unsigned polyphase_resampler::taps() const { return _bank->taps; }
+
+/* Output n sits at time n * down in the upsampled stream, plus the centre of
+ * the filter to take out its delay. That lands between input samples i and
+ * i + 1 at phase p, and the output is phase p's taps against the inputs ending
+ * at i. The input is copied with a filter's length of zeros on either side so
+ * that the loop needs no bounds checks at the edges. */
+void
+polyphase_resampler::process(sample_t const * in, std::size_t nin,
+                             sample_t * out, std::size_t nout) const
+{
+        const bank & b = *_bank;
+        const unsigned taps = b.taps;
+        std::vector<float> padded(nin + 2 * std::size_t(taps), 0.0f);
+        std::copy(in, in + nin, padded.begin() + taps);
+
+        const std::uint64_t delay = std::uint64_t(b.up) * taps / 2;
+        std::uint64_t i = delay / b.up;       // newest input in the window
+        unsigned p = delay % b.up;
+        for (std::size_t n = 0; n < nout; ++n) {
+                // window [i - taps + 1, i] in the input is [i + 1, i + taps] here
+                if (i + 1 >= nin + taps) {
+                        out[n] = 0.0f;
+                }
+                else {
+                        out[n] = dot(b.coeffs.data() + std::size_t(p) * taps,
+                                     padded.data() + i + 1, taps);
+                }
+                p += b.down;
+                i += p / b.up;
+                p %= b.up;
+        }
+}
@@ -0,0 +1,102 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _RESAMPLER_HH
+#define _RESAMPLER_HH
+
+#include <memory>
+#include <string>
+
+#include "../types.hh"
+
+namespace jill { namespace dsp {
+
+/**
+ * How hard to work at resampling stimuli. Each level names both a polyphase
+ * filter length and the libsamplerate converter used when the polyphase
+ * resampler can't handle the ratio, so the trade-off is the same either way.
+ */
+enum class resample_quality {
+        fast,
+        medium,
+        best,
+};
+
+/**
+ * Parse "fast", "medium" or "best".
+ *
+ * @throws std::invalid_argument for anything else
+ */
+resample_quality parse_resample_quality(std::string const & name);
+
+char const * to_string(resample_quality q);
+
+/** The libsamplerate converter type (SRC_*) for a quality level */
+int src_converter(resample_quality q);
+
+/**
+ * A polyphase FIR resampler for rational ratios.
+ *
+ * The rates are reduced to up/down = out/in in lowest terms, and a Kaiser
+ * windowed sinc lowpass is designed for the upsampled rate and split into
+ * @c up phases. Each output sample is then a single dot product of one phase
+ * against the input, so the cost per output is the number of taps per phase,
+ * independent of the ratio, and nothing is computed that is thrown away.
+ * Sample rates used for audio reduce to a small number of phases -- 44.1 to 48
+ * kHz is 160/147 -- so the bank is small. Ratios that need more than
+ * max_phases are not supported; use libsamplerate for those.
+ *
+ * Banks are built once per ratio and quality and shared between resamplers,
+ * so loading a directory of stimuli at one rate designs the filter once.
+ *
+ * The taps in each phase are padded to a multiple of eight, and the dot
+ * product keeps eight partial sums, so the inner loop is a fixed-width
+ * multiply-add that the compiler turns into SIMD at the baseline -O2 without
+ * needing -ffast-math to reorder the sum.
+ */
+class polyphase_resampler {
+
+public:
+        /** the largest number of phases a bank will be built with */
+        static constexpr unsigned max_phases = 1024;
+
+        /** @return true if the ratio between these rates can be handled */
+        static bool supported(nframes_t in_rate, nframes_t out_rate);
+
+        /**
+         * @throws std::invalid_argument if the ratio is not supported
+         */
+        polyphase_resampler(nframes_t in_rate, nframes_t out_rate,
+                            resample_quality quality = resample_quality::best);
+
+        unsigned up() const;
+        unsigned down() const;
+        /** taps per phase */
+        unsigned taps() const;
+
+        /**
+         * Resample a whole signal. The input is treated as zero outside
+         * [0, nin), and output is aligned so that out[n] falls at the same
+         * time as in[n * down / up]: the filter's delay is taken out.
+         *
+         * @param nout how many samples to write; the caller decides the
+         *             length, so that it can agree with other converters
+         */
+        void process(sample_t const * in, std::size_t nin,
+                     sample_t * out, std::size_t nout) const;
+
+private:
+        struct bank;
+        std::shared_ptr<bank const> _bank;
+};
+
+}} // namespace jill::dsp
+
+#endif
@@ -14,6 +14,7 @@
 #define _RINGBUFFER_HH
 
 #include <atomic>
+#include <cstring>
 #include <memory>
 #include <algorithm>
 #include <functional>
@@ -0,0 +1,153 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+#include "sharded_data_writer.hh"
+#include "../logging.hh"
+
+using namespace jill;
+using namespace jill::dsp;
+using std::size_t;
+
+sharded_data_writer::sharded_data_writer(std::vector<std::unique_ptr<buffered_data_writer>> shards)
+        : _shards(std::move(shards)), _reset(false), _rotate(false),
+          _period_end(0), _pushed(false), _open(false)
+{
+        if (_shards.empty())
+                throw std::invalid_argument("sharded_data_writer needs at least one shard");
+        DBG << "sharded_data_writer initializing with " << _shards.size() << " shards";
+}
+
+sharded_data_writer::~sharded_data_writer()
+{
+        stop();
+        join();
+}
+
+void
+sharded_data_writer::route(std::string const & id, size_t shard)
+{
+        if (shard >= _shards.size())
+                throw std::out_of_range("no shard " + std::to_string(shard));
+        _routes[id] = shard;
+}
+
+buffered_data_writer &
+sharded_data_writer::shard_for(char const * id)
+{
+        if (_shards.size() == 1) return *_shards.front();
+        const auto it = _routes.find(std::string_view(id));
+        return *_shards[it == _routes.end() ? 0 : it->second];
+}
+
+void
+sharded_data_writer::push(nframes_t time, dtype_t dtype, char const * id,
+                          size_t size, void const * data)
+{
+        push(time, dtype, id, size, data, 0);
+}
+
+void
+sharded_data_writer::push(nframes_t time, dtype_t dtype, char const * id,
+                          size_t size, void const * data, unsigned tier)
+{
+        /* The first block of a new period, and no shard has been given
+         * anything from it yet, so this is the one place a split can be
+         * placed that every shard will see at the same block. That block may
+         * be an event, stamped some way into the period, and the sampled
+         * blocks that say where the period starts come after it; so a split
+         * goes where the last period ended, which every block of the new one
+         * is at or after, and the shards start their entries there rather
+         * than at whichever block each reaches first. A reset before anything
+         * was pushed has nothing to split. A rotation splits as well, so it
+         * takes care of both. */
+        if (!_pushed || (!_open && std::int32_t(time - _period_end) >= 0)) {
+                const nframes_t split = (dtype == SAMPLED || !_pushed) ? time : _period_end;
+                const bool reset = _reset.exchange(false) && _pushed;
+                if (_rotate.exchange(false)) {
+                        for (auto & s : _shards) s->rotate_at(split);
+                }
+                else if (reset) {
+                        for (auto & s : _shards) s->reset_at(split);
+                }
+                _pushed = true;
+                _open = true;
+        }
+        // the period's length is only known from its sampled data
+        if (dtype == SAMPLED && _open) {
+                _period_end = time + nframes_t(size / sizeof(sample_t));
+                _open = false;
+        }
+        shard_for(id).push(time, dtype, id, size, data, tier);
+}
+
+void
+sharded_data_writer::xrun()
+{
+        for (auto & s : _shards) s->xrun();
+}
+
+void
+sharded_data_writer::reset()
+{
+        if (_shards.size() == 1) {
+                _shards.front()->reset();
+                return;
+        }
+        _reset = true;
+}
+
+void
+sharded_data_writer::rotate()
+{
+        _rotate = true;
+}
+
+void
+sharded_data_writer::stop()
+{
+        for (auto & s : _shards) s->stop();
+}
+
+void
+sharded_data_writer::start()
+{
+        _reset = false;
+        for (auto & s : _shards) s->start();
+}
+
+void
+sharded_data_writer::join()
+{
+        for (auto & s : _shards) s->join();
+}
+
+size_t
+sharded_data_writer::request_buffer_size(size_t bytes)
+{
+        std::vector<size_t> channels(_shards.size(), 0);
+        for (auto const & r : _routes) channels[r.second] += 1;
+        const size_t routed = _routes.size();
+        size_t total = 0;
+        for (size_t i = 0; i < _shards.size(); ++i) {
+                // an even share if nothing has been routed, and for the
+                // first shard, which takes whatever was not
+                size_t share = routed ? bytes * channels[i] / routed
+                                      : bytes / _shards.size();
+                if (i == 0) share = std::max(share, bytes / _shards.size());
+                total += _shards[i]->request_buffer_size(std::max<size_t>(share, 1));
+        }
+        return total;
+}
@@ -0,0 +1,114 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+#ifndef _SHARDED_DATA_WRITER_HH
+#define _SHARDED_DATA_WRITER_HH
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../data_thread.hh"
+#include "buffered_data_writer.hh"
+
+namespace jill { namespace dsp {
+
+/**
+ * Splits the channels of a recording between several buffered_data_writers,
+ * each with its own ringbuffer, its own writer thread and its own file.
+ *
+ * One writer thread writing one file is bounded by one core and one disk. With
+ * the channels divided into K shards, each shard's blocks go to its own ring
+ * and on to its own data_writer, which can be on another volume, so the
+ * bandwidth grows with K. Channels are assigned to shards with route() before
+ * starting; push() looks the id up and passes the block to that shard, which
+ * costs a map search and no allocation. An id that was never routed goes to
+ * the first shard.
+ *
+ * The shards' entries have to line up, or the files cannot be put back
+ * together. reset() is therefore not passed straight on: the writer threads
+ * are at different places in their rings, and each would split at whatever
+ * block it reached next. Instead the next period to be pushed after a reset()
+ * becomes the boundary, and every shard is told to split before it, and to
+ * start the next entry where it starts, with buffered_data_writer::reset_at(). Entry numbers come from the data writers,
+ * which should share a file::entry_numbering so that entries starting at the
+ * same frame get the same name.
+ *
+ * With a single shard, all of this reduces to passing calls through, and the
+ * shard may be any buffered_data_writer, including a triggered one. With more,
+ * recording has to be continuous: a trigger channel would only be seen by its
+ * own shard.
+ */
+class sharded_data_writer : public data_thread {
+
+public:
+        /** @param shards  the writers to divide the channels between; at least one */
+        explicit sharded_data_writer(std::vector<std::unique_ptr<buffered_data_writer>> shards);
+        ~sharded_data_writer() override;
+
+        /** Send blocks with @a id to shard @a shard. Call before start() */
+        void route(std::string const & id, std::size_t shard);
+
+        /** the number of shards */
+        std::size_t size() const { return _shards.size(); }
+
+        /** one shard, for the settings buffered_data_writer has */
+        buffered_data_writer & shard(std::size_t i) { return *_shards.at(i); }
+
+        /**
+         * Move every shard on to a new file at the next period, by way of
+         * buffered_data_writer::rotate_at(), so that the files change at the
+         * same block and no data fall between them. Periods are counted on
+         * sampled data, so a recording with none never rotates. Wait-free.
+         */
+        void rotate();
+
+        /* implementations of data_thread methods */
+
+        void push(nframes_t time, dtype_t dtype, char const * id,
+                  std::size_t size, void const * data) override;
+        /** @see buffered_data_writer::push(), for @a tier */
+        void push(nframes_t time, dtype_t dtype, char const * id,
+                  std::size_t size, void const * data, unsigned tier);
+        void xrun() override;
+        void reset() override;
+        void stop() override;
+        void start() override;
+        void join() override;
+
+        /**
+         * Divide @a bytes between the shards in proportion to the channels
+         * routed to each, and return the total they ended up with. The first
+         * shard, which takes any channel that was never routed, gets at
+         * least an even share.
+         */
+        std::size_t request_buffer_size(std::size_t bytes) override;
+
+private:
+        buffered_data_writer & shard_for(char const * id);
+
+        std::vector<std::unique_ptr<buffered_data_writer>> _shards;
+        // transparent, so that push() can search with the id as given
+        std::map<std::string, std::size_t, std::less<>> _routes;
+
+        std::atomic<bool> _reset;       // split at the next period
+        std::atomic<bool> _rotate;      // and change files there
+        // the realtime thread's own
+        nframes_t _period_end;          // the frame after the last period
+        bool _pushed;                   // anything at all
+        bool _open;                     // a period begun, its length not yet known
+};
+
+}} // namespace jill::dsp
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+#ifndef _SOS_FILTER_HH
+#define _SOS_FILTER_HH
+
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "../rt.hh"
+
+namespace jill { namespace dsp {
+
+/**
+ * An IIR filter as a cascade of second-order sections (biquads).
+ *
+ * Each section is in transposed direct form II, which needs two state
+ * variables and holds up well at low cutoffs relative to the sampling rate.
+ * Coefficients and state are kept in double precision: a 300 Hz high-pass at
+ * 48 kHz puts the poles close to the unit circle, where single precision adds
+ * audible noise. The sections are given at construction, so filtering never
+ * allocates.
+ */
+class sos_filter {
+public:
+        /** One section, normalized so that a0 is 1 */
+        struct section {
+                double b0, b1, b2, a1, a2;
+        };
+
+        explicit sos_filter(std::vector<section> sections)
+                : _sections(std::move(sections)), _state(_sections.size(), {0.0, 0.0}) {}
+
+        /** A second-order Butterworth high-pass, with cutoff @a fc Hz at @a fs Hz */
+        static section highpass(double fc, double fs) {
+                const double w = 2 * M_PI * fc / fs;
+                const double c = std::cos(w);
+                const double alpha = std::sin(w) / std::sqrt(2.0);
+                const double a0 = 1 + alpha;
+                return {(1 + c) / 2 / a0, -(1 + c) / a0, (1 + c) / 2 / a0,
+                        -2 * c / a0, (1 - alpha) / a0};
+        }
+
+        /** A second-order Butterworth low-pass, with cutoff @a fc Hz at @a fs Hz */
+        static section lowpass(double fc, double fs) {
+                const double w = 2 * M_PI * fc / fs;
+                const double c = std::cos(w);
+                const double alpha = std::sin(w) / std::sqrt(2.0);
+                const double a0 = 1 + alpha;
+                return {(1 - c) / 2 / a0, (1 - c) / a0, (1 - c) / 2 / a0,
+                        -2 * c / a0, (1 - alpha) / a0};
+        }
+
+        /** Filter one sample */
+        template <typename T>
+        T operator()(T x) JILL_RT {
+                double v = x;
+                for (std::size_t i = 0; i < _sections.size(); ++i) {
+                        section const & s = _sections[i];
+                        state & z = _state[i];
+                        const double y = s.b0 * v + z.z1;
+                        z.z1 = s.b1 * v - s.a1 * y + z.z2;
+                        z.z2 = s.b2 * v - s.a2 * y;
+                        v = y;
+                }
+                return T(v);
+        }
+
+        /** Clear the state, as if the input had been zero for ever */
+        void reset() {
+                for (auto & z : _state) z = {0.0, 0.0};
+        }
+
+private:
+        struct state {
+                double z1, z2;
+        };
+        std::vector<section> _sections;
+        std::vector<state> _state;
+};
+
+}} // namespace jill::dsp
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+#ifndef _SPIKE_DETECTOR_HH
+#define _SPIKE_DETECTOR_HH
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "../types.hh"
+#include "sos_filter.hh"
+
+namespace jill { namespace dsp {
+
+/**
+ * Detects spikes in one channel of extracellular data, and keeps a short
+ * snippet of the filtered waveform around each.
+ *
+ * The signal is band-passed, and a spike is the filtered signal going past a
+ * threshold set at a multiple of the noise. The noise is estimated as the
+ * median of the signal's magnitude divided by 0.6745, which for Gaussian noise
+ * is its standard deviation and which, unlike the standard deviation, the
+ * spikes themselves hardly move. The median is tracked a sample at a time by
+ * stepping the estimate up or down by a constant factor as each sample is
+ * above or below it; it settles where half the samples are either side, with
+ * no buffer to sort.
+ *
+ * Like crossing_counter, the detector keeps its state from one block to the
+ * next, so a spike and its snippet may straddle blocks. Nothing is allocated
+ * after construction.
+ */
+template <typename T>
+class spike_detector {
+public:
+        using sample_type = T;
+        using size_type = std::size_t;
+
+        /** which way a spike goes past the threshold */
+        enum polarity_type { negative, positive, either };
+
+        /**
+         * @param filter      the band-pass filter
+         * @param thresh      the threshold, in multiples of the noise estimate
+         * @param polarity    which way spikes go
+         * @param refractory  samples after a spike before the next is looked for
+         * @param pre         samples in a snippet before the crossing
+         * @param post        samples in a snippet from the crossing on
+         * @param settle      samples to let the filter and the noise estimate
+         *                    settle before anything is detected
+         * @param tau         the time constant of the noise estimate, in samples
+         */
+        spike_detector(sos_filter filter, float thresh, polarity_type polarity,
+                       size_type refractory, size_type pre, size_type post,
+                       size_type settle, size_type tau)
+                : _filter(std::move(filter)), _thresh(thresh / 0.6745f), _polarity(polarity),
+                  _dead_time(std::max(refractory, post)), _post(post),
+                  _settle(settle), _history(pre + std::max<size_type>(post, 1)),
+                  _snippet(pre + post), _head(0), _seen(0), _level(initial_level),
+                  _armed(true), _dead(0), _pending(false), _remaining(0), _time(0) {
+                // fast enough to get from the initial level to the noise
+                // within the settling time; then as slow as asked
+                _settle_step = 1.0f + (settle > 0 ? 20.0f / settle : 0.0f);
+                _step = 1.0f + (tau > 0 ? 1.0f / tau : 0.0f);
+        }
+
+        /**
+         * Analyze a block of samples.
+         *
+         * @param samples  the samples
+         * @param size     the number of samples
+         * @param time     the frame count of the first sample
+         * @param emit     called as emit(frame, snippet, length) for each spike
+         *                 whose snippet was completed in this block, with the
+         *                 frame at which it crossed the threshold. The snippet
+         *                 is only valid during the call.
+         */
+        template <typename F>
+        void push(sample_type const * samples, size_type size, nframes_t time, F && emit) JILL_RT {
+                for (size_type i = 0; i < size; ++i) {
+                        const sample_type y = _filter(samples[i]);
+                        track(std::fabs(y), (_seen < _settle) ? _settle_step : _step);
+                        _history[_head] = y;
+                        _head = (_head + 1) % _history.size();
+                        if (_seen < _settle) {
+                                ++_seen;
+                                continue;
+                        }
+                        const bool beyond = past(y, _thresh * _level);
+                        if (_dead > 0) {
+                                --_dead;
+                        }
+                        else if (beyond && _armed) {
+                                _time = time + i;
+                                _remaining = _post;
+                                _pending = true;
+                                _dead = _dead_time;
+                        }
+                        // a spike counts once, however long it stays out
+                        _armed = !beyond;
+                        if (_pending && (_remaining == 0 || --_remaining == 0)) {
+                                copy_snippet();
+                                emit(_time, _snippet.data(), _snippet.size());
+                                _pending = false;
+                        }
+                }
+        }
+
+        /** The current threshold, in sample units */
+        sample_type threshold() const { return _thresh * _level; }
+
+        /** The current estimate of the noise's standard deviation */
+        sample_type noise() const { return _level / 0.6745f; }
+
+        /** Whether the detector has settled and is looking for spikes */
+        bool settled() const { return _seen >= _settle; }
+
+        /** The length of the snippets passed to emit */
+        size_type snippet_size() const { return _snippet.size(); }
+
+private:
+        /* Where the noise estimate starts, and the least it can fall to. A
+         * multiplicative step would never leave zero. */
+        static constexpr float initial_level = 1e-4f;
+        static constexpr float floor_level = 1e-7f;
+
+        /* step the median estimate up or down by @a step. Steps of the same
+         * factor both ways, so that it settles at the median */
+        void track(sample_type magnitude, float step) JILL_RT {
+                if (magnitude > _level)
+                        _level *= step;
+                else
+                        _level = std::max(_level / step, floor_level);
+        }
+
+        bool past(sample_type y, sample_type t) const JILL_RT {
+                switch (_polarity) {
+                case negative:
+                        return y < -t;
+                case positive:
+                        return y > t;
+                default:
+                        return std::fabs(y) > t;
+                }
+        }
+
+        /* Unroll the history into _snippet. The newest sample is post - 1
+         * after the crossing; with post 0 it is the crossing itself, which
+         * the snippet then stops short of. */
+        void copy_snippet() JILL_RT {
+                const size_type n = _history.size();
+                const size_type skip = (_post == 0) ? 1 : 0;
+                size_type start = (_head + n - _snippet.size() - skip) % n;
+                for (size_type i = 0; i < _snippet.size(); ++i)
+                        _snippet[i] = _history[(start + i) % n];
+        }
+
+        sos_filter _filter;
+        const float _thresh;            // in units of the median magnitude
+        const polarity_type _polarity;
+        const size_type _dead_time;
+        const size_type _post;
+        const size_type _settle;
+        float _settle_step;
+        float _step;
+
+        std::vector<sample_type> _history; // the last samples, filtered
+        std::vector<sample_type> _snippet;
+        size_type _head;                // where the next sample goes
+        size_type _seen;                // samples seen, up to _settle
+        float _level;                   // the median magnitude
+        bool _armed;                    // inside the threshold since the last spike
+        size_type _dead;                // samples left before looking again
+        bool _pending;                  // a spike's snippet is being filled
+        size_type _remaining;           // samples it still needs
+        nframes_t _time;                // the frame the pending spike crossed at
+};
+
+}} // namespace jill::dsp
+
+#endif
@@ -90,7 +90,7 @@ triggered_data_writer::start_recording(nframes_t event_time)
         /* write partial period(s) */
         while (ptr && framediff_t(ptr->time - onset) <= 0) {
                 DBG << "prebuf frame (partial): " << *ptr << ", on=" << onset - ptr->time;
-                _writer->write(ptr, onset - ptr->time, 0);
+                write_block(ptr, onset - ptr->time, 0);
                 _buffer->release();
                 ptr = _buffer->peek();
         }
@@ -98,7 +98,7 @@ triggered_data_writer::start_recording(nframes_t event_time)
         /* write additional periods in prebuffer, up to current period */
         while (ptr && framediff_t(ptr->time + ptr->nframes() - event_time) <= 0) {
 		DBG << "prebuffer frame (complete): " << *ptr;
-                _writer->write(ptr, 0, 0);
+                write_block(ptr);
                 _buffer->release();
                 ptr = _buffer->peek();
         }
@@ -118,9 +118,17 @@ triggered_data_writer::stop_recording(nframes_t event_time)
         INFO << "writing posttrigger data from " << event_time << "--" << _last_offset;
 }
 
+void
+triggered_data_writer::rotate_at(nframes_t)
+{
+        _reset_rotate = true;
+}
+
 void
 triggered_data_writer::write(data_block_t const * data)
 {
+        // the data writer holds this until its next entry
+        if (_reset_rotate.exchange(false)) _writer->rotate();
         std::string id = data->id();
         nframes_t nframes = data->nframes();
         /* handle trigger channel */
@@ -149,7 +157,7 @@ triggered_data_writer::write(data_block_t const * data)
                 // checks disappear entirely when NDEBUG is defined.
                 assert(_buffer->peek()->time == data->time);
                 assert(_buffer->peek()->id() == id);
-                _writer->write(data, 0, 0);
+                write_block(data);
                 _buffer->release();
                 bool pending_reset = true;
                 if (_reset.compare_exchange_strong(pending_reset, false)) {
@@ -166,7 +174,7 @@ triggered_data_writer::write(data_block_t const * data)
                         _writer->close_entry();
                 }
                 else {
-                        _writer->write(data, 0, 0);//(nframes_t)compare);
+                        write_block(data);//(nframes_t)compare);
 			_buffer->release();
                 }
         }
@@ -38,6 +38,13 @@ public:
 
         ~triggered_data_writer() override;
 
+        /**
+         * The current recording, if there is one, runs to its end in the
+         * current file, and the next one goes in a new file. @a frame is
+         * ignored.
+         */
+        void rotate_at(nframes_t frame) override;
+
 protected:
 
         /** @see buffered_data_writer::write() */
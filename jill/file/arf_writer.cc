@@ -1,3 +1,10 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <system_error>
+#include <type_traits>
 #include <arf.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #define BOOST_UUID_NO_TYPE_TRAITS
@@ -11,7 +18,38 @@
 #include "../midi.hh"
 
 #define JILL_LOGDATASET_NAME "jill_log"
+#define JILL_GAPDATASET_NAME "jill_gaps"
+/* The spare entry is made in a group of its own: a reader takes the groups
+ * at the top of the file with a timestamp for entries, and this has none */
+#define JILL_SPARE_GROUP_NAME "jill_spare"
+#define JILL_SPARE_ENTRY_NAME JILL_SPARE_GROUP_NAME "/entry"
+#define JILL_MESSAGEDATASET_NAME "jill_messages"
 #define ARF_CHUNK_SIZE 1024
+/* The version of the specification, for files arf did not create itself:
+ * the one the arf library writes */
+#if defined(ARF_VERSION)
+#define ARF_SPEC_VERSION ARF_VERSION
+#elif defined(ARF_VERSION_MAJOR) && defined(ARF_VERSION_MINOR)
+#define ARF_STRINGIFY_(x) #x
+#define ARF_STRINGIFY(x) ARF_STRINGIFY_(x)
+#define ARF_SPEC_VERSION ARF_STRINGIFY(ARF_VERSION_MAJOR) "." ARF_STRINGIFY(ARF_VERSION_MINOR)
+#else
+#error "arf.hpp does not say which version of the specification it implements"
+#endif
+/* Sampled datasets are chunked by about this many bytes, or by a second of
+ * data if that is less, rounded up to a whole number of writes. 1024 samples
+ * a chunk made a 30 kHz channel write thirty chunks a second, each with its
+ * own B-tree entry and, when compressed, its own trip through the filter. */
+#define ARF_SAMPLED_CHUNK_BYTES (128 * 1024)
+/* Events are sparse and small; a chunk holds this many */
+#define ARF_EVENT_CHUNK_SIZE 256
+/* Each dataset's raw-data chunk cache holds this many of its chunks. A chunk
+ * larger than the cache is not cached at all, and appending to it rereads
+ * and, if compressed, decompresses it for every write. */
+#define ARF_CACHE_CHUNKS 4
+#define ARF_CACHE_SLOTS 521
+/* A sampled dataset's extent runs ahead of its data by this many chunks */
+#define ARF_PREALLOC_CHUNKS 8
 
 using namespace std;
 using namespace jill;
@@ -39,6 +77,13 @@ struct event_t {
         char const * message;   // message (hex encoded for standard midi status)
 };
 
+/**
+ * @brief Storage format for the strings compact events refer to
+ */
+struct message_string_t {
+        char const * value;
+};
+
 
 // template specializations for compound data types
 namespace arf { namespace h5t { namespace detail {
@@ -73,10 +118,93 @@ struct datatype_traits<event_t> {
         }
 };
 
+template<>
+struct datatype_traits<compact_event_t> {
+        static hid_t value() {
+                const hsize_t ndata = 2;
+                hid_t data = H5Tarray_create2(H5T_NATIVE_UINT8, 1, &ndata);
+                hid_t ret = H5Tcreate(H5T_COMPOUND, sizeof(compact_event_t));
+                H5Tinsert(ret, "start", HOFFSET(compact_event_t, start), H5T_NATIVE_UINT32);
+                H5Tinsert(ret, "status", HOFFSET(compact_event_t, status), H5T_NATIVE_UINT8);
+                H5Tinsert(ret, "data", HOFFSET(compact_event_t, data), data);
+                H5Tinsert(ret, "message", HOFFSET(compact_event_t, message), H5T_NATIVE_UINT32);
+                H5Tclose(data);
+                return ret;
+        }
+};
+
+template<>
+struct datatype_traits<message_string_t> {
+        static hid_t value() {
+                hid_t str = H5Tcopy(H5T_C_S1);
+                H5Tset_size(str, H5T_VARIABLE);
+                H5Tset_cset(str, H5T_CSET_UTF8);
+                return str;
+        }
+};
+
 }}}
 
 namespace {
 
+/* Frames per chunk for a sampled dataset */
+hsize_t
+sampled_chunk(nframes_t sampling_rate, nframes_t write_frames)
+{
+        hsize_t frames = std::min<hsize_t>(ARF_SAMPLED_CHUNK_BYTES / sizeof(sample_t),
+                                           sampling_rate);
+        frames = std::max<hsize_t>(frames, ARF_CHUNK_SIZE);
+        if (write_frames > 0)
+                frames = (frames + write_frames - 1) / write_frames * write_frames;
+        return frames;
+}
+
+/* The metadata cache starts at 2 MB and only grows after misses. A recording
+ * opens a few datasets per entry, thousands of entries a day, and every
+ * append touches its dataset's chunk index, so start it bigger and let it
+ * grow further. */
+void
+configure_metadata_cache(hid_t file)
+{
+        H5AC_cache_config_t config;
+        config.version = H5AC__CURR_CACHE_CONFIG_VERSION;
+        if (H5Fget_mdc_config(file, &config) < 0) return;
+        config.set_initial_size = true;
+        config.initial_size = 8 * 1024 * 1024;
+        config.min_size = 4 * 1024 * 1024;
+        config.max_size = 64 * 1024 * 1024;
+        if (H5Fset_mdc_config(file, &config) < 0)
+                LOG << "WARNING: unable to configure the HDF5 metadata cache";
+}
+
+/* Create @a filename with paged file-space aggregation if it does not exist
+ * and @a page_size is not 0, and return the name for arf to open. HDF5 then
+ * hands out file space in pages, keeping metadata and raw data apart and the
+ * free space of each page for the next allocation of its kind; arf cannot be
+ * asked for this, as it opens files with the default creation properties.
+ * arf only marks the files it creates with the specification version, so
+ * the writer adds that afterwards. */
+string const &
+create_paged(string const & filename, std::size_t page_size)
+{
+        if (page_size == 0 || std::filesystem::exists(filename)) return filename;
+#if H5_VERSION_GE(1,10,1)
+        const hid_t fcpl = H5Pcreate(H5P_FILE_CREATE);
+        // what arf sets for the files it creates
+        H5Pset_link_creation_order(fcpl, H5P_CRT_ORDER_TRACKED | H5P_CRT_ORDER_INDEXED);
+        H5Pset_file_space_strategy(fcpl, H5F_FSPACE_STRATEGY_PAGE, true, 1);
+        H5Pset_file_space_page_size(fcpl, page_size);
+        const hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_EXCL, fcpl, H5P_DEFAULT);
+        H5Pclose(fcpl);
+        if (file < 0)
+                throw arf::Exception("unable to create paged file " + filename);
+        H5Fclose(file);
+#else
+        LOG << "WARNING: HDF5 is older than 1.10.1; " << filename << " will not be paged";
+#endif
+        return filename;
+}
+
 /* The log dataset is either opened or created, which is a branch, and
  * packet_table has no default constructor to leave a member in until the branch
  * resolves. Returning by value lets it be built in the initializer list; the
@@ -105,15 +233,24 @@ open_or_create_log(arf::file & file, int compression)
 arf_writer::arf_writer(string const & filename,
                        data_source const & source,
                        map<string,string> entry_attrs,
-                       int compression)
+                       int compression,
+                       std::shared_ptr<entry_numbering> numbering,
+                       std::size_t page_size)
         : _data_source(source),
-          _file(filename, "a"),
+          _filename(filename),
+          _first_filename(filename),
+          _file(create_paged(filename, page_size), "a"),
           _attrs(std::move(entry_attrs)),
           // uses the parameter, not the member: _compression is declared later
           // and so is not initialized yet
           _log(open_or_create_log(_file, compression)),
           _compression(compression),
-          _entry_start(0), _last_offset(0), _entry_idx(0)
+          _degraded(false),
+          _entry_start(0), _last_offset(0), _entry_idx(0),
+          _numbering(std::move(numbering)),
+          _keep_next(false), _rotate(false), _file_seq(0),
+          _page_size(page_size), _keep_spare(false),
+          _compact_events(false), _closed_end(0)
 {
         _base_usec = _data_source.time();
         _base_ptime = microsec_clock::universal_time();
@@ -122,7 +259,36 @@ arf_writer::arf_writer(string const & filename,
         if (!_file.has_attribute("file_creator")) {
                 _file.write_attribute("file_creator", "org.meliza.jill/jrecord " JILL_VERSION);
         }
+        if (!_file.has_attribute("arf_version")) {
+                _file.write_attribute("arf_version", ARF_SPEC_VERSION);
+        }
+        configure_metadata_cache(_file.hid());
         _get_last_entry_index();
+        if (_numbering) _numbering->skip_to(_entry_idx);
+}
+
+arf_writer::~arf_writer()
+{
+        // an entry left open is not closed, but its events are kept
+        try {
+                write_pending_events();
+        }
+        catch (std::exception const & e) {
+                LOG << "ERROR: unable to write queued events: " << e.what();
+        }
+        // the file stays open while any dataset in it is
+        _dsets.clear();
+        _sampled.clear();
+        release_held();
+        drop_spare();
+        /* a file made ahead of a rotation that never came holds nothing but
+         * an empty log; it was new, so nobody else's data goes with it */
+        if (_next) {
+                const std::string name = _next->name;
+                _next.reset();
+                std::error_code ec;
+                std::filesystem::remove(name, ec);
+        }
 }
 
 void
@@ -130,10 +296,13 @@ arf_writer::new_entry(nframes_t frame_count)
 {
         utime_t frame_usec = 0;
 
+        close_entry();
+        const bool switched = _rotate && switch_file();
+
+        const std::size_t idx = _numbering ? _numbering->number(frame_count) : _entry_idx++;
         std::ostringstream name;
-        name << _data_source.name() << '_' << setw(4) << setfill('0') << _entry_idx++;
+        name << _data_source.name() << '_' << setw(4) << setfill('0') << idx;
 
-        close_entry();
         _entry_start = frame_count;
         _last_offset = 0;
 
@@ -141,30 +310,71 @@ arf_writer::new_entry(nframes_t frame_count)
         frame_usec = _data_source.time(_entry_start);
         ts = (_base_ptime + microseconds(frame_usec - _base_usec)) - epoch;
 
-        _entry.emplace(_file, name.str(),
-                       ts.total_seconds(), ts.fractional_seconds());
-
-        LOG << "created entry: " << _entry->name() << " (frame=" << _entry_start << ")" ;
+        if (_spare) {
+                /* made in idle(), with everything but the time; renaming
+                 * it is a change to one link */
+                if (H5Lmove(_file.hid(), JILL_SPARE_ENTRY_NAME, _file.hid(), name.str().c_str(),
+                            H5P_DEFAULT, H5P_DEFAULT) < 0)
+                        throw arf::Exception("unable to rename the prepared entry");
+                _entry.emplace(std::move(*_spare));
+                _spare.reset();
+                _unopened.swap(_spare_datasets);
+                _spare_datasets.clear();
+                H5Adelete(_entry->hid(), "timestamp");
+                _entry->write_attribute("timestamp",
+                                        std::vector<std::int64_t>{ts.total_seconds(),
+                                                                  ts.fractional_seconds()});
+                LOG << "created entry: " << _entry->name() << " (frame=" << _entry_start
+                    << ", prepared)";
+        }
+        else {
+                _entry.emplace(_file, name.str(),
+                               ts.total_seconds(), ts.fractional_seconds());
+                LOG << "created entry: " << _entry->name() << " (frame=" << _entry_start << ")" ;
+                arf::h5a::node::attr_writer a = _entry->write_attribute();
+                a("jack_sampling_rate", _data_source.sampling_rate());
+                a("entry_creator", "org.meliza.jill/jrecord " JILL_VERSION);
+                for_each(_attrs.begin(), _attrs.end(), a);
+        }
 
         arf::h5a::node::attr_writer a = _entry->write_attribute();
         a("jack_frame", _entry_start);
         a("jack_usec", frame_usec);
-        a("jack_sampling_rate", _data_source.sampling_rate());
-        a("entry_creator", "org.meliza.jill/jrecord " JILL_VERSION);
-        for_each(_attrs.begin(), _attrs.end(), a);
+        /* carrying straight on from the last entry of the previous file,
+         * with not a frame between them: the same recording, cut in two */
+        if (switched && !_closed_entry.empty() && _closed_end == frame_count) {
+                a("jill_continues", _closed_entry);
+                LOG << "entry continues " << _closed_entry;
+        }
 }
 
 void
 arf_writer::close_entry()
 {
+        // annotated while the entry and its datasets are still open
+        while (!_gaps.empty()) {
+                const string id = _gaps.begin()->first;
+                end_gap(id);
+        }
+        write_pending_events();
+        _messages.clear();
         _dsets.clear();         // closes any old packet tables
+        _sampled.clear();       // trims and closes the sampled datasets
+        release_held();
         if (_entry) {
                 LOG << "closed entry: " << _entry->name()
                     << " (frame=" << _entry_start + _last_offset << ")";
-                _entry->write_attribute("trial_off", _last_offset);
+                write_trial_off();
+                // made ahead of time for channels that had nothing this time
+                for (auto const & name : _unopened)
+                        H5Ldelete(_entry->hid(), name.c_str(), H5P_DEFAULT);
+                _closed_entry = std::filesystem::path(_filename).filename().string()
+                        + ":" + _entry->name();
+                _closed_end = _entry_start + _last_offset;
                 // if (!aligned())
                 //         o << " (warning: unequal dataset length)";
         }
+        _unopened.clear();
         _entry.reset();
 }
 
@@ -203,19 +413,40 @@ arf_writer::write(data_block_t const * data, nframes_t start_frame, nframes_t st
                 new_entry(data->time + start_frame);
         }
         /* write the data */
+        if (data->dtype != GAP && !_gaps.empty()) {
+                end_gap(id);
+        }
         if (data->dtype == SAMPLED) {
-                dset = get_dataset(id, true);
                 auto * samples = reinterpret_cast<sample_t const *>(data->data());
-                dset->second.write(samples + start_frame, stop_frame - start_frame);
+                get_sampled(id, nframes).write(samples + start_frame, stop_frame - start_frame);
         }
         else if (data->dtype == EVENT) {
-                dset = get_dataset(id, false);
-		midi::event_view ev(*data);
-		std::string encoded = ev.message();
-		event_t e = {data->time - _entry_start, ev.status().value(), encoded.c_str()};
-                DBG << "event: t=" << data->time << " id=" << id << " status=" << int(e.status)
-                    << " message=" << e.message;
-                dset->second.write(&e, 1);
+                if (_compact_events) {
+                        write_compact(id, *data);
+                }
+                else {
+                        dset = get_dataset(id);
+                        midi::event_view ev(*data);
+                        std::string encoded = ev.message();
+                        event_t e = {data->time - _entry_start, ev.status().value(), encoded.c_str()};
+                        DBG << "event: t=" << data->time << " id=" << id << " status=" << int(e.status)
+                            << " message=" << e.message;
+                        dset->second.write(&e, 1);
+                }
+        }
+        else if (data->dtype == GAP) {
+                gap_t gap;
+                std::memcpy(&gap, data->data(), sizeof(gap));
+                const nframes_t n = stop_frame - start_frame;
+                if (gap.dtype == SAMPLED) {
+                        /* zeros where the samples would have been, or every
+                         * later sample on the channel would be out of step
+                         * with the others. The annotation says they are not
+                         * real. */
+                        if (_zeros.size() < n) _zeros.resize(n);
+                        get_sampled(id, nframes).write(_zeros.data(), n);
+                }
+                note_gap(id, data->time + start_frame, n, gap.dtype);
         }
         /* Track the furthest point reached as an offset from the start of the
          * entry, not as a frame number. Two things have to hold at once: an
@@ -230,9 +461,276 @@ arf_writer::write(data_block_t const * data, nframes_t start_frame, nframes_t st
 void
 arf_writer::flush()
 {
+        write_pending_events();
+        /* the sampled datasets run on past their data, so that a file left
+         * by a crash says where its last entry ends */
+        if (_entry) write_trial_off();
         _file.flush();
 }
 
+void
+arf_writer::write_trial_off()
+{
+        if (_entry->has_attribute("trial_off"))
+                H5Adelete(_entry->hid(), "trial_off");
+        _entry->write_attribute("trial_off", _last_offset);
+}
+
+void
+arf_writer::note_gap(string const & id, nframes_t time, nframes_t nframes, dtype_t dtype)
+{
+        auto it = _gaps.find(id);
+        if (it == _gaps.end()) {
+                _gaps.emplace(id, pending_gap{time, nframes, 1, dtype});
+        }
+        else {
+                it->second.nframes = (time + nframes) - it->second.start;
+                it->second.blocks += 1;
+        }
+}
+
+void
+arf_writer::end_gap(string const & id)
+{
+        auto it = _gaps.find(id);
+        if (it == _gaps.end()) return;
+        pending_gap const & gap = it->second;
+        std::ostringstream msg;
+        msg << "gap in " << id << ": ";
+        if (gap.dtype == SAMPLED)
+                msg << gap.nframes << " frames";
+        else
+                msg << gap.blocks << " events";
+        msg << " dropped under load";
+        const string message = msg.str();
+        LOG << message << " (frame=" << gap.start << ")";
+        if (_entry) {
+                /* An event dataset beside the channels, like any other, so
+                 * that a reader finds the gaps without having to parse the
+                 * log: one event per gap, at its start, saying what is missing */
+                auto dset = get_dataset(JILL_GAPDATASET_NAME);
+                event_t e = {gap.start - _entry_start, 0, message.c_str()};
+                dset->second.write(&e, 1);
+        }
+        _gaps.erase(it);
+}
+
+void
+arf_writer::set_degraded(bool on)
+{
+        if (on == _degraded) return;
+        _degraded = on;
+        // its datasets were made with the other compression
+        if (_spare && _compression > 0) drop_spare();
+}
+
+void
+arf_writer::rotate()
+{
+        _rotate = true;
+}
+
+void
+arf_writer::prepare_rotation()
+{
+        _keep_next = true;
+}
+
+void
+arf_writer::use_compact_events(bool on)
+{
+        if (on == _compact_events) return;
+        _compact_events = on;
+        // its event datasets are in the other format
+        if (_spare) drop_spare();
+}
+
+void
+arf_writer::write_compact(string const & id, data_block_t const & data)
+{
+        midi::event_view ev(data);
+        auto const * body = reinterpret_cast<std::uint8_t const *>(data.data()) + 1;
+        const std::size_t size = data.sz_data - 1;
+        const nframes_t start = data.time - _entry_start;
+        compact_event_t e = {start, ev.status().value(), {0, 0}, compact_event_t::no_message};
+        if (ev.status().is_standard_midi() && size <= sizeof(e.data)) {
+                std::memcpy(e.data, body, size);
+        }
+        else {
+                e.message = message_row(ev.message());
+        }
+        DBG << "event: t=" << start << " id=" << id << " status=" << int(e.status)
+            << " message=" << e.message;
+        std::vector<compact_event_t> & pending = _pending_events[id];
+        pending.push_back(e);
+        if (pending.size() >= ARF_EVENT_CHUNK_SIZE) {
+                get_dataset(id, true)->second.write(pending.data(), pending.size());
+                pending.clear();
+        }
+}
+
+void
+arf_writer::write_pending_events()
+{
+        if (!_entry) return;
+        for (auto & p : _pending_events) {
+                if (p.second.empty()) continue;
+                get_dataset(p.first, true)->second.write(p.second.data(), p.second.size());
+                p.second.clear();
+        }
+}
+
+std::uint32_t
+arf_writer::message_row(string const & message)
+{
+        // up to the terminator that JILL's string messages carry
+        const string key(message.c_str());
+        auto row = _messages.find(key);
+        if (row != _messages.end()) return row->second;
+        auto dset = _dsets.find(JILL_MESSAGEDATASET_NAME);
+        if (dset == _dsets.end()) {
+                arf::h5pt::packet_table pt =
+                        _entry->create_packet_table<message_string_t>(JILL_MESSAGEDATASET_NAME, "",
+                                                                      arf::UNDEFINED, false,
+                                                                      ARF_EVENT_CHUNK_SIZE,
+                                                                      new_dataset_compression(JILL_MESSAGEDATASET_NAME));
+                LOG << "created dataset: " << _entry->name() << "/" JILL_MESSAGEDATASET_NAME;
+                dset = _dsets.emplace_hint(dset, JILL_MESSAGEDATASET_NAME, std::move(pt));
+        }
+        const message_string_t m = {key.c_str()};
+        dset->second.write(&m, 1);
+        const std::uint32_t n = _messages.size();
+        _messages.emplace(key, n);
+        return n;
+}
+
+void
+arf_writer::prepare_entries()
+{
+        _keep_spare = true;
+}
+
+void
+arf_writer::idle()
+{
+        if (_keep_next && !_next) {
+                try {
+                        _next.emplace(open_next_file());
+                }
+                catch (std::exception const & e) {
+                        /* Tried again at the switch, and every idle pass until then
+                         * would only log the same thing */
+                        LOG << "ERROR: unable to prepare the next file: " << e.what();
+                        _keep_next = false;
+                }
+        }
+        if (_keep_spare && !_spare) {
+                try {
+                        make_spare();
+                }
+                catch (std::exception const & e) {
+                        // entries are still made, only at the trigger
+                        LOG << "ERROR: unable to prepare an entry: " << e.what();
+                        drop_spare();
+                        _keep_spare = false;
+                }
+        }
+}
+
+void
+arf_writer::make_spare()
+{
+        // left by a writer that did not get to remove it
+        if (_file.contains(JILL_SPARE_GROUP_NAME))
+                H5Ldelete(_file.hid(), JILL_SPARE_GROUP_NAME, H5P_DEFAULT);
+        const hid_t group = H5Gcreate2(_file.hid(), JILL_SPARE_GROUP_NAME,
+                                       H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        if (group < 0) throw arf::Exception("unable to create " JILL_SPARE_GROUP_NAME);
+        H5Gclose(group);
+        // the timestamp is replaced when the entry is used
+        _spare.emplace(_file, JILL_SPARE_ENTRY_NAME, 0, 0);
+        arf::h5a::node::attr_writer a = _spare->write_attribute();
+        a("jack_sampling_rate", _data_source.sampling_rate());
+        a("entry_creator", "org.meliza.jill/jrecord " JILL_VERSION);
+        for_each(_attrs.begin(), _attrs.end(), a);
+        for (auto const & c : _sampled_channels) {
+                create_sampled(*_spare, c.first, sampled_chunk(_data_source.sampling_rate(), c.second));
+                _spare_datasets.insert(c.first);
+        }
+        for (auto const & name : _event_channels) {
+                create_events(*_spare, name, _compact_events);
+                _spare_datasets.insert(name);
+        }
+        INFO << "prepared an entry with " << _spare_datasets.size() << " datasets";
+}
+
+void
+arf_writer::drop_spare()
+{
+        _spare.reset();
+        _spare_datasets.clear();
+        if (_file.contains(JILL_SPARE_GROUP_NAME))
+                H5Ldelete(_file.hid(), JILL_SPARE_GROUP_NAME, H5P_DEFAULT);
+}
+
+arf_writer::next_file
+arf_writer::open_next_file()
+{
+        const std::filesystem::path first(_first_filename);
+        std::filesystem::path path;
+        do {
+                std::ostringstream name;
+                name << first.stem().string() << '-' << setw(4) << setfill('0') << ++_file_seq
+                     << first.extension().string();
+                path = first.parent_path() / name.str();
+        } while (std::filesystem::exists(path));
+
+        arf::file file(create_paged(path.string(), _page_size), "a");
+        configure_metadata_cache(file.hid());
+        arf::h5pt::packet_table log = open_or_create_log(file, _compression);
+        file.write_attribute("file_creator", "org.meliza.jill/jrecord " JILL_VERSION);
+        if (!file.has_attribute("arf_version")) {
+                file.write_attribute("arf_version", ARF_SPEC_VERSION);
+        }
+        file.write_attribute("jill_previous_file",
+                             std::filesystem::path(_filename).filename().string());
+        file.flush();
+        INFO << "prepared next file: " << path.string();
+        return next_file{path.string(), std::move(file), std::move(log)};
+}
+
+bool
+arf_writer::switch_file()
+{
+        _rotate = false;
+        if (!_next) {
+                /* not made ahead of time, so it costs the writer now; data
+                 * wait in the ringbuffer meanwhile */
+                try {
+                        _next.emplace(open_next_file());
+                }
+                catch (std::exception const & e) {
+                        // far better to carry on in this file than to stop
+                        LOG << "ERROR: unable to rotate files, continuing in "
+                            << _filename << ": " << e.what();
+                        return false;
+                }
+        }
+        // made in this file, so of no use in the next
+        drop_spare();
+        const std::string name = _next->name;
+        _file.write_attribute("jill_next_file", std::filesystem::path(name).filename().string());
+        // the old log first, as it belongs to the old file
+        _log = std::move(_next->log);
+        _file = std::move(_next->file);
+        _next.reset();
+        _filename = name;
+        LOG << "opened file: " << _filename;
+        _get_last_entry_index();
+        if (_numbering) _numbering->skip_to(_entry_idx);
+        return true;
+}
+
 void
 arf_writer::log(timestamp_t utc, string source, string msg)
 {
@@ -245,6 +743,28 @@ arf_writer::log(timestamp_t utc, string source, string msg)
         _log.write(&message, 1);
 }
 
+void
+arf_writer::log_batch(std::vector<log_entry> const & entries)
+{
+        if (entries.empty()) return;
+        /* One append to the packet table for the lot. Each append is a
+         * dataset extend and a write through HDF5's whole stack, which is most
+         * of what a log line costs; the formatting here is noise beside it.
+         * The strings are all built before any pointer into them is taken,
+         * since message_t holds only the pointer. */
+        std::vector<std::string> text;
+        text.reserve(entries.size());
+        for (auto const & e : entries)
+                text.push_back("[" + e.source + "] " + e.message);
+        std::vector<message_t> messages;
+        messages.reserve(entries.size());
+        for (std::size_t i = 0; i < entries.size(); ++i) {
+                const time_duration t = entries[i].time - epoch;
+                messages.push_back({t.total_seconds(), t.fractional_seconds(), text[i].c_str()});
+        }
+        _log.write(messages.data(), messages.size());
+}
+
 void
 arf_writer::_get_last_entry_index()
 {
@@ -261,8 +781,29 @@ arf_writer::_get_last_entry_index()
 }
 
 
-arf_writer::dset_map_type::iterator
-arf_writer::get_dataset(string const & name, bool is_sampled)
+arf::h5pt::packet_table
+arf_writer::open_cached(string const & name, std::size_t chunk_bytes)
+{
+        const hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+        // appends never revisit a full chunk, so evict those first
+        H5Pset_chunk_cache(dapl, ARF_CACHE_SLOTS, ARF_CACHE_CHUNKS * chunk_bytes, 1.0);
+        const hid_t held = H5Dopen2(_entry->hid(), name.c_str(), dapl);
+        H5Pclose(dapl);
+        if (held < 0)
+                throw arf::Exception("unable to reopen dataset " + name);
+        _held.push_back(held);
+        return arf::h5pt::packet_table(_entry->hid(), name);
+}
+
+void
+arf_writer::release_held()
+{
+        for (hid_t id : _held) H5Dclose(id);
+        _held.clear();
+}
+
+std::string const &
+arf_writer::uuid_for(string const & name)
 {
         auto uuid = _dset_uuids.find(name);
         if (uuid == _dset_uuids.end()) {
@@ -271,38 +812,164 @@ arf_writer::get_dataset(string const & name, bool is_sampled)
                 uuid = _dset_uuids.insert(uuid, make_pair(name, _uuid));
                 INFO << "uuid for " << name << ": " << uuid->second;
         }
+        return uuid->second;
+}
+
+int
+arf_writer::new_dataset_compression(string const & name) const
+{
+        /* HDF5 fixes a dataset's filters when it is created, so skipping
+         * compression under load only applies to datasets made while it
+         * lasts -- in practice, the entries a triggered recording starts
+         * then. They are still valid ARF; a reader sees no filter on them,
+         * that's all. */
+        if (_degraded && _compression > 0)
+                LOG << "writer is behind: " << name << " will not be compressed";
+        return _degraded ? 0 : _compression;
+}
+
+void
+arf_writer::create_sampled(arf::entry & entry, string const & name, hsize_t chunk)
+{
+        // arf writes the attributes the format asks for
+        arf::h5pt::packet_table pt =
+                entry.create_packet_table<sample_t>(name, "", arf::UNDEFINED, false, chunk,
+                                                    new_dataset_compression(name));
+        pt.write_attribute("sampling_rate", _data_source.sampling_rate());
+        pt.write_attribute("uuid", uuid_for(name));
+}
 
+void
+arf_writer::create_events(arf::entry & entry, string const & name, bool compact)
+{
+        /* event_t is a compound of three fields, and the specification
+         * requires one unit per field for complex event data. Only the first
+         * carries a timebase: start is in samples, status and message are not
+         * quantities. This used to pass the bare string "samples", which arf 2
+         * accepted and arf.py rejects. compact_event_t has a fourth. */
+        arf::h5pt::packet_table pt = compact
+                ? entry.create_packet_table<compact_event_t>(name,
+                                                             std::vector<std::string>{"samples", "", "", ""},
+                                                             arf::EVENT, false,
+                                                             ARF_EVENT_CHUNK_SIZE,
+                                                             new_dataset_compression(name))
+                : entry.create_packet_table<event_t>(name,
+                                                     std::vector<std::string>{"samples", "", ""},
+                                                     arf::EVENT, false,
+                                                     ARF_EVENT_CHUNK_SIZE,
+                                                     new_dataset_compression(name));
+        pt.write_attribute("sampling_rate", _data_source.sampling_rate());
+        pt.write_attribute("uuid", uuid_for(name));
+}
+
+sampled_dataset &
+arf_writer::get_sampled(string const & name, nframes_t write_frames)
+{
+        auto dset = _sampled.find(name);
+        if (dset != _sampled.end()) return dset->second;
+
+        const hsize_t chunk = sampled_chunk(_data_source.sampling_rate(), write_frames);
+        if (!_unopened.erase(name)) {
+                create_sampled(*_entry, name, chunk);
+                LOG << "created dataset: " << _entry->name() << '/' << name
+                    << " (chunk=" << chunk << ")";
+        }
+        _sampled_channels[name] = write_frames;
+        // and then it is written directly: see sampled_dataset
+        const hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+        // appends never revisit a full chunk, so evict those first
+        H5Pset_chunk_cache(dapl, ARF_CACHE_SLOTS, ARF_CACHE_CHUNKS * chunk * sizeof(sample_t), 1.0);
+        const hid_t id = H5Dopen2(_entry->hid(), name.c_str(), dapl);
+        H5Pclose(dapl);
+        if (id < 0)
+                throw arf::Exception("unable to reopen dataset " + name);
+        return _sampled.emplace(name, sampled_dataset(id, ARF_PREALLOC_CHUNKS * chunk)).first->second;
+}
+
+arf_writer::dset_map_type::iterator
+arf_writer::get_dataset(string const & name, bool compact)
+{
         auto dset = _dsets.find(name);
         if (dset == _dsets.end()) {
-                if (is_sampled) {
-                        arf::h5pt::packet_table pt =
-                                _entry->create_packet_table<sample_t>(name, "", arf::UNDEFINED,
-                                                                      false, ARF_CHUNK_SIZE,
-                                                                      _compression);
-                        pt.write_attribute("sampling_rate", _data_source.sampling_rate());
-                        pt.write_attribute("uuid", uuid->second);
-                        LOG << "created dataset: " << pt.name();
-                        dset = _dsets.emplace_hint(dset, name, std::move(pt));
-                }
-                else {
-                        /* event_t is a compound of three fields, and the
-                         * specification requires one unit per field for complex
-                         * event data. Only the first carries a timebase: start
-                         * is in samples, status and message are not quantities.
-                         * This used to pass the bare string "samples", which
-                         * arf 2 accepted and arf.py rejects. */
-                        const std::vector<std::string> units{"samples", "", ""};
-                        arf::h5pt::packet_table pt =
-                                _entry->create_packet_table<event_t>(name, units, arf::EVENT,
-                                                                     false, ARF_CHUNK_SIZE,
-                                                                     _compression);
-                        pt.write_attribute("sampling_rate", _data_source.sampling_rate());
-                        pt.write_attribute("uuid", uuid->second);
-                        LOG << "created dataset: " << pt.name();
-                        dset = _dsets.emplace_hint(dset, name, std::move(pt));
+                if (!_unopened.erase(name)) {
+                        create_events(*_entry, name, compact);
+                        LOG << "created dataset: " << _entry->name() << '/' << name;
                 }
+                // gaps are not expected again
+                if (name != JILL_GAPDATASET_NAME) _event_channels.insert(name);
+                // made and closed, then opened again: see _held
+                const std::size_t size = compact ? sizeof(compact_event_t) : sizeof(event_t);
+                dset = _dsets.emplace_hint(dset, name,
+                                           open_cached(name, ARF_EVENT_CHUNK_SIZE * size));
         }
-
         return dset;
+}
 
+sampled_dataset::sampled_dataset(hid_t id, hsize_t increment)
+        : _id(id), _size(0), _extent(0), _increment(increment)
+{
+        hid_t space = H5Dget_space(_id);
+        H5Sget_simple_extent_dims(space, &_size, nullptr);
+        H5Sclose(space);
+        _extent = _size;
+}
+
+sampled_dataset::sampled_dataset(sampled_dataset && o) noexcept
+        : _id(o._id), _size(o._size), _extent(o._extent), _increment(o._increment)
+{
+        o._id = -1;
+}
+
+sampled_dataset::~sampled_dataset()
+{
+        if (_id < 0) return;
+        trim();
+        H5Dclose(_id);
+}
+
+void
+sampled_dataset::write(sample_t const * data, hsize_t n)
+{
+        static_assert(std::is_same<sample_t, float>::value, "written as H5T_NATIVE_FLOAT");
+        if (n == 0) return;
+        if (_size + n > _extent) {
+                _extent = std::max(_size + n, _extent + _increment);
+                if (H5Dset_extent(_id, &_extent) < 0)
+                        throw arf::Exception("unable to extend dataset");
+        }
+        const hid_t file_space = H5Dget_space(_id);
+        H5Sselect_hyperslab(file_space, H5S_SELECT_SET, &_size, nullptr, &n, nullptr);
+        const hid_t mem_space = H5Screate_simple(1, &n, nullptr);
+        const herr_t ret = H5Dwrite(_id, H5T_NATIVE_FLOAT, mem_space, file_space, H5P_DEFAULT, data);
+        H5Sclose(mem_space);
+        H5Sclose(file_space);
+        if (ret < 0)
+                throw arf::Exception("unable to write to dataset");
+        _size += n;
+}
+
+void
+sampled_dataset::trim()
+{
+        if (_extent == _size) return;
+        _extent = _size;
+        H5Dset_extent(_id, &_extent);
+}
+
+void
+entry_numbering::skip_to(std::size_t next)
+{
+        std::lock_guard<std::mutex> lock(_lock);
+        _next = std::max(_next, next);
+}
+
+std::size_t
+entry_numbering::number(nframes_t frame)
+{
+        std::lock_guard<std::mutex> lock(_lock);
+        for (auto const & r : _recent)
+                if (r.first == frame) return r.second;
+        _recent.emplace_back(frame, _next);
+        if (_recent.size() > remembered) _recent.pop_front();
+        return _next++;
 }
@@ -1,9 +1,15 @@
 #ifndef _ARF_WRITER_HH
 #define _ARF_WRITER_HH
 
+#include <cstdint>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <set>
 #include <string>
+#include <vector>
 #include <iosfwd>
 #include <arf.hpp>
 
@@ -15,6 +21,94 @@ namespace jill {
 
 namespace file {
 
+/**
+ * Entry numbers shared by several arf_writers, so that the entries in files
+ * written side by side -- one per shard of a recording's channels -- have the
+ * same names when they start at the same frame.
+ *
+ * The first writer to ask for a number for a frame takes the next one, and any
+ * other asking for the same frame afterwards gets the same. The writers run on
+ * their own threads and can be well behind one another, so a few recent frames
+ * are remembered; entries are seconds apart at least, so a few is plenty.
+ */
+class entry_numbering {
+public:
+        entry_numbering() : _next(0) {}
+
+        /* Handed to writers by shared_ptr; a copy would number on its own */
+        entry_numbering(entry_numbering const &) = delete;
+        entry_numbering & operator=(entry_numbering const &) = delete;
+
+        /** Number no entry below @a next; each writer calls this with its file's */
+        void skip_to(std::size_t next);
+
+        /** The number for the entry starting at @a frame */
+        std::size_t number(nframes_t frame);
+
+private:
+        static constexpr std::size_t remembered = 64;
+        std::mutex _lock;
+        std::size_t _next;
+        std::deque<std::pair<nframes_t, std::size_t>> _recent;
+};
+
+/**
+ * An event as arf_writer::use_compact_events() stores it.
+ */
+struct compact_event_t {
+        /** the message field of an event with nothing in jill_messages */
+        static constexpr std::uint32_t no_message = 0xffffffff;
+
+        std::uint32_t start;    // relative to entry start
+        std::uint8_t status;    // see jill::midi::status_type
+        std::uint8_t data[2];   // data bytes of a standard midi message, or 0
+        std::uint32_t message;  // row of jill_messages, or no_message
+};
+
+/**
+ * A dataset of samples in the current entry, appended to with H5Dwrite.
+ *
+ * A packet table changes its dataset's extent on every append, which rewrites
+ * the dataspace in the object header each time. This keeps the extent a few
+ * chunks ahead of the data instead, so that happens once every few chunks, and
+ * trims it back to what was written when the dataset is closed. Only the
+ * extent runs ahead: the datasets keep HDF5's default incremental allocation,
+ * so file space is still taken a chunk at a time as each is first written,
+ * and the channels' chunks are interleaved in the file as before. Until the
+ * dataset is closed, and in a file left by a crash, the channel reads as up
+ * to that many chunks of zeros past the data; arf_writer keeps the entry's
+ * trial_off up to date at each flush, so that a reader can tell where the
+ * data stop.
+ */
+class sampled_dataset {
+public:
+        /**
+         * @param id         an open dataset, which this now owns
+         * @param increment  how many samples to extend the dataset by when
+         *                   it is full: a whole number of chunks
+         */
+        sampled_dataset(hid_t id, hsize_t increment);
+        sampled_dataset(sampled_dataset &&) noexcept;
+        sampled_dataset(sampled_dataset const &) = delete;
+        sampled_dataset & operator=(sampled_dataset const &) = delete;
+        ~sampled_dataset();
+
+        /** Append @a n samples. Throws arf::Exception on errors */
+        void write(sample_t const * data, hsize_t n);
+
+        /** Give back the space reserved past the last sample */
+        void trim();
+
+        /** the number of samples written */
+        hsize_t size() const { return _size; }
+
+private:
+        hid_t _id;
+        hsize_t _size;                  // samples written
+        hsize_t _extent;                // the dataset's extent
+        hsize_t _increment;
+};
+
 /**
  * Class for storing data in an ARF file. Access is not thread-safe.
  */
@@ -28,12 +122,19 @@ public:
          * @param entry_attrs  map of attributes to set on newly-created entries
          * @param data_source  the source of the data. may be null
          * @param compression  the compression level for new datasets
+         * @param numbering    entry numbers shared with other writers, or
+         *                     null to number this file's entries on its own
+         * @param page_size    if nonzero, a new file is created with paged
+         *                     file-space aggregation, in pages of this many
+         *                     bytes. Needs HDF5 1.10.1 to read
          */
         arf_writer(std::string const & filename,
                    jill::data_source const & source,
                    std::map<std::string,std::string> entry_attrs,
-                   int compression=0);
-        ~arf_writer() override = default;
+                   int compression=0,
+                   std::shared_ptr<entry_numbering> numbering=nullptr,
+                   std::size_t page_size=0);
+        ~arf_writer() override;
 
         /* Owns the HDF5 file and the packet tables written into it, which are
          * themselves move-only handles. */
@@ -47,7 +148,48 @@ public:
         void xrun() override;
         void write(data_block_t const *, nframes_t, nframes_t) override;
         void log(timestamp_t, std::string, std::string) override;
+        void log_batch(std::vector<log_entry> const &) override;
         void flush() override;
+        void set_degraded(bool) override;
+        void rotate() override;
+        void idle() override;
+
+        /**
+         * Keep the next file of a rotation open and ready from now on, so
+         * that rotate() has nothing slow left to do when it comes. The next
+         * file is made in idle(), on the writer thread -- HDF5 is not
+         * reentrant -- and removed again if it is never used. Files are
+         * named after the first, with a sequence number before the
+         * extension: rec.arf, rec-0001.arf, rec-0002.arf, ...
+         */
+        void prepare_rotation();
+
+        /**
+         * Make the next entry ahead of time from now on, with a dataset for
+         * each channel of the last one, so that new_entry() only has to
+         * rename it and stamp the time. This is for triggered recording,
+         * where an entry is started with the pretrigger data waiting. The
+         * entry is made in idle() under a placeholder name, inside a group
+         * without a timestamp so that readers do not take it for an entry;
+         * datasets that get no data are removed when it closes, and the
+         * entry itself if it is never used, or if set_degraded() changes
+         * the compression its datasets should have.
+         */
+        void prepare_entries();
+
+        /**
+         * Store events compactly in the datasets made from now on. Each
+         * event is a fixed-size record: its time, its status byte, the data
+         * bytes of a standard MIDI message, and for any other message, which
+         * is a string, a row of the entry's jill_messages dataset, where
+         * each string is stored once. Events are written in batches, when
+         * a chunk's worth is waiting and at each flush() and close_entry().
+         * Off by default, for the readers of the string format.
+         */
+        void use_compact_events(bool on = true);
+
+        /** the name of the file being written */
+        std::string const & filename() const { return _filename; }
 
 protected:
         /* arf 3 packet tables are move-only handles rather than shared_ptrs,
@@ -56,21 +198,79 @@ protected:
         typedef std::map<std::string, arf::h5pt::packet_table> dset_map_type;
 
         /**
-         * Look up dataset in current entry, creating as needed.
+         * Look up an event dataset in current entry, creating as needed.
          *
          * @param name         the name of the dataset (channel)
-         * @param is_sampled   whether the dataset holds samples or events
+         * @param compact      whether a new dataset is in the compact format
          * @return derefable iterator for appropriate dataset
          */
-        dset_map_type::iterator get_dataset(std::string const & name, bool is_sampled);
+        dset_map_type::iterator get_dataset(std::string const & name, bool compact = false);
+
+        /**
+         * Look up a sampled dataset in current entry, creating as needed.
+         *
+         * @param name         the name of the dataset (channel)
+         * @param write_frames how many frames each write will be, which
+         *                     its chunks are a multiple of. 0 if not known
+         */
+        sampled_dataset & get_sampled(std::string const & name, nframes_t write_frames);
+
+        /**
+         * Record that a channel is missing data from @a time, extending the
+         * gap already open on it if there is one. Gaps are annotated when the
+         * channel's data resume, or when the entry is closed.
+         */
+        void note_gap(std::string const & id, nframes_t time, nframes_t nframes, dtype_t dtype);
+
+        /** Annotate the gap open on a channel, if any, and close it */
+        void end_gap(std::string const & id);
 
 private:
         /* find last entry index */
         void _get_last_entry_index();
 
+        /* a file opened ahead of a rotation, with its log */
+        struct next_file {
+                std::string name;
+                arf::file file;
+                arf::h5pt::packet_table log;
+        };
+        /* open the next file in the sequence; throws if it cannot */
+        next_file open_next_file();
+        /* switch to the next file, between entries; false if it could not */
+        bool switch_file();
+        /* open a dataset just made in the current entry again, with a chunk
+         * cache of its own, and return a packet table for it */
+        arf::h5pt::packet_table open_cached(std::string const & name, std::size_t chunk_bytes);
+        /* close the datasets open_cached() holds */
+        void release_held();
+        /* make a sampled dataset in @a entry */
+        void create_sampled(arf::entry & entry, std::string const & name, hsize_t chunk);
+        /* make an event dataset in @a entry */
+        void create_events(arf::entry & entry, std::string const & name, bool compact);
+        /* queue an event in the compact format, writing if a chunk is waiting */
+        void write_compact(std::string const & id, data_block_t const & data);
+        /* write the compact events queued */
+        void write_pending_events();
+        /* the row of jill_messages holding @a message, adding it if need be */
+        std::uint32_t message_row(std::string const & message);
+        /* make the spare entry; throws if it cannot */
+        void make_spare();
+        /* remove the spare entry, if there is one */
+        void drop_spare();
+        /* record how far the current entry has got, as trial_off */
+        void write_trial_off();
+        /* the uuid for a channel, the same in every entry */
+        std::string const & uuid_for(std::string const & name);
+        /* the compression level for a dataset created now */
+        int new_dataset_compression(std::string const & name) const;
+
         // references
         jill::data_source const & _data_source;
 
+        std::string _filename;                     // current output file
+        const std::string _first_filename;         // names the rest of a rotation
+
         // owned resources. arf 3 handles own their identifier and are
         // move-only, so these are values rather than pointers; the file and the
         // log are built in the initializer list because neither is optional.
@@ -80,8 +280,25 @@ private:
         // empty between entries, which is what ready() reports on
         std::optional<arf::entry> _entry;          // current entry (owned by thread)
         dset_map_type _dsets;                      // packet tables (owned)
+        /* A second identifier for each of _dsets, opened first. HDF5 gives
+         * an open dataset the chunk cache it was first opened with, and
+         * packet tables cannot be opened with one, so this is how the
+         * datasets get theirs. Closed with the entry. */
+        std::vector<hid_t> _held;
+        std::map<std::string, sampled_dataset> _sampled; // sampled datasets (owned)
         std::map<std::string, std::string> _dset_uuids; // session/channel uuid
         int _compression;                          // compression level for new datasets
+        bool _degraded;                            // create datasets uncompressed
+
+        /* a run of dropped blocks on one channel, not yet annotated */
+        struct pending_gap {
+                nframes_t start;                   // frame of the first
+                nframes_t nframes;                 // frames from there to the end of the last
+                std::size_t blocks;                // how many were dropped
+                dtype_t dtype;
+        };
+        std::map<std::string, pending_gap> _gaps;  // by channel
+        std::vector<sample_t> _zeros;              // written in place of dropped samples
 
         // these variables allow more precise timestamps; they are registered to
         // each other when set_data_source is called
@@ -94,6 +311,33 @@ private:
                                                    // the current entry, as an
                                                    // offset from _entry_start
         std::size_t _entry_idx;                    // manage entry numbering
+        std::shared_ptr<entry_numbering> _numbering; // or null
+
+        // rotation
+        bool _keep_next;                           // prepare the next file in idle()
+        bool _rotate;                              // switch files at the next entry
+        std::size_t _file_seq;                     // sequence number of the last file made
+        std::size_t _page_size;                    // for new files; 0 for none
+
+        // entries made ahead of time
+        bool _keep_spare;                          // prepare an entry in idle()
+        std::optional<arf::entry> _spare;
+        std::set<std::string> _spare_datasets;     // made in the spare
+        std::set<std::string> _unopened;           // of those, in _entry and not yet used
+        /* the channels of the last entry, to make the spare's datasets for:
+         * sampled ones with their write size, and event ones */
+        std::map<std::string, nframes_t> _sampled_channels;
+        std::set<std::string> _event_channels;
+
+        // compact events
+        bool _compact_events;
+        std::map<std::string, std::vector<compact_event_t>> _pending_events; // by channel
+        std::map<std::string, std::uint32_t> _messages; // rows of jill_messages
+        std::optional<next_file> _next;
+        /* the entry last closed, and where it ended, so that an entry
+         * carrying straight on in a new file can say which it continues */
+        std::string _closed_entry;
+        nframes_t _closed_end;
 
 };
 
@@ -0,0 +1,149 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "stimcache.hh"
+#include "../logging.hh"
+
+namespace fs = std::filesystem;
+using namespace jill::file;
+
+stimcache::stimcache(std::string const & dir)
+        : _dir(dir)
+{
+        std::error_code ec;
+        fs::create_directories(_dir, ec);
+        if (ec || !fs::is_directory(_dir)) {
+                throw jill::FileError("unable to create stimulus cache " + _dir +
+                                      (ec ? ": " + ec.message() : ""));
+        }
+}
+
+/* 64-bit FNV-1a. Not cryptographic, and does not need to be: the question is
+ * only whether a file has changed since it was resampled, and the length is
+ * part of the key as well. It runs at a few bytes per cycle, which next to
+ * sinc resampling of the same data is nothing. */
+stimcache::digest
+stimcache::hash_file(std::string const & path)
+{
+        std::ifstream in(path, std::ios::binary);
+        if (!in) throw jill::FileError("unable to read " + path);
+        std::uint64_t hash = 0xcbf29ce484222325ULL;
+        std::uint64_t size = 0;
+        std::vector<char> chunk(1 << 16);
+        while (in) {
+                in.read(chunk.data(), chunk.size());
+                const std::streamsize n = in.gcount();
+                for (std::streamsize i = 0; i < n; ++i) {
+                        hash ^= static_cast<unsigned char>(chunk[i]);
+                        hash *= 0x100000001b3ULL;
+                }
+                size += n;
+        }
+        if (in.bad()) throw jill::FileError("error reading " + path);
+        return digest{hash, size};
+}
+
+std::string
+stimcache::entry_path(digest const & src, nframes_t samplerate, char const * converter) const
+{
+        char name[96];
+        std::snprintf(name, sizeof(name), "%016llx-%llu-%u-%s.f32",
+                      static_cast<unsigned long long>(src.hash),
+                      static_cast<unsigned long long>(src.size),
+                      samplerate, converter);
+        return (fs::path(_dir) / name).string();
+}
+
+std::shared_ptr<jill::sample_t const[]>
+stimcache::find(digest const & src, nframes_t samplerate, char const * converter,
+                nframes_t & nframes) const
+{
+        const std::string path = entry_path(src, samplerate, converter);
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size <= 0
+            || st.st_size % sizeof(sample_t) != 0) {
+                ::close(fd);
+                return nullptr;
+        }
+        const std::size_t bytes = st.st_size;
+        int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+        // fault the whole entry in now, on a loading thread, rather than
+        // from the process callback the first time it plays
+        flags |= MAP_POPULATE;
+#endif
+        void * addr = ::mmap(nullptr, bytes, PROT_READ, flags, fd, 0);
+        ::close(fd);            // the mapping keeps its own reference
+        if (addr == MAP_FAILED) {
+                LOG << "unable to map cached stimulus " << path;
+                return nullptr;
+        }
+        /* Unlike the anonymous buffers elsewhere, these pages are backed by a
+         * file, so the kernel can drop them under memory pressure whether or
+         * not the host has swap, and the next read would be a disk access in
+         * the realtime thread. Lock them if the limits allow. If they do not,
+         * this is no worse than a stimulus that was read into the heap on a
+         * machine with swap, so it is said once and not treated as fatal. */
+        if (::mlock(addr, bytes) != 0) {
+                static std::atomic<bool> warned(false);
+                if (!warned.exchange(true)) {
+                        LOG << "WARNING: could not lock cached stimuli in memory;"
+                               " raise RLIMIT_MEMLOCK to keep them resident";
+                }
+        }
+        nframes = bytes / sizeof(sample_t);
+        return std::shared_ptr<sample_t const[]>(
+                static_cast<sample_t const *>(addr),
+                [bytes](sample_t const * p) {
+                        ::munmap(const_cast<sample_t *>(p), bytes);
+                });
+}
+
+bool
+stimcache::store(digest const & src, nframes_t samplerate, char const * converter,
+                 sample_t const * samples, nframes_t nframes) const
+{
+        static std::atomic<unsigned> counter(0);
+        const std::string path = entry_path(src, samplerate, converter);
+        const std::string tmp = path + ".tmp." + std::to_string(::getpid()) + "."
+                + std::to_string(counter++);
+        {
+                std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+                out.write(reinterpret_cast<char const *>(samples),
+                          std::streamsize(nframes) * sizeof(sample_t));
+                if (!out.flush()) {
+                        LOG << "unable to write stimulus cache entry " << tmp;
+                        std::error_code ec;
+                        fs::remove(tmp, ec);
+                        return false;
+                }
+        }
+        std::error_code ec;
+        fs::rename(tmp, path, ec);
+        if (ec) {
+                LOG << "unable to store stimulus cache entry " << path << ": " << ec.message();
+                fs::remove(tmp, ec);
+                return false;
+        }
+        return true;
+}
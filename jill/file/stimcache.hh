@@ -0,0 +1,105 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _STIMCACHE_HH
+#define _STIMCACHE_HH
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "../types.hh"
+
+namespace jill { namespace file {
+
+/**
+ * A directory of stimuli that have already been resampled, so that a restart
+ * does not have to do it again.
+ *
+ * Entries are content-addressed: the name is a hash of the bytes of the source
+ * file, its length, the target rate, and the converter that produced it. A
+ * stimulus that is renamed or moved is still found, and one that is edited in
+ * place is not, without having to trust modification times. Each entry is the
+ * samples alone, as native float32, so the length of the file is the number of
+ * frames and nothing has to be parsed to use it.
+ *
+ * Entries are mapped rather than read, so a restart costs a page table rather
+ * than a copy, and every process on the machine that maps the same entry
+ * shares one copy in the page cache. The cache is an optimization only: a
+ * failure to read or write it is logged and the caller falls back to
+ * resampling.
+ *
+ * Entries are written to a temporary name and renamed into place, so two
+ * processes filling the same cache at once can both write an entry and
+ * neither will ever map a partial one. Nothing is ever evicted; clear the
+ * directory by hand to reclaim the space.
+ */
+class stimcache {
+
+public:
+        /** The content hash of a source file, with its length in bytes */
+        struct digest {
+                std::uint64_t hash;
+                std::uint64_t size;
+        };
+
+        /**
+         * Open a cache directory, creating it if needed.
+         *
+         * @throws jill::FileError if the directory can't be created
+         */
+        explicit stimcache(std::string const & dir);
+
+        /** The directory holding the entries */
+        std::string const & path() const { return _dir; }
+
+        /**
+         * Hash the contents of a file.
+         *
+         * @throws jill::FileError if the file can't be read
+         */
+        static digest hash_file(std::string const & path);
+
+        /**
+         * Map the entry for a source and target rate, if there is one.
+         *
+         * @param src        the digest of the source file
+         * @param samplerate the rate the samples were converted to
+         * @param converter  names the conversion, so that entries from
+         *                   different resamplers or settings do not collide
+         * @param nframes    set to the number of samples in the entry: frames
+         *                   times channels, for a multichannel stimulus
+         *
+         * @return the samples, or null if there is no usable entry. The
+         * mapping is released when the last copy of the pointer goes.
+         */
+        std::shared_ptr<sample_t const[]> find(digest const & src, nframes_t samplerate,
+                                               char const * converter,
+                                               nframes_t & nframes) const;
+
+        /**
+         * Store an entry of @a nframes samples. Failures are logged, not
+         * thrown.
+         *
+         * @return true if the entry was written
+         */
+        bool store(digest const & src, nframes_t samplerate, char const * converter,
+                   sample_t const * samples, nframes_t nframes) const;
+
+private:
+        std::string entry_path(digest const & src, nframes_t samplerate,
+                               char const * converter) const;
+
+        std::string _dir;
+};
+
+}} // namespace jill::file
+
+#endif
@@ -18,13 +18,28 @@
 namespace fs = std::filesystem;
 using namespace jill::file;
 
-stimfile::stimfile(std::string const & path)
-        : _name(fs::path(path).stem().string()), _sndfile(nullptr)
+/* Names the conversion in cache entries. Change it if a resampler or its
+ * settings change, so that entries made the old way are not reused. The
+ * libsamplerate names carry on from when that was the only converter and best
+ * the only setting. polyphase2 has a stopband that starts at the Nyquist
+ * frequency, and more taps when decimating. */
+static std::string
+converter_name(jill::nframes_t from, jill::nframes_t to, jill::dsp::resample_quality q)
+{
+        const bool polyphase = jill::dsp::polyphase_resampler::supported(from, to);
+        return std::string(polyphase ? "polyphase2_" : "sinc_") + jill::dsp::to_string(q);
+}
+
+stimfile::stimfile(std::string const & path, std::shared_ptr<stimcache const> cache,
+                   dsp::resample_quality quality)
+        : _path(path), _name(fs::path(path).stem().string()), _cache(std::move(cache)),
+          _quality(quality), _sndfile(nullptr)
 {
         _sndfile = sf_open(path.c_str(), SFM_READ, &_sfinfo);
         if (!_sndfile) throw jill::FileError(sf_strerror(_sndfile));
-        if (_sfinfo.channels != 1) {
-                throw jill::FileError("input file contains more than one channel");
+        if (_sfinfo.channels < 1) {
+                sf_close(_sndfile);
+                throw jill::FileError("input file contains no channels");
         }
         _nframes = _sfinfo.frames;
         _samplerate = _sfinfo.samplerate;
@@ -47,37 +62,111 @@ stimfile::load_samples(nframes_t samplerate)
                 else if (samplerate == _samplerate) return;
         }
 
+        const bool resampling = (samplerate > 0)
+                && (samplerate != nframes_t(_sfinfo.samplerate));
+        if (resampling && load_cached(samplerate)) return;
+
+        const unsigned nchans = _sfinfo.channels;
         rs.input_frames = _sfinfo.frames;
         // owned from the start: the resampling buffer below, and the logging
         // either side of it, can both throw
-        std::unique_ptr<sample_t[]> samples(new sample_t[rs.input_frames]);
-        rs.data_in = samples.get();
+        std::unique_ptr<sample_t[]> samples(new sample_t[std::size_t(rs.input_frames) * nchans]);
 
         sf_seek(_sndfile, 0, SEEK_SET);
         // read file, ignoring any discrepancies in # of samples
-        _nframes = rs.input_frames = sf_read_float(_sndfile, samples.get(), rs.input_frames);
+        _nframes = rs.input_frames = sf_readf_float(_sndfile, samples.get(), rs.input_frames);
         _samplerate = _sfinfo.samplerate;
-        LOG << "read " << _nframes << " frames from " << _name << " at " << _samplerate << " Hz";
+        LOG << "read " << _nframes << " frames from " << _name << " at " << _samplerate << " Hz"
+            << ((nchans > 1) ? " (" + std::to_string(nchans) + " channels)" : std::string());
+        if (nchans > 1) {
+                // the file is interleaved; everything from here on is planar
+                std::unique_ptr<sample_t[]> planar(new sample_t[std::size_t(_nframes) * nchans]);
+                for (unsigned c = 0; c < nchans; ++c) {
+                        sample_t * dst = planar.get() + std::size_t(c) * _nframes;
+                        for (nframes_t i = 0; i < _nframes; ++i)
+                                dst[i] = samples[std::size_t(i) * nchans + c];
+                }
+                samples = std::move(planar);
+        }
 
         if ((samplerate > 0) && (samplerate != _samplerate)) {
                 rs.src_ratio = float(samplerate) / float(_samplerate);
                 rs.output_frames = (int)(rs.input_frames * rs.src_ratio);
-                std::unique_ptr<sample_t[]> resampled(new sample_t[rs.output_frames]);
-                rs.data_out = resampled.get();
+                std::unique_ptr<sample_t[]> resampled(
+                        new sample_t[std::size_t(rs.output_frames) * nchans]);
                 LOG << "resampling " << _name << " to " << samplerate
 		    << " Hz (" << rs.src_ratio << "x) -> "
                     << rs.output_frames << " frames";
 
-                int ec = src_simple(&rs, SRC_SINC_BEST_QUALITY, 1);
-                if (ec != 0) {
-                        throw std::runtime_error(src_strerror(ec));
+                /* One channel at a time, which is no slower than handing
+                 * libsamplerate the lot: its cost is per sample either way, and
+                 * the polyphase resampler only takes one channel. */
+                const bool polyphase = dsp::polyphase_resampler::supported(_samplerate, samplerate);
+                for (unsigned c = 0; c < nchans; ++c) {
+                        rs.data_in = samples.get() + std::size_t(c) * rs.input_frames;
+                        rs.data_out = resampled.get() + std::size_t(c) * rs.output_frames;
+                        if (polyphase) {
+                                dsp::polyphase_resampler(_samplerate, samplerate, _quality)
+                                        .process(rs.data_in, rs.input_frames,
+                                                 rs.data_out, rs.output_frames);
+                        }
+                        else {
+                                int ec = src_simple(&rs, dsp::src_converter(_quality), 1);
+                                if (ec != 0) {
+                                        throw std::runtime_error(src_strerror(ec));
+                                }
+                        }
                 }
 
                 _nframes = rs.output_frames;
                 _samplerate = samplerate;
                 samples = std::move(resampled);
+                if (_cache && _digest) {
+                        // an entry is all the channels, planar, as here
+                        _cache->store(*_digest, samplerate,
+                                      converter_name(_sfinfo.samplerate, samplerate,
+                                                     _quality).c_str(),
+                                      samples.get(), _nframes * nchans);
+                }
         }
 
         _buffer = std::move(samples);
 
 }
+
+void
+stimfile::unload_samples()
+{
+        _buffer.reset();
+        _nframes = _sfinfo.frames;
+        _samplerate = _sfinfo.samplerate;
+}
+
+bool
+stimfile::load_cached(nframes_t samplerate)
+{
+        if (!_cache) return false;
+        if (!_digest) {
+                try {
+                        _digest = std::make_unique<stimcache::digest>(stimcache::hash_file(_path));
+                }
+                catch (jill::FileError const & e) {
+                        // the file was open a moment ago, so this is odd, but
+                        // sndfile can still have a go at it
+                        LOG << "not caching " << _name << ": " << e.what();
+                        return false;
+                }
+        }
+        nframes_t nframes = 0;
+        auto cached = _cache->find(*_digest, samplerate,
+                                   converter_name(_sfinfo.samplerate, samplerate,
+                                                  _quality).c_str(),
+                                   nframes);
+        if (!cached) return false;
+        _buffer = std::move(cached);
+        _nframes = nframes / _sfinfo.channels;
+        _samplerate = samplerate;
+        LOG << "mapped " << _nframes << " frames of " << _name << " at "
+            << _samplerate << " Hz from " << _cache->path();
+        return true;
+}
@@ -15,13 +15,19 @@
 #include <memory>
 #include <sndfile.h>
 #include "../stimulus.hh"
+#include "stimcache.hh"
+#include "../dsp/resampler.hh"
 
 namespace jill { namespace file {
 
 /**
  * A stimulus stored on disk in a file. This implementation of stimulus_t uses
- * libsndfile to load the samples from disk, and libsamplerate to resample (if
- * needed). The loaded samples are stored in an array managed by the object.
+ * libsndfile to load the samples from disk, and resamples (if needed) with
+ * dsp::polyphase_resampler, or with libsamplerate for ratios that it can't
+ * handle. The loaded samples are stored in an array managed by the object,
+ * or, if a stimcache is supplied and already holds the resampled data, mapped
+ * from the cache. A file with several channels is stored planar, each channel
+ * resampled on its own.
  */
 class stimfile : public jill::stimulus_t {
 
@@ -30,10 +36,14 @@ public:
          * Initialize object with path of stimfile.
          *
          * @param path   the location of the stimulus file
+         * @param cache  if not null, where resampled data are looked up
+         *               before resampling and stored after
+         * @param quality  how carefully to resample
          *
          * @throws jill::FileError if the file doesn't exist
          */
-        stimfile(std::string const & path);
+        stimfile(std::string const & path, std::shared_ptr<stimcache const> cache = nullptr,
+                 dsp::resample_quality quality = dsp::resample_quality::best);
         ~stimfile() override;
 
         /* Owns an open sound file and the samples read from it. A copy would
@@ -45,6 +55,7 @@ public:
 
         nframes_t nframes() const override { return _nframes; }
         nframes_t samplerate() const override { return _samplerate; }
+        unsigned nchannels() const override { return _sfinfo.channels; }
 
         sample_t const * buffer() const override { return (_buffer) ? _buffer.get() : nullptr; }
 
@@ -55,15 +66,28 @@ public:
          */
         void load_samples(nframes_t samplerate=0) override;
 
+        /** Free the samples, or unmap them if they came from the cache */
+        void unload_samples() override;
+
 private:
+        /** look in the cache for samples at a rate, and use them if found */
+        bool load_cached(nframes_t samplerate);
+
+        std::string _path;
         std::string _name;
+        std::shared_ptr<stimcache const> _cache;
+        dsp::resample_quality _quality;
+        /** hash of the file, computed the first time the cache is consulted */
+        std::unique_ptr<stimcache::digest> _digest;
         SF_INFO _sfinfo;
         SNDFILE *_sndfile;
 
         nframes_t _nframes;
         nframes_t _samplerate;
 
-        std::unique_ptr<sample_t[]> _buffer;
+        /* shared rather than unique only because a cached buffer is a
+         * mapping with its own deleter; nothing else holds a reference */
+        std::shared_ptr<sample_t const[]> _buffer;
 };
 
 }} // namespace jill::file
@@ -0,0 +1,224 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <chrono>
+#include <filesystem>
+#include <stdexcept>
+#include <vector>
+
+#include "stimstream.hh"
+#include "../logging.hh"
+
+namespace fs = std::filesystem;
+using namespace jill::file;
+
+namespace {
+
+// frames read from the file per pass of the decoder
+const std::size_t decode_block = 4096;
+
+/* How long the decoder sleeps when the ring is full. The realtime thread
+ * cannot wake it, for the same reason it cannot wake readahead_stimqueue's
+ * worker, so it polls. The readahead has to cover this plus the time to decode
+ * a block, which at any sensible depth it does many times over. */
+const auto poll_interval = std::chrono::milliseconds(5);
+
+}
+
+stimstream::stimstream(std::string const & path, nframes_t readahead,
+                       dsp::resample_quality quality)
+        : _name(fs::path(path).stem().string()), _sndfile(nullptr), _src(nullptr),
+          _quality(quality),
+          _ratio(1.0), _configured(false),
+          _ring(readahead), _underruns(0), _primed(false),
+          _consumed(0), _skip(0), _pending(0), _running(false)
+{
+        _sndfile = sf_open(path.c_str(), SFM_READ, &_sfinfo);
+        if (!_sndfile) throw jill::FileError(sf_strerror(_sndfile));
+        if (_sfinfo.channels != 1) {
+                sf_close(_sndfile);
+                throw jill::FileError("only single-channel files can be streamed");
+        }
+        _nframes = _sfinfo.frames;
+        _samplerate = _sfinfo.samplerate;
+}
+
+stimstream::~stimstream()
+{
+        // the decoder uses both handles, so it has to be gone first
+        _thread.request_stop();
+        if (_thread.joinable()) _thread.join();
+        if (_src) src_delete(_src);
+        if (_sndfile) sf_close(_sndfile);
+}
+
+void
+stimstream::load_samples(nframes_t samplerate)
+{
+        if (samplerate == 0) samplerate = _sfinfo.samplerate;
+        if (!_configured) {
+                if (samplerate != nframes_t(_sfinfo.samplerate)) {
+                        int ec = 0;
+                        _src = src_new(dsp::src_converter(_quality), 1, &ec);
+                        if (!_src) throw std::runtime_error(src_strerror(ec));
+                        // as stimfile computes it, so the two agree on length
+                        _ratio = float(samplerate) / float(_sfinfo.samplerate);
+                        _nframes = (nframes_t)(_sfinfo.frames * _ratio);
+                        _samplerate = samplerate;
+                }
+                _configured = true;
+                LOG << "streaming " << _name << " at " << _samplerate << " Hz ("
+                    << _nframes << " frames, " << readahead() << " frames readahead)";
+        }
+        else if (samplerate != _samplerate) {
+                throw std::invalid_argument("stream " + _name + " is already playing at "
+                                            + std::to_string(_samplerate) + " Hz");
+        }
+
+        bool started = false;
+        {
+                std::lock_guard<std::mutex> lock(_lock);
+                ++_pending;
+                if (!_running) {
+                        // the old thread decided to exit under this lock, so
+                        // it is done with everything but returning
+                        if (_thread.joinable()) _thread.join();
+                        _primed.store(false);
+                        _running = true;
+                        _thread = std::jthread([this](std::stop_token st) { decoder(st); });
+                        started = true;
+                }
+        }
+        /* Only a fresh start waits. If the decoder was already running, this
+         * presentation follows one that is still being played, and it will be
+         * decoded as that one drains. */
+        if (started) {
+                while (!_primed.load()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+}
+
+jill::nframes_t
+stimstream::read(sample_t * const * dests, unsigned nchans, nframes_t offset, nframes_t n) JILL_RT
+{
+        sample_t * dest = dests[0];
+        if (offset == 0 && _consumed > 0) {
+                // a new presentation: drop what is left of the last one
+                _skip += _nframes - _consumed;
+                _consumed = 0;
+        }
+        else if (offset > _consumed) {
+                _skip += offset - _consumed;
+                _consumed = offset;
+        }
+        if (_skip > 0) _skip -= _ring.discard(_skip);
+
+        const std::size_t got = (_skip > 0) ? 0 : _ring.pop(dest, n);
+        if (got < n) {
+                std::fill(dest + got, dest + n, 0.0f);
+                // played as silence, so skipped when they do arrive
+                _skip += n - got;
+                _underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+        _consumed += n;
+        return n;
+}
+
+void
+stimstream::decoder(std::stop_token stop)
+{
+        while (!stop.stop_requested()) {
+                {
+                        std::lock_guard<std::mutex> lock(_lock);
+                        if (_pending == 0) {
+                                _running = false;
+                                break;
+                        }
+                }
+                if (!decode_one(stop)) break;
+                std::lock_guard<std::mutex> lock(_lock);
+                --_pending;
+        }
+        // never leave load_samples() waiting, whatever ended the loop
+        _primed.store(true);
+}
+
+/* Decodes one presentation into the ring, exactly _nframes long: the converter
+ * rarely produces precisely the length asked for, so the tail is trimmed or
+ * padded with silence. A read error ends the presentation early, padded the
+ * same way, so that the realtime side still sees the length it was promised. */
+bool
+stimstream::decode_one(std::stop_token const & stop)
+{
+        std::vector<sample_t> in(decode_block);
+        std::vector<sample_t> out(std::size_t(decode_block * _ratio) + 16);
+        std::size_t in_pos = 0, in_end = 0;
+        bool eof = false;
+        nframes_t written = 0;
+
+        sf_seek(_sndfile, 0, SEEK_SET);
+        if (_src) src_reset(_src);
+
+        while (written < _nframes) {
+                if (in_pos == in_end && !eof) {
+                        const sf_count_t n = sf_read_float(_sndfile, in.data(), in.size());
+                        in_pos = 0;
+                        in_end = (n > 0) ? n : 0;
+                        eof = in_end < in.size();
+                }
+                sample_t const * block;
+                std::size_t nblock;
+                if (_src) {
+                        SRC_DATA rs;
+                        rs.data_in = in.data() + in_pos;
+                        rs.input_frames = in_end - in_pos;
+                        rs.data_out = out.data();
+                        rs.output_frames = out.size();
+                        rs.end_of_input = eof;
+                        rs.src_ratio = _ratio;
+                        const int ec = src_process(_src, &rs);
+                        if (ec != 0) {
+                                LOG << "error resampling " << _name << ": " << src_strerror(ec);
+                                break;
+                        }
+                        in_pos += rs.input_frames_used;
+                        block = out.data();
+                        nblock = rs.output_frames_gen;
+                        if (nblock == 0 && eof) break;
+                }
+                else {
+                        block = in.data() + in_pos;
+                        nblock = in_end - in_pos;
+                        in_pos = in_end;
+                        if (nblock == 0 && eof) break;
+                }
+                nblock = std::min<std::size_t>(nblock, _nframes - written);
+                if (!push_all(block, nblock, stop)) return false;
+                written += nblock;
+        }
+        if (written < _nframes && !push_all(nullptr, _nframes - written, stop))
+                return false;
+        _primed.store(true);
+        return true;
+}
+
+bool
+stimstream::push_all(sample_t const * src, std::size_t n, std::stop_token const & stop)
+{
+        while (true) {
+                const std::size_t k = _ring.push(src, n);
+                n -= k;
+                if (src) src += k;
+                if (n == 0) return true;
+                // the ring is full, which means the readahead is
+                _primed.store(true);
+                if (stop.stop_requested()) return false;
+                std::this_thread::sleep_for(poll_interval);
+        }
+}
@@ -0,0 +1,147 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _STIMSTREAM_HH
+#define _STIMSTREAM_HH
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <stop_token>
+#include <sndfile.h>
+#include <samplerate.h>
+
+#include "../stimulus.hh"
+#include "../dsp/ringbuffer.hh"
+#include "../dsp/resampler.hh"
+
+namespace jill { namespace file {
+
+/**
+ * A stimulus played straight from disk. Where stimfile reads and resamples the
+ * whole file before it can be played, this decodes it a block at a time on a
+ * background thread, resampling with libsamplerate's incremental interface
+ * (the polyphase resampler stimfile prefers only works on a whole signal),
+ * and keeps a fixed amount of it queued in a ringbuffer for read() to take
+ * from. Memory is bounded by the readahead, however long the file, and
+ * playback can begin as soon as the first readahead is decoded.
+ *
+ * There is never a buffer(): the samples only exist in passing, so this has to
+ * be played with read().
+ *
+ * Only single-channel files can be streamed. A multichannel file has to be
+ * deinterleaved, and this would have to do that in read(), on the realtime
+ * thread, or keep a ring per channel; neither is worth it until someone needs
+ * to stream one.
+ *
+ * Presentations. Each call to load_samples() asks for one more presentation of
+ * the file, and the decoder writes them into the ring back to back, each
+ * exactly nframes() long. That is what lets a playlist repeat a stream: the
+ * queue loads the next trial while the current one is still playing, and if
+ * both are this object the second presentation is simply decoded behind the
+ * first. read() at offset 0 starts the next presentation; if the previous one
+ * was cut short, whatever was left of it is dropped first.
+ *
+ * Underruns. If the decoder falls behind, read() fills the shortfall with
+ * silence and counts it, and drops the same number of frames when they turn
+ * up, so a stall leaves a gap rather than delaying the rest of the stimulus.
+ *
+ * The decoder thread only runs while there are presentations to decode, so a
+ * playlist of many streams does not keep a thread per stimulus.
+ */
+class stimstream : public jill::stimulus_t {
+
+public:
+        /**
+         * Open a stimulus file for streaming.
+         *
+         * @param path       the location of the stimulus file
+         * @param readahead  how many frames to keep decoded ahead of playback,
+         *                   at the rate the stream is played at
+         * @param quality    selects the libsamplerate converter
+         *
+         * @throws jill::FileError if the file doesn't exist or is not mono
+         */
+        stimstream(std::string const & path, nframes_t readahead,
+                   dsp::resample_quality quality = dsp::resample_quality::best);
+        ~stimstream() override;
+
+        stimstream(stimstream const &) = delete;
+        stimstream & operator=(stimstream const &) = delete;
+
+        char const * name() const override { return _name.c_str(); }
+
+        nframes_t nframes() const override { return _nframes; }
+        nframes_t samplerate() const override { return _samplerate; }
+
+        /** Always null. Use read(). */
+        sample_t const * buffer() const override { return nullptr; }
+
+        /**
+         * Queue a presentation of the stimulus at @a samplerate. The first call
+         * fixes the rate and waits for the readahead to fill.
+         *
+         * @throws std::invalid_argument if a later call asks for another rate
+         */
+        void load_samples(nframes_t samplerate=0) override;
+
+        /**
+         * Take the next @a n frames of the current presentation. Fills with
+         * silence and counts an underrun if they have not been decoded yet.
+         * A stream is always one channel, so this writes only dest[0].
+         *
+         * @note realtime safe, and must only be called from one thread
+         */
+        nframes_t read(sample_t * const * dest, unsigned nchans,
+                       nframes_t offset, nframes_t n) JILL_RT override;
+
+        /** @return the number of reads that came up short */
+        std::size_t underruns() const { return _underruns.load(std::memory_order_relaxed); }
+
+        /** @return the capacity of the readahead buffer, in frames */
+        std::size_t readahead() const { return _ring.size(); }
+
+private:
+        void decoder(std::stop_token stop);
+        bool decode_one(std::stop_token const & stop);
+        bool push_all(sample_t const * src, std::size_t n, std::stop_token const & stop);
+
+        std::string _name;
+        SF_INFO _sfinfo;
+        SNDFILE *_sndfile;
+        SRC_STATE *_src;
+        dsp::resample_quality _quality;
+
+        nframes_t _nframes;
+        nframes_t _samplerate;
+        double _ratio;
+        bool _configured;
+
+        dsp::ringbuffer<sample_t> _ring;
+        std::atomic<std::size_t> _underruns;
+        std::atomic<bool> _primed;
+
+        // touched only by the thread calling read()
+        nframes_t _consumed;
+        std::size_t _skip;
+
+        // guards the hand-off between load_samples() and the decoder exiting
+        std::mutex _lock;
+        unsigned _pending;
+        bool _running;
+
+        // last, so it is stopped and joined before anything it touches goes
+        std::jthread _thread;
+};
+
+}} // namespace jill::file
+
+#endif
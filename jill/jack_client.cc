@@ -12,34 +12,147 @@
 #include "jack_client.hh"
 #include "logging.hh"
 #include "util/string.hh"
+#include "net/zmq.hh"
 #include <jack/statistics.h>
 #include <jack/midiport.h>
+#include <atomic>
 #include <cerrno>
+#include <cstdio>
 #include <algorithm>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <sstream>
 
 using namespace jill;
 using std::string;
 
+namespace {
+
+// milliseconds; zero for none
+std::atomic<long> default_stats_interval(0);
+
+/* @a text as the inside of a JSON string. JACK allows quotes, backslashes
+ * and control characters in a client name. */
+string
+json_escape(string const & text)
+{
+        std::ostringstream o;
+        for (char c : text) {
+                if (c == '"' || c == '\\') {
+                        o << '\\' << c;
+                }
+                else if (static_cast<unsigned char>(c) < 0x20) {
+                        char buf[8];
+                        std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                        o << buf;
+                }
+                else {
+                        o << c;
+                }
+        }
+        return o.str();
+}
+
+/* One line of JSON, so that a monitor in any language can read it without a
+ * schema. Totals are since the client started, so a monitor that wants rates
+ * differences successive messages; window_max_us is the one figure that is
+ * per message. */
+string
+format_stats(string const & client, util::process_stats::snapshot const & s)
+{
+        std::ostringstream o;
+        o << "{\"client\":\"" << json_escape(client) << "\""
+          << ",\"periods\":" << s.periods
+          << ",\"misses\":" << s.misses
+          << ",\"period_us\":" << s.period_usec
+          << ",\"mean_us\":" << (s.periods ? s.total_usec / s.periods : 0)
+          << ",\"max_us\":" << s.max_usec
+          << ",\"window_max_us\":" << s.window_max_usec
+          << ",\"histogram\":[";
+        for (std::size_t i = 0; i < s.histogram.size(); ++i)
+                o << (i ? "," : "") << s.histogram[i];
+        o << "]}";
+        return o.str();
+}
+
+}
+
 jack_client::jack_client(string const & name)
-        : _nports(0)
+        : _nports(0), _server_name("default")
 {
         start_client(name.c_str(), nullptr);
         set_callbacks();
+        if (const long ms = default_stats_interval.load())
+                publish_stats(std::chrono::milliseconds(ms));
 }
 
 jack_client::jack_client(string const & name, string const & server)
-        : _nports(0)
+        : _nports(0), _server_name(server.empty() ? "default" : server)
 {
         if (!server.empty())
                 start_client(name.c_str(), server.c_str());
         else
                 start_client(name.c_str(), nullptr);
         set_callbacks();
+        if (const long ms = default_stats_interval.load())
+                publish_stats(std::chrono::milliseconds(ms));
+}
+
+void
+jack_client::set_default_stats_interval(std::chrono::milliseconds interval)
+{
+        default_stats_interval.store(interval.count());
+}
 
+void
+jack_client::publish_stats(std::chrono::milliseconds interval)
+{
+        if (_stats) return;
+        std::filesystem::path path("/tmp/org.meliza.jill");
+        path /= _server_name;
+        path /= name();
+        std::filesystem::create_directories(path);
+        path /= "stats";
+        _stats = std::make_unique<util::process_stats>();
+        // a copy, so that the thread never asks JACK for it
+        _stats_thread = std::jthread([this, client = string(name()),
+                                      endpoint = "ipc://" + path.string(), interval]
+                                     (std::stop_token st) {
+                stats_publisher(st, client, endpoint, interval);
+        });
+}
+
+void
+jack_client::stats_publisher(std::stop_token stop, string client, string endpoint,
+                             std::chrono::milliseconds interval)
+{
+        void * socket = net::zmq::context::socket(ZMQ_PUB);
+        if (net::zmq::bind(socket, endpoint) < 0) {
+                LOG << "unable to bind to endpoint " << endpoint;
+                net::zmq::close(socket);
+                return;
+        }
+        INFO << "publishing process statistics at " << endpoint;
+        // only here to sleep on, so that a stop does not wait out the interval
+        std::mutex lock;
+        std::condition_variable_any wake;
+        std::unique_lock<std::mutex> guard(lock);
+        while (!wake.wait_for(guard, stop, interval, [] { return false; }) &&
+               !stop.stop_requested()) {
+                net::zmq::send(socket, format_stats(client, _stats->take()));
+        }
+        net::zmq::close(socket);
 }
 
 jack_client::~jack_client()
 {
+        /* The publisher reads _stats, and members are destroyed only after
+         * this body has closed the client; stop it first */
+        if (_stats_thread.joinable()) {
+                _stats_thread.request_stop();
+                _stats_thread.join();
+        }
         if (_client) {
                 jack_client_close(_client);
         }
@@ -225,7 +338,19 @@ jack_client::process_callback_(nframes_t nframes, void *arg)
 {
         auto * self = static_cast<jack_client*>(arg);
         nframes_t time = jack_last_frame_time(self->_client);
-        return (self->_process_cb) ? self->_process_cb(self, nframes, time) : 0;
+        if (!self->_process_cb) return 0;
+        if (!self->_stats) return self->_process_cb(self, nframes, time);
+        /* Two reads of JACK's microsecond clock, which is what it uses for its
+         * own cycle timing and costs a vDSO call, and a handful of relaxed
+         * atomics. Cheap enough to leave on, but not free, hence optional. */
+        const jack_time_t start = jack_get_time();
+        const int ret = self->_process_cb(self, nframes, time);
+        const jack_time_t took = jack_get_time() - start;
+        const jack_nframes_t rate = jack_get_sample_rate(self->_client);
+        if (rate > 0)
+                self->_stats->record(std::uint32_t(std::min<jack_time_t>(took, UINT32_MAX)),
+                                     std::uint32_t(std::uint64_t(nframes) * 1000000 / rate));
+        return ret;
 }
 
 void
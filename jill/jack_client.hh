@@ -14,9 +14,13 @@
 
 #include <string>
 #include <list>
+#include <chrono>
 #include <functional>
+#include <memory>
+#include <thread>
 #include <jack/jack.h>
 #include "data_source.hh"
+#include "util/process_stats.hh"
 // every module's process callback needs JILL_RT, and every module includes this
 #include "rt.hh"
 
@@ -46,6 +50,11 @@ namespace jill {
  * through the `activated_client` friend class. This ensures that client
  * callbacks that depend on objects initialized after the client aren't called
  * during teardown.
+ *
+ * The client can also time its process callback and publish the figures (see
+ * util::process_stats and publish_stats()). Every client made after
+ * set_default_stats_interval() has been given a nonzero interval does so, which
+ * is how the --stats-interval option common to all the modules works.
  */
 class jack_client : public data_source {
 
@@ -158,6 +167,25 @@ public:
         void set_shutdown_callback(ShutdownCallback const & cb);
         void set_latency_callback(LatencyCallback const & cb);
 
+        /**
+         * Time every process callback from now on, and publish the figures
+         * every @a interval on a PUB socket bound to
+         * ipc:///tmp/org.meliza.jill/SERVER/CLIENT/stats. See the statistics
+         * section of doc/specification.org for the message. Call before the
+         * client is activated; a second call does nothing.
+         */
+        void publish_stats(std::chrono::milliseconds interval);
+
+        /** The callback timings, or null if publish_stats() was not called */
+        util::process_stats * stats() { return _stats.get(); }
+
+        /**
+         * The interval every client constructed from now on publishes its
+         * statistics at, or zero, the default, for none. Set by
+         * program_options from --stats-interval.
+         */
+        static void set_default_stats_interval(std::chrono::milliseconds interval);
+
         /** Get sample buffer for port */
         sample_t * samples(std::string const & name, nframes_t nframes);
         sample_t * samples(jack_port_t *port, nframes_t nframes);
@@ -208,6 +236,7 @@ private:
         void deactivate();
 
         jack_client_t * _client; // pointer to jack client
+        std::string _server_name; // as given, for the stats endpoint
 
         ProcessCallback _process_cb;
         PortRegisterCallback _portreg_cb;
@@ -218,6 +247,14 @@ private:
         ShutdownCallback _shutdown_cb;
         LatencyCallback _latency_cb;
 
+        /* Set before activation and not changed after, so the realtime thread
+         * can test it without synchronization. The publisher reads it, so it
+         * is declared first and outlives the thread. */
+        std::unique_ptr<util::process_stats> _stats;
+        std::jthread _stats_thread;
+        void stats_publisher(std::stop_token stop, std::string client, std::string endpoint,
+                             std::chrono::milliseconds interval);
+
         void start_client(char const * name, char const * server_name=nullptr);
         void set_callbacks();
 
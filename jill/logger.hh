@@ -13,9 +13,31 @@
 #define _LOGGER_HH
 
 #include <mutex>
+#include <string>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 namespace jill {
 
+/* as in logging.hh, which is not included here because its LOG and INFO
+ * macros collide with doctest's in the suites that use these */
+using timestamp_t = boost::posix_time::ptime;
+
+/**
+ * The timestamp frame of a log message as logger sends it: microseconds since
+ * the Unix epoch, as eight bytes little-endian. See the logging section of
+ * doc/specification.org.
+ */
+std::string encode_log_time(timestamp_t const & utc);
+
+/**
+ * Parse the timestamp frame of a log message, in either form the specification
+ * allows: eight binary bytes as encode_log_time() makes them, or an ISO 8601
+ * string as other programs and older versions of this one send.
+ *
+ * @throws std::exception if it is neither
+ */
+timestamp_t decode_log_time(std::string const & frame);
+
 /**
  * Logs messages to console and optionally to an external logger. This is used by
  * the log_msg class to actually write the log messages. Users generally don't
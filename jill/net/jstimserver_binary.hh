@@ -0,0 +1,312 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+#ifndef _JSTIMSERVER_BINARY_HH
+#define _JSTIMSERVER_BINARY_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../types.hh"
+
+namespace jill { namespace net { namespace stimserver {
+
+/**
+ * @file jstimserver_binary.hh
+ *
+ * The binary framing of the jstimserver control protocol (see
+ * doc/jstimserver-protocol.md, section 8), for clients that send requests
+ * faster than it is sensible to format and parse them as text.
+ *
+ * A message is a batch: a four-byte header and then a run of fixed-size
+ * records, all the same kind. Requests, replies and events each have their own
+ * record. Stimuli are named by their index in the STIMLIST array rather than by
+ * name, and frames are 32-bit counts as everywhere else. Everything is
+ * little-endian, and is packed and unpacked a byte at a time rather than by
+ * casting a struct, so that neither padding nor the host's byte order leaks
+ * onto the wire.
+ *
+ * Header:
+ *
+ *     byte 0     0x00, which no text request or event starts with
+ *     byte 1     the kind of record: 'Q' request, 'R' reply, 'E' event,
+ *                'T' timed event
+ *     bytes 2-3  the number of records
+ *
+ * A record may grow in a later version of the protocol, by fields added at its
+ * end, so the size of the records in a batch is taken from its length and
+ * count, and anything past the fields known here is skipped. A 1.6 reader
+ * may not do that, since 1.6 required records of exactly the sizes given
+ * here; so the event timestamp added in 1.7 is not appended to the event
+ * record, but carried by a kind of its own on an endpoint of its own.
+ */
+
+/** first byte of every binary message */
+constexpr std::uint8_t magic = 0x00;
+constexpr std::size_t header_size = 4;
+/** the most records one message can carry */
+constexpr std::size_t max_records = 0xffff;
+/** the stimulus index of a record that has no stimulus */
+constexpr std::uint32_t no_stimulus = 0xffffffff;
+
+enum kind : std::uint8_t { Requests = 'Q', Replies = 'R', Events = 'E', TimedEvents = 'T' };
+
+/** what a request asks for. Values are on the wire; never renumber. */
+enum class op : std::uint8_t {
+        Play = 1,
+        PlayAt = 2,             // frame is the JACK frame to start at
+        PlayAfter = 3,          // frame is the delay after the next trigger
+        Enqueue = 4,
+        Clear = 5,              // stimulus ignored
+        Interrupt = 6,          // stimulus ignored
+        Preload = 7,
+};
+
+/** the answer to a request, as the text replies of the same names */
+enum class status : std::uint8_t {
+        Ok = 0,
+        BadCmd = 1,
+        BadStim = 2,
+        Busy = 3,
+        Loading = 4,
+};
+
+/** what an event reports, as the text events of the same names */
+enum class event_type : std::uint8_t {
+        Playing = 1,
+        Interrupted = 2,
+        Done = 3,
+        Xrun = 4,
+        Busy = 5,
+        NotPlaying = 6,
+        Late = 7,
+        Cancelled = 8,
+        Starting = 9,
+        Stopping = 10,
+};
+
+/** 12 bytes: op, three reserved, stimulus, frame */
+struct request {
+        op what;
+        std::uint32_t stim;
+        nframes_t frame;
+        static constexpr std::size_t size = 12;
+};
+
+/** 8 bytes: the op answered, status, two reserved, stimulus. The op and the
+ * stimulus are copied from the request, so that a client can match the two up
+ * without counting. */
+struct reply {
+        op what;
+        status result;
+        std::uint32_t stim;
+        static constexpr std::size_t size = 8;
+};
+
+/** 12 bytes: type, three reserved, stimulus, frame. In a batch of
+ * TimedEvents, 20 bytes, with the microseconds after the frame; those were
+ * added in protocol 1.7. */
+struct event {
+        event_type type;
+        std::uint32_t stim;
+        nframes_t frame;
+        /** the frame on JACK's microsecond clock, jack_get_time(). Not sent
+         * in a batch of Events, and 0 when read from one */
+        utime_t usec;
+        static constexpr std::size_t size = 12;
+        static constexpr std::size_t timed_size = 20;
+};
+
+namespace detail {
+
+inline void
+put_u16(std::string & out, std::uint16_t v)
+{
+        out.push_back(char(v & 0xff));
+        out.push_back(char(v >> 8));
+}
+
+inline void
+put_u32(std::string & out, std::uint32_t v)
+{
+        for (int i = 0; i < 32; i += 8)
+                out.push_back(char((v >> i) & 0xff));
+}
+
+inline void
+put_u64(std::string & out, std::uint64_t v)
+{
+        for (int i = 0; i < 64; i += 8)
+                out.push_back(char((v >> i) & 0xff));
+}
+
+inline std::uint32_t
+get_u32(char const * p)
+{
+        std::uint32_t v = 0;
+        for (int i = 0; i < 4; ++i)
+                v |= std::uint32_t(std::uint8_t(p[i])) << (8 * i);
+        return v;
+}
+
+inline std::uint64_t
+get_u64(char const * p)
+{
+        return get_u32(p) | (std::uint64_t(get_u32(p + 4)) << 32);
+}
+
+inline std::size_t
+record_size(kind k)
+{
+        switch (k) {
+        case Replies: return reply::size;
+        case Events: return event::size;
+        case TimedEvents: return event::timed_size;
+        default: return request::size;
+        }
+}
+
+} // namespace detail
+
+/** true if @a msg is in the binary framing rather than text */
+inline bool
+is_binary(std::string const & msg)
+{
+        return !msg.empty() && std::uint8_t(msg[0]) == magic;
+}
+
+/**
+ * Start a batch of @a k, reserving room for @a n records. The count is filled
+ * in by finish().
+ */
+inline void
+begin(std::string & out, kind k, std::size_t n = 0)
+{
+        out.clear();
+        out.reserve(header_size + n * detail::record_size(k));
+        out.push_back(char(magic));
+        out.push_back(char(k));
+        detail::put_u16(out, 0);
+}
+
+inline void
+append(std::string & out, request const & r)
+{
+        out.push_back(char(r.what));
+        out.append(3, '\0');
+        detail::put_u32(out, r.stim);
+        detail::put_u32(out, r.frame);
+}
+
+inline void
+append(std::string & out, reply const & r)
+{
+        out.push_back(char(r.what));
+        out.push_back(char(r.result));
+        out.append(2, '\0');
+        detail::put_u32(out, r.stim);
+}
+
+/** Append an event to a batch of Events or TimedEvents, as begin() was told */
+inline void
+append(std::string & out, event const & e)
+{
+        out.push_back(char(e.type));
+        out.append(3, '\0');
+        detail::put_u32(out, e.stim);
+        detail::put_u32(out, e.frame);
+        if (out[1] == char(TimedEvents))
+                detail::put_u64(out, e.usec);
+}
+
+/** Write the record count into the header of a batch built with begin() */
+inline void
+finish(std::string & out)
+{
+        const std::size_t n = (out.size() - header_size) / detail::record_size(kind(out[1]));
+        out[2] = char(n & 0xff);
+        out[3] = char(n >> 8);
+}
+
+namespace detail {
+
+/* Checks the header and length of a batch of @a k, and calls @a decode with
+ * each record in turn. Records may be longer than record_size(k), but not
+ * shorter. */
+template <typename T, typename F>
+bool
+parse_batch(std::string const & msg, kind k, std::vector<T> & out, F && decode)
+{
+        out.clear();
+        if (msg.size() < header_size || !is_binary(msg) || msg[1] != char(k))
+                return false;
+        const std::size_t n = std::uint8_t(msg[2]) | (std::size_t(std::uint8_t(msg[3])) << 8);
+        const std::size_t body = msg.size() - header_size;
+        if (n == 0)
+                return body == 0;
+        const std::size_t stride = body / n;
+        if (stride < record_size(k) || stride * n != body)
+                return false;
+        out.reserve(n);
+        char const * p = msg.data() + header_size;
+        for (std::size_t i = 0; i < n; ++i, p += stride)
+                out.push_back(decode(p));
+        return true;
+}
+
+} // namespace detail
+
+/**
+ * Unpack a batch of requests into @a out, replacing what was there.
+ *
+ * @return false if @a msg is not a well-formed request batch: the wrong magic
+ * or kind, or a length that is not a whole number of records, each at least
+ * as long as a request. Ops are not checked
+ * here, since an unknown op is answered BadCmd in its place in the batch
+ * rather than spoiling the rest.
+ */
+inline bool
+parse(std::string const & msg, std::vector<request> & out)
+{
+        return detail::parse_batch(msg, Requests, out, [](char const * p) {
+                return request{op(p[0]), detail::get_u32(p + 4), detail::get_u32(p + 8)};
+        });
+}
+
+/** Unpack a batch of replies. @return false if it is not one. */
+inline bool
+parse(std::string const & msg, std::vector<reply> & out)
+{
+        return detail::parse_batch(msg, Replies, out, [](char const * p) {
+                return reply{op(p[0]), status(p[1]), detail::get_u32(p + 4)};
+        });
+}
+
+/** Unpack a batch of Events or TimedEvents. @return false if it is neither. */
+inline bool
+parse(std::string const & msg, std::vector<event> & out)
+{
+        if (msg.size() > 1 && msg[1] == char(TimedEvents)) {
+                return detail::parse_batch(msg, TimedEvents, out, [](char const * p) {
+                        return event{event_type(p[0]), detail::get_u32(p + 4),
+                                     detail::get_u32(p + 8), detail::get_u64(p + 12)};
+                });
+        }
+        return detail::parse_batch(msg, Events, out, [](char const * p) {
+                return event{event_type(p[0]), detail::get_u32(p + 4), detail::get_u32(p + 8), 0};
+        });
+}
+
+}}} // namespace jill::net::stimserver
+
+#endif
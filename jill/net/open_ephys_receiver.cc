@@ -46,7 +46,7 @@ open_ephys_receiver::write(data_block_t const * block, nframes_t, nframes_t)
 {
 	// decode events
         if (block->sz_data == 0) return;
-	if (block->dtype == SAMPLED) return;
+	if (block->dtype != EVENT) return;
 	auto * buffer = block->data<char>();
 	auto status = midi::status_type(buffer[0]);
 	std::ostringstream message;
@@ -15,6 +15,7 @@
 
 #include "logging.hh"
 #include "logger.hh"
+#include "jack_client.hh"
 #include "program_options.hh"
 
 using namespace jill;
@@ -32,7 +33,9 @@ program_options::program_options(std::string program_name, bool remote_log_defau
                 ("no-remote-log,L",
                  po::bool_switch()->default_value(!remote_log_default),
                  "disable logging to jrecord (will still log to console)")
-                ("config,C",  po::value<string>(), "load options from a ini file (overruled by command-line)");
+                ("config,C",  po::value<string>(), "load options from a ini file (overruled by command-line)")
+                ("stats-interval", po::value<unsigned>()->default_value(0),
+                 "publish process callback timings every N ms (0 to disable)");
         cmd_opts.add(generic);
         visible_opts.add(generic);
 }
@@ -107,6 +110,9 @@ program_options::parse(int argc, char **argv)
         }
 
         po::notify(vmap);
+        // before process_options(), and so before any module makes its client
+        jack_client::set_default_stats_interval(
+                std::chrono::milliseconds(get<unsigned>("stats-interval", 0)));
         process_options();
 }
 
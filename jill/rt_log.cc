@@ -0,0 +1,174 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "rt_log.hh"
+#include "logging.hh"
+#include "logger.hh"
+
+namespace jill { namespace detail {
+
+/*
+ * The thread that formats every rt_log's records, and the list of rt_logs it
+ * reads. The list is only touched when an rt_log is made or destroyed and when
+ * the rings are drained, never from the realtime thread, so a mutex is fine.
+ *
+ * The thread starts with the first rt_log and runs until the program exits. It
+ * is a function-local static, and reaches logger::instance() before it is
+ * constructed, so the logger is destroyed after it and can take its last lines.
+ */
+class rt_log_drain {
+
+public:
+        static rt_log_drain & instance() {
+                static rt_log_drain _instance;
+                return _instance;
+        }
+
+        util::doorbell * add(rt_log * log) {
+                std::lock_guard<std::mutex> lock(_lock);
+                _logs.push_back(log);
+                if (!_thread.joinable())
+                        _thread = std::jthread([this](std::stop_token st) { run(st); });
+                return &_bell;
+        }
+
+        void remove(rt_log * log) {
+                std::lock_guard<std::mutex> lock(_lock);
+                _logs.erase(std::remove(_logs.begin(), _logs.end(), log), _logs.end());
+        }
+
+        void flush() {
+                std::lock_guard<std::mutex> lock(_lock);
+                for (rt_log * log : _logs) log->drain();
+        }
+
+private:
+        rt_log_drain() { logger::instance(); }
+
+        ~rt_log_drain() {
+                _thread.request_stop();
+                if (_thread.joinable()) _thread.join();
+        }
+
+        bool idle() {
+                std::lock_guard<std::mutex> lock(_lock);
+                return std::all_of(_logs.begin(), _logs.end(),
+                                   [](rt_log const * log) { return log->pending() == 0; });
+        }
+
+        /* The timeout is only there for drop reports: a full ring does not
+         * ring the bell, so the count of what it lost would otherwise wait for
+         * the next record that fits. */
+        void run(std::stop_token stop) {
+                std::stop_callback wake(stop, [this] { _bell.ring(); });
+                while (!stop.stop_requested()) {
+                        _bell.arm();
+                        if (idle() && !stop.stop_requested())
+                                _bell.wait(std::chrono::seconds(1));
+                        else
+                                _bell.disarm();
+                        flush();
+                }
+        }
+
+        std::mutex _lock;
+        std::vector<rt_log *> _logs;
+        util::doorbell _bell;
+        std::jthread _thread;           // last, so it stops before the rest go
+};
+
+}} // namespace jill::detail
+
+using namespace jill;
+
+namespace {
+
+void
+put(std::ostream & o, rt_log::arg const & a)
+{
+        switch (a.kind) {
+        case rt_log::arg::Signed:
+                o << a.i;
+                break;
+        case rt_log::arg::Unsigned:
+                o << a.u;
+                break;
+        case rt_log::arg::Float:
+                o << a.d;
+                break;
+        case rt_log::arg::String:
+                o << (a.s ? a.s : "(null)");
+                break;
+        }
+}
+
+}
+
+rt_log::rt_log(std::size_t capacity)
+        : _ring(capacity), _dropped(0), _reported(0),
+          _bell(detail::rt_log_drain::instance().add(this))
+{}
+
+rt_log::~rt_log()
+{
+        detail::rt_log_drain::instance().remove(this);
+        // off the list, so nothing else reads the ring now
+        drain();
+}
+
+void
+rt_log::flush()
+{
+        detail::rt_log_drain::instance().flush();
+}
+
+std::string
+rt_log::format(record const & r)
+{
+        std::ostringstream o;
+        std::size_t next = 0;
+        for (char const * p = r.format; *p; ++p) {
+                if (p[0] == '{' && p[1] == '}') {
+                        // one too many placeholders is left as written
+                        if (next < r.nargs) put(o, r.args[next++]);
+                        else o << "{}";
+                        ++p;
+                }
+                else if (std::strncmp(p, "{frame}", 7) == 0) {
+                        o << r.frame;
+                        p += 6;
+                }
+                else {
+                        o << *p;
+                }
+        }
+        return o.str();
+}
+
+void
+rt_log::drain()
+{
+        record r;
+        while (_ring.pop(&r, 1) > 0)
+                log_msg() << format(r);
+        const std::size_t dropped = _dropped.load(std::memory_order_relaxed);
+        if (dropped != _reported) {
+                LOG << "WARNING: realtime log full; " << dropped - _reported << " lines lost";
+                _reported = dropped;
+        }
+}
@@ -0,0 +1,173 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+#ifndef _RT_LOG_HH
+#define _RT_LOG_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+#include "rt.hh"
+#include "types.hh"
+#include "dsp/ringbuffer.hh"
+#include "util/doorbell.hh"
+
+namespace jill {
+
+namespace detail { class rt_log_drain; }
+
+/**
+ * Logging from the realtime thread.
+ *
+ * log_msg formats into an ostringstream and logger::log takes a mutex, writes
+ * to stdout and sends on a socket, none of which a process callback may do. So
+ * each module that wanted to report something from process() grew its own
+ * ringbuffer of a struct made for the purpose, and a loop somewhere in main()
+ * that popped and formatted it. This is that pattern, written once.
+ *
+ * An rt_log is one producer's queue: a preallocated ring of fixed-size binary
+ * records, each holding a format string, the frame it concerns, and up to
+ * max_args numbers or strings. Logging copies those in and rings a doorbell;
+ * it does not format, allocate or lock. A single background thread, shared by
+ * every rt_log in the process, drains the rings, formats the records and hands
+ * the lines to log_msg, so they come out with everything else the program logs.
+ *
+ *     jill::rt_log rtlog(128);
+ *     ...
+ *     rtlog(time + offset, "signal on: frames={frame}, us={}", client->time(time + offset));
+ *
+ * In the format, each "{}" takes the next argument and "{frame}" the frame.
+ * The format and any string arguments are stored as pointers and read later,
+ * on the other thread, so they have to outlive the rt_log: string literals, or
+ * names owned by something that stays put, like a stimulus in a stimset.
+ *
+ * One rt_log per producing thread, since each ring has one writer. A full ring
+ * drops the record and counts it, and the drop is reported once there is room.
+ * The timestamp on the line is when it was formatted, which can be a scheduling
+ * delay after the frame; if the time matters, log the frame or client->time().
+ */
+class rt_log {
+
+public:
+        static constexpr std::size_t max_args = 4;
+
+        struct arg {
+                enum kind_type : std::uint8_t { Signed, Unsigned, Float, String } kind;
+                union {
+                        std::int64_t i;
+                        std::uint64_t u;
+                        double d;
+                        char const * s;
+                };
+        };
+
+        /** what goes in the ring. Trivial, as dsp::ringbuffer requires */
+        struct record {
+                char const * format;
+                nframes_t frame;
+                std::uint8_t nargs;
+                arg args[max_args];
+        };
+
+        /** @param capacity  records the ring holds, rounded up as ringbuffer does */
+        explicit rt_log(std::size_t capacity = 256);
+        /** Stops accepting records and formats whatever is left */
+        ~rt_log();
+
+        /* Registered with the drain thread by address */
+        rt_log(rt_log const &) = delete;
+        rt_log & operator=(rt_log const &) = delete;
+
+        /**
+         * Queue a line for the background thread to format.
+         *
+         * @return false if the ring was full and the line was dropped
+         */
+        template <typename... Args>
+        bool operator()(nframes_t frame, char const * fmt, Args... args) JILL_RT {
+                static_assert(sizeof...(Args) <= max_args, "too many arguments for rt_log");
+                record r;
+                r.format = fmt;
+                r.frame = frame;
+                r.nargs = sizeof...(Args);
+                [[maybe_unused]] std::size_t i = 0;
+                ((r.args[i++] = make_arg(args)), ...);
+                if (_ring.push(r) == 0) {
+                        _dropped.fetch_add(1, std::memory_order_relaxed);
+                        return false;
+                }
+                _bell->ring();
+                return true;
+        }
+
+        /** records dropped because the ring was full, since construction */
+        std::size_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+        /** records waiting to be formatted */
+        std::size_t pending() const { return _ring.read_space(); }
+
+        /**
+         * Format everything queued in every rt_log now, on the calling thread,
+         * rather than waiting for the background thread. For the end of a
+         * run, where the last lines should come out before the program does.
+         */
+        static void flush();
+
+        /** The line a record becomes */
+        static std::string format(record const & r);
+
+private:
+        friend class detail::rt_log_drain;
+
+        template <typename T>
+        static arg make_arg(T v) noexcept {
+                arg a;
+                if constexpr (std::is_enum_v<T>) {
+                        a = make_arg(static_cast<std::underlying_type_t<T>>(v));
+                }
+                else if constexpr (std::is_same_v<T, bool> || std::is_unsigned_v<T>) {
+                        a.kind = arg::Unsigned;
+                        a.u = v;
+                }
+                else if constexpr (std::is_integral_v<T>) {
+                        a.kind = arg::Signed;
+                        a.i = v;
+                }
+                else if constexpr (std::is_floating_point_v<T>) {
+                        a.kind = arg::Float;
+                        a.d = v;
+                }
+                else {
+                        static_assert(std::is_convertible_v<T, char const *>,
+                                      "rt_log takes numbers, enums and C strings");
+                        a.kind = arg::String;
+                        a.s = v;
+                }
+                return a;
+        }
+
+        /* Formats and logs what is in the ring. Only the drain thread and
+         * flush() call this, under the registry lock, so the ring has one
+         * reader at a time. */
+        void drain();
+
+        dsp::ringbuffer<record> _ring;
+        std::atomic<std::size_t> _dropped;
+        std::size_t _reported;          // drops already logged
+        util::doorbell * _bell;         // the drain thread's; outlives this
+};
+
+} // namespace jill
+
+#endif
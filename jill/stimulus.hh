@@ -11,7 +11,9 @@
 #ifndef _STIMULUS_HH
 #define _STIMULUS_HH
 
+#include <algorithm>
 #include "types.hh"
+#include "rt.hh"
 
 namespace jill {
 
@@ -21,6 +23,11 @@ namespace jill {
  * accessible in a contiguous array, and may have to be generated or loaded from
  * disk.
  *
+ * A stimulus may have several channels, one per speaker. They are stored
+ * planar -- all of channel 0, then all of channel 1, and so on -- rather than
+ * interleaved as in the file, because the realtime thread copies each channel
+ * to its own JACK port, and a port buffer is a plain run of samples. Planar,
+ * every channel is a single contiguous copy.
  */
 class stimulus_t {
 public:
@@ -44,15 +51,47 @@ public:
         /** The sampling rate of the stimulus */
         virtual nframes_t samplerate() const = 0;
 
+        /** The number of channels in the stimulus */
+        virtual unsigned nchannels() const { return 1; }
+
         /** The duration of the stimulus */
         virtual float duration() const { return float(nframes()) / samplerate(); }
 
         /**
-         * The buffer for the stimulus. May be 0 if not loaded. If not 0, the
-         * length of the array will be equal to nframes()
+         * The buffer for the stimulus. May be 0 if not loaded. If not 0, it
+         * holds nchannels() channels of nframes() samples each, one after
+         * the other.
          */
         virtual sample_t const * buffer() const = 0;
 
+        /** The samples of channel @a c, or 0 if not loaded */
+        sample_t const * channel(unsigned c) const {
+                sample_t const * buf = buffer();
+                return (buf) ? buf + std::size_t(c) * nframes() : nullptr;
+        }
+
+        /**
+         * Copy @a n frames, starting @a offset frames into the stimulus, to
+         * @a dest, which holds a buffer for each of @a nchans channels. This
+         * is how the realtime thread plays a stimulus. Channels the stimulus
+         * does not have are left alone, and channels it has beyond @a nchans
+         * are not played. The default copies out of buffer(), which must be
+         * loaded; a stimulus that never holds all its samples at once
+         * overrides it.
+         *
+         * Calls for one presentation come in order of offset, starting at
+         * zero, and a call at offset zero starts a new presentation.
+         *
+         * @return the number of frames written, which is @a n
+         */
+        virtual nframes_t read(sample_t * const * dest, unsigned nchans,
+                               nframes_t offset, nframes_t n) JILL_RT {
+                const unsigned nc = std::min(nchans, nchannels());
+                for (unsigned c = 0; c < nc; ++c)
+                        std::copy_n(channel(c) + offset, n, dest[c]);
+                return n;
+        }
+
         /**
          * Load samples and resample as needed.  Only needs to be called if
          * buffer() == 0, but may be called multiple times.
@@ -61,6 +100,16 @@ public:
          */
         virtual void load_samples(nframes_t samplerate=0) {}
 
+        /**
+         * Release the samples, so that buffer() == 0 until load_samples() is
+         * called again. nframes() and samplerate() revert to whatever they
+         * were before the load. Does nothing by default, for stimuli whose
+         * samples are not worth freeing.
+         *
+         * @note the caller must know that nothing is reading the buffer.
+         */
+        virtual void unload_samples() {}
+
         friend std::ostream & operator<< (std::ostream &, stimulus_t const &);
 };
 
@@ -14,6 +14,7 @@
 #include <cassert>
 #include <jack/types.h>
 #include <jack/transport.h>
+#include <cstring>
 #include <iosfwd>
 #include <stdexcept>
 #include <string>
@@ -36,11 +37,22 @@ using utime_t = jack_time_t;
 /** A data type holding extended position information. Inherited from JACK */
 using position_t = jack_position_t;
 
-/** The kinds of data moved through JILL. Corresponds to jack port types */
+/**
+ * The kinds of data moved through JILL. Corresponds to jack port types, except
+ * for GAP, which marks where a block was dropped to make room for others; its
+ * data is a gap_t.
+ */
 enum dtype_t {
         SAMPLED = 0,
         EVENT = 1,
-        VIDEO = 2
+        VIDEO = 2,
+        GAP = 3
+};
+
+/** What a GAP block stands in for */
+struct gap_t {
+        nframes_t nframes;      // frames of sampled data, or 1 for an event
+        dtype_t dtype;          // the type of the block that was dropped
 };
 
 namespace detail {
@@ -106,6 +118,12 @@ struct data_block_t {
         /** number of frames in the block; always 1 for event data */
         nframes_t nframes() const {
                 // TODO change if multiple events in a block
+                if (dtype == GAP) {
+                        // the data follow the id, so need not be aligned
+                        gap_t gap;
+                        std::memcpy(&gap, data(), sizeof(gap));
+                        return gap.nframes;
+                }
                 return (dtype == SAMPLED) ? sz_data / sizeof(sample_t) : 1;
         }
 }; // does this need to be packed?
@@ -0,0 +1,70 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "doorbell.hh"
+
+using namespace jill::util;
+
+doorbell::doorbell()
+        : _armed(false)
+{
+#ifdef __linux__
+        _read_fd = _write_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (_read_fd < 0) throw std::system_error(errno, std::generic_category(), "eventfd");
+#else
+        int fds[2];
+        if (::pipe(fds) != 0) throw std::system_error(errno, std::generic_category(), "pipe");
+        for (int fd : fds) {
+                ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+                ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        _read_fd = fds[0];
+        _write_fd = fds[1];
+#endif
+}
+
+doorbell::~doorbell()
+{
+        ::close(_read_fd);
+        if (_write_fd != _read_fd) ::close(_write_fd);
+}
+
+void
+doorbell::signal() noexcept
+{
+        /* An eventfd wants exactly eight bytes; a pipe takes whatever it is
+         * given. EAGAIN means it is already readable, which is all a ring has
+         * to achieve, so the result is not checked. */
+        const std::uint64_t one = 1;
+        [[maybe_unused]] ssize_t n = ::write(_write_fd, &one, sizeof(one));
+}
+
+bool
+doorbell::wait(std::chrono::milliseconds timeout)
+{
+        struct pollfd pfd = {_read_fd, POLLIN, 0};
+        const int ret = ::poll(&pfd, 1, int(timeout.count()));
+        _armed.store(false);
+        if (ret <= 0) return false;
+        // drain, so the next wait blocks
+        std::uint64_t buf[8];
+        while (::read(_read_fd, buf, sizeof(buf)) > 0) {}
+        return true;
+}
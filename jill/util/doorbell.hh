@@ -0,0 +1,88 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _DOORBELL_HH
+#define _DOORBELL_HH
+
+#include <atomic>
+#include <chrono>
+
+namespace jill { namespace util {
+
+/**
+ * Lets the realtime thread wake a background thread that is waiting for work,
+ * without a condition variable.
+ *
+ * pthread_cond_signal takes the condition variable's internal lock, which is
+ * why the workers here used to poll instead. This is a file descriptor -- an
+ * eventfd on Linux, a pipe elsewhere -- that the waiter blocks on in poll(),
+ * plus a flag saying whether it is actually blocked. ring() writes to the
+ * descriptor only when the flag is set, so in the common case, where the
+ * waiter is busy, ringing is one atomic exchange. When it does write, the
+ * write cannot block: the descriptor is non-blocking and a full eventfd or
+ * pipe already means "wake up".
+ *
+ * The waiter has to follow the pattern
+ *
+ *     bell.arm();
+ *     if (nothing_to_do()) bell.wait(timeout);
+ *     else bell.disarm();
+ *
+ * so that work published between its last look and arm() is not missed: the
+ * ringer publishes and then rings, the waiter arms and then looks, and one of
+ * them is bound to see the other. Both sides use a read-modify-write on the
+ * flag rather than a fence, which is a full barrier on x86 and ARM alike and
+ * keeps ThreadSanitizer, which does not model fences, able to check callers.
+ * The timeout is a backstop, not a tick.
+ *
+ * One waiter. Any number of threads may ring.
+ */
+class doorbell {
+
+public:
+        /** @throws std::system_error if the descriptor can't be created */
+        doorbell();
+        ~doorbell();
+
+        doorbell(doorbell const &) = delete;
+        doorbell & operator=(doorbell const &) = delete;
+
+        /** Declare the intent to wait. Call before the last check for work. */
+        void arm() noexcept { _armed.exchange(true); }
+
+        /** Withdraw from arm(), having found work after all */
+        void disarm() noexcept { _armed.store(false); }
+
+        /**
+         * Wake the waiter, if it is waiting. Call after publishing the work.
+         * Makes a non-blocking write only when the waiter is armed.
+         */
+        void ring() noexcept {
+                if (_armed.exchange(false)) signal();
+        }
+
+        /**
+         * Block until rung or until @a timeout passes. Disarms.
+         *
+         * @return true if rung
+         */
+        bool wait(std::chrono::milliseconds timeout);
+
+private:
+        void signal() noexcept;
+
+        int _read_fd;
+        int _write_fd;
+        std::atomic<bool> _armed;
+};
+
+}} // namespace jill::util
+
+#endif
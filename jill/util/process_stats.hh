@@ -0,0 +1,114 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _PROCESS_STATS_HH
+#define _PROCESS_STATS_HH
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "../rt.hh"
+
+namespace jill { namespace util {
+
+/**
+ * How long a process callback takes, measured against the period it has to
+ * fit in.
+ *
+ * An xrun says a deadline was missed after it has happened, and not how close
+ * the others came. This keeps, for every period, the time the callback took: a
+ * histogram of it as a percentage of the period, the longest seen, and how many
+ * went over. jack_client fills one in when statistics are turned on, and
+ * publishes what it holds at intervals.
+ *
+ * One writer, the realtime thread, calling record(); one reader, calling
+ * take(). Every counter is a relaxed atomic, so a snapshot is not taken at a
+ * single instant: it can count a period in `periods` and not yet in the
+ * histogram. Each counter is exact on its own, and a monitor looking at trends
+ * will not notice the difference of one.
+ */
+class process_stats {
+
+public:
+        /** tenths of the period, and a last bin for the whole period or more */
+        static constexpr std::size_t nbins = 11;
+
+        struct snapshot {
+                std::uint64_t periods;          // callbacks timed
+                std::uint64_t misses;           // took the whole period or more
+                std::uint64_t total_usec;       // time spent in all of them
+                std::uint32_t max_usec;         // longest ever
+                std::uint32_t window_max_usec;  // longest since the last take()
+                std::uint32_t period_usec;      // length of the latest period
+                std::array<std::uint64_t, nbins> histogram;
+        };
+
+        process_stats() : _periods(0), _misses(0), _total_usec(0), _max_usec(0),
+                          _window_max_usec(0), _period_usec(0) {
+                for (auto & b : _histogram) b.store(0);
+        }
+
+        process_stats(process_stats const &) = delete;
+        process_stats & operator=(process_stats const &) = delete;
+
+        /**
+         * Count one callback that took @a usec of a period @a period_usec long.
+         * A zero-length period, which JACK never reports, is ignored.
+         */
+        void record(std::uint32_t usec, std::uint32_t period_usec) JILL_RT {
+                if (period_usec == 0) return;
+                const std::size_t bin =
+                        std::min<std::uint64_t>(std::uint64_t(usec) * (nbins - 1) / period_usec,
+                                                nbins - 1);
+                _histogram[bin].fetch_add(1, std::memory_order_relaxed);
+                if (usec >= period_usec) _misses.fetch_add(1, std::memory_order_relaxed);
+                _periods.fetch_add(1, std::memory_order_relaxed);
+                _total_usec.fetch_add(usec, std::memory_order_relaxed);
+                _period_usec.store(period_usec, std::memory_order_relaxed);
+                // only this thread writes the overall maximum
+                if (usec > _max_usec.load(std::memory_order_relaxed))
+                        _max_usec.store(usec, std::memory_order_relaxed);
+                // take() resets this one, so it needs a compare-and-swap
+                std::uint32_t seen = _window_max_usec.load(std::memory_order_relaxed);
+                while (usec > seen &&
+                       !_window_max_usec.compare_exchange_weak(seen, usec, std::memory_order_relaxed))
+                        ;
+        }
+
+        /** Read every counter, and start a new window for window_max_usec */
+        snapshot take() {
+                snapshot s;
+                s.periods = _periods.load(std::memory_order_relaxed);
+                s.misses = _misses.load(std::memory_order_relaxed);
+                s.total_usec = _total_usec.load(std::memory_order_relaxed);
+                s.max_usec = _max_usec.load(std::memory_order_relaxed);
+                s.window_max_usec = _window_max_usec.exchange(0, std::memory_order_relaxed);
+                s.period_usec = _period_usec.load(std::memory_order_relaxed);
+                for (std::size_t i = 0; i < nbins; ++i)
+                        s.histogram[i] = _histogram[i].load(std::memory_order_relaxed);
+                return s;
+        }
+
+private:
+        std::atomic<std::uint64_t> _periods;
+        std::atomic<std::uint64_t> _misses;
+        std::atomic<std::uint64_t> _total_usec;
+        std::atomic<std::uint32_t> _max_usec;
+        std::atomic<std::uint32_t> _window_max_usec;
+        std::atomic<std::uint32_t> _period_usec;
+        std::array<std::atomic<std::uint64_t>, nbins> _histogram;
+};
+
+}} // namespace jill::util
+
+#endif
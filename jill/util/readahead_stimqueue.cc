@@ -17,46 +17,26 @@ using namespace jill::util;
 
 namespace {
 
-/* How long the worker sleeps before checking whether the realtime thread has
- * taken the pre-loaded trial.
+/* How long the worker sleeps, at most, when it has nothing to do.
  *
- * Nothing wakes it for that any more. It used to be signalled from release(),
- * which meant pthread_cond_signal on the audio path -- glibc's takes the
- * condition variable's internal lock and issues a futex wake. The realtime
- * thread now promotes the pre-loaded trial itself, so this only governs how
- * quickly the empty slot is refilled.
- *
- * It bounds the queue's sustained rate at one trial per interval, because
- * head() empties _next and nothing refills it until the next wake. That is not
- * a throughput problem for the protocols this runs -- stimuli last a second or
- * two with gaps of at least a second -- but it is a jitter problem: whatever
- * the interval is, it is also how much the gap between stimuli can vary from
- * one run to the next. --gap promises a minimum rather than an exact spacing,
- * so this breaks no contract, but repeatable is better than merely conformant.
- * Five milliseconds costs two hundred wakeups a second on a thread that does
- * one comparison when it has nothing to do, and measures out: consuming
- * back-to-back went from 51 ms a trial to 5.6, and a consumer holding each
- * trial for 20 ms now runs at 21.5 ms a trial rather than 50, meaning the
- * queue has stopped being the thing setting the pace.
- *
- * Note this is a floor, not the whole story: a stimulus not already in memory
- * still has to be read and resampled, which dominates for a playlist of
- * distinct files and vanishes for one that repeats.
- *
- * It also bounds how long stop() takes to be noticed, since sleep_for cannot
- * be interrupted. Five milliseconds is not worth a mutex and a
- * condition_variable_any to skip, but the two are coupled: raise this interval
- * much and an interruptible wait starts to earn its keep. */
-const auto poll_interval = std::chrono::milliseconds(5);
+ * It used to poll every five milliseconds for the single slot to empty, which
+ * capped the queue at one trial per interval and made that interval the
+ * jitter in the gap between stimuli. It now sleeps on a doorbell that
+ * release() rings, so this is only a backstop: if a ring were ever lost, the
+ * queue would slow down rather than stop. Stopping does not wait for it, since
+ * a stop request rings the bell too. */
+const auto max_sleep = std::chrono::milliseconds(100);
 
 }
 
 readahead_stimqueue::readahead_stimqueue(iterator first, iterator last,
                                          nframes_t samplerate,
-                                         bool loop)
+                                         bool loop, std::size_t depth)
         :  _first(first), _last(last), _it(first),
-           _next(nullptr), _head(nullptr), _previous(nullptr),
-           _samplerate(samplerate), _loop(loop), _finished(false),
+           _ready(std::max<std::size_t>(depth, 1)), _head(nullptr), _previous(nullptr),
+           _samplerate(samplerate), _loop(loop), _depth(std::max<std::size_t>(depth, 1)),
+           _exhausted(false), _finished(false),
+           _loaded(0), _starved(0), _load_ns(0), _max_load_ns(0),
            // a lambda rather than a pointer-to-member: jthread supplies the
            // stop token as the first argument, which for a pmf is where the
            // object has to go. Qualified because the constructor's `loop`
@@ -80,38 +60,58 @@ readahead_stimqueue::join()
                 _thread.join();
 }
 
+bool
+readahead_stimqueue::needs_worker() const
+{
+        if (_it != _last || _loop) return _ready.read_space() < _depth;
+        // list exhausted: the worker's last job is to notice playback is over
+        return _ready.read_space() == 0 && _head.load() == nullptr;
+}
 
 /*
- * The worker keeps _next filled and does nothing else. It never writes _head:
- * the realtime thread promotes for itself in head(), so a stimulus becomes
- * available the moment the previous one is released rather than whenever this
- * thread is next scheduled.
+ * The worker keeps _ready topped up and does nothing else. It never writes
+ * _head: the realtime thread promotes for itself in head(), so a stimulus
+ * becomes available the moment the previous one is released rather than
+ * whenever this thread is next scheduled.
  *
  * Loading a stimulus that is already loaded is cheap -- load_samples() checks
- * -- so a pass with nothing to do costs a comparison and a sleep.
+ * -- so once a repeating playlist has been through once, a refill costs little
+ * more than the push.
  */
 void
 readahead_stimqueue::loop(std::stop_token st)
 {
+        std::stop_callback wake(st, [this] { _doorbell.ring(); });
         while (!st.stop_requested()) {
-                if (_next.load() == nullptr) {
+                if (_ready.read_space() < _depth) {
                         if (_it == _last && _loop) {
                                 _it = _first;
                         }
                         if (_it != _last) {
                                 trial * t = &*_it;
+                                const auto start = std::chrono::steady_clock::now();
                                 t->stim->load_samples(_samplerate);
+                                const std::uint64_t ns =
+                                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                std::chrono::steady_clock::now() - start).count();
+                                _load_ns.fetch_add(ns);
+                                if (ns > _max_load_ns.load()) _max_load_ns.store(ns);
+                                _loaded.fetch_add(1);
                                 LOG << "pre-loaded next stim: " << t->stim->name()
                                     << " (" << t->stim->duration() << " s)";
-                                _next.store(t);
                                 _it += 1;
+                                if (_it == _last && !_loop) _exhausted.store(true);
+                                _ready.push(t);
+                                continue;
                         }
-                        else if (_head.load() == nullptr) {
+                        else if (_ready.read_space() == 0 && _head.load() == nullptr) {
                                 // list exhausted and nothing still playing
                                 break;
                         }
                 }
-                std::this_thread::sleep_for(poll_interval);
+                _doorbell.arm();
+                if (needs_worker() || st.stop_requested()) _doorbell.disarm();
+                else _doorbell.wait(max_sleep);
         }
         LOG << "end of stimulus list";
         // published last, so a caller that sees finished() also sees
@@ -125,10 +125,12 @@ readahead_stimqueue::head()
         trial * ptr = _head.load();
         if (ptr) return ptr;
         /* Nothing current, so take whatever the worker has ready. Both steps
-         * are ours alone: the worker only ever fills _next, and only the
+         * are ours alone: the worker only ever fills _ready, and only the
          * realtime thread writes _head. */
-        ptr = _next.exchange(nullptr);
-        if (ptr) _head.store(ptr);
+        if (_ready.pop(&ptr, 1) == 0) return nullptr;
+        _head.store(ptr);
+        // the worker sleeps while the queue is full; wake it at half
+        if (_ready.read_space() <= _depth / 2) _doorbell.ring();
         return ptr;
 }
 
@@ -143,8 +145,28 @@ void
 readahead_stimqueue::release()
 {
         /* Hand the current trial to _previous and clear _head. The next call to
-         * head() promotes the pre-loaded one, so there is no window where the
+         * head() promotes the next loaded one, so there is no window where the
          * queue looks empty while a background thread catches up. */
         _previous.store(_head.load());
         _head.store(nullptr);
+        if (_ready.read_space() == 0) {
+                if (!_exhausted.load(std::memory_order_relaxed)) {
+                        _starved.fetch_add(1, std::memory_order_relaxed);
+                }
+                // if the list is over, the worker has to see this to finish
+                _doorbell.ring();
+        }
+}
+
+readahead_stimqueue::stats
+readahead_stimqueue::statistics() const
+{
+        stats out;
+        out.depth = _ready.read_space();
+        out.capacity = _depth;
+        out.loaded = _loaded.load();
+        out.starved = _starved.load();
+        out.mean_load_ms = (out.loaded > 0) ? _load_ns.load() / 1e6 / out.loaded : 0.0;
+        out.max_load_ms = _max_load_ns.load() / 1e6;
+        return out;
 }
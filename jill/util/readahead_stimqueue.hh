@@ -12,10 +12,13 @@
 #define _READAHEAD_STIMQUEUE_HH
 
 #include <atomic>
+#include <cstdint>
 #include <thread>
 #include <stop_token>
 #include <vector>
 #include "stimqueue.hh"
+#include "doorbell.hh"
+#include "../dsp/ringbuffer.hh"
 
 namespace jill {
 
@@ -27,20 +30,32 @@ namespace util {
  * An implementation of stimqueue that provides a background thread for loading
  * data from disk and resampling.
  *
- * Handoff between the two threads. The worker's only job is to keep _next
- * filled with a trial whose samples are loaded; the realtime thread takes it
- * from there and owns it until it is done. So _next has exactly one producer
- * (the worker, writing null to non-null) and one consumer (the realtime
- * thread, exchanging non-null back to null), and _head is written only by the
- * realtime thread. Neither pointer needs a read-modify-write to arbitrate, and
- * nothing on the realtime side waits for the worker to run.
+ * Handoff between the two threads. The worker's only job is to keep up to
+ * @c depth trials with loaded samples waiting in _ready, a single-producer,
+ * single-consumer ringbuffer; the realtime thread takes them from there in
+ * order and owns each until it is done. _head is written only by the realtime
+ * thread, and nothing on the realtime side waits for the worker to run.
  *
- * That last part is the point. head() promotes the pre-loaded trial itself
+ * That last part is the point. head() promotes the next loaded trial itself
  * rather than clearing _head and asking the worker to refill it, so there is no
  * interval after a stimulus ends during which head() returns null while a
  * background thread is scheduled. jstim checks head() before it reads its
  * trigger port and gives up for the period if the queue is empty, so such an
  * interval does not delay an external trigger, it discards it.
+ *
+ * Depth. With one slot, a playlist of distinct files can only go as fast as
+ * one load per trial, and a single slow load (a long file, a cold disk)
+ * stalls playback. More slots let the worker get ahead during the easy
+ * stretches. Loaded stimuli keep their samples, so the memory cost is only
+ * what the playlist would use anyway once it had been through once.
+ *
+ * Waking the worker. When the queue is full the worker sleeps on a doorbell,
+ * and head() rings it when taking a trial leaves the queue half empty;
+ * release() rings it when there is nothing left, so that it can notice the
+ * end of the list. Ringing is an atomic exchange unless the worker is actually
+ * asleep, and then a single non-blocking write, so a refill costs the
+ * realtime thread one syscall per half a queue rather than a condition
+ * variable per trial.
  */
 class readahead_stimqueue : public stimqueue {
 
@@ -55,19 +70,21 @@ public:
          * @param last   iterator pointing to the end of the sequence
          * @param samplerate   the sampling rate needed by the consumer
          * @param loop         whether to keep repeating the queue
+         * @param depth        how many loaded trials to keep ready (at least 1)
          *
          * @note the sequence must outlive the queue, and must not be resized
          * while it runs: the queue hands out pointers into it.
          */
         readahead_stimqueue(iterator first, iterator last,
                             nframes_t samplerate,
-                            bool loop=false);
+                            bool loop=false,
+                            std::size_t depth=4);
 
         /**
          * Stops the background thread and waits for it.
          *
-         * Nothing to write: ~jthread requests a stop and joins, which is the
-         * whole of it. That also covers a throw between construction and the
+         * Nothing to write: ~jthread requests a stop and joins, and the
+         * worker's stop callback rings it awake, which is the whole of it. That also covers a throw between construction and the
          * explicit teardown, where a bare std::thread would reach ~thread
          * joinable and call std::terminate.
          *
@@ -104,26 +121,51 @@ public:
          */
         bool finished() const { return _finished.load(std::memory_order_acquire); }
 
+        struct stats {
+                std::size_t depth;      ///< trials loaded and waiting
+                std::size_t capacity;   ///< the most that will wait
+                std::size_t loaded;     ///< trials loaded so far
+                /** times a trial was released with nothing behind it, before
+                 *  the end of the list: each one is a gap the worker caused */
+                std::size_t starved;
+                double mean_load_ms;
+                double max_load_ms;
+        };
+
+        /** Counters for reporting. Safe to call from any thread. */
+        stats statistics() const;
+
 private:
         void loop(std::stop_token st);    // called by thread
+        /** whether the worker has something to do, or should exit */
+        bool needs_worker() const;
 
         iterator const _first;
         iterator const _last;
         iterator _it;                             // next trial to load
 
-        /* _next is filled by the worker and taken by the realtime thread;
-         * _head and _previous are touched only by the realtime thread, through
-         * head(), previous() and release(). Default ordering throughout: one
-         * access per period, nothing to gain from tuning it. */
-        std::atomic<trial *> _next;
+        /* _ready is filled by the worker and drained by the realtime thread;
+         * _head and _previous are written only by the realtime thread, through
+         * head() and release(). Default ordering on the pointers: one access
+         * per period, nothing to gain from tuning it. */
+        dsp::ringbuffer<trial *> _ready;
         std::atomic<trial *> _head;
         std::atomic<trial *> _previous;
 
         nframes_t const _samplerate;
         bool const _loop;
+        std::size_t const _depth;
+        doorbell _doorbell;
+        // set by the worker once it has queued the last trial of a finite list
+        std::atomic<bool> _exhausted;
         // set by the worker as it exits; read by any thread through finished()
         std::atomic<bool> _finished;
 
+        std::atomic<std::size_t> _loaded;
+        std::atomic<std::size_t> _starved;
+        std::atomic<std::uint64_t> _load_ns;
+        std::atomic<std::uint64_t> _max_load_ns;
+
         // Declared last so that it is destroyed first, stopping and joining
         // the worker while everything it touches is still alive.
         std::jthread _thread;
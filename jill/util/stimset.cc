@@ -0,0 +1,167 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#include <algorithm>
+#include "../logging.hh"
+#include "stimset.hh"
+
+using namespace jill::util;
+
+stimset::stimset(nframes_t samplerate, std::size_t budget)
+        : _samplerate(samplerate), _budget(budget)
+{}
+
+stimset::~stimset()
+{
+        stop();
+}
+
+stimset::entry *
+stimset::add(std::string const & name, std::unique_ptr<stimulus_t> stim)
+{
+        if (_entries.count(name) > 0) return nullptr;
+        auto e = std::make_unique<entry>(name, std::move(stim));
+        entry * ptr = e.get();
+        _entries.emplace(name, std::move(e));
+        _order.push_back(ptr);
+        return ptr;
+}
+
+void
+stimset::start(unsigned nthreads)
+{
+        nthreads = std::max(nthreads, 1u);
+        for (unsigned i = 0; i < nthreads; ++i) {
+                _loaders.emplace_back([this](std::stop_token st) { loader(st); });
+        }
+}
+
+void
+stimset::stop()
+{
+        for (auto & t : _loaders) t.request_stop();
+        _wake.notify_all();
+        for (auto & t : _loaders) {
+                if (t.joinable()) t.join();
+        }
+        _loaders.clear();
+}
+
+stimset::entry *
+stimset::find(std::string const & name)
+{
+        auto it = _entries.find(name);
+        return (it == _entries.end()) ? nullptr : it->second.get();
+}
+
+stimset::state_t
+stimset::request(entry & e)
+{
+        std::lock_guard<std::mutex> lock(_lock);
+        touch(e);
+        const state_t state = e._state.load(std::memory_order_relaxed);
+        if (state != Unloaded) return state;
+        e._state.store(Loading, std::memory_order_relaxed);
+        _queue.push_back(&e);
+        ++_requested;
+        _wake.notify_one();
+        return Loading;
+}
+
+bool
+stimset::acquire(entry & e)
+{
+        std::lock_guard<std::mutex> lock(_lock);
+        if (e._state.load(std::memory_order_acquire) != Ready) return false;
+        e._pins.fetch_add(1, std::memory_order_relaxed);
+        touch(e);
+        return true;
+}
+
+std::size_t
+stimset::resident() const
+{
+        std::lock_guard<std::mutex> lock(_lock);
+        return _resident;
+}
+
+/* Loads are done outside the lock, since they take as long as resampling
+ * does, and the lock is what the control thread needs to answer PLAY. The
+ * entry is Loading throughout, which nothing else will touch: request() leaves
+ * it alone, acquire() refuses it, and eviction only considers Ready entries. */
+void
+stimset::loader(std::stop_token stop)
+{
+        std::unique_lock<std::mutex> lock(_lock);
+        while (true) {
+                _wake.wait(lock, stop, [this] { return !_queue.empty(); });
+                if (stop.stop_requested()) return;
+                entry * e = _queue.front();
+                _queue.pop_front();
+
+                lock.unlock();
+                bool ok = true;
+                try {
+                        e->_stim->load_samples(_samplerate);
+                }
+                catch (std::exception const & err) {
+                        LOG << "unable to load stimulus " << e->_name << ": " << err.what();
+                        ok = false;
+                }
+                lock.lock();
+
+                if (ok) {
+                        e->_bytes = std::size_t(e->_stim->nframes()) * e->_stim->nchannels()
+                                * sizeof(sample_t);
+                        _resident += e->_bytes;
+                        // make room before publishing, so that anyone who sees
+                        // this Ready also sees the set back within budget
+                        evict_to_budget(e);
+                        e->_state.store(Ready, std::memory_order_release);
+                }
+                else {
+                        e->_state.store(Failed, std::memory_order_release);
+                }
+                if (++_done == _requested && _queue.empty()) {
+                        LOG << "loaded " << _done << " stimuli; " << _resident
+                            << " bytes resident";
+                }
+        }
+}
+
+void
+stimset::evict_to_budget(entry const * keep)
+{
+        if (_budget == 0) return;
+        while (_resident > _budget) {
+                /* A linear scan for the oldest. This runs once per load, on a
+                 * loader thread, and a set is thousands of entries at most;
+                 * an intrusive list would only add bookkeeping to get wrong. */
+                entry * oldest = nullptr;
+                for (entry * e : _order) {
+                        if (e == keep || e->_state.load(std::memory_order_relaxed) != Ready)
+                                continue;
+                        if (e->_pins.load(std::memory_order_acquire) > 0)
+                                continue;
+                        if (!oldest || e->_last_used < oldest->_last_used)
+                                oldest = e;
+                }
+                if (!oldest) {
+                        LOG << "WARNING: " << _resident << " bytes of stimuli resident, over the "
+                            << _budget << " byte budget; nothing else can be evicted";
+                        return;
+                }
+                DBG << "evicting stimulus " << oldest->_name;
+                oldest->_stim->unload_samples();
+                oldest->_state.store(Unloaded, std::memory_order_release);
+                _resident -= oldest->_bytes;
+                oldest->_bytes = 0;
+        }
+}
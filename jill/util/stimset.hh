@@ -0,0 +1,177 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#ifndef _STIMSET_HH
+#define _STIMSET_HH
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <stop_token>
+#include <vector>
+
+#include "../stimulus.hh"
+
+namespace jill { namespace util {
+
+/**
+ * A set of named stimuli whose samples are loaded on demand by a pool of
+ * background threads and, if a memory budget is set, evicted least recently
+ * used first to stay within it.
+ *
+ * Residency. An entry is Unloaded until something asks for it with
+ * request(), which queues it for a loader and marks it Loading; a loader then
+ * makes it Ready or, if the load throws, Failed. A Ready entry whose samples
+ * take the set over budget causes the least recently used Ready entries to be
+ * unloaded until it fits again. Entries that are in use are never chosen, so
+ * the set can go over budget when everything resident is playing; it comes
+ * back down as they are released.
+ *
+ * In use. The realtime thread cannot take a lock, so it cannot take part in
+ * the bookkeeping, and yet eviction must never free a buffer under it. Each
+ * entry therefore has a pin count. acquire() pins an entry (on the control
+ * thread, under the lock), and the holder drops the pin with entry::release(),
+ * which is a single atomic decrement and safe to call from the process
+ * callback. Eviction happens only under the lock and only to an entry with no
+ * pins; since pins are only ever added under the same lock, an entry seen
+ * unpinned there stays unpinned until the eviction is done. The release is
+ * ordered after the holder's last read of the samples, and the evicting thread
+ * reads the count with acquire, so the free cannot overtake the reads.
+ *
+ * Entries are added before start() and never removed, so an entry's address,
+ * its name and its stimulus object are stable for the life of the set. Only
+ * the samples come and go.
+ */
+class stimset {
+
+public:
+        enum state_t { Unloaded, Loading, Ready, Failed };
+
+        class entry {
+        public:
+                entry(std::string name, std::unique_ptr<stimulus_t> stim)
+                        : _name(std::move(name)), _stim(std::move(stim)) {}
+
+                std::string const & name() const { return _name; }
+
+                /** The stimulus. Its samples are only valid while pinned. */
+                stimulus_t const * stim() const { return _stim.get(); }
+
+                /** The residency state, read with acquire */
+                state_t state() const { return _state.load(std::memory_order_acquire); }
+
+                /** Drop a pin taken by stimset::acquire(). Realtime safe. */
+                void release() noexcept { _pins.fetch_sub(1, std::memory_order_release); }
+
+        private:
+                friend class stimset;
+                std::string const _name;
+                std::unique_ptr<stimulus_t> const _stim;
+                std::atomic<state_t> _state{Unloaded};
+                std::atomic<int> _pins{0};
+                // the rest are guarded by stimset::_lock
+                std::uint64_t _last_used = 0;
+                std::size_t _bytes = 0;
+        };
+
+        /**
+         * @param samplerate  the rate stimuli are loaded at
+         * @param budget      the most bytes of samples to keep resident, or 0
+         *                    for no limit
+         */
+        stimset(nframes_t samplerate, std::size_t budget);
+
+        /** Stops and joins the loaders */
+        ~stimset();
+
+        stimset(stimset const &) = delete;
+        stimset & operator=(stimset const &) = delete;
+
+        /**
+         * Add a stimulus. Must be called before start().
+         *
+         * @return the new entry, or null if the name is taken
+         */
+        entry * add(std::string const & name, std::unique_ptr<stimulus_t> stim);
+
+        /** Start @a nthreads loader threads (at least one). */
+        void start(unsigned nthreads);
+
+        /** Stop the loaders and wait for them. Idempotent. */
+        void stop();
+
+        /** @return the entry with this name, or null */
+        entry * find(std::string const & name);
+
+        /** @return the entries, in the order they were added */
+        std::vector<entry *> const & entries() const { return _order; }
+
+        /**
+         * Ask for an entry to be loaded if it is not, and count this as a use
+         * of it for eviction.
+         *
+         * @return the state after the request: Loading if a load was queued
+         *         or is already under way
+         */
+        state_t request(entry & e);
+
+        /**
+         * Pin a Ready entry, so that its samples stay resident until the pin
+         * is dropped with entry::release(). Counts as a use.
+         *
+         * @return false, and no pin, if the entry is not Ready
+         */
+        bool acquire(entry & e);
+
+        /** @return bytes of samples currently resident */
+        std::size_t resident() const;
+
+        /** @return how many loads have been queued since the set started */
+        std::size_t loads_requested() const { return _requested.load(); }
+
+        /** @return how many of those have finished, successfully or not */
+        std::size_t loads_done() const { return _done.load(); }
+
+        std::size_t budget() const { return _budget; }
+
+private:
+        void loader(std::stop_token stop);
+        // both called with _lock held
+        void touch(entry & e) { e._last_used = ++_clock; }
+        void evict_to_budget(entry const * keep);
+
+        nframes_t const _samplerate;
+        std::size_t const _budget;
+
+        std::map<std::string, std::unique_ptr<entry>> _entries;
+        std::vector<entry *> _order;
+
+        mutable std::mutex _lock;
+        std::condition_variable_any _wake;
+        std::deque<entry *> _queue;
+        std::size_t _resident = 0;
+        std::uint64_t _clock = 0;
+
+        std::atomic<std::size_t> _requested{0};
+        std::atomic<std::size_t> _done{0};
+
+        // last, so that the loaders are stopped before anything they touch
+        std::vector<std::jthread> _loaders;
+};
+
+}} // namespace jill::util
+
+#endif
@@ -11,6 +11,8 @@
  * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
  */
 #include <iostream>
+#include <map>
+#include <memory>
 #include <random>
 #include <csignal>
 #include <atomic>
@@ -26,6 +28,7 @@
 #include "jill/dsp/ringbuffer.hh"
 #include "jill/util/event_randomizer.hh"
 #include "jill/dsp/pulse.hh"
+#include "jill/file/stimfile.hh"
 
 #define PROGRAM_NAME "jclicker"
 
@@ -55,19 +58,27 @@ protected:
 
 
 struct pulse_type {
-        /** the shape of the pulse */
+        /** the shape of the pulse; ignored when the waveform came from a file */
         dsp::pulse_shape shape;
+        /** the file the waveform was loaded from, or empty for a standard shape */
+        string source;
         /** the type of midi message that will trigger the pulse */
         midi::data_type status;
         /** delay between the triggering event and pulse onset, in samples */
         nframes_t delay;
         /** duration of the pulse, in samples */
         nframes_t duration;
+        /** the waveform, rendered at startup. Shared between pulses that use
+         * the same file, so a train used for several conditions is loaded and
+         * resampled once. */
+        std::shared_ptr<dsp::pulse_template const> wave;
 };
 
 std::ostream& operator << (std::ostream &os, const pulse_type &p) {
         os << midi::status_type(p.status) << ": ";
-        switch(p.shape) {
+        if (!p.source.empty())
+                os << "waveform from " << p.source;
+        else switch(p.shape) {
         case dsp::pulse_shape::positive: os << "positive"; break;
         case dsp::pulse_shape::negative: os << "negative"; break;
         case dsp::pulse_shape::biphasic: os << "biphasic"; break;
@@ -85,6 +96,12 @@ std::set<midi::data_type> event_types;
 static nframes_t max_lookahead = 0;
 // ringbuffer acts as a backing buffer so that pulses can span the end of the current period.
 std::unique_ptr<sample_ringbuffer> ringbuf;
+/* How many samples from the read pointer may hold pulse data. Everything else
+ * in the ringbuffer is zero, so only this span has to be mixed, copied and
+ * cleared; in the common case of no pulse in flight it is zero and a period
+ * costs one memset of the output. Touched only by process() and by
+ * jack_bufsize(), which JACK never runs concurrently. */
+static nframes_t active_frames = 0;
 std::atomic<int> ret(EXIT_SUCCESS);
 std::atomic<bool> running(true);
 // used to track stimuli so that probability is on a per-stimulus basis
@@ -94,6 +111,24 @@ static std::random_device rd;  // Will be used to obtain a seed for the random n
 static std::mt19937 p_gen(rd()); // Standard mersenne_twister_engine seeded with rd()
 static std::uniform_real_distribution<> p_dis(0.0, 1.0);
 
+/* Write visitor that claims the space without touching it. The samples behind
+ * the write pointer are already zero (see process()), so there is nothing to
+ * write. A plain function rather than a lambda so that wrapping it in the
+ * ringbuffer's std::function is guaranteed not to allocate. */
+static std::size_t
+claim_zeroed(sample_t *, std::size_t cnt)
+{
+        return cnt;
+}
+
+/*
+ * The ringbuffer is only ever written by adding templates into it, and every
+ * sample is set back to zero as it is read out, so anything outside the first
+ * active_frames samples past the read pointer is known to be zero. That
+ * invariant is what lets a period with no pulses in flight skip the ringbuffer
+ * entirely, and lets one with a 1 ms click touch 1 ms of memory instead of a
+ * period plus the lookahead.
+ */
 int
 process(jack_client *client, nframes_t nframes, nframes_t time) JILL_RT
 {
@@ -103,9 +138,9 @@ process(jack_client *client, nframes_t nframes, nframes_t time) JILL_RT
         // write pointer should be one period + max_lookahead ahead of read pointer
         assert (ringbuf->read_space() == nframes + max_lookahead);
         assert (ringbuf->write_space() >= nframes);
-        // zero out the back of the buffer
-        ringbuf->push(nullptr, nframes);
-        // write the pulses to the front using the read pointer
+        // extend the back of the buffer; it is zero already
+        ringbuf->push(claim_zeroed, nframes);
+        // mix the pulses into the front using the read pointer
         sample_t * buf = ringbuf->buffer() + ringbuf->read_offset();
 
         jack_midi_event_t event;
@@ -134,12 +169,22 @@ process(jack_client *client, nframes_t nframes, nframes_t time) JILL_RT
                 for (const auto &pulse : pulses) {
                         if (pulse.status != event.buffer[0]) continue;
                         DBG << " - adding pulse at " << pulse.delay;
-                        sample_t * pulse_buf = buf + event.time + pulse.delay;
-                        dsp::render_pulse(pulse_buf, pulse.shape, pulse.duration);
+                        const nframes_t onset = event.time + pulse.delay;
+                        pulse.wave->mix(buf + onset);
+                        active_frames = std::max(active_frames, onset + pulse.duration);
                 }
         }
-        // copy the front of the buffer into the output and advance the read pointer
-        ringbuf->pop(out, nframes);
+        /* Copy out the part of the period that can hold anything, clipped
+         * because overlapping pulses now add rather than overwrite, and zero
+         * the rest of the output directly. The copied span is then cleared in
+         * the ringbuffer to keep the invariant above. */
+        const nframes_t nactive = std::min(active_frames, nframes);
+        for (nframes_t i = 0; i < nactive; ++i)
+                out[i] = std::clamp(buf[i], -1.0f, 1.0f);
+        std::fill(out + nactive, out + nframes, 0.0f);
+        std::fill(buf, buf + nactive, 0.0f);
+        active_frames -= nactive;
+        ringbuf->discard(nframes);
 
         return 0;
 }
@@ -163,14 +208,18 @@ jack_bufsize(jack_client *, nframes_t nframes)
          * is worse than the silence that replaces them. */
         const std::size_t needed = nframes * 3 + max_lookahead;
         if (needed > ringbuf->size()) {
-                ringbuf->resize(needed);        // discards
+                ringbuf->resize(needed);        // discards; new memory is zero
         }
         else {
                 ringbuf->clear();
+                // clear() keeps the samples, and process() relies on them
+                // being zero outside the active span
+                std::fill(ringbuf->buffer(), ringbuf->buffer() + ringbuf->size(), 0.0f);
         }
+        active_frames = 0;
         // process() requires exactly one period plus the lookahead margin to be
         // readable; re-establish that against the new period size
-        ringbuf->push(nullptr, nframes + max_lookahead);
+        ringbuf->push(claim_zeroed, nframes + max_lookahead);
         DBG << "jack period size now " << nframes << "; ringbuffer holds "
             << ringbuf->size() << " samples, " << ringbuf->read_space() << " primed";
         return 0;
@@ -255,17 +304,49 @@ auto parse_whole(char const * field, string const & value, Parse parse)
 
 } // namespace
 
+/* Load a waveform file into a template at the JACK sampling rate. Files are
+ * cached by path, so naming the same one in several pulses costs one load. */
+static std::shared_ptr<dsp::pulse_template const>
+load_waveform(string const & path, nframes_t sampling_rate)
+{
+        static std::map<string, std::shared_ptr<dsp::pulse_template const>> loaded;
+        auto it = loaded.find(path);
+        if (it != loaded.end())
+                return it->second;
+        file::stimfile f(path);
+        // stimfile accepts any number of channels, but a pulse has one
+        if (f.nchannels() != 1) {
+                throw std::invalid_argument("pulse waveform '" + path + "' is not mono");
+        }
+        f.load_samples(sampling_rate);
+        if (f.nframes() == 0) {
+                throw std::invalid_argument("pulse waveform '" + path + "' has no samples");
+        }
+        auto wave = std::make_shared<dsp::pulse_template const>(f.buffer(), f.nframes());
+        loaded.emplace(path, wave);
+        return wave;
+}
+
 static
 void parse_pulses(stringvec const & pulse_defs, nframes_t sampling_rate) {
         LOG << "parsing pulse specifications: ";
         float dt = 1.0 / sampling_rate;
         for (const auto &it : pulse_defs) {
                 const stringvec words = split_on(it, ',');
-                if (words.size() != 3 && words.size() != 4) {
+                /* A waveform file sets its own duration, so the form is
+                 * condition,@file[,delay]; the named shapes keep
+                 * condition,shape,duration[,delay]. */
+                const bool from_file = words.size() >= 2
+                        && !words[1].empty() && words[1][0] == '@';
+                if (from_file && words.size() != 2 && words.size() != 3) {
+                        throw std::invalid_argument(
+                                "invalid pulse configuration (must be condition,@file[,delay])");
+                }
+                if (!from_file && words.size() != 3 && words.size() != 4) {
                         throw std::invalid_argument(
                                 "invalid pulse configuration (must be condition,shape,duration[,delay])");
                 }
-                pulse_type pulse;
+                pulse_type pulse{};
                 // first token is a hex MIDI status byte
                 const unsigned long status = parse_whole(
                         "condition", words[0],
@@ -281,6 +362,28 @@ void parse_pulses(stringvec const & pulse_defs, nframes_t sampling_rate) {
                         throw std::invalid_argument(msg.str());
                 }
                 pulse.status = static_cast<midi::data_type>(status);
+                auto parse_ms = [](string const & s, std::size_t * used) {
+                        return std::stof(s, used);
+                };
+                const std::size_t delay_at = from_file ? 2 : 3;
+                // parse optional last token as a float (delay in ms)
+                const float delay_ms = (words.size() > delay_at)
+                        ? parse_whole("delay", words[delay_at], parse_ms) : 0.0f;
+                if (delay_ms < 0.0) {
+                        throw std::invalid_argument("delay must not be negative");
+                }
+                pulse.delay = 0.001 * delay_ms * sampling_rate;
+
+                if (from_file) {
+                        pulse.source = words[1].substr(1);
+                        pulse.wave = load_waveform(pulse.source, sampling_rate);
+                        pulse.duration = pulse.wave->size();
+                        LOG << "  " << pulse;
+                        event_types.insert(pulse.status);
+                        max_lookahead = std::max(max_lookahead, pulse.delay + pulse.duration);
+                        pulses.push_back(std::move(pulse));
+                        continue;
+                }
                 // parse second token by string matching
                 if (iequals_ascii(words[1], "positive"))
                         pulse.shape = dsp::pulse_shape::positive;
@@ -289,10 +392,7 @@ void parse_pulses(stringvec const & pulse_defs, nframes_t sampling_rate) {
                 else if (iequals_ascii(words[1], "biphasic"))
                         pulse.shape = dsp::pulse_shape::biphasic;
                 else
-                        throw std::invalid_argument("pulse shape must be 'positive', 'negative', or 'biphasic'");
-                auto parse_ms = [](string const & s, std::size_t * used) {
-                        return std::stof(s, used);
-                };
+                        throw std::invalid_argument("pulse shape must be 'positive', 'negative', 'biphasic', or '@file'");
                 const float duration_ms = parse_whole("duration", words[2], parse_ms);
                 if (duration_ms < dt) {
                         throw std::invalid_argument("duration must be positive and at least one sample");
@@ -305,18 +405,12 @@ void parse_pulses(stringvec const & pulse_defs, nframes_t sampling_rate) {
                         throw std::invalid_argument(
                                 "a biphasic pulse must be at least two samples long");
                 }
-                // parse optional fourth token as a float (delay in ms)
-                const float delay_ms = (words.size() == 4)
-                        ? parse_whole("delay", words[3], parse_ms) : 0.0f;
-                if (delay_ms < 0.0) {
-                        throw std::invalid_argument("delay must not be negative");
-                }
-                pulse.delay = 0.001 * delay_ms * sampling_rate;
+                pulse.wave = std::make_shared<dsp::pulse_template const>(pulse.shape, pulse.duration);
 
                 LOG << "  " << pulse;
-                pulses.push_back(pulse);
                 event_types.insert(pulse.status);
                 max_lookahead = std::max(max_lookahead, pulse.delay + pulse.duration);
+                pulses.push_back(std::move(pulse));
         }
 }
 
@@ -452,7 +546,7 @@ jclicker_options::jclicker_options(string const &program_name)
         cmd_opts.add_options()
                 ("pulse",
                  po::value<stringvec>(&pulses)->multitoken(),
-                 "defines a pulse: condition,shape,duration");
+                 "defines a pulse: condition,shape,duration[,delay] or condition,@file[,delay]");
         pos_opts.add("pulse", -1);
 }
 
@@ -463,7 +557,7 @@ jclicker_options::print_usage()
         std::cout << _program_name << ": generate audible clicks for events\n\n"
                   << "Usage: " << _program_name << " [options] [pulse1] [pulse2] ...\n"
                   << visible_opts << std::endl
-                  << "Pulse specification: condition,shape,duration \n"
+                  << "Pulse specification: condition,shape,duration[,delay] or condition,@file[,delay]\n"
                   << " - condition: the midi event code. The high nibble is on (0x0) or off\n"
                   << "     (0x1); the low nibble is the channel: 0 the stimulus\n"
                   << "     itself, 1 the trial window around it, 2 the trials in\n"
@@ -471,6 +565,9 @@ jclicker_options::print_usage()
                   << "     on, 0x02 condition on, 0x10/0x11/0x12 the matching offs.\n"
                   << " - shape: {positive,negative,biphasic}\n"
                   << " - duration: total duration of the click, in ms\n"
+                  << " - @file: emit the waveform in a mono sound file instead, resampled\n"
+                  << "     to the JACK rate; its length sets the duration. Overlapping\n"
+                  << "     pulses add, and the sum is clipped to full scale.\n"
                   << " - delay: delay between event and pulse onset, in ms (optional; default 0)\n\n"
                   << "Ports:\n"
                   << " * in:        input event port\n"
@@ -16,7 +16,7 @@
 #include "jill/jack_client.hh"
 #include "jill/program_options.hh"
 #include "jill/midi.hh"
-#include "jill/dsp/ringbuffer.hh"
+#include "jill/rt_log.hh"
 #include "jill/dsp/crossing_trigger.hh"
 
 #define PROGRAM_NAME "jdetect"
@@ -66,12 +66,9 @@ std::atomic<bool> stopping(false);
 std::atomic<bool> running(true);
 std::atomic<int> ret(EXIT_SUCCESS);
 
-/* data storage for event times */
-struct event_t {
-        nframes_t time;
-        midi::status_type status;
-};
-dsp::ringbuffer<event_t> trig_times(128);
+/* Gate openings and closings, logged from the realtime thread and formatted
+ * on rt_log's own. Created in main(), since it starts that thread. */
+std::unique_ptr<rt_log> trig_log;
 
 int
 process(jack_client *client, nframes_t nframes, nframes_t time) JILL_RT
@@ -101,39 +98,21 @@ process(jack_client *client, nframes_t nframes, nframes_t time) JILL_RT
         else
                 buf[0] = midi::status_type(midi::status_type::note_off, options.output_chan);
 
-        event_t event = { time + offset, buf[0] }; // data sent to logger
+        const nframes_t frame = time + offset;
         if (jack_midi_event_write(trig_buffer, offset, buf, 3) != 0) {
-                // indicate error to logger function
-                event.status = midi::status_type::sysex;
+                (*trig_log)(frame, "WARNING: detected but couldn't send event:  frames={frame}, us={}",
+                            client->time(frame));
+        }
+        else if (trigger->open()) {
+                (*trig_log)(frame, "signal on:  frames={frame}, us={}", client->time(frame));
+        }
+        else {
+                (*trig_log)(frame, "signal off:  frames={frame}, us={}", client->time(frame));
         }
-        trig_times.push(event);
 
         return 0;
 }
 
-/** visitor function for gate time ringbuffer */
-std::size_t log_times(event_t const * events, std::size_t count)
-{
-        event_t const *e;
-        std::size_t i;
-        for (i = 0; i < count; ++i) {
-                e = events+i;
-                log_msg msg;
-                switch(e->status) {
-                case midi::status_type::note_on:
-                        msg << "signal on: ";
-                        break;
-                case midi::status_type::note_off:
-                        msg << "signal off: ";
-                        break;
-                default:
-                        msg << "WARNING: detected but couldn't send event: ";
-                }
-                msg << " frames=" << e->time << ", us=" << client->time(e->time);
-        }
-        return i;
-}
-
 void
 signal_handler(int sig)
 {
@@ -196,6 +175,7 @@ main(int argc, char **argv)
         try {
                 options.parse(argc, argv);
                 client.reset(new jack_client(options.client_name, options.server_name));
+                trig_log = std::make_unique<rt_log>(128);
 
                 port_in = client->register_port("in", JACK_DEFAULT_AUDIO_TYPE,
                                                 JackPortIsInput, 0);
@@ -222,7 +202,6 @@ main(int argc, char **argv)
                 while (running) {
                         // interrupted by a signal, so this does not delay shutdown
                         sleep(1);
-                        trig_times.pop(log_times); // calls visitor function on ringbuffer
                 }
 
                 /* Give the realtime thread a period to notice `stopping` and
@@ -230,7 +209,7 @@ main(int argc, char **argv)
                  * of scope and deactivates the client. The signal handler used
                  * to do this wait itself, from signal context. */
                 usleep(2e6 * client->buffer_size() / client->sampling_rate());
-                trig_times.pop(log_times); // whatever it logged on the way out
+                rt_log::flush();        // whatever it logged on the way out
 
                 return ret;
         }
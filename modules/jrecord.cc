@@ -12,8 +12,11 @@
  */
 #include <iostream>
 #include <atomic>
+#include <chrono>
+#include <filesystem>
 #include <unistd.h>
 #include <csignal>
+#include <ctime>
 
 #include "jill/logging.hh"
 #include "jill/jack_client.hh"
@@ -21,6 +24,7 @@
 #include "jill/midi.hh"
 #include "jill/file/arf_writer.hh"
 #include "jill/dsp/buffered_data_writer.hh"
+#include "jill/dsp/sharded_data_writer.hh"
 #include "jill/dsp/triggered_data_writer.hh"
 #include "jill/util/scope_guard.hh"
 
@@ -41,13 +45,24 @@ public:
 
         /** key-value pairs to store as attributes in created entries */
         std::map<string, string> additional_options;
+        /** port names and their priority tiers, as given */
+        std::map<string, string> port_priorities;
 
         string output_file;
+        /** further files, each taking a share of the channels */
+        svec shard_files;
         float pretrigger_size_s;
         float posttrigger_size_s;
         float buffer_size_s;
         int max_size_mb;
+        /** how often to start a new file; zero for never */
+        std::chrono::seconds rotate_every;
         int compression;
+        /** file-space page size for new files, in KB; zero for none */
+        unsigned page_size_kb;
+        unsigned buffer_stats_s;
+        float soft_limit;
+        float reserve;
 
 protected:
 
@@ -56,9 +71,60 @@ protected:
 
 };
 
+/* high, normal or low, or the number of a tier, 0 being the highest */
+unsigned
+parse_tier(string const & name)
+{
+        if (name == "high") return 0;
+        if (name == "normal") return 1;
+        if (name == "low") return 2;
+        std::size_t end;
+        const unsigned long tier = std::stoul(name, &end);
+        if (end != name.size() || tier > 9) throw std::invalid_argument(name);
+        return tier;
+}
+
+/* hourly, daily, or a number of seconds */
+std::chrono::seconds
+parse_rotation(string const & name)
+{
+        if (name == "hourly") return std::chrono::hours(1);
+        if (name == "daily") return std::chrono::hours(24);
+        std::size_t end;
+        const unsigned long s = std::stoul(name, &end);
+        if (end != name.size() || s == 0) throw std::invalid_argument(name);
+        return std::chrono::seconds(s);
+}
+
+/* The next multiple of @a every after @a now, counted in local time so that
+ * daily files change over at midnight. The offset from UTC at the boundary
+ * may not be the one now, across a change to or from daylight saving time, so
+ * the boundary is found on the wall clock and mktime() says when that is. */
+std::chrono::system_clock::time_point
+next_rotation(std::chrono::system_clock::time_point now, std::chrono::seconds every)
+{
+        const std::time_t t = std::chrono::system_clock::to_time_t(now);
+        struct tm local;
+        localtime_r(&t, &local);
+        // the wall clock as a count of seconds, which gmtime_r() takes apart
+        std::time_t wall = timegm(&local);
+        for (;;) {
+                wall = (wall / every.count() + 1) * every.count();
+                struct tm next;
+                gmtime_r(&wall, &next);
+                next.tm_isdst = -1;
+                // a time the clocks go back over comes twice; take one ahead
+                const std::time_t at = mktime(&next);
+                if (at > t) return std::chrono::system_clock::from_time_t(at);
+        }
+}
+
 jrecord_options options(PROGRAM_NAME);
-std::unique_ptr<dsp::buffered_data_writer> arf_thread;
+std::unique_ptr<dsp::sharded_data_writer> arf_thread;
 jack_port_t * port_trig = nullptr;
+/* Priority tier of each port not in the first. Filled in before activation and
+ * only read after, so the realtime thread can look ports up without a lock. */
+std::map<jack_port_t const *, unsigned> port_tiers;
 /* cleared by the signal handler; main() drives the shutdown */
 std::atomic<bool> running(true);
 
@@ -73,9 +139,11 @@ process(jack_client *client, nframes_t nframes, nframes_t time) JILL_RT
                 port = *it;
                 buffer = jack_port_get_buffer(port, nframes);
                 if (buffer == nullptr) continue;
+                const auto tier = port_tiers.find(port);
+                const unsigned priority = (tier == port_tiers.end()) ? 0 : tier->second;
                 if (strcmp(jack_port_type(port), JACK_DEFAULT_AUDIO_TYPE) == 0) {
                         arf_thread->push(time, SAMPLED, jack_port_short_name(port),
-                                         nframes * sizeof(sample_t), buffer);
+                                         nframes * sizeof(sample_t), buffer, priority);
                 }
                 else {
                         jack_midi_event_t event;
@@ -85,7 +153,7 @@ process(jack_client *client, nframes_t nframes, nframes_t time) JILL_RT
                                 if (event.size == 0) continue;
                                 arf_thread->push(time + event.time,
                                                  EVENT, jack_port_short_name(port),
-                                                 event.size, event.buffer);
+                                                 event.size, event.buffer, priority);
                         }
                 }
         }
@@ -188,43 +256,95 @@ main(int argc, char **argv)
         try {
                 options.parse(argc,argv);
                 auto client = jack_client(options.client_name, options.server_name);
-                auto writer = std::make_unique<arf_writer>(options.output_file,
-                                                           client,
-                                                           options.additional_options,
-                                                           options.compression);
+                const std::size_t nshards = 1 + options.shard_files.size();
+                /* with more than one file, entries starting at the same frame
+                 * get the same name in all of them */
+                auto numbering = (nshards > 1) ? std::make_shared<file::entry_numbering>() : nullptr;
+                auto make_writer = [&](string const & path, std::size_t shard) {
+                        auto attrs = options.additional_options;
+                        if (nshards > 1) {
+                                attrs["jill_shard"] = std::to_string(shard);
+                                attrs["jill_shards"] = std::to_string(nshards);
+                        }
+                        auto w = std::make_unique<arf_writer>(path, client, attrs,
+                                                              options.compression, numbering,
+                                                              std::size_t(options.page_size_kb) << 10);
+                        if (options.rotate_every.count() > 0 || options.max_size_mb > 0)
+                                w->prepare_rotation();
+                        /* a trigger opens an entry with the pretrigger
+                         * data already waiting to be written */
+                        if (options.count("trig"))
+                                w->prepare_entries();
+                        if (options.count("compact-events"))
+                                w->use_compact_events();
+                        return w;
+                };
 
                 /* The activation object below stops the callbacks, but that
                  * is not enough here. arf_thread is at file scope and so
-                 * outlives this one, while the writer it owns holds a
-                 * reference to client and calls into it while draining --
+                 * outlives this one, while the writers it owns hold a
+                 * reference to client and call into it while draining --
                  * new_entry() and get_dataset() both do. It therefore has to be
                  * released before client goes out of scope, on the error paths
                  * as well as the normal one. Leaving it to static destruction
                  * would also run it after HDF5 has finalized itself.
                  *
                  * This is the one module where scoping the activation is not
-                 * sufficient; the rest is a consequence of the writer holding a
-                 * reference to a local, and would go away if arf_thread's
+                 * sufficient; the rest is a consequence of the writers holding
+                 * a reference to a local, and would go away if arf_thread's
                  * ownership moved into main. */
                 util::scope_guard release_writer{[&]{ arf_thread.reset(); }};
 
                 /* create ports: one for trigger, and one for each input */
+                std::vector<std::unique_ptr<dsp::buffered_data_writer>> shards;
                 if (options.count("trig")) {
                         LOG << "recordings will be triggered";
                         port_trig = client.register_port("trig_in",JACK_DEFAULT_MIDI_TYPE,
                                                          JackPortIsInput | JackPortIsTerminal, 0);
-                        arf_thread.reset(new dsp::triggered_data_writer(
-                                                 std::move(writer),
-                                                 jack_port_short_name(port_trig),
-                                                 options.pretrigger_size_s * client.sampling_rate(),
-                                                 options.posttrigger_size_s * client.sampling_rate()));
+                        shards.emplace_back(new dsp::triggered_data_writer(
+                                                    make_writer(options.output_file, 0),
+                                                    jack_port_short_name(port_trig),
+                                                    options.pretrigger_size_s * client.sampling_rate(),
+                                                    options.posttrigger_size_s * client.sampling_rate()));
                 }
                 else {
                         LOG << "recording will be continuous";
-                        arf_thread.reset(new dsp::buffered_data_writer(std::move(writer)));
+                        shards.emplace_back(new dsp::buffered_data_writer(
+                                                    make_writer(options.output_file, 0)));
+                        for (std::size_t i = 1; i < nshards; ++i) {
+                                LOG << "shard " << i << " will be written to "
+                                    << options.shard_files[i - 1];
+                                shards.emplace_back(new dsp::buffered_data_writer(
+                                                            make_writer(options.shard_files[i - 1], i)));
+                        }
+                }
+                arf_thread = std::make_unique<dsp::sharded_data_writer>(std::move(shards));
+                /* bind socket for storing messages in arf file. Only the first
+                 * file gets the log, as the socket can only be bound once. */
+                arf_thread->shard(0).bind_logger(options.server_name);
+
+                /* how each writer is keeping up: a line in its file's log
+                 * every so often, and with --stats-interval the same figures
+                 * published alongside the process callback timings */
+                const std::chrono::milliseconds publish(options.get<unsigned>("stats-interval", 0));
+                std::filesystem::path stats_dir("/tmp/org.meliza.jill");
+                stats_dir /= options.server_name;
+                stats_dir /= client.name();
+                if (publish.count() > 0)
+                        std::filesystem::create_directories(stats_dir);
+                for (std::size_t i = 0; i < arf_thread->size(); ++i) {
+                        dsp::buffered_data_writer & shard = arf_thread->shard(i);
+                        shard.set_soft_limit(options.soft_limit);
+                        shard.set_reserve(options.reserve);
+                        string endpoint;
+                        if (publish.count() > 0) {
+                                const string name = (i == 0) ? "writer-stats"
+                                        : "writer-stats-" + std::to_string(i);
+                                endpoint = "ipc://" + (stats_dir / name).string();
+                        }
+                        shard.report_stats(std::chrono::seconds(options.buffer_stats_s),
+                                           endpoint, publish);
                 }
-                /* bind socket for storing messages in arf file */
-                arf_thread->bind_logger(options.server_name);
 
                 /* register input ports */
                 if (options.count("in")) {
@@ -269,6 +389,37 @@ main(int argc, char **argv)
                                               JackPortIsInput | JackPortIsTerminal, 0);
                 }
 
+                /* Priorities. A port not named is in the first tier, and so is
+                 * the trigger, whatever it is called: losing a trigger would
+                 * lose whole recordings. */
+                for (auto const & kv : options.port_priorities) {
+                        jack_port_t const * found = nullptr;
+                        for (jack_port_t const * p : client.ports())
+                                if (kv.first == jack_port_short_name(p)) found = p;
+                        if (found == nullptr) {
+                                LOG << "ERROR: no port named " << kv.first << " to set the priority of";
+                                throw Exit(EXIT_FAILURE);
+                        }
+                        if (found == port_trig) continue;
+                        const unsigned tier = parse_tier(kv.second);
+                        if (tier > 0) {
+                                port_tiers[found] = tier;
+                                LOG << kv.first << " will be dropped first if the writer falls behind"
+                                    << " (tier " << tier << ")";
+                        }
+                }
+
+                /* Shards. Audio and event ports are dealt out in turn, in the
+                 * order they were registered */
+                if (arf_thread->size() > 1) {
+                        std::size_t next = 0;
+                        for (jack_port_t const * p : client.ports()) {
+                                const std::size_t shard = next++ % arf_thread->size();
+                                arf_thread->route(jack_port_short_name(p), shard);
+                                LOG << jack_port_short_name(p) << " -> shard " << shard;
+                        }
+                }
+
                 // register signal handlers
                 signal(SIGINT,  signal_handler);
                 signal(SIGTERM, signal_handler);
@@ -297,9 +448,31 @@ main(int argc, char **argv)
 
                 /* Wait for a signal or a server shutdown, then stop the
                  * writer from here. stop() takes a lock, so it cannot be
-                 * called from the signal handler. */
+                 * called from the signal handler. Meanwhile, move on to new
+                 * files when it is time, or when any shard has recorded
+                 * --max-size since the last change. That is counted as the
+                 * data go to the file, before compression, so compressed files
+                 * come out smaller; pretrigger data that is never written does
+                 * not count. */
+                using clock = std::chrono::system_clock;
+                const std::uint64_t max_bytes = std::uint64_t(options.max_size_mb) << 20;
+                auto rotate_time = (options.rotate_every.count() > 0)
+                        ? next_rotation(clock::now(), options.rotate_every)
+                        : clock::time_point::max();
+                std::vector<std::uint64_t> rotated_bytes(arf_thread->size(), 0);
                 while (running) {
                         usleep(100000);
+                        bool due = clock::now() >= rotate_time;
+                        for (std::size_t i = 0; max_bytes > 0 && i < arf_thread->size(); ++i)
+                                if (arf_thread->shard(i).bytes_written() - rotated_bytes[i] >= max_bytes)
+                                        due = true;
+                        if (!due) continue;
+                        INFO << "starting new files";
+                        arf_thread->rotate();
+                        if (options.rotate_every.count() > 0)
+                                rotate_time = next_rotation(clock::now(), options.rotate_every);
+                        for (std::size_t i = 0; i < arf_thread->size(); ++i)
+                                rotated_bytes[i] = arf_thread->shard(i).bytes_written();
                 }
                 arf_thread->stop();
                 arf_thread->join();
@@ -336,7 +509,15 @@ jrecord_options::jrecord_options(string const &program_name)
                 ("trig,t",    po::value<svec>()->multitoken()->zero_tokens(),
                  "record in triggered mode (optionally specify inputs)")
                 ("buffer",     po::value<float>(&buffer_size_s)->default_value(2.0),
-                 "minimum ringbuffer size (s)");
+                 "minimum ringbuffer size (s)")
+                ("soft-limit", po::value<float>(&soft_limit)->default_value(0.75),
+                 "fraction of the ringbuffer at which to stop flushing and compressing (0 to disable)")
+                ("priority,p", po::value<svec>(),
+                 "set the priority of a port (port=high|normal|low, or a tier number)")
+                ("reserve",    po::value<float>(&reserve)->default_value(0.1),
+                 "fraction of the ringbuffer each priority tier leaves for those above it")
+                ("shard-file", po::value<svec>(&shard_files)->multitoken(),
+                 "write a share of the channels to each of these files as well (continuous only)");
 
         po::options_description tropts("Capture options");
         tropts.add_options()
@@ -347,7 +528,16 @@ jrecord_options::jrecord_options(string const &program_name)
                 ("posttrigger", po::value<float>(&posttrigger_size_s)->default_value(0.5),
                  "duration to record after offset trigger (s)")
                 ("compression", po::value<int>(&compression)->default_value(0),
-                 "set compression in output file (0-9)");
+                 "set compression in output file (0-9)")
+                ("page-size",   po::value<unsigned>(&page_size_kb)->default_value(0),
+                 "create output files with paged file space, in pages of N KB (0 to disable)")
+                ("compact-events", "store events as fixed-size records, with strings in a side table")
+                ("buffer-stats", po::value<unsigned>(&buffer_stats_s)->default_value(60),
+                 "log ringbuffer and writer statistics every N s (0 to disable)")
+                ("rotate",      po::value<string>(),
+                 "start a new output file hourly, daily, or every N s")
+                ("max-size",    po::value<int>(&max_size_mb)->default_value(0),
+                 "start a new output file after recording this many MB (0 for no limit)");
 
         // command-line options
         cmd_opts.add(jillopts).add(tropts);
@@ -380,4 +570,43 @@ jrecord_options::process_options()
                 throw Exit(EXIT_FAILURE);
         }
         parse_keyvals(additional_options, "attr");
+        parse_keyvals(port_priorities, "priority");
+        if (max_size_mb < 0) {
+                LOG << "ERROR: --max-size cannot be negative";
+                throw Exit(EXIT_FAILURE);
+        }
+        rotate_every = std::chrono::seconds(0);
+        if (auto rotate = get<string>("rotate")) {
+                try {
+                        rotate_every = parse_rotation(*rotate);
+                }
+                catch (std::logic_error const &) {
+                        LOG << "ERROR: " << *rotate << " is not a rotation interval";
+                        throw Exit(EXIT_FAILURE);
+                }
+        }
+        if (!shard_files.empty() && count("trig")) {
+                LOG << "ERROR: --shard-file cannot be used with --trig";
+                throw Exit(EXIT_FAILURE);
+        }
+        if (reserve < 0 || reserve >= 1) {
+                LOG << "ERROR: --reserve must be at least 0 and less than 1";
+                throw Exit(EXIT_FAILURE);
+        }
+        for (auto const & kv : port_priorities) {
+                unsigned tier;
+                try {
+                        tier = parse_tier(kv.second);
+                }
+                catch (std::logic_error const &) {
+                        LOG << "ERROR: " << kv.second << " is not a priority (for " << kv.first << ")";
+                        throw Exit(EXIT_FAILURE);
+                }
+                // a tier the reserve leaves no room for would record nothing but gaps
+                if (tier > dsp::buffered_data_writer::lowest_tier(reserve)) {
+                        LOG << "ERROR: with --reserve " << reserve << ", priority "
+                            << kv.second << " (for " << kv.first << ") can never be recorded";
+                        throw Exit(EXIT_FAILURE);
+                }
+        }
 }
@@ -0,0 +1,432 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ *
+ */
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <unistd.h>
+#include <csignal>
+
+#include "jill/logging.hh"
+#include "jill/jack_client.hh"
+#include "jill/program_options.hh"
+#include "jill/midi.hh"
+#include "jill/file/arf_writer.hh"
+#include "jill/dsp/buffered_data_writer.hh"
+#include "jill/dsp/spike_detector.hh"
+#include "jill/util/scope_guard.hh"
+
+#define PROGRAM_NAME "jspike"
+
+using namespace jill;
+using std::string;
+using svec = std::vector<string>;
+
+class jspike_options : public program_options {
+
+public:
+        jspike_options(string const &program_name);
+
+        string server_name;
+        string client_name;
+
+        /** key-value pairs to store as attributes in created entries */
+        std::map<string, string> additional_options;
+
+        string output_file;
+        float low_hz;
+        float high_hz;
+        float threshold;
+        dsp::spike_detector<sample_t>::polarity_type polarity;
+        float refractory_ms;
+        float pre_ms;
+        float post_ms;
+        float tau_s;
+        float settle_s;
+        float max_rate;
+        float buffer_size_s;
+        int compression;
+
+protected:
+
+        void print_usage() override;
+        void process_options() override;
+
+};
+
+/*
+ * One input. The detector is built once the sampling rate is known, before
+ * activation; the payload is the event pushed to the writer for each spike,
+ * allocated along with it so that process() only fills it in.
+ */
+struct channel_t {
+        jack_port_t * port;
+        std::unique_ptr<dsp::spike_detector<sample_t>> detector;
+        std::vector<char> payload;
+};
+
+jspike_options options(PROGRAM_NAME);
+std::unique_ptr<dsp::buffered_data_writer> arf_thread;
+std::vector<channel_t> channels;
+/* the sampling rate the detectors were built for, and the length of the
+ * snippets after the crossing */
+nframes_t detector_rate = 0;
+nframes_t snippet_post = 0;
+/* set to start a new entry at the next period: the first, and after a gap */
+std::atomic<bool> split(true);
+bool started = false;           // the realtime thread's own
+/* cleared by the signal handler; main() drives the shutdown */
+std::atomic<bool> running(true);
+
+
+/*
+ * Each spike is a note_on event on its channel's dataset, at the frame the
+ * signal crossed the threshold. The body is the snippet of filtered signal
+ * as 16-bit little-endian integers, full scale being 1.0, which arf_writer
+ * stores hex-encoded like any other standard MIDI message.
+ *
+ * Nothing else is pushed, so without a split the writer would open an entry
+ * at the first spike. Snippets come out post samples after their crossings,
+ * a channel at a time, so a later channel's spike can have crossed before one
+ * already pushed, and the writer would take the frame count going backwards
+ * for a wrap and start another entry. The first entry starts at the first
+ * period instead, and one after a gap far enough back to take the spikes
+ * that crossed before the gap and finish after it.
+ */
+int
+process(jack_client *client, nframes_t nframes, nframes_t time) JILL_RT
+{
+        if (split.exchange(false)) {
+                arf_thread->reset_at(started ? time - snippet_post : time);
+                started = true;
+        }
+        for (channel_t & c : channels) {
+                sample_t const * in = client->samples(c.port, nframes);
+                if (in == nullptr) continue;
+                char const * id = jack_port_short_name(c.port);
+                c.detector->push(in, nframes, time,
+                                 [&](nframes_t frame, sample_t const * snippet, std::size_t n) {
+                                         char * out = c.payload.data() + 1;
+                                         for (std::size_t i = 0; i < n; ++i) {
+                                                 const float s = std::clamp(snippet[i], -1.0f, 1.0f);
+                                                 const std::int16_t v = std::lrint(s * 32767);
+                                                 out[2 * i] = v & 0xff;
+                                                 out[2 * i + 1] = (v >> 8) & 0xff;
+                                         }
+                                         arf_thread->push(frame, EVENT, id, c.payload.size(),
+                                                          c.payload.data());
+                                 });
+        }
+        return 0;
+}
+
+
+int
+jack_xrun(jack_client *client, float delay)
+{
+        arf_thread->xrun();
+        return 0;
+}
+
+
+/*
+ * Builds a detector for each channel, as the filter and every duration depend
+ * on the rate. Returns the upper edge of the band, which is lowered if it is
+ * too close to the Nyquist frequency.
+ */
+float
+make_detectors(nframes_t samplerate)
+{
+        using detector_t = dsp::spike_detector<sample_t>;
+        const double fs = samplerate;
+        const float high_hz = std::min<double>(options.high_hz, 0.45 * fs);
+        if (high_hz < options.high_hz)
+                LOG << "WARNING: lowering the upper band edge to " << high_hz << " Hz";
+        auto samples = [fs](float ms) { return std::size_t(std::lround(ms * fs / 1000)); };
+        const std::size_t pre = samples(options.pre_ms);
+        const std::size_t post = samples(options.post_ms);
+        for (channel_t & c : channels) {
+                dsp::sos_filter filter({dsp::sos_filter::highpass(options.low_hz, fs),
+                                        dsp::sos_filter::lowpass(high_hz, fs)});
+                c.detector = std::make_unique<detector_t>(std::move(filter), options.threshold,
+                                                          options.polarity,
+                                                          samples(options.refractory_ms),
+                                                          pre, post,
+                                                          samples(options.settle_s * 1000),
+                                                          samples(options.tau_s * 1000));
+                c.payload.assign(1 + 2 * c.detector->snippet_size(), 0);
+                c.payload[0] = midi::status_type(midi::status_type::note_on, 0).value();
+        }
+        detector_rate = samplerate;
+        snippet_post = post;
+        LOG << "band: " << options.low_hz << "-" << high_hz << " Hz";
+        LOG << "threshold: " << options.threshold << " x noise";
+        LOG << "snippets: " << pre << " samples before, " << post << " from the crossing";
+        return high_hz;
+}
+
+
+/*
+ * Called once when the callback is set, and whenever the sampling rate
+ * changes. process() may be running with the detectors, so they cannot be
+ * rebuilt here; and the file's attributes describe the old rate. A change
+ * ends the recording instead.
+ */
+int
+samplerate_callback(jack_client *client, nframes_t samplerate)
+{
+        if (samplerate != detector_rate) {
+                LOG << "ERROR: sampling rate changed from " << detector_rate << " to "
+                    << samplerate << " Hz; stopping";
+                running = false;
+        }
+        return 0;
+}
+
+
+int
+jack_bufsize(jack_client *client, nframes_t nframes)
+{
+        /* As in jrecord, a change in period size means the stream had a gap,
+         * which a new entry marks. The ringbuffer is sized for every channel
+         * firing at --max-rate; spikes are small next to the samples jrecord
+         * buffers, so this is well short of what it would need. */
+        static nframes_t last_period = 0;
+        if (last_period != 0 && last_period != nframes) {
+                LOG << "WARNING: JACK period size changed from " << last_period
+                    << " to " << nframes << " frames; starting a new entry to mark the gap.";
+        }
+        last_period = nframes;
+
+        std::size_t event = sizeof(data_block_t) + 8;
+        if (!channels.empty()) event += channels.front().payload.size();
+        std::size_t bytes = options.max_rate * options.buffer_size_s * channels.size() * event;
+        bytes = arf_thread->request_buffer_size(std::max<std::size_t>(bytes, nframes * event));
+        split = true;
+        LOG << "ringbuffer size (bytes): " << bytes;
+        return 0;
+}
+
+
+void
+jack_shutdown(jack_status_t code, char const * msg)
+{
+        LOG << "jackd shut the client down (" << msg << ")";
+        running = false;
+}
+
+
+/* Only sets a flag; main() does the rest. See jrecord. */
+void
+signal_handler(int sig)
+{
+        running = false;
+}
+
+
+int
+main(int argc, char **argv)
+{
+        using namespace std;
+        using jill::file::arf_writer;
+        int ret = 0;
+        map<string,string> port_connections;
+        try {
+                options.parse(argc,argv);
+                auto client = jack_client(options.client_name, options.server_name);
+
+                /* register input ports */
+                int name_index = 0;
+                for (const auto & it : options.vmap["in"].as<svec>()) {
+                        jack_port_t *p = client.get_port(it);
+                        if (p == nullptr) {
+                                LOG << "error registering port: source port \""
+                                    << it << "\" does not exist";
+                                throw Exit(-1);
+                        }
+                        else if (!(jack_port_flags(p) & JackPortIsOutput) ||
+                                 strcmp(jack_port_type(p), JACK_DEFAULT_AUDIO_TYPE) != 0) {
+                                LOG << "error registering port: source port \""
+                                    << it << "\" is not a sampled output port";
+                                throw Exit(-1);
+                        }
+                        char buf[16];
+                        snprintf(buf, sizeof(buf), "spk_%03d", name_index++);
+                        LOG << "startup connection: " << it << " -> " << buf;
+                        channel_t c;
+                        c.port = client.register_port(buf, JACK_DEFAULT_AUDIO_TYPE,
+                                                      JackPortIsInput | JackPortIsTerminal, 0);
+                        channels.push_back(std::move(c));
+                        port_connections[buf] = it;
+                }
+                const float high_hz = make_detectors(client.sampling_rate());
+
+                /* Describe the events, so the file can be read without this
+                 * program's options to hand */
+                auto attrs = options.additional_options;
+                attrs["jill_spike_band"] = std::to_string(options.low_hz) + "-"
+                        + std::to_string(high_hz);
+                attrs["jill_spike_threshold"] = std::to_string(options.threshold);
+                attrs["jill_spike_pre_ms"] = std::to_string(options.pre_ms);
+                attrs["jill_spike_post_ms"] = std::to_string(options.post_ms);
+                attrs["jill_spike_encoding"] = "int16le";
+                auto writer = std::make_unique<arf_writer>(options.output_file, client, attrs,
+                                                           options.compression);
+
+                // see jrecord: the writer holds a reference to client
+                util::scope_guard release_writer{[&]{ arf_thread.reset(); }};
+                arf_thread = std::make_unique<dsp::buffered_data_writer>(std::move(writer));
+                arf_thread->bind_logger(options.server_name);
+
+                // register signal handlers
+                signal(SIGINT,  signal_handler);
+                signal(SIGTERM, signal_handler);
+                signal(SIGHUP,  signal_handler);
+
+                // register callbacks; the detectors the buffer size
+                // depends on are built already
+                client.set_shutdown_callback(jack_shutdown);
+                client.set_xrun_callback(jack_xrun);
+                client.set_sample_rate_callback(samplerate_callback);
+                client.set_process_callback(process);
+                client.set_buffer_size_callback(jack_bufsize);
+
+                // start disk thread and activate process callback
+                activated_client active(client);
+                arf_thread->start();
+
+                for (auto const & kv : port_connections)
+                        active.connect_port(kv.second, kv.first);
+
+                while (running) {
+                        usleep(100000);
+                }
+                arf_thread->stop();
+                arf_thread->join();
+        }
+        catch (Exit const &e) {
+                ret = e.status();
+        }
+        catch (exception const &e) {
+                LOG << "ERROR: " << e.what();
+                ret = EXIT_FAILURE;
+        }
+
+        return ret;
+}
+
+
+/** implementation of jspike_options */
+jspike_options::jspike_options(string const &program_name)
+        : program_options(program_name)
+{
+        po::options_description jillopts("JILL options");
+        jillopts.add_options()
+                ("server,s",  po::value<string>(&server_name)->default_value("default"),
+                 "connect to specific jack server")
+                ("name,n",    po::value<string>(&client_name)->default_value(_program_name),
+                 "set client name")
+                ("in,i",      po::value<svec>(),
+                 "connect to an input port: must be the name of an existing sampled port")
+                ("buffer",    po::value<float>(&buffer_size_s)->default_value(2.0),
+                 "minimum ringbuffer size (s)");
+
+        po::options_description spkopts("Detection options");
+        spkopts.add_options()
+                ("band",       po::value<string>()->default_value("300,6000"),
+                 "pass band of the filter (low,high Hz)")
+                ("thresh",     po::value<float>(&threshold)->default_value(4.5),
+                 "threshold, in multiples of the estimated noise")
+                ("polarity",   po::value<string>()->default_value("neg"),
+                 "direction of spikes (neg, pos, or both)")
+                ("refractory", po::value<float>(&refractory_ms)->default_value(1.0),
+                 "time after a spike before the next is looked for (ms)")
+                ("pre",        po::value<float>(&pre_ms)->default_value(0.5),
+                 "length of waveform to keep before the crossing (ms)")
+                ("post",       po::value<float>(&post_ms)->default_value(1.0),
+                 "length of waveform to keep from the crossing (ms)")
+                ("tau",        po::value<float>(&tau_s)->default_value(10),
+                 "time constant of the noise estimate (s)")
+                ("settle",     po::value<float>(&settle_s)->default_value(1),
+                 "time to settle before detecting anything (s)")
+                ("max-rate",   po::value<float>(&max_rate)->default_value(200),
+                 "spike rate per channel to size the ringbuffer for (s^-1)");
+
+        po::options_description fileopts("Output options");
+        fileopts.add_options()
+                ("attr,a",     po::value<svec>(),
+                 "set additional attributes for recorded entries (key=value)")
+                ("compression", po::value<int>(&compression)->default_value(0),
+                 "set compression in output file (0-9)");
+
+        cmd_opts.add(jillopts).add(spkopts).add(fileopts);
+        cmd_opts.add_options()
+                ("output-file,f", po::value<string>(), "output filename");
+        pos_opts.add("output-file", -1);
+        visible_opts.add(jillopts).add(spkopts).add(fileopts);
+}
+
+
+void
+jspike_options::print_usage()
+{
+        std::cout << "Usage: " << _program_name << " [options] -i port [-i port ...] output-file\n"
+                  << visible_opts << std::endl
+                  << "Ports:\n"
+                  << " * spk_NNN:    sampled input ports, one for each -i\n\n"
+                  << "Each spike is stored as an event in the dataset named for its port"
+                  << std::endl;
+}
+
+
+void
+jspike_options::process_options()
+{
+        program_options::process_options();
+        if (!assign(output_file, "output-file")) {
+                LOG << "ERROR: missing required output file name " << std::endl;
+                throw Exit(EXIT_FAILURE);
+        }
+        if (!count("in")) {
+                LOG << "ERROR: no input ports (-i)";
+                throw Exit(EXIT_FAILURE);
+        }
+        parse_keyvals(additional_options, "attr");
+
+        const string band = vmap["band"].as<string>();
+        char comma = 0;
+        std::istringstream bs(band);
+        if (!(bs >> low_hz >> comma >> high_hz) || comma != ',' || !bs.eof()
+            || low_hz <= 0 || high_hz <= low_hz) {
+                LOG << "ERROR: " << band << " is not a pass band (low,high)";
+                throw Exit(EXIT_FAILURE);
+        }
+
+        const string pol = vmap["polarity"].as<string>();
+        using detector_t = dsp::spike_detector<sample_t>;
+        if (pol == "neg") polarity = detector_t::negative;
+        else if (pol == "pos") polarity = detector_t::positive;
+        else if (pol == "both") polarity = detector_t::either;
+        else {
+                LOG << "ERROR: " << pol << " is not a polarity (neg, pos, or both)";
+                throw Exit(EXIT_FAILURE);
+        }
+
+        if (threshold <= 0 || refractory_ms < 0 || pre_ms < 0 || post_ms < 0
+            || tau_s <= 0 || settle_s < 0 || max_rate <= 0) {
+                LOG << "ERROR: detection options must be positive";
+                throw Exit(EXIT_FAILURE);
+        }
+}
@@ -24,8 +24,11 @@
 #include "jill/program_options.hh"
 #include "jill/midi.hh"
 #include "jill/file/stimfile.hh"
+#include "jill/file/stimcache.hh"
+#include "jill/file/stimstream.hh"
 #include "jill/util/readahead_stimqueue.hh"
 #include "jill/dsp/ringbuffer.hh"
+#include "jill/dsp/resampler.hh"
 #include "jill/dsp/playback_timing.hh"
 
 #define PROGRAM_NAME "jstim"
@@ -47,6 +50,14 @@ public:
         std::vector<string> trigin_ports;
 
         std::vector<string> stimuli; // this is postprocessed
+        /** where resampled stimuli are cached; empty to resample every time */
+        string cache_dir;
+        /** fast, medium or best */
+        string resample_quality;
+        /** seconds to decode ahead when streaming; 0 to load whole files */
+        float readahead_sec;
+        /** how many trials the queue keeps loaded ahead of playback */
+        size_t queue_depth;
 
         size_t nreps;           // default set by reps flag
         float min_gap_sec;      // min gap btw sound, in sec
@@ -78,6 +89,8 @@ jstim_options options(PROGRAM_NAME);
  * The pointers _stimlist hands the queue stay valid across growth either way,
  * since it is the unique_ptrs that move and not what they point at. */
 std::vector<std::unique_ptr<stimulus_t>> _stimuli;
+// the members of _stimuli that are streamed, for reporting underruns
+std::vector<file::stimstream const *> _streams;
 // The sequence of trials being played. May be shuffled, and holds one entry
 // per repetition -- several of which alias the same stimulus, which is why the
 // condition flag lives on the entry rather than on the stimulus.
@@ -86,7 +99,13 @@ std::vector<util::trial> _stimlist;
 // needed in a background thread. Must be declared after _stimuli so that the
 // thread can continue to dereference the objects owned by _stimuli.
 std::unique_ptr<util::readahead_stimqueue> stim_queue;
-jack_port_t *port_out, *port_syncout, *port_trigin;
+jack_port_t *port_syncout, *port_trigin;
+/* One output port per stimulus channel, as many as the widest stimulus has.
+ * The two buffer-pointer arrays are sized with the ports so that process()
+ * can fill them in without allocating: the first holds each port's buffer for
+ * the period, the second where in it the stimulus starts. */
+std::vector<jack_port_t *> ports_out;
+std::vector<sample_t *> outs, outs_at;
 std::atomic<int> xruns(0);                  // xrun counter
 std::atomic<nframes_t> last_stop(0);        // time when last stimulus ended
 std::atomic<int> ret(EXIT_SUCCESS);
@@ -125,14 +144,17 @@ process(jack_client *client, nframes_t nframes, nframes_t time) JILL_RT
         nframes_t period_offset;      // the offset in the period to start copying
 
         void * sync = client->events(port_syncout, nframes);
-        sample_t * out = client->samples(port_out, nframes);
-        // zero the output buffer - somewhat inefficient but safer
-        memset(out, 0, nframes * sizeof(sample_t));
+        // zero the output buffers - somewhat inefficient but safer
+        for (size_t c = 0; c < ports_out.size(); ++c) {
+                outs[c] = client->samples(ports_out[c], nframes);
+                memset(outs[c], 0, nframes * sizeof(sample_t));
+        }
 
         // the currently playing trial (or nullptr), and the one before it
         util::trial const * current = stim_queue->head();
         util::trial const * last = stim_queue->previous();
-        jill::stimulus_t const * stim = (current) ? current->stim : nullptr;
+        // not const: reading a streamed stimulus consumes it
+        jill::stimulus_t * stim = (current) ? current->stim : nullptr;
         jill::stimulus_t const * last_stim = (last) ? last->stim : nullptr;
 
         // handle xruns
@@ -245,9 +267,10 @@ process(jack_client *client, nframes_t nframes, nframes_t time) JILL_RT
         // DBG << "stim_offset=" << stim_offset << ", period_offset="
         //     << period_offset << ", nsamples=" << nsamples;
         if (nsamples > 0) {
-                memcpy(out + period_offset,
-                       stim->buffer() + stim_offset,
-                       nsamples * sizeof(sample_t));
+                // every channel in one call, so a stream is consumed once
+                for (size_t c = 0; c < outs.size(); ++c)
+                        outs_at[c] = outs[c] + period_offset;
+                stim->read(outs_at.data(), outs_at.size(), stim_offset, nsamples);
                 stim_offset += nsamples;
         }
         // did the stimulus end?
@@ -343,10 +366,21 @@ parse_count(string const & s, size_t & out)
         return true;
 }
 
+/* The name of output port @a c of @a n. A single channel keeps the name it has
+ * always had; with more, they are numbered from zero, as jrecord numbers its
+ * inputs. */
+static string
+output_port_name(size_t c, size_t n)
+{
+        return (n == 1) ? string("out") : "out_" + std::to_string(c);
+}
+
 /* parse the list of stimuli */
 static void
 init_stimset(std::vector<string> const & stims, size_t const default_nreps,
-             float condition_prob, std::mt19937 & rng)
+             float condition_prob, std::mt19937 & rng,
+             std::shared_ptr<file::stimcache const> cache, nframes_t readahead,
+             dsp::resample_quality quality)
 {
         namespace fs = std::filesystem;
 
@@ -364,7 +398,18 @@ init_stimset(std::vector<string> const & stims, size_t const default_nreps,
                         i += 1;
                 }
                 try {
-                        _stimuli.push_back(std::make_unique<file::stimfile>(p.string()));
+                        if (readahead > 0) {
+                                auto stream = std::make_unique<file::stimstream>(p.string(),
+                                                                                 readahead,
+                                                                                 quality);
+                                _streams.push_back(stream.get());
+                                _stimuli.push_back(std::move(stream));
+                        }
+                        else {
+                                _stimuli.push_back(std::make_unique<file::stimfile>(p.string(),
+                                                                                    cache,
+                                                                                    quality));
+                        }
                         jill::stimulus_t * stim = _stimuli.back().get();
                         /* Assign the condition by counting rather than by
                          * drawing per trial. Every stimulus gets exactly
@@ -439,18 +484,46 @@ main(int argc, char **argv)
                         throw std::invalid_argument("--condition-prob must be between 0 and 1");
                 }
                 std::mt19937 rng(std::random_device{}());
-                init_stimset(options.stimuli, options.nreps, options.condition_prob, rng);
+                std::shared_ptr<file::stimcache const> cache;
+                if (!options.cache_dir.empty()) {
+                        cache = std::make_shared<file::stimcache const>(options.cache_dir);
+                        LOG << "caching resampled stimuli in " << cache->path();
+                }
+                if (options.readahead_sec < 0.0) {
+                        throw std::invalid_argument("--readahead must not be negative");
+                }
+                const nframes_t readahead = options.readahead_sec * sampling_rate;
+                if (readahead > 0) {
+                        LOG << "streaming stimuli from disk with " << options.readahead_sec
+                            << " s (" << readahead << " samples) of readahead";
+                        if (cache) LOG << "streamed stimuli are not cached";
+                }
+                const auto quality = dsp::parse_resample_quality(options.resample_quality);
+                init_stimset(options.stimuli, options.nreps, options.condition_prob, rng,
+                             cache, readahead, quality);
                 if (options.count("shuffle")) {
                         LOG << "shuffled stimuli";
                         shuffle(_stimlist.begin(), _stimlist.end(), rng);
                 }
                 stim_queue.reset(new util::readahead_stimqueue(_stimlist.begin(), _stimlist.end(),
                                                           client.sampling_rate(),
-                                                          options.count("loop")));
-
-
-                port_out = client.register_port("out", JACK_DEFAULT_AUDIO_TYPE,
-                                                 JackPortIsOutput | JackPortIsTerminal, 0);
+                                                          options.count("loop"),
+                                                          options.queue_depth));
+
+
+                /* a port for every channel of the widest stimulus. Narrower
+                 * ones leave the extra ports silent. */
+                unsigned nchannels = 1;
+                for (auto const & stim : _stimuli)
+                        nchannels = std::max(nchannels, stim->nchannels());
+                if (nchannels > 1) LOG << "playing " << nchannels << " output channels";
+                for (unsigned c = 0; c < nchannels; ++c) {
+                        ports_out.push_back(client.register_port(
+                                output_port_name(c, nchannels), JACK_DEFAULT_AUDIO_TYPE,
+                                JackPortIsOutput | JackPortIsTerminal, 0));
+                }
+                outs.resize(nchannels);
+                outs_at.resize(nchannels);
                 port_syncout = client.register_port("sync_out", JACK_DEFAULT_MIDI_TYPE,
                                                      JackPortIsOutput | JackPortIsTerminal, 0);
                 if (options.count("trig")) {
@@ -474,8 +547,14 @@ main(int argc, char **argv)
                 // when the buffer size *changes*
                 client.set_buffer_size_callback(jack_bufsize);
 
-                active.connect_ports("out",
-                                      options.output_ports.begin(), options.output_ports.end());
+                /* With one channel every --out is connected to it. With more,
+                 * they are dealt out in turn: the first to out_0, the second
+                 * to out_1, and so on, wrapping round, so that listing the
+                 * speakers in order wires them up. */
+                for (size_t i = 0; i < options.output_ports.size(); ++i) {
+                        active.connect_port(output_port_name(i % nchannels, nchannels),
+                                            options.output_ports[i]);
+                }
                 active.connect_ports("sync_out",
                                       options.syncout_ports.begin(), options.syncout_ports.end());
                 active.connect_ports(options.trigin_ports.begin(), options.trigin_ports.end(),
@@ -484,11 +563,31 @@ main(int argc, char **argv)
 		// Poll the running flag and the stimulus queue. Running gets
 		// flipped to false by signal handlers; stimulus queue flags
 		// finished when the stimulus list is complete.
+                size_t underruns = 0;
+                size_t starved = 0;
                 while (running && !stim_queue->finished()) {
                         usleep(100000);
+                        const auto qs = stim_queue->statistics();
+                        if (qs.starved > starved) {
+                                LOG << "WARNING: the next stimulus was not ready in time ("
+                                    << qs.starved << " times); mean load " << qs.mean_load_ms
+                                    << " ms, max " << qs.max_load_ms << " ms";
+                                starved = qs.starved;
+                        }
+                        size_t total = 0;
+                        for (auto const * s : _streams) total += s->underruns();
+                        if (total > underruns) {
+                                LOG << "WARNING: " << total - underruns << " underruns streaming stimuli ("
+                                    << total << " total); increase --readahead";
+                                underruns = total;
+                        }
                 }
                 stim_queue->stop();
                 stim_queue->join();
+                const auto qs = stim_queue->statistics();
+                LOG << "stimulus queue: " << qs.loaded << " trials loaded, mean "
+                    << qs.mean_load_ms << " ms, max " << qs.max_load_ms << " ms; "
+                    << qs.starved << " not ready in time";
                 // wait for posttrigger and midi buffers to clear
                 sleep(options.posttrigger_interval_sec.value_or(0.0) + 1.0);
         }
@@ -556,7 +655,19 @@ jstim_options::jstim_options(string const &program_name)
                 ("condition-prob", po::value(&condition_prob)->default_value(0.0),
                  "proportion of each stimulus's repetitions to mark as being in "
                  "the manipulated condition (channel 2). Exactly this fraction "
-                 "of every stimulus's repeats is marked, chosen at random.");
+                 "of every stimulus's repeats is marked, chosen at random.")
+                ("cache-dir", po::value(&cache_dir),
+                 "keep resampled stimuli in this directory, so later runs at the "
+                 "same rate can map them instead of resampling")
+                ("resample-quality", po::value<string>(&resample_quality)->default_value("best"),
+                 "how carefully to resample stimuli that are not at the server's "
+                 "rate: fast, medium or best")
+                ("queue-depth", po::value(&queue_depth)->default_value(4),
+                 "number of trials to keep loaded ahead of the one playing")
+                ("readahead", po::value(&readahead_sec)->default_value(0.0),
+                 "stream stimuli from disk, decoding this many seconds ahead of "
+                 "playback, instead of loading each file whole. Use for stimuli "
+                 "too long to hold in memory; 0 to disable.");
 
 
         cmd_opts.add(jillopts).add(opts);
@@ -572,7 +683,8 @@ jstim_options::print_usage()
         std::cout << "Usage: " << _program_name << " [options] [stim1 [nreps]] [stim2 [nreps]] ...\n"
                   << visible_opts << std::endl
                   << "Ports:\n"
-                  << " * out:       sampled output of the presented stimulus\n"
+                  << " * out:       sampled output of the presented stimulus. Named out_0,\n"
+                  << "              out_1, ... when a stimulus has more than one channel\n"
                   << " * sync_out:  event port reporting stimulus onset/offsets\n"
                   << " * trig_in:   (optional) event port for triggering playback"
                   << std::endl;
@@ -9,31 +9,41 @@
  * Copyright (C) 2010-2026 C Daniel Meliza <dan || meliza.org>
  */
 #include <iostream>
+#include <algorithm>
 #include <atomic>
 #include <csignal>
+#include <limits>
 #include <memory>
 #include <thread>
 #include <stop_token>
 #include <filesystem>
 #include <map>
-#include <memory>
+#include <unordered_map>
+#include <vector>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
 #include "jill/net/zmq.hh"
+#include "jill/net/jstimserver_binary.hh"
 #include "jill/logging.hh"
 #include "jill/jack_client.hh"
 #include "jill/program_options.hh"
 #include "jill/midi.hh"
 #include "jill/file/stimfile.hh"
+#include "jill/file/stimcache.hh"
 #include "jill/dsp/ringbuffer.hh"
+#include "jill/dsp/playback_schedule.hh"
+#include "jill/dsp/resampler.hh"
+#include "jill/util/doorbell.hh"
 #include "jill/util/scope_guard.hh"
+#include "jill/util/stimset.hh"
 
 constexpr char PROGRAM_NAME[] = "jstimserver";
 
 using namespace jill;
 using namespace jill::net;
 namespace fs = std::filesystem;
+namespace wire = jill::net::stimserver;
 using std::string;
 
 class jstim_options : public program_options {
@@ -47,9 +57,20 @@ public:
         /** Ports to connect to */
         std::vector<string> output_ports;
         std::vector<string> trigout_ports;
+        std::vector<string> trigin_ports;
         midi::data_type trigout_chan;
 
         std::vector<string> stimuli; // this is postprocessed
+        /** where resampled stimuli are cached; empty to resample every time */
+        string cache_dir;
+        /** fast, medium or best */
+        string resample_quality;
+        /** how many threads load stimuli; 0 for one per core */
+        unsigned load_threads;
+        /** most MB of samples to keep resident; 0 to load everything at startup */
+        std::size_t memory_budget_mb;
+        /** how many stimuli may play at once */
+        unsigned voices;
 
 protected:
 
@@ -64,8 +85,11 @@ enum class ProcessStatus {Playing, Stopped};
 struct ProcessRequest {
         enum request_t {None, Start, Interrupt};
         std::atomic<request_t> request;
-        /** the stimulus to start (only used with Start) */
-        stimulus_t const * stim;
+        /** the stimulus to start (only used with Start). Pinned by the main
+         * thread before the request is made; the pin passes to the realtime
+         * thread, which drops it when it is done with the stimulus or
+         * refuses it. */
+        util::stimset::entry * stim;
 
         ProcessRequest() : request(None), stim(0) {}
 
@@ -73,17 +97,27 @@ struct ProcessRequest {
                 return request != None;
         }
 
+        /* stim is cleared before the slot is freed, not after: once request
+         * reads None the main thread may write the next stim, and clearing
+         * it afterwards could wipe that out. */
         void clear() {
-                request.store(None);
                 stim = 0;
+                request.store(None);
         }
 
-        bool start(stimulus_t const * new_stim) {
-                request_t expected = None;
-                if (!request.compare_exchange_strong(expected, Start)) {
+        /* Only the main thread moves the slot out of None, so testing for
+         * None and then storing is not a race, and it lets stim be written
+         * before Start is published. The compare-exchange this replaces
+         * published Start first and wrote stim afterwards, leaving a window
+         * in which the realtime thread could see Start and read a stale
+         * pointer -- harmless when stim was only ever a stimulus that lived
+         * forever, but not now that it carries a pin that must be dropped. */
+        bool start(util::stimset::entry * new_stim) {
+                if (request.load() != None) {
                         return false;
                 }
                 stim = new_stim;
+                request.store(Start);
                 return true;
         }
 
@@ -94,22 +128,51 @@ struct ProcessRequest {
 
 };
 
-// four kinds of events: Started, Interrupted, Finished, Xrun
+/* A start the main thread has scheduled, on its way to the realtime thread.
+ *
+ * These do not go through ProcessRequest, which has one slot and is emptied
+ * every period: a scheduled start may wait far longer than that, and several
+ * may be waiting at once. They go through their own ringbuffer instead, and
+ * the realtime thread moves them into the schedule it keeps in process(). */
+struct ScheduleRequest {
+        /** the stimulus, pinned as for ProcessRequest */
+        util::stimset::entry * stim;
+        /** the JACK frame to start at, or with after_trigger, the frames to
+         * wait after the next onset on trig_in */
+        nframes_t frame;
+        bool after_trigger;
+};
+
+// the events the realtime thread reports to the publisher
 struct Event {
-        enum { Started, Interrupted, Done, Busy, NotPlaying, Xrun } status;
+        enum { Started, Interrupted, Done, Busy, NotPlaying, Xrun, Late, Cancelled } status;
         /** the frame when the event occurred */
         nframes_t time;
         /** the stimulus that started/stopped/was interrupted */
         stimulus_t const * stim;
-
+        /** time on JACK's microsecond clock, filled in by post() */
+        utime_t usec;
 
 };
 
 /** store program options */
 jstim_options options(PROGRAM_NAME);
-/** the pre-loaded stimuli, keyed by name; loaded once at startup and only read
-    afterwards */
-std::map<std::string, std::unique_ptr<stimulus_t>> _stimuli;
+/* The stimuli, keyed by name.
+ *
+ * The set is fixed before the server binds -- every file is opened and named
+ * then, which is fast -- but the samples are loaded and resampled afterwards by
+ * the set's loader threads, so a large library does not hold up the request
+ * socket. Without a memory budget everything is queued for loading at startup
+ * and stays resident. With one, a stimulus is loaded when it is first asked
+ * for, by PLAY or PRELOAD, and the least recently used are unloaded to make
+ * room. Whatever the realtime thread is playing, or has been asked to play, is
+ * pinned, and stays resident until it lets go. Created in main(), once the
+ * sampling rate is known. */
+std::unique_ptr<util::stimset> _stimuli;
+/* Each stimulus's position in the STIMLIST array, which is how the binary
+ * framing names it. Filled in before the publisher starts and only read after,
+ * so it needs no lock. */
+std::unordered_map<stimulus_t const *, std::uint32_t> _stim_index;
 /** signal from main thread to process to start or stop playback */
 ProcessRequest _request;
 /** signal from jack server to process that there was an xrun */
@@ -118,12 +181,70 @@ std::atomic<int> _xruns(0);
 std::atomic<bool> _running(true);
 /** ringbuffer to send events from process thread to zmq publisher */
 static dsp::ringbuffer<Event> _eventbuf(64);
+/* Wakes the publisher when there is something in _eventbuf. It used to poll
+ * every 10 ms, so a client heard about a start or a stop anything up to that
+ * late, and a closed-loop experiment waits on exactly those. Created in main(),
+ * since the constructor can throw. */
+std::unique_ptr<util::doorbell> _eventbell;
+/* How many starts can be scheduled at once.
+ *
+ * The realtime thread keeps them in a fixed array and sorts by insertion, so
+ * this is kept small; it only has to cover the starts a closed-loop protocol
+ * has in flight, which is rarely more than one or two. */
+constexpr std::size_t SCHEDULE_SIZE = 16;
+/** scheduled starts from the main thread to process */
+static dsp::ringbuffer<ScheduleRequest> _schedbuf(SCHEDULE_SIZE);
+/* Scheduled starts that are in flight or waiting, whether in _schedbuf or the
+ * realtime thread's schedule. The main thread counts them in and refuses a
+ * request that would make more than SCHEDULE_SIZE; the realtime thread counts
+ * them out as it starts, refuses or cancels them. So the schedule never has to
+ * turn anything away, which it could not report to anyone. */
+std::atomic<std::size_t> _nscheduled(0);
+/* The schedule itself. Touched only by the realtime thread, and global rather
+ * than a static in process() only so that it does not need a guard variable. */
+dsp::playback_schedule<util::stimset::entry *, SCHEDULE_SIZE> _schedule;
+/* A stimulus being played, one of --voices.
+ *
+ * A voice whose entry is null is free. The entry holds the pin on stim for as
+ * long as the voice plays it, which is what keeps its samples resident. */
+struct Voice {
+        util::stimset::entry * entry;
+        stimulus_t const * stim;
+        /** the position in stim's buffer */
+        nframes_t offset;
+        /** started from the queue, rather than by PLAY */
+        bool queued;
+};
+/* The voices. Sized from --voices in main() before the client is activated,
+ * and touched only by the realtime thread after that. */
+std::vector<Voice> _voices;
+/* How many stimuli can wait in the queue. The ringbuffer rounds this up to a
+ * page, so the real capacity is larger; it is the floor the protocol
+ * promises. */
+constexpr std::size_t QUEUE_SIZE = 64;
+/* The queue, from the main thread to process. Entries are pinned when they
+ * are enqueued and stay in the ringbuffer until they start, so the queue is
+ * full exactly when the ringbuffer is, and ENQUEUE can say so. */
+static dsp::ringbuffer<util::stimset::entry *> _queuebuf(QUEUE_SIZE);
+/** how many entries the main thread has pushed to _queuebuf */
+std::size_t _enqueued = 0;
+/* CLEAR and INTERRUPT drop everything enqueued so far, and no more: the main
+ * thread publishes its count of pushes here, and the realtime thread discards
+ * entries until its count of pops catches up. A flag would be simpler, but
+ * would also take anything enqueued between the CLEAR and the period that
+ * noticed it. */
+std::atomic<std::size_t> _clear_until(0);
 /** jack ports */
-jack_port_t *port_out, *port_trigout;
+jack_port_t *port_trigout, *port_trigin;
+/* One output port per channel of the widest stimulus, and somewhere for
+ * process() to keep their buffers that it does not have to allocate. */
+std::vector<jack_port_t *> ports_out;
+std::vector<sample_t *> outs;
 /* What the realtime thread is playing, or null. Published for STATUS, which
  * is the only way a client can learn the state without having seen every
  * event -- and no client has, since a SUB that connects after the server
- * binds misses everything before it.
+ * binds misses everything before it. With more than one voice playing, this
+ * is the one that started last, if it is still going.
  *
  * Written only by the realtime thread and read only by main, so relaxed is
  * enough: there is no other data whose visibility this has to order, and the
@@ -131,20 +252,81 @@ jack_port_t *port_out, *port_trigout;
 std::atomic<stimulus_t const *> _playing{nullptr};
 
 
+/* Adds n samples of in to out. A plain loop, but one gcc and clang turn into
+ * packed adds at -O2: unit stride, no reduction, and restrict so that they
+ * need not check for overlap. A stimulus never overlaps the port buffer, so
+ * the promise is a safe one. */
+static inline void
+mix(sample_t * __restrict out, sample_t const * __restrict in, nframes_t n) JILL_RT
+{
+        for (nframes_t i = 0; i < n; ++i)
+                out[i] += in[i];
+}
+
+/* Hands an event to the publisher and wakes it. The event's frame is converted
+ * to microseconds here, while JACK's estimate of the period it is in is
+ * current, so that a client can see how long the news took to reach it. */
+static void
+post(jack_client * client, decltype(Event::status) status, nframes_t frame,
+     stimulus_t const * stim) JILL_RT
+{
+        _eventbuf.push(Event{status, frame, stim, client->time(frame)});
+        _eventbell->ring();
+}
+
 /** The realtime process loop for jstimserver. */
 int
 process(jack_client *client, nframes_t nframes, nframes_t time) JILL_RT
 {
         // NB static variables are initialized to 0
-        static stimulus_t const * _stim;       // currently playing stimulus or
-                                               // zero if stopped
-        static nframes_t stim_offset;          // current position in stimulus buffer
+        static std::size_t dequeued;            // entries taken off _queuebuf
+        static bool queue_playing;              // a voice is playing from the queue
+        static stimulus_t const * latest;       // the stimulus started last
 
         void * trig = client->events(port_trigout, nframes);
-        sample_t * out = client->samples(port_out, nframes);
-        // zero the output buffer
-        for(nframes_t i = 0; i < nframes; ++i)
-                out[i] = 0.0f;
+        // zero the output buffers
+        for (std::size_t c = 0; c < ports_out.size(); ++c) {
+                outs[c] = client->samples(ports_out[c], nframes);
+                for (nframes_t i = 0; i < nframes; ++i)
+                        outs[c][i] = 0.0f;
+        }
+
+        auto free_voice = []() -> Voice * {
+                for (auto & v : _voices)
+                        if (!v.entry) return &v;
+                return nullptr;
+        };
+        auto start = [&](Voice & v, util::stimset::entry * entry, nframes_t offset, bool queued) {
+                v = Voice{entry, entry->stim(), 0, queued};
+                if (queued) queue_playing = true;
+                latest = v.stim;
+                midi::write_message(trig, offset, midi::status_type::stim_on, v.stim->name());
+                post(client, Event::Started, time + offset, v.stim);
+        };
+        /* Every path that stops a voice comes through here, so that the pin
+         * is dropped exactly once and the set may evict the samples. Nothing
+         * touches the stimulus's buffer after this. */
+        auto stop = [&](Voice & v) {
+                if (v.queued) queue_playing = false;
+                v.entry->release();
+                v = Voice{};
+        };
+        auto cancel = [client, time](util::stimset::entry * entry) {
+                post(client, Event::Cancelled, time, entry->stim());
+                entry->release();
+        };
+        // @return true if anything was cleared
+        auto clear_queue = [&]() {
+                const std::size_t until = _clear_until.load();
+                bool cleared = false;
+                util::stimset::entry * entry;
+                while (dequeued < until && _queuebuf.pop(&entry, 1) > 0) {
+                        ++dequeued;
+                        cancel(entry);
+                        cleared = true;
+                }
+                return cleared;
+        };
 
         /* An xrun -- or a buffer size change, which routes here too -- means
          * a gap in the audio stream. Truncate anything playing rather than
@@ -161,68 +343,164 @@ process(jack_client *client, nframes_t nframes, nframes_t time) JILL_RT
                  * while idle. Nothing is lost by staying quiet -- a break
                  * between trials affects no playback, and jrecord marks xruns
                  * against the data they actually corrupted. */
-                if (_stim) {
-                        _eventbuf.push(Event{Event::Xrun, time, _stim});
+                for (auto & v : _voices) {
+                        if (!v.entry) continue;
+                        post(client, Event::Xrun, time, v.stim);
                         midi::write_message(trig, 0, midi::status_type::stim_off,
-                                            _stim->name());
-                        _eventbuf.push(Event{Event::Interrupted, time, _stim});
-                        _stim = nullptr;
-                        stim_offset = 0;
+                                            v.stim->name());
+                        post(client, Event::Interrupted, time, v.stim);
+                        stop(v);
                 }
                 _xruns.fetch_add(-1);
         }
 
+        /* Take in newly scheduled starts. The main thread has already made
+         * sure there is room for them. */
+        ScheduleRequest sched;
+        while (_schedbuf.pop(&sched, 1) > 0) {
+                if (sched.after_trigger)
+                        _schedule.arm(sched.stim, sched.frame);
+                else
+                        _schedule.schedule(sched.stim, sched.frame, time);
+        }
+
+        /* An onset on trig_in releases everything armed, counting from the
+         * frame of the onset, not from the period -- which is the point of
+         * arming rather than having the client react and send an absolute
+         * time. The start may well fall in this same period. */
+        if (_schedule.armed()) {
+                const int trigger = midi::find_trigger(client->events(port_trigin, nframes), true);
+                if (trigger >= 0)
+                        _schedule.trigger(time + trigger);
+        }
+
+        /* A start that is already in the past is refused rather than played
+         * late: whoever scheduled it wanted that sample exactly, and starting
+         * at some other one would pass for success in everything but the
+         * timing. It can only happen if the request arrives after its time,
+         * or an xrun swallows it. */
+        _schedule.pop_late(time, [client](auto const & item) {
+                post(client, Event::Late, item.start, item.value->stim());
+                item.value->release();
+                _nscheduled.fetch_sub(1);
+        });
+
         // process request
         if (_request.request == ProcessRequest::Start) {
-                if (_stim) {
-                        _eventbuf.push(Event{Event::Busy, time, nullptr});
+                if (Voice * v = free_voice()) {
+                        start(*v, _request.stim, 0, false);
                 }
                 else {
-                        stim_offset = 0;
-                        _stim = _request.stim;
-                        midi::write_message(trig, 0, midi::status_type::stim_on, _stim->name());
-                        _eventbuf.push(Event{Event::Started, time, _stim});
+                        // refused, so the pin that came with it goes too
+                        _request.stim->release();
+                        post(client, Event::Busy, time, nullptr);
                 }
                 _request.clear();
         }
         else if (_request.request == ProcessRequest::Interrupt) {
-                if (_stim) {
-                        midi::write_message(trig, 0, midi::status_type::stim_off, _stim->name());
-                        _eventbuf.push(Event{Event::Interrupted, time, _stim});
-                        _stim = nullptr;
-                }
-                else {
-                        _eventbuf.push(Event{Event::NotPlaying, time, nullptr});
+                /* An interrupt is a clean slate, so it takes the schedule and
+                 * the queue too. The main thread published the queue's clear
+                 * before the request, so having seen the one, this sees the
+                 * other, and the next queued stimulus cannot slip in below. */
+                bool cancelled = _schedule.size() > 0;
+                _schedule.clear([&](auto const & item) {
+                        cancel(item.value);
+                        _nscheduled.fetch_sub(1);
+                });
+                cancelled |= clear_queue();
+                bool interrupted = false;
+                for (auto & v : _voices) {
+                        if (!v.entry) continue;
+                        midi::write_message(trig, 0, midi::status_type::stim_off, v.stim->name());
+                        post(client, Event::Interrupted, time, v.stim);
+                        stop(v);
+                        interrupted = true;
                 }
+                if (!interrupted && !cancelled)
+                        post(client, Event::NotPlaying, time, nullptr);
                 _request.clear();
         }
+        // CLEAR, which is not a request to this thread and cannot be BUSY
+        clear_queue();
 
-        // if no stimulus queued return
-        if (!_stim) {
-                _playing.store(nullptr, std::memory_order_relaxed);
-                return 0;
-        }
+        /* Work through the period in pieces, split wherever something starts
+         * or stops. Each pass first takes whatever starts at the current
+         * offset -- scheduled starts, then the head of the queue -- then mixes
+         * every voice up to the next start or the next voice to finish, and
+         * retires the voices that finished there.
+         *
+         * Starts are refused only when every voice is busy, so with one voice
+         * this is the old rule: a PLAY or scheduled start is refused while
+         * something is playing, but one that falls after it ends, even in the
+         * same period, is not. The queue is never refused. Its head waits
+         * until no queued stimulus is playing and a voice is free, and then
+         * starts on that very sample, which is what makes it gapless: the next
+         * entry starts on the sample after the last one ended.
+         *
+         * Without a schedule or a queue, and with one voice, this is one pass,
+         * and the same as it always was. */
+        nframes_t pos = 0;                      // offset into the period
+        while (true) {
+                while (_schedule.next_offset(time, nframes) <= pos) {
+                        auto * entry = _schedule.pop().value;
+                        _nscheduled.fetch_sub(1);
+                        if (Voice * v = free_voice()) {
+                                start(*v, entry, pos, false);
+                        }
+                        else {
+                                entry->release();
+                                post(client, Event::Busy, time + pos, nullptr);
+                        }
+                }
+                if (!queue_playing && _queuebuf.read_space() > 0) {
+                        if (Voice * v = free_voice()) {
+                                util::stimset::entry * entry;
+                                _queuebuf.pop(&entry, 1);
+                                ++dequeued;
+                                start(*v, entry, pos, true);
+                        }
+                }
 
-        // copy samples, if there are any
-        nframes_t nsamples = std::min(_stim->nframes() - stim_offset, nframes);
-        auto * stimptr = _stim->buffer() + stim_offset;
-        nframes_t i = 0;
-        for (; i < nsamples; ++i)
-                out[i] = stimptr[i];
-        for (; i < nframes; ++i)
-                out[i] = 0.0f;
-        stim_offset += nsamples;
-
-        // did the stimulus end?
-        if (stim_offset >= _stim->nframes()) {
-                midi::write_message(trig, nsamples, midi::status_type::stim_off, _stim->name());
-                _eventbuf.push(Event{Event::Done, time + nsamples, _stim});
-                _stim = nullptr;
+                // every voice still playing has at least next - pos to go
+                nframes_t next = _schedule.next_offset(time, nframes);
+                for (auto const & v : _voices) {
+                        if (v.entry)
+                                next = pos + dsp::samples_to_copy(v.stim->nframes(), v.offset,
+                                                                  next, pos);
+                }
+                for (auto & v : _voices) {
+                        if (!v.entry) continue;
+                        /* channel by channel, a stimulus with fewer than
+                         * there are ports leaving the rest to the others */
+                        const std::size_t nc = std::min<std::size_t>(v.stim->nchannels(),
+                                                                     outs.size());
+                        for (std::size_t c = 0; c < nc; ++c)
+                                mix(outs[c] + pos, v.stim->channel(c) + v.offset, next - pos);
+                        v.offset += next - pos;
+                }
+                pos = next;
+
+                // did any of them end?
+                for (auto & v : _voices) {
+                        if (v.entry && v.offset >= v.stim->nframes()) {
+                                midi::write_message(trig, pos, midi::status_type::stim_off,
+                                                    v.stim->name());
+                                post(client, Event::Done, time + pos, v.stim);
+                                stop(v);
+                        }
+                }
+                if (pos >= nframes) break;
         }
 
         /* Publish after every transition above, so a STATUS answer is never a
-         * state that did not happen. The other exit stores too. */
-        _playing.store(_stim, std::memory_order_relaxed);
+         * state that did not happen. */
+        stimulus_t const * playing = nullptr;
+        for (auto const & v : _voices) {
+                if (!v.entry) continue;
+                playing = v.stim;
+                if (playing == latest) break;
+        }
+        _playing.store(playing, std::memory_order_relaxed);
         return 0;
 }
 
@@ -254,18 +532,34 @@ void
 jack_shutdown(jack_status_t code, char const *)
 {
         _running.store(false);
+        if (_eventbell) _eventbell->ring();
 }
 
+/* ring() is an atomic exchange and a write(), both safe in a handler */
 void
 signal_handler(int sig)
 {
         _running.store(false);
+        if (_eventbell) _eventbell->ring();
 }
 
 
-/** parse the list of stimuli */
+/* The name of output port @a c of @a n: "out" alone, or numbered from zero */
+static string
+output_port_name(std::size_t c, std::size_t n)
+{
+        return (n == 1) ? string("out") : "out_" + std::to_string(c);
+}
+
+/**
+ * parse the list of stimuli
+ *
+ * @param nchannels  set to the number of channels in the widest stimulus
+ */
 static std::string
-init_stimset(std::vector<string> const & stims, nframes_t sampling_rate)
+init_stimset(std::vector<string> const & stims,
+             std::shared_ptr<file::stimcache const> cache,
+             dsp::resample_quality quality, unsigned & nchannels)
 {
         // serialize the stimulus list here as well. It's sort of a shitty JSON
         // serializer (floats get cast to strings, etc)
@@ -277,7 +571,7 @@ init_stimset(std::vector<string> const & stims, nframes_t sampling_rate)
         for (size_t i = 0; i < stims.size(); ++i) {
                 fs::path p(stims[i]);
                 try {
-                        auto stim = std::make_unique<file::stimfile>(p.string());
+                        auto stim = std::make_unique<file::stimfile>(p.string(), cache, quality);
                         std::string name(stim->name());
                         /* Stimuli are addressed by basename, so two files that
                          * share one are a configuration error there is no
@@ -292,24 +586,29 @@ init_stimset(std::vector<string> const & stims, nframes_t sampling_rate)
                          * accurate; this cannot, because two different files
                          * are claiming one identity.
                          *
-                         * Checked before load_samples() so a misconfigured
-                         * playlist fails immediately rather than after
-                         * resampling everything ahead of the collision. */
-                        if (_stimuli.count(name) > 0) {
+                         * This runs before any samples are loaded, so a
+                         * misconfigured playlist fails immediately rather than
+                         * after resampling everything ahead of the collision. */
+                        if (_stimuli->find(name)) {
                                 std::ostringstream msg;
                                 msg << "duplicate stimulus name '" << name
                                     << "': " << p << " shares a basename with an "
                                     "earlier file, and could never be played";
                                 throw std::invalid_argument(msg.str());
                         }
-                        stim->load_samples(sampling_rate);
-                        // read before the move; the map owns it afterwards
+                        /* The duration comes from the file header, since the
+                         * samples are not loaded yet. Resampling changes it by
+                         * less than a frame, which is below the precision the
+                         * list promises (see the protocol, section 5). */
                         const float duration = stim->duration();
-                        _stimuli.emplace(name, std::move(stim));
+                        const unsigned channels = stim->nchannels();
+                        nchannels = std::max(nchannels, channels);
+                        _stimuli->add(name, std::move(stim));
 
                         pt::ptree stim_node;
                         stim_node.put("name", name);
                         stim_node.put("duration", duration);
+                        stim_node.put("channels", channels);
                         stim_list.push_back(std::make_pair("", stim_node));
                 }
                 catch (jill::FileError const & e) {
@@ -322,6 +621,53 @@ init_stimset(std::vector<string> const & stims, nframes_t sampling_rate)
         return ss.str();
 }
 
+/* The binary record for an event */
+static wire::event
+to_wire(Event const & event)
+{
+        static constexpr wire::event_type types[] = {
+                wire::event_type::Playing, wire::event_type::Interrupted,
+                wire::event_type::Done, wire::event_type::Busy,
+                wire::event_type::NotPlaying, wire::event_type::Xrun,
+                wire::event_type::Late, wire::event_type::Cancelled,
+        };
+        const auto it = event.stim ? _stim_index.find(event.stim) : _stim_index.end();
+        return wire::event{types[event.status],
+                           (it != _stim_index.end()) ? it->second : wire::no_stimulus,
+                           event.time, event.usec};
+}
+
+/* Binds a publisher at @a name alongside the request endpoint. @return the
+ * socket, or null if it could not be bound. */
+static void *
+bind_publisher(char const * name)
+{
+        fs::path path{"/tmp/org.meliza.jill"};
+        path /= options.server_name;
+        path /= options.client_name;
+        path /= name;
+        std::ostringstream endpoint;
+        endpoint << "ipc://" << path.string();
+        void * socket = zmq::context::socket(ZMQ_PUB);
+        if (zmq::bind(socket, endpoint.str()) < 0) {
+                LOG << "unable to bind to endpoint " << endpoint.str();
+                zmq::close(socket);
+                return nullptr;
+        }
+        INFO << "publishing start/stop events at " << endpoint.str();
+        return socket;
+}
+
+/* Publishes a binary batch of @a k holding the one event @a type */
+static void
+send_one(void * socket, wire::kind k, wire::event_type type, std::string & buf)
+{
+        wire::begin(buf, k, 1);
+        wire::append(buf, wire::event{type, wire::no_stimulus, 0, 0});
+        wire::finish(buf);
+        zmq::send(socket, buf);
+}
+
 /* This thread publishes events to a zmq socket.
  *
  * Takes a stop token as well as watching the global _running flag, because the
@@ -331,28 +677,41 @@ init_stimset(std::vector<string> const & stims, nframes_t sampling_rate)
  * A jthread only helps if the thread function actually reads its token --
  * without this the destructor would request a stop nobody observes and then
  * block forever, which is a worse failure than the abort it replaced.
+ *
+ * Every event goes out three times: as text on pub, one message each, and in
+ * the binary framing on pub-binary and pub-timed, everything drained in one
+ * pass batched into a single message. pub-binary carries the 12-byte records
+ * of 1.6 and pub-timed the 20-byte ones with the microseconds, which a 1.6
+ * client would refuse. A SUB only sees the socket it connects to, so no kind
+ * of client has to filter out another.
+ *
+ * Between passes it sleeps on _eventbell, which the realtime thread rings
+ * after each push, so an event goes out as soon as it is posted rather than on
+ * the next tick of a poll. The timeout only bounds how long a stop can go
+ * unnoticed if nothing rings; the stop callback and the signal handlers ring
+ * too.
  */
 void
 stim_monitor(std::stop_token stop)
 {
-        // set up zeromq socket
-        fs::path path{"/tmp/org.meliza.jill"};
-        path /= options.server_name;
-        path /= options.client_name;
-        path /= "pub";
-        std::ostringstream endpoint;
-        endpoint << "ipc://" << path.string();
-        void * socket = zmq::context::socket(ZMQ_PUB);
-        if (zmq::bind(socket, endpoint.str()) < 0) {
-                LOG << "unable to bind to endpoint " << endpoint.str();
+        void * socket = bind_publisher("pub");
+        if (!socket) return;
+        void * binary = bind_publisher("pub-binary");
+        void * timed = binary ? bind_publisher("pub-timed") : nullptr;
+        if (!timed) {
+                if (binary) zmq::close(binary);
+                zmq::close(socket);
                 return;
         }
-        else {
-                INFO << "publishing start/stop events at " << endpoint.str();
-        }
+        std::stop_callback wake(stop, [] { _eventbell->ring(); });
+        std::string batch, timed_batch;
         zmq::send(socket, "STARTING");
+        send_one(binary, wire::Events, wire::event_type::Starting, batch);
+        send_one(timed, wire::TimedEvents, wire::event_type::Starting, timed_batch);
         while (!stop.stop_requested() && _running.load()) {
                 Event event;
+                wire::begin(batch, wire::Events);
+                wire::begin(timed_batch, wire::TimedEvents);
                 while (_eventbuf.pop(&event, 1) > 0) {
                         std::ostringstream o;
                         switch (event.status) {
@@ -374,12 +733,35 @@ stim_monitor(std::stop_token stop)
                         case Event::NotPlaying:
                                 o << "NOTPLAYING";
                                 break;
+                        case Event::Late:
+                                o << "LATE " << event.stim->name() << " " << event.time;
+                                break;
+                        case Event::Cancelled:
+                                o << "CANCELLED " << event.stim->name() << " " << event.time;
+                                break;
                         }
                         zmq::send(socket, o.str());
+                        const wire::event e = to_wire(event);
+                        wire::append(batch, e);
+                        wire::append(timed_batch, e);
                 }
-                usleep(10000);
+                if (batch.size() > wire::header_size) {
+                        wire::finish(batch);
+                        zmq::send(binary, batch);
+                        wire::finish(timed_batch);
+                        zmq::send(timed, timed_batch);
+                }
+                _eventbell->arm();
+                if (_eventbuf.read_space() == 0 && !stop.stop_requested() && _running.load())
+                        _eventbell->wait(std::chrono::milliseconds(100));
+                else
+                        _eventbell->disarm();
         }
         zmq::send(socket, "STOPPING");
+        send_one(binary, wire::Events, wire::event_type::Stopping, batch);
+        send_one(timed, wire::TimedEvents, wire::event_type::Stopping, timed_batch);
+        zmq::close(timed);
+        zmq::close(binary);
         zmq::close(socket);
 }
 
@@ -395,21 +777,247 @@ stim_monitor(std::stop_token stop)
  * Major changes when an existing exchange changes meaning, so a client MUST
  * refuse a major it does not know. Minor changes when something is added that
  * an older client can ignore. See doc/jstimserver-protocol.md. */
-constexpr char PROTOCOL_VERSION[] = "1.0";
+constexpr char PROTOCOL_VERSION[] = "1.7";
+/* Appended to the version by VERSION BINARY, to say the server takes binary
+ * batches. A server that predates them answers that request BADCMD, which is
+ * how a client knows to stay with text. */
+constexpr char BINARY_FRAMING[] = "BINARY";
 
 constexpr char REQ_VERSION[] = "VERSION";
+constexpr char REQ_VERSION_BINARY[] = "VERSION BINARY";
 constexpr char REQ_STIMLIST[] = "STIMLIST";
 /* The separator is part of the token deliberately, so that a bare "PLAY"
  * fails to match and falls through to BADCMD by construction rather than by
  * a length check someone has to remember to write. */
 constexpr char REQ_PLAYSTIM[] = "PLAY ";
+constexpr char REQ_PLAY_AT[] = " AT ";
+constexpr char REQ_PLAY_AFTER[] = " AFTER ";
+constexpr char REQ_ENQUEUE[] = "ENQUEUE ";
+constexpr char REQ_CLEAR[] = "CLEAR";
 constexpr char REQ_INTERRUPT[] = "INTERRUPT";
 constexpr char REQ_STATUS[] = "STATUS";
+constexpr char REQ_LOADSTATUS[] = "LOADSTATUS";
+constexpr char REQ_PRELOAD[] = "PRELOAD ";
 constexpr char REP_BADCMD[] = "BADCMD";
 constexpr char REP_BADSTIM[] = "BADSTIM";
 constexpr char REP_OK[] = "OK";
 constexpr char REP_BUSY[] = "BUSY";
 constexpr char REP_IDLE[] = "IDLE";
+constexpr char REP_LOADING[] = "LOADING";
+constexpr char REP_READY[] = "READY";
+
+/* Splits the argument of a scheduled PLAY, "<name> AT <frame>" or "<name>
+ * AFTER <frames>", filling in everything in @a req but the stimulus.
+ *
+ * The keyword is found from the right, because a name may contain spaces --
+ * and may even contain " AT ", which is why the caller tries the whole
+ * argument as a name first. The count has to be a plain unsigned 32-bit
+ * decimal: no sign, no exponent, nothing after it.
+ *
+ * @return false if @a arg is not in either form */
+static bool
+parse_schedule(std::string const & arg, std::string & name, ScheduleRequest & req)
+{
+        const auto space = arg.rfind(' ');
+        if (space == std::string::npos || space + 1 == arg.size())
+                return false;
+        const std::string count = arg.substr(space + 1);
+        if (count.size() > 10 || count.find_first_not_of("0123456789") != std::string::npos)
+                return false;
+        const unsigned long long value = std::stoull(count);
+        if (value > std::numeric_limits<nframes_t>::max())
+                return false;
+        for (char const * keyword : {REQ_PLAY_AT, REQ_PLAY_AFTER}) {
+                const std::size_t len = strlen(keyword);
+                if (space + 1 >= len && arg.compare(space + 1 - len, len, keyword) == 0) {
+                        name = arg.substr(0, space + 1 - len);
+                        req.frame = nframes_t(value);
+                        req.after_trigger = (keyword == REQ_PLAY_AFTER);
+                        return true;
+                }
+        }
+        return false;
+}
+
+/* Pins a stimulus for the realtime thread, as PLAY needs to before it hands it
+ * over: if it is resident it is pinned at once, and if not, this is the
+ * request that loads it, and the client is told to come back.
+ *
+ * @return Ok if the stimulus is pinned, otherwise the reply to send */
+static wire::status
+pin_for_playback(util::stimset::entry & entry)
+{
+        if (_stimuli->acquire(entry))
+                return wire::status::Ok;
+        const auto state = _stimuli->request(entry);
+        if (state == util::stimset::Ready && _stimuli->acquire(entry))
+                return wire::status::Ok;
+        const bool failed = (state == util::stimset::Failed);
+        LOG << "client requested stimulus that "
+            << (failed ? "failed to load: " : "is not loaded yet: ") << entry.name();
+        return failed ? wire::status::BadStim : wire::status::Loading;
+}
+
+/* The requests that change what is played, one function each, so that the
+ * text and binary framings share them and cannot drift apart. Each is handed
+ * a stimulus that exists, and returns the reply. All run on the main thread. */
+
+/* The pin goes with the request to the realtime thread, or is dropped here if
+ * the request slot is taken. */
+static wire::status
+request_play(util::stimset::entry & entry)
+{
+        if (auto refusal = pin_for_playback(entry); refusal != wire::status::Ok)
+                return refusal;
+        if (_request.start(&entry)) {
+                LOG << "client requested stimulus: " << entry.name();
+                return wire::status::Ok;
+        }
+        entry.release();
+        LOG << "client requested stimulus before previous request was handled";
+        return wire::status::Busy;
+}
+
+/* Counted before there is a pin to drop, and reserved before it is handed
+ * over, so that the realtime thread can never count it out before it has been
+ * counted in. */
+static wire::status
+request_schedule(util::stimset::entry & entry, ScheduleRequest sched)
+{
+        if (_nscheduled.fetch_add(1) >= SCHEDULE_SIZE) {
+                _nscheduled.fetch_sub(1);
+                LOG << "client scheduled stimulus with the schedule full: " << entry.name();
+                return wire::status::Busy;
+        }
+        if (auto refusal = pin_for_playback(entry); refusal != wire::status::Ok) {
+                _nscheduled.fetch_sub(1);
+                return refusal;
+        }
+        sched.stim = &entry;
+        _schedbuf.push(&sched, 1);
+        LOG << "client scheduled stimulus: " << entry.name()
+            << (sched.after_trigger ? " after trigger + " : " at frame ") << sched.frame;
+        return wire::status::Ok;
+}
+
+static wire::status
+request_enqueue(util::stimset::entry & entry)
+{
+        if (auto refusal = pin_for_playback(entry); refusal != wire::status::Ok)
+                return refusal;
+        util::stimset::entry * e = &entry;
+        if (_queuebuf.push(&e, 1) == 0) {
+                entry.release();
+                LOG << "client enqueued stimulus with the queue full: " << entry.name();
+                return wire::status::Busy;
+        }
+        ++_enqueued;
+        LOG << "client enqueued stimulus: " << entry.name();
+        return wire::status::Ok;
+}
+
+static wire::status
+request_preload(util::stimset::entry & entry)
+{
+        if (_stimuli->request(entry) == util::stimset::Failed) {
+                LOG << "client requested preload of invalid stimulus: " << entry.name();
+                return wire::status::BadStim;
+        }
+        DBG << "client requested preload of " << entry.name();
+        return wire::status::Ok;
+}
+
+static wire::status
+request_clear()
+{
+        _clear_until.store(_enqueued);
+        LOG << "client cleared the queue";
+        return wire::status::Ok;
+}
+
+/* The queue is cleared before the interrupt is published, so that the
+ * realtime thread cannot see the one without the other and start the next
+ * queued stimulus in between. That is only right if the interrupt is then
+ * accepted -- which it is if the slot is empty, since only this thread fills
+ * it. */
+static wire::status
+request_interrupt()
+{
+        if (_request) {
+                LOG << "client requested interrupt before the previous request was handled";
+                return wire::status::Busy;
+        }
+        _clear_until.store(_enqueued);
+        _request.interrupt();
+        LOG << "client requested interrupt";
+        return wire::status::Ok;
+}
+
+static char const *
+reply_text(wire::status s)
+{
+        switch (s) {
+        case wire::status::Ok: return REP_OK;
+        case wire::status::BadStim: return REP_BADSTIM;
+        case wire::status::Busy: return REP_BUSY;
+        case wire::status::Loading: return REP_LOADING;
+        default: return REP_BADCMD;
+        }
+}
+
+/* Answers one request of a binary batch. The stimulus is an index into the
+ * STIMLIST array, which is the order of _stimuli->entries(). */
+static wire::status
+handle_binary(wire::request const & r)
+{
+        auto const & entries = _stimuli->entries();
+        util::stimset::entry * entry = (r.stim < entries.size()) ? entries[r.stim] : nullptr;
+        switch (r.what) {
+        case wire::op::Clear: return request_clear();
+        case wire::op::Interrupt: return request_interrupt();
+        case wire::op::Play:
+        case wire::op::PlayAt:
+        case wire::op::PlayAfter:
+        case wire::op::Enqueue:
+        case wire::op::Preload:
+                break;
+        default:
+                LOG << "invalid binary client request: op " << int(r.what);
+                return wire::status::BadCmd;
+        }
+        if (!entry) {
+                LOG << "client requested invalid stimulus index: " << r.stim;
+                return wire::status::BadStim;
+        }
+        switch (r.what) {
+        case wire::op::PlayAt:
+                return request_schedule(*entry, ScheduleRequest{nullptr, r.frame, false});
+        case wire::op::PlayAfter:
+                return request_schedule(*entry, ScheduleRequest{nullptr, r.frame, true});
+        case wire::op::Enqueue: return request_enqueue(*entry);
+        case wire::op::Preload: return request_preload(*entry);
+        default: return request_play(*entry);
+        }
+}
+
+/* Answers a binary batch, request by request in the order given, into @a out.
+ * A batch that cannot be unpacked is answered with a plain BADCMD, since there
+ * is no record to put the reply in. */
+static void
+handle_batch(std::string const & msg, std::string & out)
+{
+        // kept between batches, so a steady client costs no allocation here
+        static std::vector<wire::request> requests;
+        if (!wire::parse(msg, requests)) {
+                LOG << "malformed binary client request (" << msg.size() << " bytes)";
+                out = REP_BADCMD;
+                return;
+        }
+        wire::begin(out, wire::Replies, requests.size());
+        for (auto const & r : requests)
+                wire::append(out, wire::reply{r.what, handle_binary(r), r.stim});
+        wire::finish(out);
+}
 
 int
 main(int argc, char **argv)
@@ -424,8 +1032,44 @@ main(int argc, char **argv)
                         throw Exit(0);
                 }
                 /* load the stimuli */
-                std::string stimlist = init_stimset(options.stimuli, client.sampling_rate());
+                std::shared_ptr<file::stimcache const> cache;
+                if (!options.cache_dir.empty()) {
+                        cache = std::make_shared<file::stimcache const>(options.cache_dir);
+                        LOG << "caching resampled stimuli in " << cache->path();
+                }
+                _eventbell = std::make_unique<util::doorbell>();
+                const std::size_t budget = options.memory_budget_mb << 20;
+                _stimuli = std::make_unique<util::stimset>(client.sampling_rate(), budget);
+                /* Stop the loaders on every way out of main, while the
+                 * logger they report to still exists; the set itself is a
+                 * global and outlives this. Declared before the activated
+                 * client, so the realtime thread has let go of its pins
+                 * first. */
+                util::scope_guard stop_loaders{[]{ _stimuli->stop(); }};
+                const auto quality = dsp::parse_resample_quality(options.resample_quality);
+                unsigned nchannels = 1;
+                std::string stimlist = init_stimset(options.stimuli, cache, quality, nchannels);
                 DBG << "stimlist: " << stimlist;
+                for (std::size_t i = 0; i < _stimuli->entries().size(); ++i)
+                        _stim_index.emplace(_stimuli->entries()[i]->stim(), i);
+
+                /* Load in the background, so the socket below is bound and
+                 * answering within moments however large the library is. */
+                unsigned nloaders = options.load_threads;
+                if (nloaders == 0)
+                        nloaders = std::max(1u, std::thread::hardware_concurrency());
+                _stimuli->start(nloaders);
+                if (budget == 0) {
+                        for (auto * entry : _stimuli->entries())
+                                _stimuli->request(*entry);
+                        LOG << "loading " << _stimuli->entries().size() << " stimuli in "
+                            << nloaders << " thread(s)";
+                }
+                else {
+                        LOG << "loading stimuli on demand in " << nloaders
+                            << " thread(s), keeping at most " << options.memory_budget_mb
+                            << " MB resident";
+                }
 
                 // set up zeromq socket
                 fs::path path("/tmp/org.meliza.jill");
@@ -448,10 +1092,25 @@ main(int argc, char **argv)
                         INFO << "listening for requests at " << endpoint.str();
                 }
 
-                port_out = client.register_port("out", JACK_DEFAULT_AUDIO_TYPE,
-                                                 JackPortIsOutput | JackPortIsTerminal, 0);
+                if (options.voices == 0) {
+                        LOG << "ERROR: there must be at least one voice";
+                        throw Exit(EXIT_FAILURE);
+                }
+                _voices.resize(options.voices);
+                if (options.voices > 1)
+                        LOG << "mixing up to " << options.voices << " stimuli at once";
+
+                if (nchannels > 1) LOG << "playing " << nchannels << " output channels";
+                for (unsigned c = 0; c < nchannels; ++c) {
+                        ports_out.push_back(client.register_port(
+                                output_port_name(c, nchannels), JACK_DEFAULT_AUDIO_TYPE,
+                                JackPortIsOutput | JackPortIsTerminal, 0));
+                }
+                outs.resize(nchannels);
                 port_trigout = client.register_port("trig_out", JACK_DEFAULT_MIDI_TYPE,
                                                      JackPortIsOutput | JackPortIsTerminal, 0);
+                port_trigin = client.register_port("trig_in", JACK_DEFAULT_MIDI_TYPE,
+                                                   JackPortIsInput | JackPortIsTerminal, 0);
 
                 // register signal handlers
                 signal(SIGINT,  signal_handler);
@@ -466,10 +1125,15 @@ main(int argc, char **argv)
                 // when the buffer size *changes*
                 client.set_buffer_size_callback(jack_bufsize);
 
-                active.connect_ports("out",
-                                      options.output_ports.begin(), options.output_ports.end());
+                // as in jstim: in turn, wrapping round, when there are several
+                for (std::size_t i = 0; i < options.output_ports.size(); ++i) {
+                        active.connect_port(output_port_name(i % nchannels, nchannels),
+                                            options.output_ports[i]);
+                }
                 active.connect_ports("trig_out",
                                       options.trigout_ports.begin(), options.trigout_ports.end());
+                active.connect_ports(options.trigin_ports.begin(), options.trigin_ports.end(),
+                                      "trig_in");
 
                 std::jthread monitor_thread(stim_monitor);
                 LOG << "waiting for requests";
@@ -483,6 +1147,10 @@ main(int argc, char **argv)
                                 DBG << "client requested jstimserver version";
                                 messages.back() = PROTOCOL_VERSION;
                         }
+                        else if (data.compare(REQ_VERSION_BINARY) == 0) {
+                                DBG << "client requested jstimserver version and binary framing";
+                                messages.back() = std::string(PROTOCOL_VERSION) + " " + BINARY_FRAMING;
+                        }
                         else if (data.compare(REQ_STIMLIST) == 0) {
                                 DBG << "client requested playlist";
                                 messages.back() = stimlist;
@@ -499,6 +1167,33 @@ main(int argc, char **argv)
                                         ? std::string("PLAYING ") + playing->name()
                                         : REP_IDLE;
                         }
+                        else if (data.compare(REQ_LOADSTATUS) == 0) {
+                                // done first: read the other way round, a load
+                                // queued in between could make done > total
+                                const std::size_t done = _stimuli->loads_done();
+                                const std::size_t total = _stimuli->loads_requested();
+                                DBG << "client requested loading status";
+                                if (done >= total)
+                                        messages.back() = REP_READY;
+                                else
+                                        messages.back() = std::string(REP_LOADING) + " "
+                                                + std::to_string(done) + "/"
+                                                + std::to_string(total);
+                        }
+                        else if (data.starts_with(REQ_PRELOAD)) {
+                                auto name = data.substr(strlen(REQ_PRELOAD));
+                                auto * entry = _stimuli->find(name);
+                                if (name.empty()) {
+                                        messages.back() = REP_BADCMD;
+                                }
+                                else if (!entry) {
+                                        LOG << "client requested preload of invalid stimulus: " << name;
+                                        messages.back() = REP_BADSTIM;
+                                }
+                                else {
+                                        messages.back() = reply_text(request_preload(*entry));
+                                }
+                        }
                         /* There is deliberately no "is a request already
                          * pending" test ahead of the dispatch. There used to
                          * be, and because it ran before the command was
@@ -511,34 +1206,56 @@ main(int argc, char **argv)
                          * when they lose. */
                         else if (data.starts_with(REQ_PLAYSTIM)) {
                                 auto stim = data.substr(strlen(REQ_PLAYSTIM));
-                                auto it = _stimuli.find(stim);
+                                auto * entry = _stimuli->find(stim);
+                                ScheduleRequest sched{};
+                                std::string name;
+                                /* A name that matches as a whole is always an
+                                 * immediate PLAY, so no stimulus that could be
+                                 * played before scheduling existed has become
+                                 * unreachable by it. */
+                                const bool scheduled = !entry && parse_schedule(stim, name, sched);
+                                if (scheduled) {
+                                        stim = name;
+                                        entry = _stimuli->find(stim);
+                                }
                                 if (stim.empty()) {
                                         LOG << "client requested playback with no stimulus name";
                                         messages.back() = REP_BADCMD;
                                 }
-                                else if (it == _stimuli.end()) {
+                                else if (!entry) {
                                         LOG << "client requested invalid stimulus: " << stim;
                                         messages.back() = REP_BADSTIM;
                                 }
-                                else if (_request.start(it->second.get())) {
-                                        LOG << "client requested stimulus: " << stim;
-                                        messages.back() = REP_OK;
+                                else if (scheduled) {
+                                        messages.back() = reply_text(request_schedule(*entry, sched));
                                 }
                                 else {
-                                        LOG << "client requested stimulus before previous request was handled";
-                                        messages.back() = REP_BUSY;
+                                        messages.back() = reply_text(request_play(*entry));
                                 }
                         }
-                        else if (data.compare(REQ_INTERRUPT) == 0) {
-                                if (_request.interrupt()) {
-                                        LOG << "client requested interrupt";
-                                        messages.back() = REP_OK;
+                        else if (data.starts_with(REQ_ENQUEUE)) {
+                                auto stim = data.substr(strlen(REQ_ENQUEUE));
+                                auto * entry = _stimuli->find(stim);
+                                if (stim.empty()) {
+                                        messages.back() = REP_BADCMD;
+                                }
+                                else if (!entry) {
+                                        LOG << "client enqueued invalid stimulus: " << stim;
+                                        messages.back() = REP_BADSTIM;
                                 }
                                 else {
-                                        LOG << "client requested interrupt before the previous request was handled";
-                                        messages.back() = REP_BUSY;
+                                        messages.back() = reply_text(request_enqueue(*entry));
                                 }
                         }
+                        else if (data.compare(REQ_CLEAR) == 0) {
+                                messages.back() = reply_text(request_clear());
+                        }
+                        else if (data.compare(REQ_INTERRUPT) == 0) {
+                                messages.back() = reply_text(request_interrupt());
+                        }
+                        else if (wire::is_binary(data)) {
+                                handle_batch(data, messages.back());
+                        }
                         else {
                                 LOG << "invalid client request: " << data;
                                 messages.back() = REP_BADCMD;
@@ -579,11 +1296,27 @@ jstim_options::jstim_options(string const &program_name)
                 ("out,o",     po::value<vector<string> >(&output_ports),
                  "add connection to output audio port")
                 ("event,e",   po::value<vector<string> >(&trigout_ports),
-                 "add connection to output event port");
+                 "add connection to output event port")
+                ("trig,t",    po::value<vector<string> >(&trigin_ports),
+                 "add connection to input trigger port, for PLAY ... AFTER");
 
         // tropts is a group of options
         po::options_description opts("Stimulus options");
-        //opts.add_options()
+        opts.add_options()
+                ("cache-dir", po::value<string>(&cache_dir),
+                 "keep resampled stimuli in this directory, so later runs at the "
+                 "same rate can map them instead of resampling")
+                ("resample-quality", po::value<string>(&resample_quality)->default_value("best"),
+                 "how carefully to resample stimuli that are not at the server's "
+                 "rate: fast, medium or best")
+                ("load-threads", po::value<unsigned>(&load_threads)->default_value(0),
+                 "number of threads loading stimuli (0 for one per core)")
+                ("memory-budget", po::value<std::size_t>(&memory_budget_mb)->default_value(0),
+                 "most MB of samples to keep in memory. If set, stimuli are loaded "
+                 "when first requested and the least recently used are unloaded to "
+                 "make room; if 0, all are loaded at startup and kept")
+                ("voices", po::value<unsigned>(&voices)->default_value(1),
+                 "number of stimuli that may play at once, mixed together");
 
         cmd_opts.add(jillopts).add(opts);
         cmd_opts.add_options()
@@ -598,7 +1331,9 @@ jstim_options::print_usage()
         std::cout << "Usage: " << _program_name << " [options] [stimfile] [stimfile] ...\n"
                   << visible_opts << std::endl
                   << "Ports:\n"
-                  << " * out:       sampled output of the presented stimulus\n"
+                  << " * out:       sampled output of the presented stimulus. Named out_0,\n"
+                  << "              out_1, ... when a stimulus has more than one channel\n"
                   << " * trig_out:  event port reporting stimulus onset/offsets\n"
+                  << " * trig_in:   event port whose onsets release PLAY ... AFTER requests\n"
                   << std::endl;
 }
@@ -21,12 +21,68 @@ rather than a hang that has to be killed from outside.
 """
 
 import json
+import struct
+import time
 
 import zmq
 
 #: How long to wait for a reply or an event before giving up.
 DEFAULT_TIMEOUT = 2.0
 
+# The binary framing (protocol section 8). Stimuli are indices into the
+# STIMLIST array, and everything is little-endian.
+BINARY_OPS = {"PLAY": 1, "PLAY_AT": 2, "PLAY_AFTER": 3, "ENQUEUE": 4,
+              "CLEAR": 5, "INTERRUPT": 6, "PRELOAD": 7}
+BINARY_STATUS = ["OK", "BADCMD", "BADSTIM", "BUSY", "LOADING"]
+BINARY_EVENTS = [None, "PLAYING", "INTERRUPTED", "DONE", "XRUN", "BUSY",
+                 "NOTPLAYING", "LATE", "CANCELLED", "STARTING", "STOPPING"]
+#: the stimulus index of an event that has none
+NO_STIMULUS = 0xFFFFFFFF
+_HEADER = struct.Struct("<BcH")
+_REQUEST = struct.Struct("<B3xII")
+_REPLY = struct.Struct("<BB2xI")
+_EVENT = struct.Struct("<B3xII")
+_TIMED_EVENT = struct.Struct("<B3xIIQ")
+
+
+def pack_requests(requests):
+    """Pack (op, index, frame) tuples into a request batch.
+
+    `op` is a key of BINARY_OPS or a raw number, so that a test can send one
+    the server does not know.
+    """
+    body = b"".join(_REQUEST.pack(BINARY_OPS.get(op, op), index, frame)
+                    for op, index, frame in requests)
+    return _HEADER.pack(0, b"Q", len(requests)) + body
+
+
+def _unpack(data, kind, record):
+    # records may be longer than `record` in a later version; the size comes
+    # from the length and count, and anything past what we know is skipped
+    magic, got, count = _HEADER.unpack_from(data)
+    body = len(data) - _HEADER.size
+    stride = body // count if count else 0
+    if magic != 0 or got != kind or stride * count != body or (count and stride < record.size):
+        raise ValueError("not a %r batch: %r" % (kind, data))
+    return [record.unpack_from(data, _HEADER.size + i * stride) for i in range(count)]
+
+
+def unpack_replies(data):
+    """Unpack a reply batch into (op, status name, index) tuples."""
+    return [(op, BINARY_STATUS[status], index)
+            for op, status, index in _unpack(data, b"R", _REPLY)]
+
+
+def unpack_events(data):
+    """Unpack an event batch into (verb, index, frame, usec) tuples, the verb as
+    in the text event. usec is on JACK's clock, normally CLOCK_MONOTONIC, in a
+    timed batch from pub-timed, and None in one from pub-binary."""
+    if data[1:2] == b"T":
+        return [(BINARY_EVENTS[kind], index, frame, usec)
+                for kind, index, frame, usec in _unpack(data, b"T", _TIMED_EVENT)]
+    return [(BINARY_EVENTS[kind], index, frame, None)
+            for kind, index, frame in _unpack(data, b"E", _EVENT)]
+
 
 class Timeout(Exception):
     """No reply or event arrived within the deadline."""
@@ -61,6 +117,9 @@ class JstimserverClient:
         # the server publishes no topic prefix, so subscribe to everything
         self._sub.setsockopt(zmq.SUBSCRIBE, b"")
         self._sub.connect("%s/pub" % endpoint_dir)
+        self._endpoint_dir = endpoint_dir
+        # connected by negotiate_binary()
+        self._binsub = None
 
     # -- lifecycle ---------------------------------------------------------
 
@@ -73,6 +132,8 @@ class JstimserverClient:
     def close(self):
         self._req.close()
         self._sub.close()
+        if self._binsub is not None:
+            self._binsub.close()
         if self._owns_context:
             self._ctx.term()
 
@@ -121,16 +182,57 @@ class JstimserverClient:
         """
         return self.request("VERSION", **kw)
 
+    def negotiate_binary(self, timed=False, **kw):
+        """Ask for the binary framing. Added in 1.6.
+
+        Returns the protocol version if the server agrees, and subscribes to
+        its binary events, or None if it is too old to know the request. With
+        `timed`, the events are the ones on pub-timed, which carry the time
+        they happened; that needs 1.7.
+        """
+        reply = self.request("VERSION BINARY", **kw)
+        version, _, framing = reply.partition(" ")
+        if framing != "BINARY":
+            return None
+        if self._binsub is None:
+            self._binsub = self._ctx.socket(zmq.SUB)
+            self._binsub.setsockopt(zmq.LINGER, 0)
+            self._binsub.setsockopt(zmq.SUBSCRIBE, b"")
+            self._binsub.connect("%s/%s" % (self._endpoint_dir,
+                                            "pub-timed" if timed else "pub-binary"))
+        return version
+
+    def batch(self, requests, timeout=None):
+        """Send (op, index, frame) requests in one binary batch.
+
+        Returns the replies as (op, status, index) tuples, or the text reply
+        if the server could not unpack the batch.
+        """
+        return self.request_raw(pack_requests(requests), timeout)
+
+    def request_raw(self, data, timeout=None):
+        """Send a binary message and return the unpacked reply."""
+        self._req.send(data)
+        if not self._req.poll(1000 * (self.timeout if timeout is None else timeout)):
+            self._timed_out("no reply to a binary batch")
+        reply = self._req.recv()
+        if reply[:1] != b"\x00":
+            return reply.decode("utf-8")
+        return unpack_replies(reply)
+
     def stimlist(self, **kw):
         """The stimulus set, as a list of dicts.
 
-        Durations are converted to float here: the server serializes them as
-        JSON *strings*, because its writer does not track types.
+        Durations and channel counts are converted here: the server
+        serializes them as JSON *strings*, because its writer does not track
+        types. A server before 1.5 does not report channels, and every
+        stimulus it has is mono.
         """
         reply = self.request("STIMLIST", **kw)
         stimuli = json.loads(reply)["stimuli"]
         for stim in stimuli:
             stim["duration"] = float(stim["duration"])
+            stim["channels"] = int(stim.get("channels", 1))
         return stimuli
 
     def status(self, **kw):
@@ -148,9 +250,59 @@ class JstimserverClient:
             raise ValueError("unexpected STATUS reply: %r" % reply)
         return name
 
+    def loadstatus(self, **kw):
+        """Loading progress: None once every stimulus is loaded, else (done, total).
+
+        The server answers requests while it is still loading and resampling
+        its stimuli, and refuses a PLAY for one that is not ready with
+        LOADING. Added in protocol 1.1.
+        """
+        reply = self.request("LOADSTATUS", **kw)
+        if reply == "READY":
+            return None
+        verb, _, progress = reply.partition(" ")
+        done, _, total = progress.partition("/")
+        if verb != "LOADING" or not done.isdigit() or not total.isdigit():
+            raise ValueError("unexpected LOADSTATUS reply: %r" % reply)
+        return int(done), int(total)
+
+    def wait_until_loaded(self, timeout=None, poll=0.05):
+        """Poll LOADSTATUS until the server has loaded every stimulus.
+
+        :raises Timeout: if it has not finished by the deadline.
+        """
+        deadline = time.monotonic() + (self.timeout if timeout is None else timeout)
+        progress = self.loadstatus()
+        while progress is not None:
+            if time.monotonic() > deadline:
+                self._timed_out("still loading stimuli: %d of %d done" % progress)
+            time.sleep(poll)
+            progress = self.loadstatus()
+
+    def preload(self, name, **kw):
+        """Ask for a stimulus to be loaded ahead of playing it. Added in 1.2."""
+        return self.request("PRELOAD %s" % name, **kw)
+
     def play(self, name, **kw):
         return self.request("PLAY %s" % name, **kw)
 
+    def play_at(self, name, frame, **kw):
+        """Schedule a stimulus to start at a JACK frame. Added in 1.3."""
+        return self.request("PLAY %s AT %d" % (name, frame), **kw)
+
+    def play_after(self, name, frames, **kw):
+        """Start a stimulus a number of frames after the next onset on the
+        server's trig_in port. Added in 1.3."""
+        return self.request("PLAY %s AFTER %d" % (name, frames), **kw)
+
+    def enqueue(self, name, **kw):
+        """Add a stimulus to the server's queue. Added in 1.4."""
+        return self.request("ENQUEUE %s" % name, **kw)
+
+    def clear(self, **kw):
+        """Drop everything queued that has not started. Added in 1.4."""
+        return self.request("CLEAR", **kw)
+
     def interrupt(self, **kw):
         return self.request("INTERRUPT", **kw)
 
@@ -185,6 +337,27 @@ class JstimserverClient:
             if event.split(" ", 1)[0] == verb:
                 return seen
 
+    def next_batch(self, timeout=None):
+        """The next batch of binary events, as unpack_events() returns them.
+
+        :raises Timeout: if none arrives.
+        """
+        if not self._binsub.poll(1000 * (self.timeout if timeout is None else timeout)):
+            self._timed_out("no binary event")
+        return unpack_events(self._binsub.recv())
+
+    def binary_events_until(self, verb, timeout=None):
+        """Collect binary events up to and including the first `verb`."""
+        seen = []
+        while True:
+            try:
+                batch = self.next_batch(timeout)
+            except Timeout:
+                self._timed_out("no binary %s; saw %r" % (verb, seen))
+            seen.extend(batch)
+            if any(event[0] == verb for event in batch):
+                return seen
+
     def drain_events(self, settle=0.2):
         """Discard anything already published, and return it.
 
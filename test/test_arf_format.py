@@ -9,6 +9,8 @@ so these tests also confirm the recordings are readable by the tools that
 consume them.
 """
 
+import pathlib
+
 import numpy as np
 import pytest
 
@@ -25,6 +27,10 @@ CHANNELS = ["pcm_000", "pcm_001"]
 EVENT_CHANNEL = "trig_in"
 STIMULUS_NAME = "stim_a"
 STIM_ON = 0x00
+NOTE_ON = 0x80
+NO_MESSAGE = 0xFFFFFFFF
+PAGE_SIZE = 64 * 1024
+SPIKE_PERIOD = 5000
 
 pytestmark = pytest.mark.needs_arf
 
@@ -51,6 +57,36 @@ def arf_file(tmp_path_factory):
         yield f
 
 
+@pytest.fixture(scope="module")
+def crashed_file(tmp_path_factory):
+    """A file left with an entry open, as by a jrecord that died."""
+    if not (TEST_DIR / "write_arf_fixture").exists():
+        pytest.skip("write_arf_fixture was not built (scons --no-arf?)")
+    path = tmp_path_factory.mktemp("arf") / "crashed.arf"
+    result = run_binary("write_arf_fixture", timeout=120, args=(str(path), "--crash"))
+    assert result.returncode == 0, (
+        "write_arf_fixture exited %d\n--- output ---\n%s%s"
+        % (result.returncode, result.stdout, result.stderr)
+    )
+    with h5py.File(path, "r") as f:
+        yield f
+
+
+@pytest.fixture(scope="module")
+def spikes_file(tmp_path_factory):
+    """Events alone, as jspike writes them, arriving out of order."""
+    if not (TEST_DIR / "write_arf_fixture").exists():
+        pytest.skip("write_arf_fixture was not built (scons --no-arf?)")
+    path = tmp_path_factory.mktemp("arf") / "spikes.arf"
+    result = run_binary("write_arf_fixture", timeout=120, args=(str(path), "--spikes"))
+    assert result.returncode == 0, (
+        "write_arf_fixture exited %d\n--- output ---\n%s%s"
+        % (result.returncode, result.stdout, result.stderr)
+    )
+    with h5py.File(path, "r") as f:
+        yield f
+
+
 @pytest.fixture(scope="module")
 def entries(arf_file):
     """The entry groups, in name order."""
@@ -62,6 +98,17 @@ def test_file_is_arf(arf_file):
     assert arf_file.attrs["file_creator"].decode().startswith("org.meliza.jill")
 
 
+def test_file_space_is_paged(arf_file):
+    """The fixture asks for paged file-space aggregation, and the rotated
+    file gets the same."""
+    path = pathlib.Path(arf_file.filename)
+    with h5py.File(path.with_name("fixture-0001.arf"), "r") as following:
+        for f in (arf_file, following):
+            fcpl = f.id.get_create_plist()
+            assert fcpl.get_file_space_strategy()[0] == h5py.h5f.FSPACE_STRATEGY_PAGE
+            assert fcpl.get_file_space_page_size() == PAGE_SIZE
+
+
 def test_log_dataset(arf_file):
     """doc/arf-files.md: /jill_log holds log messages."""
     assert "jill_log" in arf_file
@@ -77,8 +124,8 @@ def test_entries_are_numbered_sequentially(arf_file, entries):
     """Entries are <source>_0000, _0001, ... in creation order."""
     names = [n for n in sorted(arf_file) if isinstance(arf_file[n], h5py.Group)]
     assert names == ["%s_%04d" % (SOURCE, i) for i in range(len(names))]
-    # four, because the frame counter wrap splits the last one
-    assert len(entries) == 5
+    # six: the frame counter wrap splits the third into two
+    assert len(entries) == 6
 
 
 @pytest.mark.parametrize("attr", ["timestamp", "jack_frame", "jack_sampling_rate",
@@ -148,6 +195,23 @@ def test_channels_are_distinguishable(entries):
     np.testing.assert_allclose(b, -a, rtol=0, atol=1e-6)
 
 
+def test_prepared_entry_is_used_and_tidied(arf_file, entries):
+    """The second entry is made ahead of time, under a placeholder name.
+
+    It is renamed and stamped when used, and the event dataset made for it,
+    which got no events, is removed again. The spare made before the
+    rotation is removed from the old file rather than left in it.
+    """
+    for path in (arf_file.filename, pathlib.Path(arf_file.filename).with_name("fixture-0001.arf")):
+        with h5py.File(path, "r") as f:
+            assert "jill_spare" not in f
+    entry = entries[1]
+    assert entry.attrs["jack_frame"] == 100000
+    assert tuple(entry.attrs["timestamp"]) > tuple(entries[0].attrs["timestamp"])
+    assert entry.attrs["experimenter"].decode() == "dmeliza"
+    assert sorted(entry) == sorted(CHANNELS)
+
+
 def test_channel_uuids_are_stable_across_entries(entries):
     """A channel keeps its uuid, so it can be followed through a session."""
     for channel in CHANNELS:
@@ -219,3 +283,107 @@ def test_trial_off_is_the_furthest_point_written(entries):
     entry = entries[4]
     assert entry.attrs["trial_off"] == 2 * PERIOD
     assert entry[CHANNELS[0]].shape[0] == 2 * PERIOD
+
+
+def test_trial_off_says_where_a_crashed_entry_ends(crashed_file):
+    """Sampled datasets are extended ahead of their data and only trimmed
+    when the entry is closed, so a file left by a crash ends its channels in
+    zeros. trial_off is kept up to date at each flush to say where."""
+    entry = crashed_file["%s_%04d" % (SOURCE, 0)]
+    assert entry.attrs["trial_off"] == 3 * PERIOD
+    for c, name in enumerate(CHANNELS):
+        data = entry[name]
+        assert data.shape[0] > 3 * PERIOD, "the extent runs past the data"
+        valid = data[: entry.attrs["trial_off"]]
+        np.testing.assert_allclose(valid[-PERIOD:], expected_ramp(c), rtol=0, atol=1e-6)
+        assert not data[3 * PERIOD :].any()
+
+
+def test_a_spare_left_by_a_crash_is_not_an_entry(crashed_file):
+    """The entry made ahead of time sits in a group with no timestamp, which
+    ARF readers pass over, rather than at the top level looking like one."""
+    assert "jill_spare" in crashed_file
+    spare = crashed_file["jill_spare"]
+    assert "timestamp" not in spare.attrs
+    assert "entry" in spare
+    entries = [n for n in crashed_file if "timestamp" in crashed_file[n].attrs]
+    assert entries == ["%s_%04d" % (SOURCE, 0)]
+
+
+def test_spikes_out_of_order_stay_in_one_entry(spikes_file):
+    """jspike starts its entry at the period, not at the first spike.
+
+    A spike on a later channel may have crossed before one already written
+    from an earlier channel. With the entry opened at the first spike, the
+    earlier crossing looked like the frame counter wrapping, and split the
+    entry in two.
+    """
+    names = [n for n in spikes_file if "timestamp" in spikes_file[n].attrs]
+    assert names == ["%s_%04d" % (SOURCE, 0)]
+    entry = spikes_file[names[0]]
+    assert entry.attrs["jack_frame"] == SPIKE_PERIOD
+    assert list(entry["spk_000"]["start"]) == [300, 900]
+    assert list(entry["spk_001"]["start"]) == [100]
+
+
+def test_compact_events(entries):
+    """Entry 4's events are in the compact format, with fixed-size fields.
+
+    Standard MIDI keeps its data bytes in the record; a string is stored once
+    in jill_messages and referred to by its row.
+    """
+    entry = entries[4]
+    events = entry[EVENT_CHANNEL]
+    assert events.dtype.names == ("start", "status", "data", "message")
+    assert [u.decode() for u in events.attrs["units"]] == ["samples", "", "", ""]
+    assert list(events["start"]) == [0, PERIOD // 2, PERIOD]
+    assert list(events["status"]) == [STIM_ON, NOTE_ON, STIM_ON]
+    assert list(events["data"][1]) == [60, 64]
+    assert events["message"][1] == NO_MESSAGE
+    assert events["message"][0] == events["message"][2] == 0
+    messages = entry["jill_messages"]
+    assert len(messages) == 1
+    assert messages[0].decode() == STIMULUS_NAME
+
+
+def test_dropped_blocks_are_zeros_and_annotated(entries):
+    """A channel dropped under load keeps its length and says where.
+
+    The fixture's last entry stands GAP blocks in for the second and third
+    periods of the second channel, as buffered_data_writer does for a
+    low-priority channel when the ringbuffer is short of room.
+    """
+    entry = entries[5]
+    assert "jill_gaps" not in entries[0]
+    kept, dropped = entry[CHANNELS[0]][:], entry[CHANNELS[1]][:]
+    assert len(dropped) == len(kept) == 4 * PERIOD
+    assert not dropped[PERIOD:3 * PERIOD].any()
+    np.testing.assert_allclose(dropped[3 * PERIOD:], expected_ramp(1), rtol=0, atol=1e-6)
+
+    gaps = entry["jill_gaps"]
+    assert len(gaps) == 1
+    assert gaps[0]["start"] == PERIOD
+    assert gaps[0]["message"].decode() == "gap in pcm_001: 2048 frames dropped under load"
+
+
+def test_rotation_continues_in_a_new_file(arf_file):
+    """The fixture's last entry is written after a rotation.
+
+    It goes in a new file named after the first, and the two files and the
+    entries either side of the switch say how they follow on.
+    """
+    path = pathlib.Path(arf_file.filename)
+    following = path.with_name("fixture-0001.arf")
+    assert arf_file.attrs["jill_next_file"].decode() == following.name
+    assert following.exists()
+    with h5py.File(following, "r") as f:
+        assert f.attrs["jill_previous_file"].decode() == path.name
+        assert "jill_log" in f
+        names = [n for n in sorted(f) if isinstance(f[n], h5py.Group)]
+        assert names == ["%s_%04d" % (SOURCE, 6)], "numbering carries on"
+        entry = f[names[0]]
+        assert entry.attrs["jack_frame"] == 300000 + 4 * PERIOD
+        continues = entry.attrs["jill_continues"].decode()
+        assert continues.startswith(path.name + ":")
+        assert continues.endswith("%s_%04d" % (SOURCE, 5))
+        assert entry[CHANNELS[0]].shape[0] == 2 * PERIOD
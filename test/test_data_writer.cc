@@ -6,7 +6,9 @@
  * buffered_data_writer takes a data_writer by unique_ptr, so a test can supply
  * its own and drive the thread without a JACK server or a file on disk. These
  * cover starting and stopping, which is where a lost stop() used to hang
- * join() forever.
+ * join() forever, the log messages it takes from its socket, the figures
+ * it keeps on how well it is keeping up, and splitting channels between
+ * several writers.
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -16,6 +18,7 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <memory>
@@ -23,8 +26,14 @@
 #include <thread>
 #include <vector>
 
+#include <unistd.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
 #include "jill/data_writer.hh"
+#include "jill/logger.hh"
 #include "jill/dsp/buffered_data_writer.hh"
+#include "jill/dsp/sharded_data_writer.hh"
+#include "jill/net/zmq.hh"
 
 using jill::data_block_t;
 using jill::nframes_t;
@@ -57,11 +66,32 @@ public:
         bool ready() const override { return _ready; }
         void write(data_block_t const * data, nframes_t, nframes_t) override
         {
-                calls.push_back({"write", data->time});
+                if (write_delay.count() > 0) std::this_thread::sleep_for(write_delay);
+                calls.push_back({data->dtype == jill::GAP ? "gap" : "write", data->time});
+                blocks.push_back((data->dtype == jill::GAP ? "gap " : "") + data->id());
         }
         void flush() override { ++flushes; }
+        void set_degraded(bool on) override
+        {
+                calls.push_back({on ? "degraded" : "recovered", 0});
+        }
+        void log_batch(std::vector<jill::log_entry> const & entries) override
+        {
+                batches.push_back(entries);
+        }
+        void log(jill::timestamp_t, std::string source, std::string message) override
+        {
+                logged.push_back(source + ": " + message);
+                logged_after.push_back(blocks.size());
+        }
+        void rotate() override { calls.push_back({"rotate", 0}); }
 
         std::vector<call> calls;
+        std::vector<std::vector<jill::log_entry>> batches;
+        std::vector<std::string> logged;
+        std::vector<std::size_t> logged_after;  // blocks written by then
+        std::chrono::milliseconds write_delay{0};       // a slow disk
+        std::vector<std::string> blocks;        // ids, in the order written
         int flushes = 0;
 
 private:
@@ -177,3 +207,318 @@ TEST_CASE("data pushed before stopping reaches the writer") {
         }
         CHECK(writes == 8);
 }
+
+TEST_CASE("a log timestamp survives the binary form") {
+        using namespace boost::posix_time;
+        const jill::timestamp_t t = from_iso_string("20260818T101112.131415");
+        const std::string frame = jill::encode_log_time(t);
+        CHECK(frame.size() == 8);
+        CHECK(jill::decode_log_time(frame) == t);
+        // and the form other programs send still parses
+        CHECK(jill::decode_log_time("20260818T101112.131415") == t);
+}
+
+TEST_CASE("log messages waiting on the socket reach the writer in one batch") {
+        using namespace boost::posix_time;
+        namespace zmq = jill::net::zmq;
+        recording_writer * sink = nullptr;
+        auto w = make_writer(&sink);
+        const std::string server = "test_data_writer_" + std::to_string(getpid());
+        w->bind_logger(server);
+
+        void * socket = zmq::context::socket(ZMQ_DEALER);
+        REQUIRE(zmq::connect(socket, "ipc:///tmp/org.meliza.jill/" + server + "/msg") == 0);
+        const jill::timestamp_t t = from_iso_string("20260818T101112.131415");
+        const int n = 50;
+        for (int i = 0; i < n; ++i) {
+                // every other one in the older string form
+                zmq::send(socket, "source", ZMQ_SNDMORE);
+                zmq::send(socket, (i % 2) ? to_iso_string(t) : jill::encode_log_time(t),
+                          ZMQ_SNDMORE);
+                zmq::send(socket, "line " + std::to_string(i));
+        }
+        // queued before the writer starts, so that its first pass finds them
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        w->start();
+        w->stop();
+        join_within(w, std::chrono::seconds(10));
+        zmq::close(socket);
+
+        std::vector<jill::log_entry> all;
+        for (auto const & b : sink->batches) all.insert(all.end(), b.begin(), b.end());
+        REQUIRE(all.size() == n);
+        for (int i = 0; i < n; ++i) {
+                CAPTURE(i);
+                CHECK(all[i].source == "source");
+                CHECK(all[i].message == "line " + std::to_string(i));
+                CHECK(all[i].time == t);
+        }
+        // not one write per line, which is the point
+        CHECK(sink->batches.size() < std::size_t(n));
+}
+
+TEST_CASE("the writer thread counts what it did") {
+        recording_writer * sink = nullptr;
+        auto w = make_writer(&sink);
+        const std::vector<sample_t> samples(64, 0.5f);
+        // pushed before start, so the lag and the high-water mark are known
+        for (nframes_t i = 0; i < 8; ++i) {
+                w->push(i * 64, jill::SAMPLED, "pcm",
+                        samples.size() * sizeof(sample_t), samples.data());
+        }
+        w->start();
+        w->stop();
+        join_within(w, std::chrono::seconds(10));
+
+        auto const & stats = w->stats();
+        CHECK(stats.writes == 8);
+        CHECK(stats.passes >= 1);
+        CHECK(stats.max_blocks_per_pass == 8);
+        CHECK(stats.max_lag == 7 * 64);
+        CHECK(stats.high_water >= 8 * samples.size() * sizeof(sample_t));
+        CHECK(stats.max_write_usec <= stats.write_usec);
+}
+
+TEST_CASE("the writer thread logs a summary every interval") {
+        recording_writer * sink = nullptr;
+        auto w = make_writer(&sink);
+        w->report_stats(std::chrono::milliseconds(20));
+        w->start();
+        const std::vector<sample_t> samples(64, 0.5f);
+        for (nframes_t i = 0; i < 8; ++i) {
+                w->push(i * 64, jill::SAMPLED, "pcm",
+                        samples.size() * sizeof(sample_t), samples.data());
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        // long enough for a pass after the interval is up
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        w->stop();
+        join_within(w, std::chrono::seconds(10));
+
+        REQUIRE_FALSE(sink->logged.empty());
+        CHECK(sink->logged[0].find("buffered_data_writer: buffer high water") == 0);
+}
+
+TEST_CASE("a writer that never catches up still reports") {
+        recording_writer * sink = nullptr;
+        auto w = make_writer(&sink);
+        sink->write_delay = std::chrono::milliseconds(20);
+        w->report_stats(std::chrono::milliseconds(30));
+        const std::vector<sample_t> samples(64, 0.5f);
+        // all queued at once, so the buffer does not empty until the end
+        for (nframes_t i = 0; i < 8; ++i) {
+                w->push(i * 64, jill::SAMPLED, "pcm",
+                        samples.size() * sizeof(sample_t), samples.data());
+        }
+        w->start();
+        w->stop();
+        join_within(w, std::chrono::seconds(10));
+
+        REQUIRE_FALSE(sink->logged.empty());
+        CHECK(sink->logged_after[0] < 8);
+}
+
+TEST_CASE("a ringbuffer past the soft limit degrades the writer") {
+        recording_writer * sink = nullptr;
+        auto w = make_writer(&sink);
+        CHECK_THROWS_AS(w->set_soft_limit(1.5), std::invalid_argument);
+        // a single block is over the limit, so draining the backlog trips it
+        w->set_soft_limit(0.01, std::chrono::milliseconds(0));
+        const std::vector<sample_t> samples(64, 0.5f);
+        for (nframes_t i = 0; i < 8; ++i) {
+                w->push(i * 64, jill::SAMPLED, "pcm",
+                        samples.size() * sizeof(sample_t), samples.data());
+        }
+        w->start();
+        // with no hold, the next idle pass lets it go again
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        CHECK_FALSE(w->degraded());
+        w->stop();
+        join_within(w, std::chrono::seconds(10));
+
+        CHECK(w->stats().degradations == 1);
+        std::vector<std::string> changes;
+        for (auto const & c : sink->calls)
+                if (c.what == "degraded" || c.what == "recovered") changes.push_back(c.what);
+        CHECK(changes == std::vector<std::string>{"degraded", "recovered"});
+}
+
+TEST_CASE("lower priority tiers are dropped first, and leave a gap marker") {
+        recording_writer * sink = nullptr;
+        auto w = make_writer(&sink);
+        CHECK_THROWS_AS(w->set_reserve(1.0), std::invalid_argument);
+        w->set_reserve(0.5);
+        const std::vector<sample_t> samples(64, 0.5f);
+        const std::size_t bytes = samples.size() * sizeof(sample_t);
+        // with the writer not yet started the buffer only fills: tier 1 is
+        // refused once half is gone, while tier 0 carries on into the reserve
+        for (nframes_t t = 0; t < 64 * 64; t += 64) {
+                w->push(t, jill::SAMPLED, "high", bytes, samples.data(), 0);
+                w->push(t, jill::SAMPLED, "low", bytes, samples.data(), 1);
+        }
+        w->start();
+        w->stop();
+        join_within(w, std::chrono::seconds(10));
+
+        auto count = [sink](std::string const & what) {
+                return std::count(sink->blocks.begin(), sink->blocks.end(), what);
+        };
+        CHECK(count("low") > 0);
+        CHECK(count("high") > count("low"));
+        CHECK(count("gap low") > 0);
+        CHECK(count("gap high") == 0);
+        CHECK(std::size_t(count("gap low")) == w->stats().gaps);
+}
+
+TEST_CASE("a tier the reserve leaves no room for is the one past the lowest") {
+        using jill::dsp::buffered_data_writer;
+        CHECK(buffered_data_writer::lowest_tier(0.1) == 9);
+        CHECK(buffered_data_writer::lowest_tier(0.1f) == 9);
+        CHECK(buffered_data_writer::lowest_tier(0.25) == 3);
+        CHECK(buffered_data_writer::lowest_tier(0.3) == 3);
+        CHECK(buffered_data_writer::lowest_tier(0.5) == 1);
+        CHECK(buffered_data_writer::lowest_tier(0.9) == 1);
+        CHECK(buffered_data_writer::lowest_tier(0) > 9);
+
+        // and the lowest tier does get into the buffer
+        recording_writer * sink = nullptr;
+        auto w = make_writer(&sink);
+        w->set_reserve(0.25);
+        const std::vector<sample_t> samples(16, 0.5f);
+        w->push(0, jill::SAMPLED, "low", samples.size() * sizeof(sample_t), samples.data(),
+                buffered_data_writer::lowest_tier(0.25));
+        w->start();
+        w->stop();
+        join_within(w, std::chrono::seconds(10));
+        CHECK(std::count(sink->blocks.begin(), sink->blocks.end(), "low") == 1);
+        CHECK(w->stats().gaps == 0);
+}
+
+namespace {
+
+/* The frame of the first write after each close_entry */
+std::vector<nframes_t>
+splits(recording_writer const & sink)
+{
+        std::vector<nframes_t> out;
+        bool closed = false;
+        for (auto const & c : sink.calls) {
+                if (c.what == "close_entry") closed = true;
+                else if (c.what == "write" && closed) {
+                        out.push_back(c.frame);
+                        closed = false;
+                }
+        }
+        return out;
+}
+
+}
+
+TEST_CASE("a sharded writer sends each channel to its shard, and splits them together") {
+        recording_writer * sinks[2] = {nullptr, nullptr};
+        std::vector<std::unique_ptr<jill::dsp::buffered_data_writer>> shards;
+        shards.push_back(make_writer(&sinks[0]));
+        shards.push_back(make_writer(&sinks[1]));
+        jill::dsp::sharded_data_writer w(std::move(shards));
+        CHECK_THROWS_AS(w.route("a", 2), std::out_of_range);
+        w.route("a", 0);
+        w.route("b", 1);
+
+        const std::vector<sample_t> samples(64, 0.5f);
+        const std::size_t bytes = samples.size() * sizeof(sample_t);
+        w.start();
+        for (nframes_t t = 0; t < 64 * 6; t += 64) {
+                w.push(t, jill::SAMPLED, "a", bytes, samples.data());
+                // asked for partway through a period: the split is at the next
+                if (t == 64 * 3) w.reset();
+                w.push(t, jill::SAMPLED, "b", bytes, samples.data());
+                w.push(t, jill::SAMPLED, "c", bytes, samples.data());
+        }
+        w.stop();
+        w.join();
+
+        CHECK(std::count(sinks[0]->blocks.begin(), sinks[0]->blocks.end(), "a") == 6);
+        CHECK(std::count(sinks[0]->blocks.begin(), sinks[0]->blocks.end(), "c") == 6);
+        CHECK(std::count(sinks[1]->blocks.begin(), sinks[1]->blocks.end(), "b") == 6);
+        CHECK(sinks[1]->blocks.size() == 6);
+        CHECK(splits(*sinks[0]) == std::vector<nframes_t>{64 * 4});
+        CHECK(splits(*sinks[1]) == std::vector<nframes_t>{64 * 4});
+}
+
+TEST_CASE("a shard whose period starts with an event splits where the others do") {
+        recording_writer * sinks[2] = {nullptr, nullptr};
+        std::vector<std::unique_ptr<jill::dsp::buffered_data_writer>> shards;
+        shards.push_back(make_writer(&sinks[0]));
+        shards.push_back(make_writer(&sinks[1]));
+        jill::dsp::sharded_data_writer w(std::move(shards));
+        w.route("a", 0);
+        w.route("e", 0);
+        w.route("b", 1);
+
+        const std::vector<sample_t> samples(64, 0.5f);
+        const std::size_t bytes = samples.size() * sizeof(sample_t);
+        const char note[] = {char(0x90), 60, 64};
+        w.start();
+        for (nframes_t t = 0; t < 64 * 6; t += 64) {
+                // stamped partway into the period, and pushed ahead of it
+                w.push(t + 10, jill::EVENT, "e", sizeof(note), note);
+                if (t == 64 * 3) w.reset();
+                w.push(t, jill::SAMPLED, "a", bytes, samples.data());
+                w.push(t, jill::SAMPLED, "b", bytes, samples.data());
+        }
+        w.stop();
+        w.join();
+
+        auto entries = [](recording_writer const & sink) {
+                std::vector<nframes_t> out;
+                for (auto const & c : sink.calls)
+                        if (c.what == "new_entry") out.push_back(c.frame);
+                return out;
+        };
+        CHECK(entries(*sinks[0]) == std::vector<nframes_t>{64 * 4});
+        CHECK(entries(*sinks[1]) == std::vector<nframes_t>{64 * 4});
+        // the event that opened the period is in the new entry
+        CHECK(splits(*sinks[0]) == std::vector<nframes_t>{64 * 4 + 10});
+        CHECK(splits(*sinks[1]) == std::vector<nframes_t>{64 * 4});
+}
+
+TEST_CASE("the first shard gets room for channels that were never routed") {
+        std::vector<std::unique_ptr<jill::dsp::buffered_data_writer>> shards;
+        shards.push_back(make_writer());
+        shards.push_back(make_writer());
+        jill::dsp::sharded_data_writer w(std::move(shards));
+        w.route("a", 1);
+        const std::size_t bytes = 1 << 20;
+        w.request_buffer_size(bytes);
+        CHECK(w.shard(0).request_buffer_size(0) >= bytes / 2);
+        CHECK(w.shard(1).request_buffer_size(0) >= bytes);
+}
+
+TEST_CASE("rotating files splits at the next period, between entries") {
+        recording_writer * sink = nullptr;
+        std::vector<std::unique_ptr<jill::dsp::buffered_data_writer>> shards;
+        shards.push_back(make_writer(&sink));
+        jill::dsp::sharded_data_writer w(std::move(shards));
+
+        const std::vector<sample_t> samples(64, 0.5f);
+        const std::size_t bytes = samples.size() * sizeof(sample_t);
+        w.start();
+        for (nframes_t t = 0; t < 64 * 6; t += 64) {
+                w.push(t, jill::SAMPLED, "a", bytes, samples.data());
+                if (t == 64 * 2) w.rotate();
+                w.push(t, jill::SAMPLED, "b", bytes, samples.data());
+        }
+        w.stop();
+        w.join();
+
+        CHECK(w.shard(0).bytes_written() == 12 * bytes);
+        CHECK(splits(*sink) == std::vector<nframes_t>{64 * 3});
+        // the writer is told between closing one entry and starting the next
+        auto rotated = std::find_if(sink->calls.begin(), sink->calls.end(),
+                                    [](auto const & c) { return c.what == "rotate"; });
+        REQUIRE(rotated != sink->calls.end());
+        CHECK(std::prev(rotated)->what == "close_entry");
+        CHECK(std::next(rotated)->frame == 64 * 3);
+        CHECK(std::count_if(sink->calls.begin(), sink->calls.end(),
+                            [](auto const & c) { return c.what == "rotate"; }) == 1);
+}
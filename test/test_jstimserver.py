@@ -37,7 +37,8 @@ import pytest
 pytest.importorskip("zmq", reason="the jstimserver protocol tests need pyzmq")
 
 from conftest import TEST_DIR, sanitizer_env  # noqa: E402
-from jstimserver_client import JstimserverClient, Timeout, parse_event  # noqa: E402
+from jstimserver_client import (  # noqa: E402
+    JstimserverClient, Timeout, pack_requests, parse_event)
 
 MODULE = TEST_DIR.parent / "modules" / "jstimserver"
 
@@ -45,10 +46,13 @@ pytestmark = pytest.mark.needs_jack
 
 #: The protocol version the server should report. Bump deliberately, and
 #: only alongside doc/jstimserver-protocol.md.
-PROTOCOL_VERSION = "1.0"
+PROTOCOL_VERSION = "1.7"
 
 SAMPLERATE = 44100
 
+#: How many starts the server will hold scheduled at once (section 3.7).
+SCHEDULE_SIZE = 16
+
 # Long enough that a request issued after playback starts is comfortably
 # inside it, short enough not to pad the suite.
 LONG_SECONDS = 2.0
@@ -92,15 +96,17 @@ def expect_completion(client, name, timeout):
             return frame
 
 
-def write_tone(path, seconds, freq=440.0):
+def write_tone(path, seconds, freq=440.0, channels=1):
+    """A tone in every channel, channel c an octave above channel c - 1."""
     nframes = int(seconds * SAMPLERATE)
     with wave.open(str(path), "w") as w:
-        w.setnchannels(1)
+        w.setnchannels(channels)
         w.setsampwidth(2)
         w.setframerate(SAMPLERATE)
         w.writeframes(b"".join(
-            struct.pack("<h", int(16000 * math.sin(2 * math.pi * freq * i / SAMPLERATE)))
-            for i in range(nframes)))
+            struct.pack("<h", int(16000 * math.sin(2 * math.pi * freq * (1 << c) * i
+                                                   / SAMPLERATE)))
+            for i in range(nframes) for c in range(channels)))
     return str(path)
 
 
@@ -118,10 +124,12 @@ def stimuli(tmp_path_factory):
 class Server:
     """A running jstimserver and a client connected to it."""
 
-    def __init__(self, proc, client, logfile):
+    def __init__(self, proc, client, logfile, name):
         self.proc = proc
         self.client = client
         self.logfile = logfile
+        #: the JACK client name, for connecting other clients to its ports
+        self.name = name
 
     def returncode(self):
         return self.proc.poll()
@@ -154,14 +162,14 @@ def start_server(tmp_path, jack_server):
     started = []
     counter = [0]
 
-    def _start(stims, server_name="default", timeout=15.0):
+    def _start(stims, server_name="default", timeout=15.0, args=()):
         if not MODULE.exists():
             pytest.skip("jstimserver was not built")
         counter[0] += 1
         name = "jstimtest_%d_%d" % (os.getpid(), counter[0])
         logfile = tmp_path / ("%s.log" % name)
         proc = subprocess.Popen(
-            [str(MODULE), "--name", name, "--server", server_name, *stims],
+            [str(MODULE), "--name", name, "--server", server_name, *args, *stims],
             stdout=logfile.open("w"), stderr=subprocess.STDOUT,
             env=sanitizer_env())
         socket_dir = pathlib.Path("/tmp/org.meliza.jill") / server_name / name
@@ -203,7 +211,7 @@ def start_server(tmp_path, jack_server):
             endpoint,
             on_timeout=lambda msg: alive_or_fail("while a client was waiting",
                                                  cause=msg))
-        server = Server(proc, client, logfile)
+        server = Server(proc, client, logfile, name)
         started.append(server)
         alive_or_fail("after binding")
         try:
@@ -211,6 +219,9 @@ def start_server(tmp_path, jack_server):
         except Timeout as e:
             alive_or_fail("before answering VERSION", cause=e)
             raise
+        # the endpoints are bound before the samples are loaded, and a PLAY
+        # for a stimulus still loading is answered LOADING
+        client.wait_until_loaded(timeout=timeout)
 
         # Confirm the subscription has actually reached the publisher, rather
         # than sleeping and hoping: zmq propagates subscriptions asynchronously
@@ -334,6 +345,31 @@ def test_play_unknown_stimulus_is_refused(server):
     assert server.client.play("no_such_stimulus") == "BADSTIM"
 
 
+def test_loadstatus_is_ready_once_loaded(server):
+    assert server.client.request("LOADSTATUS") == "READY"
+    assert server.client.loadstatus() is None
+
+
+def test_budgeted_server_loads_on_first_play(start_server, stimuli):
+    """With --memory-budget nothing is loaded until asked for (section 3.5)."""
+    server = start_server([stimuli["short"]], args=["--memory-budget", "16"])
+    client = server.client
+    assert client.play("short") == "LOADING"
+    client.wait_until_loaded(timeout=10)
+    assert client.play("short") == "OK"
+    expect_completion(client, "short", timeout=5)
+
+
+def test_preload_loads_without_playing(start_server, stimuli):
+    server = start_server([stimuli["short"]], args=["--memory-budget", "16"])
+    client = server.client
+    assert client.preload("short") == "OK"
+    client.wait_until_loaded(timeout=10)
+    assert client.play("short") == "OK"
+    assert client.preload("no_such_stimulus") == "BADSTIM"
+    assert client.request("PRELOAD ") == "BADCMD"
+
+
 def test_interrupt_while_idle(server):
     assert server.client.interrupt() == "OK"
     assert server.client.next_event() == "NOTPLAYING"
@@ -380,6 +416,294 @@ def test_stimulus_names_may_contain_spaces(server):
     assert isinstance(frame, int)
 
 
+def test_play_at_starts_on_the_requested_frame(server):
+    """Scheduled playback is sample-accurate, not period-accurate.
+
+    The target is deliberately not on a period boundary, which is where an
+    immediate PLAY would land: the PLAYING event has to report the exact frame.
+    """
+    client = server.client
+    assert client.play("short") == "OK"
+    end = expect_completion(client, "short", timeout=SHORT_SECONDS + 2)
+
+    target = (end + SAMPLERATE // 2 + 37) % 2**32
+    assert client.play_at("short", target) == "OK"
+    verb, name, start = parse_event(client.next_event(timeout=3.0))
+    assert (verb, name, start) == ("PLAYING", "short", target)
+    done = expect_completion(client, "short", timeout=SHORT_SECONDS + 2)
+    assert done - start == pytest.approx(SHORT_SECONDS * SAMPLERATE, abs=2)
+
+
+def test_play_at_a_past_frame_is_late(server):
+    """A start whose moment has gone is refused, not played at the wrong time."""
+    client = server.client
+    assert client.play("short") == "OK"
+    _, _, start = parse_event(client.next_event())
+    expect_completion(client, "short", timeout=SHORT_SECONDS + 2)
+
+    assert client.play_at("short", start) == "OK"
+    assert parse_event(client.next_event()) == ("LATE", "short", start)
+    assert client.status() is None
+
+
+def test_interrupt_cancels_scheduled_starts(server):
+    client = server.client
+    assert client.play("short") == "OK"
+    _, _, start = parse_event(client.next_event())
+    far = (start + 600 * SAMPLERATE) % 2**32
+    assert client.play_at("long", far) == "OK"
+    assert client.play_after("short", 100) == "OK"
+
+    assert client.interrupt() == "OK"
+    seen = client.events_until("CANCELLED", timeout=3.0)
+    seen += [client.next_event()]
+    cancelled = sorted(parse_event(e)[1] for e in seen if e.startswith("CANCELLED"))
+    assert cancelled == ["long", "short"]
+    # something was cancelled, so the interrupt was not a no-op
+    assert "NOTPLAYING" not in seen
+
+
+def test_a_full_schedule_is_busy(server):
+    client = server.client
+    assert client.play("short") == "OK"
+    _, _, start = parse_event(client.next_event())
+    far = (start + 600 * SAMPLERATE) % 2**32
+    for i in range(SCHEDULE_SIZE):
+        assert client.play_at("short", far + i) == "OK"
+    assert client.play_at("short", far + SCHEDULE_SIZE) == "BUSY"
+    assert client.play_after("short", 0) == "BUSY"
+
+    assert client.interrupt() == "OK"
+    client.drain_events()
+    # and the slots come back once the schedule is cleared
+    assert client.play_at("short", far) == "OK"
+
+
+@pytest.mark.parametrize("request_text,reply", [
+    ("PLAY no_such_stimulus AT 1000", "BADSTIM"),
+    ("PLAY short AT", "BADSTIM"),
+    ("PLAY short AT -5", "BADSTIM"),
+    ("PLAY short AT 4294967296", "BADSTIM"),
+    ("PLAY  AT 1000", "BADCMD"),
+])
+def test_malformed_scheduled_play_is_refused(server, request_text, reply):
+    """Anything that is not exactly "<name> AT|AFTER <count>" is a name.
+
+    So it is answered as an unknown stimulus, unless the name it leaves is
+    empty, which is malformed in either form.
+    """
+    assert server.client.request(request_text) == reply
+
+
+def test_play_after_counts_from_a_trigger(start_server, stimuli):
+    """Playback locked to an onset on trig_in, with no client in the loop.
+
+    The trigger comes from a second server's trig_out, so the onset frame is
+    the one that server reports in its own PLAYING event.
+    """
+    source = start_server([stimuli["long"]])
+    target = start_server([stimuli["short"]],
+                          args=["--trig", "%s:trig_out" % source.name])
+    delay = 1000
+    assert target.client.play_after("short", delay) == "OK"
+    # armed, not started
+    assert target.client.drain_events(settle=0.3) == []
+
+    assert source.client.play("long") == "OK"
+    verb, _, onset = parse_event(source.client.next_event())
+    assert verb == "PLAYING"
+    verb, name, start = parse_event(target.client.next_event(timeout=3.0))
+    assert (verb, name) == ("PLAYING", "short")
+    assert start == (onset + delay) % 2**32
+
+
+def test_queued_stimuli_play_without_a_gap(server):
+    """Each entry starts on the sample after the one before it ended."""
+    client = server.client
+    assert client.enqueue("short") == "OK"
+    assert client.enqueue("two words") == "OK"
+    verb, name, _ = parse_event(client.next_event())
+    assert (verb, name) == ("PLAYING", "short")
+    end = expect_completion(client, "short", timeout=SHORT_SECONDS + 2)
+    verb, name, start = parse_event(client.next_event())
+    assert (verb, name, start) == ("PLAYING", "two words", end)
+    expect_completion(client, "two words", timeout=SHORT_SECONDS + 2)
+
+
+def test_enqueue_unknown_stimulus_is_refused(server):
+    assert server.client.enqueue("no_such_stimulus") == "BADSTIM"
+    assert server.client.request("ENQUEUE ") == "BADCMD"
+
+
+def test_clear_cancels_what_has_not_started(server):
+    client = server.client
+    for name in ("long", "short", "two words"):
+        assert client.enqueue(name) == "OK"
+    assert parse_event(client.next_event())[:2] == ("PLAYING", "long")
+
+    assert client.clear() == "OK"
+    cancelled = [parse_event(client.next_event())[:2] for _ in range(2)]
+    assert cancelled == [("CANCELLED", "short"), ("CANCELLED", "two words")]
+    # the one that had started is left to finish
+    expect_completion(client, "long", timeout=LONG_SECONDS + 2)
+    assert client.drain_events(settle=0.3) == []
+
+
+def test_interrupt_clears_the_queue(server):
+    client = server.client
+    assert client.enqueue("long") == "OK"
+    assert client.enqueue("short") == "OK"
+    assert parse_event(client.next_event())[:2] == ("PLAYING", "long")
+
+    assert client.interrupt() == "OK"
+    seen = client.events_until("INTERRUPTED", timeout=3.0)
+    assert [parse_event(e)[:2] for e in seen] == [("CANCELLED", "short"),
+                                                   ("INTERRUPTED", "long")]
+    assert client.drain_events(settle=0.3) == []
+
+
+def test_a_queued_stimulus_waits_for_a_played_one(server):
+    """With one voice, the queue does not preempt PLAY, it follows it."""
+    client = server.client
+    assert client.play("short") == "OK"
+    assert parse_event(client.next_event())[:2] == ("PLAYING", "short")
+    assert client.enqueue("two words") == "OK"
+    end = expect_completion(client, "short", timeout=SHORT_SECONDS + 2)
+    assert parse_event(client.next_event()) == ("PLAYING", "two words", end)
+
+
+def test_several_voices_play_at_once(start_server, stimuli):
+    server = start_server([stimuli["long"], stimuli["short"]], args=["--voices", "2"])
+    client = server.client
+    assert client.play("long") == "OK"
+    assert parse_event(client.next_event())[:2] == ("PLAYING", "long")
+    assert client.play("short") == "OK"
+    assert parse_event(client.next_event())[:2] == ("PLAYING", "short")
+    expect_completion(client, "short", timeout=SHORT_SECONDS + 2)
+
+    # both voices busy is BUSY again
+    assert client.play("short") == "OK"
+    assert parse_event(client.next_event())[:2] == ("PLAYING", "short")
+    assert client.play("short") == "OK"
+    assert client.next_event() == "BUSY"
+
+    # and an interrupt stops all of them
+    assert client.interrupt() == "OK"
+    seen = client.events_until("INTERRUPTED", timeout=3.0)
+    seen += [client.next_event()]
+    assert sorted(parse_event(e)[1] for e in seen if e.startswith("INTERRUPTED")) \
+        == ["long", "short"]
+
+
+def negotiate_binary(client, timed=False):
+    """Switch a client to binary and wait for its event subscription to land.
+
+    As in the start_server fixture, by interrupting until the NOTPLAYING that
+    answers it arrives, rather than sleeping and hoping.
+    """
+    assert client.negotiate_binary(timed=timed) == PROTOCOL_VERSION
+    for _ in range(40):
+        assert client.batch([("INTERRUPT", 0, 0)]) == [(6, "OK", 0)]
+        try:
+            client.binary_events_until("NOTPLAYING", timeout=0.25)
+            break
+        except Timeout:
+            continue
+    else:
+        pytest.fail("no binary events arrived from jstimserver")
+    client.drain_events(settle=0.1)
+    return {s["name"]: i for i, s in enumerate(client.stimlist())}
+
+
+def test_version_binary_offers_the_binary_framing(server):
+    assert server.client.request("VERSION BINARY") == PROTOCOL_VERSION + " BINARY"
+    # and asking changes nothing about the text protocol
+    assert server.client.version() == PROTOCOL_VERSION
+
+
+def test_a_binary_batch_is_answered_in_order(server):
+    client = server.client
+    index = negotiate_binary(client)
+    replies = client.batch([("ENQUEUE", index["short"], 0),
+                            ("ENQUEUE", index["two words"], 0),
+                            ("ENQUEUE", 1000, 0),
+                            (99, index["short"], 0)])
+    assert replies == [(4, "OK", index["short"]), (4, "OK", index["two words"]),
+                       (4, "BADSTIM", 1000), (99, "BADCMD", index["short"])]
+
+    events = client.binary_events_until("DONE", timeout=SHORT_SECONDS + 2)
+    events += client.binary_events_until("DONE", timeout=SHORT_SECONDS + 2)
+    played = [(verb, i) for verb, i, _, _ in events if verb in ("PLAYING", "DONE")]
+    assert played == [("PLAYING", index["short"]), ("DONE", index["short"]),
+                      ("PLAYING", index["two words"]), ("DONE", index["two words"])]
+    # back to back, as over text
+    frames = {(verb, i): frame for verb, i, frame, _ in events}
+    assert frames[("PLAYING", index["two words"])] == frames[("DONE", index["short"])]
+    # pub-binary keeps the 1.6 record, which has no time
+    assert all(usec is None for _, _, _, usec in events)
+
+    # the text events went out as well
+    assert parse_event(client.next_event())[:2] == ("PLAYING", "short")
+
+
+def test_timed_events_carry_the_time_they_happened(server):
+    client = server.client
+    index = negotiate_binary(client, timed=True)
+    before = time.monotonic_ns() // 1000
+    assert client.batch([("PLAY", index["short"], 0)]) == [(1, "OK", index["short"])]
+    events = client.binary_events_until("DONE", timeout=SHORT_SECONDS + 2)
+    after = time.monotonic_ns() // 1000
+    usec = {verb: t for verb, _, _, t in events}
+    # JACK's clock is CLOCK_MONOTONIC on Linux, so it shares ours; allow a
+    # period either side for where in the cycle the frame fell
+    assert before - 100_000 <= usec["PLAYING"] <= usec["DONE"] <= after + 100_000
+    assert usec["DONE"] - usec["PLAYING"] == pytest.approx(SHORT_SECONDS * 1e6, rel=0.1)
+
+
+def test_two_plays_in_one_batch_are_ok_then_busy(server):
+    client = server.client
+    index = negotiate_binary(client)
+    replies = client.batch([("PLAY", index["long"], 0), ("PLAY", index["short"], 0)])
+    assert [status for _, status, _ in replies] == ["OK", "BUSY"]
+
+
+def test_a_malformed_batch_is_badcmd(server):
+    client = server.client
+    negotiate_binary(client)
+    batch = pack_requests([("PLAY", 0, 0)])
+    assert client.request_raw(batch[:-1]) == "BADCMD"
+    # a byte over is not a longer record when there are two of them
+    two = pack_requests([("PLAY", 0, 0), ("PLAY", 0, 0)])
+    assert client.request_raw(two + b"\x00") == "BADCMD"
+    # and the server carries on
+    assert client.version() == PROTOCOL_VERSION
+
+
+def test_a_multichannel_stimulus_gets_a_port_per_channel(start_server, stimuli, tmp_path):
+    stereo = write_tone(tmp_path / "stereo.wav", SHORT_SECONDS, channels=2)
+    server = start_server([stimuli["short"], stereo])
+    client = server.client
+    channels = {s["name"]: s["channels"] for s in client.stimlist()}
+    assert channels == {"short": 1, "stereo": 2}
+    assert "playing 2 output channels" in server.logfile.read_text()
+
+    # and either plays on them
+    for name in ("stereo", "short"):
+        assert client.play(name) == "OK"
+        assert parse_event(client.next_event())[:2] == ("PLAYING", name)
+        expect_completion(client, name, timeout=SHORT_SECONDS + 2)
+
+
+def test_zero_voices_is_refused(tmp_path, jack_server, stimuli):
+    if not MODULE.exists():
+        pytest.skip("jstimserver was not built")
+    proc = subprocess.run(
+        [str(MODULE), "--name", "jstimtest_novoice_%d" % os.getpid(),
+         "--voices", "0", stimuli["short"]],
+        capture_output=True, text=True, timeout=BUDGET, env=sanitizer_env())
+    assert proc.returncode > 0
+
+
 # --------------------------------------------------------------------------
 # Known defects. Each asserts what the specification calls for.
 # --------------------------------------------------------------------------
@@ -0,0 +1,185 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Unit tests for the binary framing of the jstimserver control protocol. The
+ * byte layouts asserted here are the ones in doc/jstimserver-protocol.md,
+ * section 8, which clients in other languages are written against.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <string>
+#include <vector>
+
+#include "jill/net/jstimserver_binary.hh"
+
+namespace wire = jill::net::stimserver;
+
+namespace {
+
+std::string
+bytes(std::initializer_list<int> b)
+{
+        std::string out;
+        for (int c : b) out.push_back(char(c));
+        return out;
+}
+
+}
+
+TEST_CASE("a request batch has the documented layout") {
+        std::string msg;
+        wire::begin(msg, wire::Requests, 2);
+        wire::append(msg, wire::request{wire::op::PlayAt, 3, 0x01020304});
+        wire::append(msg, wire::request{wire::op::Interrupt, 0, 0});
+        wire::finish(msg);
+
+        CHECK(msg == bytes({0x00, 'Q', 2, 0,
+                            2, 0, 0, 0, 3, 0, 0, 0, 0x04, 0x03, 0x02, 0x01,
+                            6, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}));
+        CHECK(wire::is_binary(msg));
+        CHECK_FALSE(wire::is_binary("PLAY tone"));
+        CHECK_FALSE(wire::is_binary(""));
+}
+
+TEST_CASE("requests survive a round trip") {
+        std::string msg;
+        wire::begin(msg, wire::Requests);
+        for (std::uint32_t i = 0; i < 300; ++i)
+                wire::append(msg, wire::request{wire::op::Enqueue, i, 0xfffffff0 + i});
+        wire::finish(msg);
+
+        std::vector<wire::request> out;
+        REQUIRE(wire::parse(msg, out));
+        REQUIRE(out.size() == 300);
+        for (std::uint32_t i = 0; i < 300; ++i) {
+                CAPTURE(i);
+                CHECK(out[i].what == wire::op::Enqueue);
+                CHECK(out[i].stim == i);
+                CHECK(out[i].frame == 0xfffffff0 + i);
+        }
+}
+
+TEST_CASE("replies and events have the documented layout") {
+        std::string msg;
+        wire::begin(msg, wire::Replies);
+        wire::append(msg, wire::reply{wire::op::Play, wire::status::Busy, 258});
+        wire::finish(msg);
+        CHECK(msg == bytes({0x00, 'R', 1, 0, 1, 3, 0, 0, 2, 1, 0, 0}));
+
+        std::vector<wire::reply> replies;
+        REQUIRE(wire::parse(msg, replies));
+        REQUIRE(replies.size() == 1);
+        CHECK(replies[0].result == wire::status::Busy);
+        CHECK(replies[0].stim == 258);
+
+        wire::begin(msg, wire::Events);
+        wire::append(msg, wire::event{wire::event_type::Done, 1, 44100, 0x0102030405060708});
+        wire::append(msg, wire::event{wire::event_type::NotPlaying, wire::no_stimulus, 0, 0});
+        wire::finish(msg);
+        // as in 1.6: no microseconds
+        CHECK(msg.size() == wire::header_size + 2 * 12);
+        CHECK(msg.substr(0, 16) == bytes({0x00, 'E', 2, 0, 3, 0, 0, 0,
+                                          1, 0, 0, 0, 0x44, 0xac, 0, 0}));
+
+        std::vector<wire::event> events;
+        REQUIRE(wire::parse(msg, events));
+        REQUIRE(events.size() == 2);
+        CHECK(events[0].type == wire::event_type::Done);
+        CHECK(events[0].frame == 44100);
+        CHECK(events[0].usec == 0);
+        CHECK(events[1].stim == wire::no_stimulus);
+
+        wire::begin(msg, wire::TimedEvents);
+        wire::append(msg, wire::event{wire::event_type::Done, 1, 44100, 0x0102030405060708});
+        wire::finish(msg);
+        CHECK(msg == bytes({0x00, 'T', 1, 0, 3, 0, 0, 0,
+                            1, 0, 0, 0, 0x44, 0xac, 0, 0,
+                            8, 7, 6, 5, 4, 3, 2, 1}));
+        REQUIRE(wire::parse(msg, events));
+        REQUIRE(events.size() == 1);
+        CHECK(events[0].frame == 44100);
+        CHECK(events[0].usec == 0x0102030405060708);
+}
+
+TEST_CASE("a timed event batch is not mistaken for a short one") {
+        // twelve bytes is a whole event, but not a whole timed event
+        const std::string msg = bytes({0x00, 'T', 1, 0, 3, 0, 0, 0,
+                                       1, 0, 0, 0, 0x44, 0xac, 0, 0});
+        std::vector<wire::event> events;
+        CHECK_FALSE(wire::parse(msg, events));
+}
+
+TEST_CASE("a malformed batch is refused whole") {
+        std::string msg;
+        wire::begin(msg, wire::Requests);
+        wire::append(msg, wire::request{wire::op::Play, 0, 0});
+        wire::finish(msg);
+        std::vector<wire::request> out;
+
+        SUBCASE("short by a byte") {
+                CHECK_FALSE(wire::parse(msg.substr(0, msg.size() - 1), out));
+        }
+        SUBCASE("with a byte that is not a whole record") {
+                std::string two;
+                wire::begin(two, wire::Requests);
+                wire::append(two, wire::request{wire::op::Play, 0, 0});
+                wire::append(two, wire::request{wire::op::Play, 1, 0});
+                wire::finish(two);
+                CHECK_FALSE(wire::parse(two + '\0', out));
+        }
+        SUBCASE("the wrong kind") {
+                std::vector<wire::event> events;
+                CHECK_FALSE(wire::parse(msg, events));
+        }
+        SUBCASE("a count that overstates the records") {
+                msg[2] = 2;
+                CHECK_FALSE(wire::parse(msg, out));
+        }
+        SUBCASE("only a header") {
+                CHECK_FALSE(wire::parse(msg.substr(0, 3), out));
+        }
+        CHECK(out.empty());
+}
+
+TEST_CASE("records longer than the ones known are read, and the rest skipped") {
+        // what a later version's records look like to this one: two known
+        // requests, each followed by four bytes of something new
+        const std::string msg = bytes({0x00, 'Q', 2, 0,
+                                       4, 0, 0, 0, 7, 0, 0, 0, 0, 0, 0, 0, 9, 9, 9, 9,
+                                       1, 0, 0, 0, 8, 0, 0, 0, 0, 0, 0, 0, 9, 9, 9, 9});
+        std::vector<wire::request> out;
+        REQUIRE(wire::parse(msg, out));
+        REQUIRE(out.size() == 2);
+        CHECK(out[0].what == wire::op::Enqueue);
+        CHECK(out[0].stim == 7);
+        CHECK(out[1].what == wire::op::Play);
+        CHECK(out[1].stim == 8);
+
+        SUBCASE("but not shorter") {
+                // a request missing its frame
+                const std::string shorter = bytes({0x00, 'Q', 1, 0, 4, 0, 0, 0, 7, 0, 0, 0});
+                CHECK_FALSE(wire::parse(shorter, out));
+        }
+}
+
+TEST_CASE("an empty batch is well formed") {
+        std::string msg;
+        wire::begin(msg, wire::Requests);
+        wire::finish(msg);
+        std::vector<wire::request> out{wire::request{wire::op::Play, 1, 1}};
+        CHECK(wire::parse(msg, out));
+        CHECK(out.empty());
+}
+
+TEST_CASE("an unknown op still unpacks, to be refused on its own") {
+        const std::string msg = bytes({0x00, 'Q', 1, 0, 99, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0});
+        std::vector<wire::request> out;
+        REQUIRE(wire::parse(msg, out));
+        CHECK(int(out[0].what) == 99);
+}
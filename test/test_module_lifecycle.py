@@ -97,6 +97,7 @@ def assert_exited_under_its_own_control(rc, elapsed, out, name):
 # file scope, which is the case that skips the explicit teardown.
 ERROR_PATHS = [
     pytest.param("jrecord", ["-i", "no_such_port", "{tmp}/out.arf"], id="jrecord"),
+    pytest.param("jspike", ["-i", "no_such_port", "{tmp}/out.arf"], id="jspike"),
     pytest.param("jdetect", ["-i", "no_such_port"], id="jdetect"),
     pytest.param("jrelay", ["-i", "no_such_port"], id="jrelay"),
     pytest.param("jclicker", ["-i", "no_such_port"], id="jclicker"),
@@ -175,6 +176,7 @@ SHUTDOWN_PATHS = [
     ("jnoise", []),
     ("jdetect", []),
     ("jrecord", ["-i", "system:capture_1", "{tmp}/out.arf"]),
+    ("jspike", ["-i", "system:capture_1", "{tmp}/out.arf"]),
     ("jstim", ["-l", "{tone}"]),
 ]
 
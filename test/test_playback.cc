@@ -16,10 +16,13 @@
 #include <doctest/doctest.h>
 
 #include <limits>
+#include <vector>
 
 #include "jill/dsp/playback_timing.hh"
+#include "jill/dsp/playback_schedule.hh"
 
 using namespace jill;
+using jill::dsp::frames_until;
 using jill::dsp::next_onset_offset;
 using jill::dsp::posttrigger_offset;
 using jill::dsp::pretrigger_offset;
@@ -151,3 +154,111 @@ TEST_CASE("nothing is copied when the onset is past the end of the period") {
         CHECK(samples_to_copy(48000, 0, NFRAMES, NFRAMES) == 0);
         CHECK(samples_to_copy(48000, 0, NFRAMES, NFRAMES + 500) == 0);
 }
+
+TEST_CASE("frames_until is signed distance to a frame") {
+        CHECK(frames_until(1500, 1000) == 500);
+        CHECK(frames_until(1000, 1000) == 0);
+        CHECK(frames_until(1000, 1500) == -500);
+}
+
+TEST_CASE("frames_until works across a counter wrap") {
+        const nframes_t before = std::numeric_limits<nframes_t>::max() - 99;
+        // a start just after the wrap is still in the future
+        CHECK(frames_until(400, before) == 500);
+        // and one just before it, seen from after, is in the past
+        CHECK(frames_until(before, 400) == -500);
+}
+
+namespace {
+using schedule_t = jill::dsp::playback_schedule<int, 4>;
+}
+
+TEST_CASE("a schedule yields entries in order of start, not of arrival") {
+        schedule_t s;
+        REQUIRE(s.schedule(1, 3000, 0));
+        REQUIRE(s.schedule(2, 1000, 0));
+        REQUIRE(s.schedule(3, 2000, 0));
+        CHECK(s.pop().value == 2);
+        CHECK(s.pop().value == 3);
+        CHECK(s.pop().value == 1);
+        CHECK(s.empty());
+}
+
+TEST_CASE("entries for the same frame come out in the order they went in") {
+        schedule_t s;
+        s.schedule(1, 1000, 0);
+        s.schedule(2, 1000, 0);
+        CHECK(s.pop().value == 1);
+        CHECK(s.pop().value == 2);
+}
+
+TEST_CASE("a schedule is ordered correctly across a counter wrap") {
+        const nframes_t now = std::numeric_limits<nframes_t>::max() - 999;
+        schedule_t s;
+        s.schedule(1, 500, now);                // after the wrap
+        s.schedule(2, now + 100, now);          // before it
+        CHECK(s.pop().value == 2);
+        CHECK(s.pop().value == 1);
+}
+
+TEST_CASE("next_offset gives the exact offset of a start in this period") {
+        schedule_t s;
+        CHECK(s.next_offset(10000, NFRAMES) == NFRAMES);
+        s.schedule(1, 10300, 10000);
+        CHECK(s.next_offset(10000, NFRAMES) == 300);
+        // a later period finds it at the start, an earlier one not at all
+        CHECK(s.next_offset(10300, NFRAMES) == 0);
+        CHECK(s.next_offset(10300 - NFRAMES, NFRAMES) == NFRAMES);
+}
+
+TEST_CASE("a start in the past is popped as late") {
+        schedule_t s;
+        s.schedule(1, 900, 0);
+        s.schedule(2, 1000, 0);
+        s.schedule(3, 1100, 0);
+        std::vector<int> late;
+        s.pop_late(1000, [&](auto const & item) { late.push_back(item.value); });
+        // a start exactly now is not late
+        CHECK(late == std::vector<int>{1});
+        CHECK(s.size() == 2);
+        CHECK(s.next_offset(1000, NFRAMES) == 0);
+}
+
+TEST_CASE("a full schedule refuses more, armed or not") {
+        schedule_t s;
+        for (int i = 0; i < 3; ++i)
+                REQUIRE(s.schedule(i, 1000 + i, 0));
+        REQUIRE(s.arm(3, 100));
+        CHECK(s.full());
+        CHECK_FALSE(s.schedule(4, 5000, 0));
+        CHECK_FALSE(s.arm(4, 100));
+        CHECK(s.size() == schedule_t::capacity());
+}
+
+TEST_CASE("armed entries wait for a trigger and then count from it") {
+        schedule_t s;
+        s.arm(1, 200);
+        s.arm(2, 0);
+        CHECK(s.empty());
+        CHECK(s.armed() == 2);
+        CHECK(s.next_offset(5000, NFRAMES) == NFRAMES);
+
+        s.trigger(5100);
+        CHECK(s.armed() == 0);
+        auto first = s.pop();
+        CHECK(first.value == 2);
+        CHECK(first.start == 5100);
+        auto second = s.pop();
+        CHECK(second.value == 1);
+        CHECK(second.start == 5300);
+}
+
+TEST_CASE("clearing a schedule hands back armed entries too") {
+        schedule_t s;
+        s.schedule(1, 1000, 0);
+        s.arm(2, 100);
+        std::vector<int> cleared;
+        s.clear([&](auto const & item) { cleared.push_back(item.value); });
+        CHECK(cleared == std::vector<int>{1, 2});
+        CHECK(s.size() == 0);
+}
@@ -11,6 +11,7 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 
+#include <cstdint>
 #include <vector>
 
 #include "jill/dsp/pulse.hh"
@@ -137,3 +138,47 @@ TEST_CASE("pulses stay within the range the format allows") {
                 }
         }
 }
+
+TEST_CASE("a template holds the same samples as render_pulse") {
+        for (auto shape : {pulse_shape::positive, pulse_shape::negative,
+                           pulse_shape::biphasic}) {
+                const jill::dsp::pulse_template tmpl(shape, 7);
+                const auto buf = rendered(shape, 7);
+                REQUIRE(tmpl.size() == 7);
+                for (std::size_t i = 0; i < 7; ++i) {
+                        CAPTURE(i);
+                        CHECK(tmpl.data()[i] == buf[PAD + i]);
+                }
+        }
+}
+
+TEST_CASE("a template from samples is a copy") {
+        std::vector<sample_t> wave = {0.5f, -0.25f, 0.125f};
+        const jill::dsp::pulse_template tmpl(wave.data(), wave.size());
+        wave[0] = 0.0f;
+        REQUIRE(tmpl.size() == 3);
+        CHECK(tmpl.data()[0] == 0.5f);
+        CHECK(tmpl.data()[1] == -0.25f);
+        CHECK(tmpl.data()[2] == 0.125f);
+}
+
+TEST_CASE("template storage is cache-line aligned") {
+        const jill::dsp::pulse_template tmpl(pulse_shape::positive, 13);
+        CHECK(reinterpret_cast<std::uintptr_t>(tmpl.data()) % 64 == 0);
+}
+
+TEST_CASE("mixing a template adds into the buffer and nowhere else") {
+        // jclicker used to overwrite, so a second pulse landing on the first
+        // erased it; now they sum and the output stage clips
+        const jill::dsp::pulse_template tmpl(pulse_shape::biphasic, 4);
+        std::vector<sample_t> buf(2 * PAD + 4, 0.25f);
+        tmpl.mix(buf.data() + PAD);
+        CHECK(buf[PAD + 0] == 1.25f);
+        CHECK(buf[PAD + 1] == 1.25f);
+        CHECK(buf[PAD + 2] == -0.75f);
+        CHECK(buf[PAD + 3] == -0.75f);
+        for (std::size_t i = 0; i < PAD; ++i) {
+                CHECK(buf[i] == 0.25f);
+                CHECK(buf[buf.size() - 1 - i] == 0.25f);
+        }
+}
@@ -0,0 +1,148 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Unit tests for the polyphase resampler used to load stimuli.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "jill/dsp/resampler.hh"
+
+using jill::sample_t;
+using jill::dsp::polyphase_resampler;
+using jill::dsp::resample_quality;
+
+namespace {
+
+std::vector<sample_t> tone(std::size_t n, double freq, double rate)
+{
+        std::vector<sample_t> out(n);
+        for (std::size_t i = 0; i < n; ++i) out[i] = std::sin(2.0 * M_PI * freq * i / rate);
+        return out;
+}
+
+std::vector<sample_t> resample(std::vector<sample_t> const & in, jill::nframes_t from,
+                               jill::nframes_t to, resample_quality q)
+{
+        std::vector<sample_t> out(std::size_t(in.size() * double(to) / from));
+        polyphase_resampler(from, to, q).process(in.data(), in.size(), out.data(), out.size());
+        return out;
+}
+
+/* Largest error against the ideal tone, away from the edges, where the input
+ * stopping abruptly is not the filter's fault */
+double max_error(std::vector<sample_t> const & out, double freq, double rate)
+{
+        double worst = 0.0;
+        for (std::size_t i = out.size() / 8; i < out.size() * 7 / 8; ++i) {
+                const double want = std::sin(2.0 * M_PI * freq * i / rate);
+                worst = std::max(worst, std::fabs(out[i] - want));
+        }
+        return worst;
+}
+
+/* Largest magnitude, away from the edges */
+double peak(std::vector<sample_t> const & out)
+{
+        double worst = 0.0;
+        for (std::size_t i = out.size() / 8; i < out.size() * 7 / 8; ++i)
+                worst = std::max(worst, double(std::fabs(out[i])));
+        return worst;
+}
+
+}
+
+TEST_CASE("the usual audio rates reduce to a supported ratio") {
+        CHECK(polyphase_resampler::supported(44100, 48000));
+        CHECK(polyphase_resampler::supported(48000, 44100));
+        CHECK(polyphase_resampler::supported(22050, 96000));
+        CHECK(polyphase_resampler::supported(8000, 44100));
+
+        const polyphase_resampler r(44100, 48000);
+        CHECK(r.up() == 160);
+        CHECK(r.down() == 147);
+        CHECK(r.taps() % 8 == 0);
+}
+
+TEST_CASE("ratios that need too many phases are left to libsamplerate") {
+        // 44101 is prime, so this does not reduce
+        CHECK_FALSE(polyphase_resampler::supported(44101, 48000));
+        CHECK_FALSE(polyphase_resampler::supported(0, 48000));
+        CHECK_THROWS_AS(polyphase_resampler(44101, 48000), std::invalid_argument);
+}
+
+TEST_CASE("a constant signal keeps its level") {
+        const std::vector<sample_t> in(4410, 0.5f);
+        for (auto q : {resample_quality::fast, resample_quality::medium, resample_quality::best}) {
+                CAPTURE(jill::dsp::to_string(q));
+                const auto out = resample(in, 44100, 48000, q);
+                REQUIRE(out.size() == 4800);
+                for (std::size_t i = 200; i < out.size() - 200; ++i) {
+                        CAPTURE(i);
+                        REQUIRE(out[i] == doctest::Approx(0.5).epsilon(1e-3));
+                }
+        }
+}
+
+TEST_CASE("a tone comes out at the same frequency and in phase") {
+        const double freq = 1000.0;
+        const auto in = tone(44100 / 4, freq, 44100);
+        SUBCASE("upsampling") {
+                CHECK(max_error(resample(in, 44100, 48000, resample_quality::best), freq, 48000) < 1e-3);
+        }
+        SUBCASE("downsampling") {
+                CHECK(max_error(resample(in, 44100, 22050, resample_quality::best), freq, 22050) < 1e-3);
+        }
+}
+
+TEST_CASE("higher quality is at least as accurate") {
+        const double freq = 9000.0;
+        const auto in = tone(44100 / 4, freq, 44100);
+        const double fast = max_error(resample(in, 44100, 48000, resample_quality::fast), freq, 48000);
+        const double best = max_error(resample(in, 44100, 48000, resample_quality::best), freq, 48000);
+        CHECK(best <= fast);
+        CHECK(best < 1e-2);
+}
+
+TEST_CASE("content above the new Nyquist frequency is removed") {
+        // 20 kHz is fine at 44.1 kHz and has to go at 22.05
+        const auto in = tone(44100 / 4, 20000.0, 44100);
+        CHECK(peak(resample(in, 44100, 22050, resample_quality::best)) < 1e-3);
+}
+
+TEST_CASE("the stopband holds when decimating by a large factor") {
+        /* The filter's length has to grow with the decimation; at a fixed
+         * length per phase, these tones came through at -24 and -34 dB */
+        struct ratio { jill::nframes_t from, to; double freq; };
+        for (ratio r : {ratio{96000, 8000, 6000.0}, ratio{48000, 16000, 9000.0},
+                        ratio{48000, 44100, 22500.0}}) {
+                CAPTURE(r.from);
+                CAPTURE(r.to);
+                const auto in = tone(r.from / 2, r.freq, r.from);
+                CHECK(peak(resample(in, r.from, r.to, resample_quality::fast)) < 1e-3);
+                CHECK(peak(resample(in, r.from, r.to, resample_quality::medium)) < 1e-4);
+                CHECK(peak(resample(in, r.from, r.to, resample_quality::best)) < 1e-5);
+        }
+}
+
+TEST_CASE("the passband survives decimation") {
+        const auto in = tone(96000 / 2, 1000.0, 96000);
+        CHECK(max_error(resample(in, 96000, 8000, resample_quality::best), 1000.0, 8000) < 1e-3);
+}
+
+TEST_CASE("quality levels are named") {
+        CHECK(jill::dsp::parse_resample_quality("fast") == resample_quality::fast);
+        CHECK(jill::dsp::parse_resample_quality("medium") == resample_quality::medium);
+        CHECK(jill::dsp::parse_resample_quality("best") == resample_quality::best);
+        CHECK(std::string(jill::dsp::to_string(resample_quality::medium)) == "medium");
+        CHECK_THROWS_AS(jill::dsp::parse_resample_quality("sinc"), std::invalid_argument);
+}
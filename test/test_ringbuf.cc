@@ -393,3 +393,46 @@ TEST_CASE("popping a single element reports an empty buffer") {
         rb.push(&v, 1);
         CHECK(rb.pop().value_or(-1) == 42);
 }
+
+TEST_CASE("block_ringbuffer remembers the most it has held") {
+        const std::size_t frames = 16;
+        const std::size_t bytes = frames * sizeof(jill::sample_t);
+        jill::dsp::block_ringbuffer rb(bytes * 8);
+        std::vector<jill::sample_t> payload(frames, 1.0f);
+        CHECK(rb.high_water() == 0);
+
+        std::size_t held = 0;
+        for (int i = 0; i < 3; ++i)
+                held += rb.push(i * frames, jill::SAMPLED, "pcm", bytes, payload.data());
+        CHECK(rb.high_water() == held);
+
+        // draining does not lower it
+        rb.release();
+        rb.release();
+        CHECK(rb.high_water() == held);
+
+        // taking it starts a new window at what is left
+        CHECK(rb.take_high_water() == held);
+        CHECK(rb.high_water() == rb.read_space());
+        rb.release();
+        CHECK(rb.take_high_water() < held);
+        CHECK(rb.high_water() == 0);
+}
+
+TEST_CASE("block_ringbuffer can keep room free for other writes") {
+        const std::size_t frames = 16;
+        const std::size_t bytes = frames * sizeof(jill::sample_t);
+        jill::dsp::block_ringbuffer rb(4096);
+        std::vector<jill::sample_t> payload(frames, 1.0f);
+        const std::size_t block = rb.push(0, jill::SAMPLED, "pcm", bytes, payload.data());
+        REQUIRE(block > 0);
+
+        // refused if it would leave less than asked, accepted without it
+        const std::size_t free_space = rb.write_space();
+        CHECK(rb.push(1, jill::SAMPLED, "pcm", bytes, payload.data(),
+                      free_space - block + 1) == 0);
+        CHECK(rb.write_space() == free_space);
+        CHECK(rb.push(1, jill::SAMPLED, "pcm", bytes, payload.data(),
+                      free_space - block) == block);
+        CHECK(rb.write_space() == free_space - block);
+}
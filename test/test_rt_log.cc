@@ -0,0 +1,206 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Unit tests for rt_log, the realtime thread's logger. What reaches the log is
+ * checked by pointing stdout, where logger writes every line, at a temporary
+ * file for the duration of each case.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include "jill/rt_log.hh"
+
+using jill::rt_log;
+
+namespace {
+
+/* Sends stdout to a file until destroyed, then returns what was written */
+class capture_stdout {
+public:
+        capture_stdout() : _path("rt_log_capture.XXXXXX") {
+                std::fflush(stdout);
+                const int fd = mkstemp(_path.data());
+                _saved = dup(STDOUT_FILENO);
+                dup2(fd, STDOUT_FILENO);
+                close(fd);
+        }
+        ~capture_stdout() { release(); unlink(_path.c_str()); }
+
+        std::string release() {
+                if (_saved >= 0) {
+                        std::fflush(stdout);
+                        dup2(_saved, STDOUT_FILENO);
+                        close(_saved);
+                        _saved = -1;
+                }
+                std::ifstream in(_path);
+                return std::string(std::istreambuf_iterator<char>(in), {});
+        }
+
+private:
+        std::string _path;
+        int _saved;
+};
+
+/* Sends stdout into a pipe that is already full, so that whoever writes to it
+ * next blocks until unblock(). release() then returns what was written, less
+ * the newlines the pipe was filled with. Nothing may be checked while it is
+ * blocked, since doctest reports on stdout too. */
+class stall_stdout {
+public:
+        stall_stdout() {
+                std::fflush(stdout);
+                REQUIRE(pipe(_fds) == 0);
+                fcntl(_fds[1], F_SETFL, O_NONBLOCK);
+                char fill[4096];
+                std::memset(fill, '\n', sizeof(fill));
+                while (write(_fds[1], fill, sizeof(fill)) > 0) {}
+                // a write of less than PIPE_BUF is all or nothing
+                while (write(_fds[1], fill, 1) > 0) {}
+                fcntl(_fds[1], F_SETFL, 0);
+                _saved = dup(STDOUT_FILENO);
+                dup2(_fds[1], STDOUT_FILENO);
+                close(_fds[1]);
+        }
+        ~stall_stdout() { release(); }
+
+        void unblock() {
+                if (_reader.joinable()) return;
+                _reader = std::thread([this] {
+                        char buf[4096];
+                        ssize_t n;
+                        while ((n = read(_fds[0], buf, sizeof(buf))) > 0)
+                                _text.append(buf, n);
+                });
+        }
+
+        std::string release() {
+                if (_saved >= 0) {
+                        unblock();
+                        std::fflush(stdout);
+                        dup2(_saved, STDOUT_FILENO);    // the last write end
+                        close(_saved);
+                        _saved = -1;
+                        _reader.join();
+                        close(_fds[0]);
+                }
+                return _text.substr(_text.find_first_not_of('\n') == std::string::npos
+                                    ? _text.size() : _text.find_first_not_of('\n'));
+        }
+
+private:
+        int _fds[2];
+        int _saved;
+        std::thread _reader;
+        std::string _text;
+};
+
+std::size_t
+count(std::string const & text, std::string const & what)
+{
+        std::size_t n = 0;
+        for (auto p = text.find(what); p != std::string::npos; p = text.find(what, p + 1)) ++n;
+        return n;
+}
+
+/* What one call leaves in the log: the end of the line, after the timestamp
+ * and source that logger puts in front */
+template <typename... Args>
+std::string
+logged(jill::nframes_t frame, char const * fmt, Args... args)
+{
+        capture_stdout out;
+        {
+                rt_log log(16);
+                log(frame, fmt, args...);
+        }
+        std::string text = out.release();
+        const auto end = text.find('\n');
+        const auto start = text.rfind("] ", end);
+        REQUIRE(start != std::string::npos);
+        return text.substr(start + 2, end - start - 2);
+}
+
+enum class colour { red = 1, green = 2 };
+
+}
+
+TEST_CASE("placeholders take the arguments in order") {
+        CHECK(logged(10, "plain") == "plain");
+        CHECK(logged(10, "a={} b={}", 1, -2) == "a=1 b=-2");
+        CHECK(logged(10, "{} at {frame}", "tone") == "tone at 10");
+        CHECK(logged(4294967295u, "{frame}") == "4294967295");
+        CHECK(logged(0, "{}", 0.5) == "0.5");
+        CHECK(logged(0, "{} {}", 18446744073709551615ull, true) == "18446744073709551615 1");
+        CHECK(logged(0, "{}", colour::green) == "2");
+}
+
+TEST_CASE("placeholders and arguments that do not match up") {
+        CHECK(logged(0, "{} {}", 1) == "1 {}");
+        CHECK(logged(0, "none", 1) == "none");
+        CHECK(logged(0, "{", 1) == "{");
+        CHECK(logged(0, "{frame", 1) == "{frame");
+}
+
+TEST_CASE("each line queued is logged once") {
+        capture_stdout out;
+        {
+                rt_log log(64);
+                CHECK(log(7, "rt_log test line {} of {frame}", 1));
+                CHECK(log(7, "rt_log test line {} of {frame}", 2));
+                rt_log::flush();
+                CHECK(log.pending() == 0);
+        }
+        const std::string text = out.release();
+        CHECK(count(text, "rt_log test line 1 of 7") == 1);
+        CHECK(count(text, "rt_log test line 2 of 7") == 1);
+        CHECK(text.find("line 1") < text.find("line 2"));
+}
+
+TEST_CASE("a full ring drops lines, and says how many") {
+        stall_stdout out;
+        std::size_t queued = 0, dropped = 0;
+        {
+                rt_log log(16);
+                /* The drain thread blocks in its first write to stdout, or
+                 * the one after its buffer fills, so the ring has to fill as
+                 * well; the bound only turns a failure into a failed check
+                 * rather than a hang */
+                for (int i = 0; i < 1000000 && log.dropped() < 10; ++i)
+                        queued += log(0, "rt_log flood");
+                dropped = log.dropped();
+                out.unblock();
+        }
+        const std::string text = out.release();
+        REQUIRE(dropped == 10);
+        CHECK(count(text, "rt_log flood") == queued);
+        CHECK(count(text, "10 lines lost") == 1);
+}
+
+TEST_CASE("lines from several producers all arrive") {
+        capture_stdout out;
+        std::size_t dropped = 0;
+        {
+                rt_log a(1024), b(1024);
+                std::thread ta([&] { for (int i = 0; i < 500; ++i) a(i, "rt_log from a"); });
+                std::thread tb([&] { for (int i = 0; i < 500; ++i) b(i, "rt_log from b"); });
+                ta.join();
+                tb.join();
+                dropped = a.dropped() + b.dropped();
+        }
+        const std::string text = out.release();
+        CHECK(count(text, "rt_log from a") + count(text, "rt_log from b") + dropped == 1000);
+}
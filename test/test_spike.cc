@@ -0,0 +1,153 @@
+/*
+ * JILL - C++ framework for JACK
+ *
+ * Unit tests for the band-pass filter and the spike detector behind jspike.
+ * Most cases run the detector without a filter, so that the spikes planted
+ * in the noise arrive at the threshold exactly as written, and the times and
+ * snippets can be checked to the sample.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "jill/dsp/sos_filter.hh"
+#include "jill/dsp/spike_detector.hh"
+
+using jill::nframes_t;
+using jill::dsp::sos_filter;
+using detector = jill::dsp::spike_detector<float>;
+
+namespace {
+
+const double rate = 30000;
+const float sigma = 0.01;
+const std::size_t settle = 15000;
+const std::size_t pre = 8;
+const std::size_t post = 24;
+
+/* Gaussian noise, the same every time, with negative pulses five samples long
+ * and ten standard deviations deep starting at each of @a spikes */
+std::vector<float> recording(std::size_t n, std::vector<std::size_t> const & spikes)
+{
+        std::mt19937 gen(1);
+        std::normal_distribution<float> noise(0, sigma);
+        std::vector<float> out(n);
+        for (auto & x : out) x = noise(gen);
+        for (std::size_t s : spikes)
+                for (std::size_t i = s; i < s + 5 && i < n; ++i) out[i] = -10 * sigma;
+        return out;
+}
+
+detector make(std::size_t refractory = 30)
+{
+        // no sections: the identity
+        return detector(sos_filter({}), 5.0, detector::negative, refractory, pre, post,
+                        settle, 30000);
+}
+
+struct spike {
+        nframes_t time;
+        std::vector<float> snippet;
+};
+
+/* Run @a data through @a d in blocks of @a block, starting at frame @a start */
+std::vector<spike> detect(detector & d, std::vector<float> const & data, std::size_t block,
+                          nframes_t start = 1000)
+{
+        std::vector<spike> found;
+        for (std::size_t i = 0; i < data.size(); i += block) {
+                const std::size_t n = std::min(block, data.size() - i);
+                d.push(data.data() + i, n, start + i,
+                       [&](nframes_t t, float const * s, std::size_t len) {
+                               found.push_back({t, std::vector<float>(s, s + len)});
+                       });
+        }
+        return found;
+}
+
+/* The gain of @a f at @a freq, from the amplitude of a sine once it settles */
+double gain(sos_filter f, double freq)
+{
+        double peak = 0;
+        for (int i = 0; i < 30000; ++i) {
+                const double y = f(std::sin(2 * M_PI * freq * i / rate));
+                if (i > 20000) peak = std::max(peak, std::fabs(y));
+        }
+        return peak;
+}
+
+}
+
+TEST_CASE("butterworth sections pass their band and stop the rest") {
+        const sos_filter::section hp = sos_filter::highpass(300, rate);
+        const sos_filter::section lp = sos_filter::lowpass(6000, rate);
+        CHECK(gain(sos_filter({hp}), 30) < 0.02);
+        CHECK(gain(sos_filter({hp}), 3000) == doctest::Approx(1.0).epsilon(0.01));
+        CHECK(gain(sos_filter({lp}), 14000) < 0.02);
+        CHECK(gain(sos_filter({lp}), 300) == doctest::Approx(1.0).epsilon(0.01));
+        // half power at the cutoff
+        CHECK(gain(sos_filter({hp}), 300) == doctest::Approx(M_SQRT1_2).epsilon(0.02));
+        CHECK(gain(sos_filter({hp, lp}), 1500) == doctest::Approx(1.0).epsilon(0.05));
+}
+
+TEST_CASE("the noise estimate finds the standard deviation") {
+        detector d = make();
+        detect(d, recording(60000, {}), 256);
+        CHECK(d.settled());
+        CHECK(d.noise() == doctest::Approx(sigma).epsilon(0.1));
+        CHECK(d.threshold() == doctest::Approx(5 * sigma).epsilon(0.1));
+}
+
+TEST_CASE("spikes are found at the frame they cross, with the waveform around them") {
+        const std::vector<std::size_t> planted{20000, 25000, 25100, 40000};
+        const std::vector<float> data = recording(60000, planted);
+        detector d = make();
+        const std::vector<spike> found = detect(d, data, 256);
+        REQUIRE(found.size() == planted.size());
+        for (std::size_t i = 0; i < planted.size(); ++i) {
+                CHECK(found[i].time == 1000 + planted[i]);
+                REQUIRE(found[i].snippet.size() == pre + post);
+                for (std::size_t j = 0; j < pre + post; ++j)
+                        CHECK(found[i].snippet[j] == data[planted[i] - pre + j]);
+        }
+}
+
+TEST_CASE("how the samples are divided into blocks makes no difference") {
+        const std::vector<float> data = recording(60000, {20000, 20511, 30000, 59990});
+        detector a = make(), b = make();
+        const std::vector<spike> one = detect(a, data, 1024);
+        const std::vector<spike> other = detect(b, data, 37);
+        REQUIRE(one.size() == other.size());
+        // the last spike's snippet runs off the end of the data
+        CHECK(one.size() == 3);
+        for (std::size_t i = 0; i < one.size(); ++i) {
+                CHECK(one[i].time == other[i].time);
+                CHECK(one[i].snippet == other[i].snippet);
+        }
+}
+
+TEST_CASE("a second spike within the refractory period is not counted") {
+        const std::vector<float> data = recording(60000, {20000, 20040, 30000});
+        detector d = make(60);
+        const std::vector<spike> found = detect(d, data, 256);
+        REQUIRE(found.size() == 2);
+        CHECK(found[0].time == 21000);
+        CHECK(found[1].time == 31000);
+}
+
+TEST_CASE("nothing is detected while the detector settles") {
+        const std::vector<float> data = recording(30000, {100, 5000, 20000});
+        detector d = make();
+        const std::vector<spike> found = detect(d, data, 256);
+        REQUIRE(found.size() == 1);
+        CHECK(found[0].time == 21000);
+}
@@ -16,15 +16,21 @@
 #include <unistd.h>
 #include <sndfile.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <filesystem>
+#include <fstream>
+#include <memory>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include "jill/file/stimfile.hh"
+#include "jill/file/stimcache.hh"
+#include "jill/file/stimstream.hh"
 #include "jill/util/readahead_stimqueue.hh"
+#include "jill/util/stimset.hh"
 
 namespace fs = std::filesystem;
 using jill::file::stimfile;
@@ -76,6 +82,33 @@ std::string write_tone(fs::path const & path, jill::nframes_t nframes,
         return path.string();
 }
 
+/* Write a file with one tone per channel, channel c at @a freq * (c + 1), so
+ * that the channels can be told apart after loading. */
+std::string write_channels(fs::path const & path, jill::nframes_t nframes,
+                           jill::nframes_t samplerate, unsigned nchans,
+                           float freq = 440.0)
+{
+        SF_INFO info;
+        memset(&info, 0, sizeof(info));
+        info.samplerate = static_cast<int>(samplerate);
+        info.channels = static_cast<int>(nchans);
+        info.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+
+        SNDFILE * f = sf_open(path.c_str(), SFM_WRITE, &info);
+        REQUIRE_MESSAGE(f != nullptr, sf_strerror(nullptr));
+
+        std::vector<float> data(std::size_t(nframes) * nchans);
+        for (jill::nframes_t i = 0; i < nframes; ++i) {
+                for (unsigned c = 0; c < nchans; ++c)
+                        data[std::size_t(i) * nchans + c] =
+                                0.5f * std::sin(2.0 * M_PI * freq * (c + 1) * i / samplerate);
+        }
+        const sf_count_t written = sf_writef_float(f, data.data(), nframes);
+        sf_close(f);
+        REQUIRE(written == static_cast<sf_count_t>(nframes));
+        return path.string();
+}
+
 /* Drain a queue, giving up after a budget rather than blocking forever: a
  * stalled queue has to fail the suite, not hang the run. */
 std::vector<std::string> drain(jill::util::stimqueue & q, std::size_t expected,
@@ -169,6 +202,291 @@ TEST_CASE("resampling to the file's own rate is a no-op") {
         CHECK(f.nframes() == nframes);
 }
 
+TEST_CASE("a multichannel file is stored planar") {
+        temp_dir dir;
+        const jill::nframes_t nframes = 1000, samplerate = 8000;
+        const unsigned nchans = 3;
+        const std::string path = write_channels(dir.path / "three.wav", nframes,
+                                                samplerate, nchans);
+        const std::string mono = write_tone(dir.path / "mono.wav", nframes, samplerate);
+
+        stimfile f(path);
+        CHECK(f.nchannels() == nchans);
+        CHECK(f.nframes() == nframes);
+        f.load_samples();
+        REQUIRE(f.buffer() != nullptr);
+        CHECK(f.channel(0) == f.buffer());
+        CHECK(f.channel(2) == f.buffer() + 2 * nframes);
+        for (unsigned c = 0; c < nchans; ++c) {
+                for (jill::nframes_t i = 0; i < nframes; i += 37) {
+                        CAPTURE(c);
+                        CAPTURE(i);
+                        const float expected = 0.5f * std::sin(
+                                2.0 * M_PI * 440.0 * (c + 1) * i / samplerate);
+                        REQUIRE(f.channel(c)[i] == doctest::Approx(expected));
+                }
+        }
+
+        SUBCASE("and each channel is resampled like a mono file") {
+                stimfile m(mono);
+                m.load_samples(44100);
+                f.load_samples(44100);
+                REQUIRE(f.nframes() == m.nframes());
+                for (jill::nframes_t i = 0; i < m.nframes(); ++i) {
+                        CAPTURE(i);
+                        REQUIRE(f.channel(0)[i] == m.buffer()[i]);
+                }
+        }
+        SUBCASE("and a mono file says it has one channel") {
+                CHECK(stimfile(mono).nchannels() == 1);
+        }
+}
+
+TEST_CASE("read copies the channels the stimulus and the caller have in common") {
+        temp_dir dir;
+        const jill::nframes_t nframes = 500, samplerate = 8000;
+        stimfile f(write_channels(dir.path / "two.wav", nframes, samplerate, 2));
+        f.load_samples();
+
+        SUBCASE("more outputs than channels leaves the extra ones alone") {
+                std::vector<float> a(64, 9.0f), b(64, 9.0f), c(64, 9.0f);
+                jill::sample_t * dest[] = {a.data(), b.data(), c.data()};
+                CHECK(f.read(dest, 3, 100, 64) == 64);
+                CHECK(std::equal(a.begin(), a.end(), f.channel(0) + 100));
+                CHECK(std::equal(b.begin(), b.end(), f.channel(1) + 100));
+                CHECK(c == std::vector<float>(64, 9.0f));
+        }
+        SUBCASE("fewer outputs than channels drops the rest") {
+                std::vector<float> a(64, 9.0f), b(64, 9.0f);
+                // b stands in for the output that isn't there
+                jill::sample_t * dest[] = {a.data(), b.data()};
+                CHECK(f.read(dest, 1, 0, 64) == 64);
+                CHECK(std::equal(a.begin(), a.end(), f.channel(0)));
+                CHECK(b == std::vector<float>(64, 9.0f));
+        }
+}
+
+TEST_CASE("a multichannel file cannot be streamed") {
+        temp_dir dir;
+        const std::string path = write_channels(dir.path / "two.wav", 500, 8000, 2);
+        CHECK_THROWS_AS(jill::file::stimstream(path, 1024), jill::FileError);
+}
+
+/* Read a whole presentation of a stream, in periods of @a period frames,
+ * waiting between them so that the decoder keeps up */
+std::vector<float> play_stream(jill::file::stimstream & s, jill::nframes_t period)
+{
+        std::vector<float> out(s.nframes());
+        for (jill::nframes_t off = 0; off < s.nframes(); off += period) {
+                const jill::nframes_t n = std::min(period, s.nframes() - off);
+                jill::sample_t * dest = out.data() + off;
+                s.read(&dest, 1, off, n);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return out;
+}
+
+TEST_CASE("a stream plays the same samples as a loaded file") {
+        temp_dir dir;
+        const jill::nframes_t nframes = 20000, samplerate = 8000;
+        const std::string path = write_tone(dir.path / "tone.wav", nframes, samplerate);
+
+        stimfile f(path);
+        f.load_samples();
+        // much shorter than the file, so the ring wraps many times
+        jill::file::stimstream s(path, 1024);
+        CHECK(s.buffer() == nullptr);
+        s.load_samples();
+        REQUIRE(s.nframes() == f.nframes());
+
+        const auto out = play_stream(s, 128);
+        CHECK(s.underruns() == 0);
+        for (jill::nframes_t i = 0; i < nframes; ++i) {
+                CAPTURE(i);
+                REQUIRE(out[i] == f.buffer()[i]);
+        }
+}
+
+TEST_CASE("a resampled stream is as long as a resampled file") {
+        temp_dir dir;
+        const jill::nframes_t nframes = 8000, samplerate = 16000;
+        const std::string path = write_tone(dir.path / "tone.wav", nframes, samplerate);
+
+        stimfile f(path);
+        f.load_samples(44100);
+        jill::file::stimstream s(path, 4096);
+        s.load_samples(44100);
+        CHECK(s.samplerate() == 44100);
+        CHECK(s.nframes() == f.nframes());
+
+        const auto out = play_stream(s, 256);
+        CHECK(s.underruns() == 0);
+        /* the stream resamples with libsamplerate and the file with the
+         * polyphase filter, so they agree only as well as each matches the
+         * ideal. Compare in the middle, clear of the edges. */
+        for (jill::nframes_t i = 1000; i < s.nframes() - 1000; i += 97) {
+                CAPTURE(i);
+                CHECK(std::fabs(out[i] - f.buffer()[i]) < 0.01);
+        }
+
+        SUBCASE("and cannot change rate once playing") {
+                CHECK_THROWS_AS(s.load_samples(48000), std::invalid_argument);
+        }
+}
+
+TEST_CASE("each load_samples queues another presentation of a stream") {
+        temp_dir dir;
+        const jill::nframes_t nframes = 3000, samplerate = 8000;
+        const std::string path = write_tone(dir.path / "tone.wav", nframes, samplerate);
+
+        jill::file::stimstream s(path, 512);
+        s.load_samples();
+        s.load_samples();
+        const auto first = play_stream(s, 100);
+        const auto second = play_stream(s, 100);
+        CHECK(s.underruns() == 0);
+        CHECK(first == second);
+}
+
+TEST_CASE("an underrun is silence and the stream stays in time") {
+        temp_dir dir;
+        const jill::nframes_t nframes = 4000, samplerate = 8000;
+        const std::string path = write_tone(dir.path / "tone.wav", nframes, samplerate);
+        stimfile f(path);
+        f.load_samples();
+
+        jill::file::stimstream s(path, 512);
+        s.load_samples();
+        // ask for more than the readahead in one go. The ring rounds up to
+        // whole pages, so it can hold more than was asked for.
+        const std::size_t ahead = s.readahead();
+        REQUIRE(ahead < 2048);
+        std::vector<float> out(2048, 1.0f);
+        jill::sample_t * dest = out.data();
+        s.read(&dest, 1, 0, 2048);
+        CHECK(s.underruns() == 1);
+        for (std::size_t i = 0; i < 2048; ++i) {
+                CAPTURE(i);
+                REQUIRE(((i < ahead) ? f.buffer()[i] : 0.0f) == out[i]);
+        }
+
+        /* the frames that went unplayed are dropped as they arrive, so once
+         * the decoder has caught up the samples are the ones due now */
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        std::vector<float> next(64);
+        dest = next.data();
+        jill::nframes_t off = 2048;
+        while (std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                const std::size_t before = s.underruns();
+                s.read(&dest, 1, off, 64);
+                if (s.underruns() == before) break;
+                off += 64;
+        }
+        REQUIRE(off + 64 <= nframes);
+        for (std::size_t i = 0; i < 64; ++i) {
+                CAPTURE(i);
+                CHECK(next[i] == f.buffer()[off + i]);
+        }
+}
+
+TEST_CASE("the stimulus cache returns what was stored") {
+        temp_dir dir;
+        jill::file::stimcache cache((dir.path / "cache").string());
+        const jill::file::stimcache::digest src{0x1234, 99};
+        const std::vector<float> samples = {0.5f, -0.5f, 0.25f, 0.0f, 1.0f};
+
+        jill::nframes_t nframes = 0;
+        CHECK(cache.find(src, 48000, "test", nframes) == nullptr);
+        REQUIRE(cache.store(src, 48000, "test", samples.data(), samples.size()));
+
+        auto mapped = cache.find(src, 48000, "test", nframes);
+        REQUIRE(mapped != nullptr);
+        REQUIRE(nframes == samples.size());
+        for (std::size_t i = 0; i < samples.size(); ++i) {
+                CAPTURE(i);
+                CHECK(mapped[i] == samples[i]);
+        }
+
+        SUBCASE("and only for the same rate and converter") {
+                CHECK(cache.find(src, 44100, "test", nframes) == nullptr);
+                CHECK(cache.find(src, 48000, "other", nframes) == nullptr);
+                CHECK(cache.find({0x1234, 100}, 48000, "test", nframes) == nullptr);
+        }
+}
+
+TEST_CASE("the cache key follows the contents of a file, not its name") {
+        temp_dir dir;
+        const std::string a = write_tone(dir.path / "a.wav", 800, 8000);
+        const std::string b = write_tone(dir.path / "b.wav", 800, 8000);
+        const std::string c = write_tone(dir.path / "c.wav", 800, 8000, 1000.0);
+
+        const auto da = jill::file::stimcache::hash_file(a);
+        const auto db = jill::file::stimcache::hash_file(b);
+        const auto dc = jill::file::stimcache::hash_file(c);
+        CHECK(da.hash == db.hash);
+        CHECK(da.size == db.size);
+        CHECK(da.hash != dc.hash);
+}
+
+TEST_CASE("a cached stimulus is mapped instead of resampled") {
+        temp_dir dir;
+        const jill::nframes_t nframes = 4000, file_rate = 8000, target = 24000;
+        const std::string path = write_tone(dir.path / "tone.wav", nframes, file_rate);
+        auto cache = std::make_shared<jill::file::stimcache const>(
+                (dir.path / "cache").string());
+
+        stimfile first(path, cache);
+        first.load_samples(target);
+        REQUIRE(first.buffer() != nullptr);
+        CHECK(std::distance(fs::directory_iterator(cache->path()),
+                            fs::directory_iterator()) == 1);
+
+        /* The second load has to come from the cache, and so must match the
+         * first exactly. Make the entry identifiably different to be sure it
+         * is what was used. */
+        const auto entry = fs::directory_iterator(cache->path())->path();
+        std::vector<float> marked(first.buffer(), first.buffer() + first.nframes());
+        marked[0] = 0.75f;
+        {
+                std::ofstream out(entry, std::ios::binary | std::ios::trunc);
+                out.write(reinterpret_cast<char const *>(marked.data()),
+                          marked.size() * sizeof(float));
+        }
+
+        stimfile second(path, cache);
+        second.load_samples(target);
+        REQUIRE(second.buffer() != nullptr);
+        CHECK(second.samplerate() == target);
+        CHECK(second.nframes() == first.nframes());
+        CHECK(second.buffer()[0] == 0.75f);
+        CHECK(second.buffer()[1] == first.buffer()[1]);
+
+        SUBCASE("but not when no resampling is needed") {
+                stimfile native(path, cache);
+                native.load_samples(file_rate);
+                CHECK(native.nframes() == nframes);
+                CHECK(native.buffer()[0] != 0.75f);
+        }
+}
+
+TEST_CASE("a multichannel stimulus round-trips through the cache") {
+        temp_dir dir;
+        const jill::nframes_t nframes = 2000;
+        const std::string path = write_channels(dir.path / "two.wav", nframes, 8000, 2);
+        auto cache = std::make_shared<jill::file::stimcache const>(
+                (dir.path / "cache").string());
+
+        stimfile first(path, cache);
+        first.load_samples(24000);
+        stimfile second(path, cache);
+        second.load_samples(24000);
+        REQUIRE(second.nframes() == first.nframes());
+        CHECK(second.nchannels() == 2);
+        CHECK(std::equal(first.buffer(), first.buffer() + 2 * first.nframes(),
+                         second.buffer()));
+}
+
 TEST_CASE("readahead_stimqueue delivers every stimulus in order") {
         temp_dir dir;
         const jill::nframes_t samplerate = 8000;
@@ -403,3 +721,181 @@ TEST_CASE("finished() waits for the last stimulus to be released") {
         CHECK(queue.finished());
         queue.join();
 }
+
+TEST_CASE("the queue keeps several trials ready") {
+        temp_dir dir;
+        const jill::nframes_t samplerate = 8000;
+        std::vector<std::unique_ptr<stimfile>> files;
+        std::vector<jill::util::trial> playlist;
+        for (int i = 0; i < 6; ++i) {
+                const std::string name = "stim_" + std::to_string(i);
+                files.push_back(std::make_unique<stimfile>(
+                        write_tone(dir.path / (name + ".wav"), 400, samplerate)));
+                playlist.push_back({files.back().get(), false});
+        }
+
+        jill::util::readahead_stimqueue queue(playlist.begin(), playlist.end(), samplerate,
+                                              false, 3);
+        // without anyone consuming, the worker fills the queue and stops there
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (queue.statistics().depth < 3 && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        auto st = queue.statistics();
+        CHECK(st.capacity == 3);
+        CHECK(st.depth == 3);
+        CHECK(st.loaded == 3);
+        CHECK(st.max_load_ms >= st.mean_load_ms);
+
+        // and the sleeping worker is woken to deliver the rest, in order
+        const auto seen = drain(queue, playlist.size());
+        REQUIRE(seen.size() == playlist.size());
+        for (std::size_t i = 0; i < seen.size(); ++i) {
+                CHECK(seen[i] == "stim_" + std::to_string(i));
+        }
+        queue.join();
+        CHECK(queue.statistics().loaded == playlist.size());
+}
+
+TEST_CASE("a consumer that keeps pace is never starved") {
+        /* Each trial is held for a few milliseconds, as playback would, and
+         * the next must be ready when it is released. The old single slot
+         * refilled on a five millisecond poll and would miss here. */
+        temp_dir dir;
+        const jill::nframes_t samplerate = 8000;
+        const std::string path = write_tone(dir.path / "a.wav", 400, samplerate);
+        stimfile f(path);
+        std::vector<jill::util::trial> playlist(20, jill::util::trial{&f, false});
+
+        jill::util::readahead_stimqueue queue(playlist.begin(), playlist.end(), samplerate);
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (queue.statistics().depth < 4 && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::size_t played = 0;
+        while (played < playlist.size() && std::chrono::steady_clock::now() < deadline) {
+                if (queue.head() == nullptr) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        continue;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(3));
+                queue.release();
+                ++played;
+        }
+        CHECK(played == playlist.size());
+        CHECK(queue.statistics().starved == 0);
+        queue.join();
+}
+
+namespace {
+
+/* A stimulus that synthesizes its samples, so the residency tests can count
+ * loads and unloads without touching the disk. */
+struct synthetic_stim : jill::stimulus_t {
+        explicit synthetic_stim(std::string n, jill::nframes_t frames)
+                : _name(std::move(n)), _frames(frames) {}
+        char const * name() const override { return _name.c_str(); }
+        jill::nframes_t nframes() const override { return _frames; }
+        jill::nframes_t samplerate() const override { return 8000; }
+        jill::sample_t const * buffer() const override { return _buf.empty() ? nullptr : _buf.data(); }
+        void load_samples(jill::nframes_t) override {
+                _buf.assign(_frames, 0.5f);
+                ++loads;
+        }
+        void unload_samples() override {
+                _buf.clear();
+                _buf.shrink_to_fit();
+        }
+        std::string _name;
+        jill::nframes_t _frames;
+        std::vector<jill::sample_t> _buf;
+        int loads = 0;
+};
+
+using jill::util::stimset;
+
+/* Wait for an entry to leave Loading, within a budget. */
+stimset::state_t settle(stimset::entry const & e)
+{
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (e.state() == stimset::Loading && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return e.state();
+}
+
+}
+
+TEST_CASE("a stimset loads only what is asked for") {
+        stimset set(8000, 0);
+        auto * a = set.add("a", std::make_unique<synthetic_stim>("a", 100));
+        auto * b = set.add("b", std::make_unique<synthetic_stim>("b", 100));
+        REQUIRE(a != nullptr);
+        REQUIRE(b != nullptr);
+        CHECK(set.add("a", std::make_unique<synthetic_stim>("a", 1)) == nullptr);
+        set.start(2);
+
+        CHECK_FALSE(set.acquire(*a));          // not loaded, so not pinned
+        CHECK(set.request(*a) == stimset::Loading);
+        CHECK(settle(*a) == stimset::Ready);
+        CHECK(b->state() == stimset::Unloaded);
+        CHECK(set.resident() == 100 * sizeof(jill::sample_t));
+        CHECK(set.loads_done() == set.loads_requested());
+        set.stop();
+}
+
+TEST_CASE("a stimset over budget evicts the least recently used") {
+        const std::size_t each = 1000 * sizeof(jill::sample_t);
+        stimset set(8000, 2 * each);
+        auto * a = set.add("a", std::make_unique<synthetic_stim>("a", 1000));
+        auto * b = set.add("b", std::make_unique<synthetic_stim>("b", 1000));
+        auto * c = set.add("c", std::make_unique<synthetic_stim>("c", 1000));
+        set.start(1);
+
+        set.request(*a);
+        REQUIRE(settle(*a) == stimset::Ready);
+        set.request(*b);
+        REQUIRE(settle(*b) == stimset::Ready);
+        // a use of a makes b the older of the two
+        set.request(*a);
+        set.request(*c);
+        REQUIRE(settle(*c) == stimset::Ready);
+
+        CHECK(a->state() == stimset::Ready);
+        CHECK(b->state() == stimset::Unloaded);
+        CHECK(b->stim()->buffer() == nullptr);
+        CHECK(set.resident() == 2 * each);
+        set.stop();
+}
+
+TEST_CASE("a pinned stimulus is never evicted") {
+        /* The realtime thread's buffer is protected by the pin and nothing
+         * else, so this is the property that keeps jstimserver from freeing
+         * audio under the process callback. */
+        const std::size_t each = 1000 * sizeof(jill::sample_t);
+        stimset set(8000, each);
+        auto * a = set.add("a", std::make_unique<synthetic_stim>("a", 1000));
+        auto * b = set.add("b", std::make_unique<synthetic_stim>("b", 1000));
+        auto * c = set.add("c", std::make_unique<synthetic_stim>("c", 1000));
+        set.start(1);
+
+        set.request(*a);
+        REQUIRE(settle(*a) == stimset::Ready);
+        REQUIRE(set.acquire(*a));
+        set.request(*b);
+        REQUIRE(settle(*b) == stimset::Ready);
+
+        // over budget, but the only candidate is pinned
+        CHECK(a->state() == stimset::Ready);
+        CHECK(a->stim()->buffer() != nullptr);
+        CHECK(set.resident() == 2 * each);
+
+        // released, it is the oldest, and goes when the next load needs room
+        a->release();
+        set.request(*c);
+        REQUIRE(settle(*c) == stimset::Ready);
+        CHECK(a->state() == stimset::Unloaded);
+        CHECK(set.resident() == each);
+        set.stop();
+}
@@ -30,9 +30,13 @@ UNIT_SUITES = [
     "test_util",
     "test_playback",
     "test_pulse",
+    "test_resampler",
     "test_ringbuf_concurrent",
     "test_data_writer",
     "test_triggered_writer",
+    "test_jstimserver_binary",
+    "test_rt_log",
+    "test_spike",
 ]
 
 # Older programs that predate the harness. They mostly return 0 whatever
@@ -232,6 +232,16 @@ TEST_CASE("the prebuffer walk writes exactly the pretrigger window") {
         CHECK(data_writes.back().time + PERIOD == onset_at);
 }
 
+TEST_CASE("only the data written count toward the size of the file") {
+        harness h(PERIOD * 2, PERIOD * 2);
+        h.fill(8);
+        for (int i = 0; i < 8; ++i) h.step();
+        CHECK(h.writer->bytes_written() == 0);
+        h.trigger(midi::status_type::note_on);
+        // the pretrigger window, and the one-byte trigger event
+        CHECK(h.writer->bytes_written() == 2 * PERIOD * sizeof(sample_t) + 1);
+}
+
 TEST_CASE("a period straddling the onset is written from the onset") {
         /* A pretrigger that is not a multiple of the period puts the onset
          * inside a period rather than on a boundary. That period must be
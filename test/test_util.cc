@@ -2,7 +2,8 @@
  * JILL - C++ framework for JACK
  *
  * Unit tests for small pure utilities: the data block header, the stringstream
- * wrapper, and the daily time window used by jtime.
+ * wrapper, the daily time window used by jtime, the doorbell, and the process
+ * callback timings.
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -12,8 +13,10 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 
+#include <chrono>
 #include <cstring>
 #include <string>
+#include <thread>
 #include <vector>
 
 // daytime.hh needs only the types; parsing durations from strings needs the
@@ -23,6 +26,8 @@
 #include "jill/types.hh"
 #include "jill/util/string.hh"
 #include "jill/util/daytime.hh"
+#include "jill/util/doorbell.hh"
+#include "jill/util/process_stats.hh"
 
 using jill::util::is_daytime;
 using jill::util::make_string;
@@ -158,3 +163,70 @@ TEST_CASE("an empty window covers the whole day") {
         CHECK(is_daytime(t, t, duration_from_string("09:00:00")));
         CHECK(is_daytime(t, t, duration_from_string("21:00:00")));
 }
+
+TEST_CASE("a doorbell rung while nobody waits is not remembered") {
+        // ringing unarmed is the cheap path, and must not leave a wakeup
+        // behind for a later wait to return on at once
+        jill::util::doorbell bell;
+        bell.ring();
+        bell.arm();
+        CHECK_FALSE(bell.wait(std::chrono::milliseconds(20)));
+}
+
+TEST_CASE("a doorbell wakes an armed waiter") {
+        jill::util::doorbell bell;
+        bell.arm();
+        std::thread ringer([&bell] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                bell.ring();
+        });
+        const auto start = std::chrono::steady_clock::now();
+        CHECK(bell.wait(std::chrono::seconds(10)));
+        CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+        ringer.join();
+
+        SUBCASE("and is quiet again afterwards") {
+                bell.arm();
+                CHECK_FALSE(bell.wait(std::chrono::milliseconds(20)));
+        }
+}
+
+TEST_CASE("a ring between arming and waiting is not lost") {
+        jill::util::doorbell bell;
+        bell.arm();
+        bell.ring();
+        CHECK(bell.wait(std::chrono::seconds(10)));
+}
+
+TEST_CASE("process timings are binned by tenths of the period") {
+        jill::util::process_stats stats;
+        stats.record(0, 1000);          // 0%
+        stats.record(99, 1000);         // still under 10%
+        stats.record(100, 1000);        // 10%
+        stats.record(999, 1000);        // 99.9%
+        stats.record(1000, 1000);       // the whole period: a miss
+        stats.record(5000, 1000);       // well over
+        stats.record(10, 0);            // no period, not counted
+        const auto s = stats.take();
+        CHECK(s.periods == 6);
+        CHECK(s.misses == 2);
+        CHECK(s.total_usec == 0 + 99 + 100 + 999 + 1000 + 5000);
+        CHECK(s.period_usec == 1000);
+        CHECK(s.histogram[0] == 2);
+        CHECK(s.histogram[1] == 1);
+        CHECK(s.histogram[9] == 1);
+        CHECK(s.histogram[10] == 2);
+        CHECK(s.max_usec == 5000);
+}
+
+TEST_CASE("the window maximum starts again at each take") {
+        jill::util::process_stats stats;
+        stats.record(800, 1000);
+        stats.record(300, 1000);
+        CHECK(stats.take().window_max_usec == 800);
+        stats.record(200, 1000);
+        const auto s = stats.take();
+        CHECK(s.window_max_usec == 200);
+        CHECK(s.max_usec == 800);
+        CHECK(stats.take().window_max_usec == 0);
+}
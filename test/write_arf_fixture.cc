@@ -9,13 +9,21 @@
  * easier to express. It does report progress on stdout, so that if the writer
  * crashes it is obvious how far it got.
  *
- * usage: write_arf_fixture <output.arf>
+ * usage: write_arf_fixture <output.arf> [--crash | --spikes]
+ *
+ * With --crash, it instead writes part of an entry, prepares the next one,
+ * flushes the file, and exits without closing anything, as jrecord would
+ * leave a file if it died.
+ *
+ * With --spikes, it writes events alone through a buffered_data_writer, as
+ * jspike does, out of order across channels.
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
  * the Free Software Foundation; either version 2 of the License, or
  * (at your option) any later version.
  */
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <map>
@@ -29,6 +37,7 @@
 #include "jill/data_writer.hh"
 #include "jill/midi.hh"
 #include "jill/file/arf_writer.hh"
+#include "jill/dsp/buffered_data_writer.hh"
 
 using namespace jill;
 using boost::posix_time::microsec_clock;
@@ -43,6 +52,8 @@ const int PERIODS_PER_ENTRY = 10;
 const char * CHANNELS[] = {"pcm_000", "pcm_001"};
 const char * EVENT_CHANNEL = "trig_in";
 const char * STIMULUS_NAME = "stim_a";
+const std::size_t PAGE_SIZE = 64 * 1024;
+const nframes_t SPIKE_PERIOD = 5000;
 
 /* A data source that does not need a JACK server. */
 class null_source : public data_source {
@@ -133,7 +144,7 @@ int
 main(int argc, char ** argv)
 {
         if (argc < 2) {
-                std::cerr << "usage: write_arf_fixture <output.arf>" << std::endl;
+                std::cerr << "usage: write_arf_fixture <output.arf> [--crash | --spikes]" << std::endl;
                 return 2;
         }
         const std::string path = argv[1];
@@ -143,9 +154,44 @@ main(int argc, char ** argv)
         attrs["experiment"] = "arf format fixture";
 
         null_source source("fixture", SAMPLING_RATE);
+        if (argc > 2 && std::string(argv[2]) == "--crash") {
+                std::cout << "creating " << path << " (crashing)" << std::endl;
+                auto * arf = new file::arf_writer(path, source, attrs);
+                arf->new_entry(0);
+                write_periods(*arf, 0, 3);
+                // and the next entry made ahead, as a triggered recording has
+                arf->prepare_entries();
+                arf->idle();
+                arf->flush();
+                std::cout << "crashing" << std::endl;
+                // no destructors: the entry is never closed or trimmed
+                std::_Exit(0);
+        }
+        if (argc > 2 && std::string(argv[2]) == "--spikes") {
+                std::cout << "creating " << path << " (spikes)" << std::endl;
+                dsp::buffered_data_writer w(
+                        std::make_unique<file::arf_writer>(path, source, attrs));
+                // as jspike does at its first period
+                w.reset_at(SPIKE_PERIOD);
+                /* A snippet is finished some time after its crossing, and the
+                 * channels are handled in turn, so the second channel's
+                 * spike arrives before the first's that crossed later. */
+                const char note[] = {char(midi::status_type::note_on),
+                                     char(midi::default_pitch), char(midi::default_velocity)};
+                w.push(SPIKE_PERIOD + 300, EVENT, "spk_000", sizeof(note), note);
+                w.push(SPIKE_PERIOD + 100, EVENT, "spk_001", sizeof(note), note);
+                w.push(SPIKE_PERIOD + 900, EVENT, "spk_000", sizeof(note), note);
+                w.start();
+                w.stop();
+                w.join();
+                std::cout << "done" << std::endl;
+                return 0;
+        }
         std::cout << "creating " << path << std::endl;
-        std::unique_ptr<data_writer> writer(
-                new file::arf_writer(path, source, attrs, 0));
+        // paged, so the tests read a file laid out that way, and the rotated
+        // file after it is too
+        auto * arf = new file::arf_writer(path, source, attrs, 0, nullptr, PAGE_SIZE);
+        std::unique_ptr<data_writer> writer(arf);
 
         std::cout << "writing log message" << std::endl;
         writer->log(microsec_clock::universal_time(), "fixture", "a log message");
@@ -157,8 +203,12 @@ main(int argc, char ** argv)
         write_periods(*writer, 1000, PERIODS_PER_ENTRY, 2);
         writer->close_entry();
 
-        // second entry, to check that numbering advances
-        std::cout << "entry 1" << std::endl;
+        /* second entry, to check that numbering advances. It is made ahead
+         * of time, as in a triggered recording, with the event channel of
+         * the first entry, which gets nothing this time. */
+        std::cout << "entry 1 (prepared)" << std::endl;
+        arf->prepare_entries();
+        writer->idle();
         writer->new_entry(100000);
         write_periods(*writer, 100000, 2);
         writer->xrun();
@@ -176,7 +226,12 @@ main(int argc, char ** argv)
         /* An event stamped before data already written. arf_writer used to
          * record the end of an entry as the last write rather than the
          * furthest one, so this dragged trial_off backwards; the entry is two
-         * periods long whichever order the writes arrive in. */
+         * periods long whichever order the writes arrive in.
+         *
+         * Its events are stored in the compact format: the stimulus twice,
+         * to be stored once in jill_messages, and a note on between. */
+        std::cout << "entry 4 (compact events)" << std::endl;
+        arf->use_compact_events();
         writer->new_entry(200000);
         write_periods(*writer, 200000, 2);
         {
@@ -187,9 +242,52 @@ main(int argc, char ** argv)
                 std::vector<char> block = make_block(200000, EVENT, EVENT_CHANNEL,
                                                      payload.data(), payload.size());
                 writer->write(reinterpret_cast<data_block_t const *>(block.data()), 0, 0);
+
+                const char note[] = {char(midi::status_type::note_on),
+                                     char(midi::default_pitch), char(midi::default_velocity)};
+                block = make_block(200000 + PERIOD / 2, EVENT, EVENT_CHANNEL, note, sizeof(note));
+                writer->write(reinterpret_cast<data_block_t const *>(block.data()), 0, 0);
+
+                block = make_block(200000 + PERIOD, EVENT, EVENT_CHANNEL,
+                                   payload.data(), payload.size());
+                writer->write(reinterpret_cast<data_block_t const *>(block.data()), 0, 0);
         }
         writer->close_entry();
 
+        /* Four periods with the second and third of the second channel
+         * dropped, as a low-priority channel is when the writer falls behind:
+         * GAP blocks stand in for them. */
+        std::cout << "entry 5 (gaps)" << std::endl;
+        writer->new_entry(300000);
+        for (int p = 0; p < 4; ++p) {
+                const nframes_t t = 300000 + p * PERIOD;
+                for (int c = 0; c < 2; ++c) {
+                        std::vector<char> block;
+                        if (c == 1 && (p == 1 || p == 2)) {
+                                const gap_t gap{PERIOD, SAMPLED};
+                                block = make_block(t, GAP, CHANNELS[c], &gap, sizeof(gap));
+                        }
+                        else {
+                                const std::vector<sample_t> samples = ramp(PERIOD, c);
+                                block = make_block(t, SAMPLED, CHANNELS[c], samples.data(),
+                                                   samples.size() * sizeof(sample_t));
+                        }
+                        writer->write(reinterpret_cast<data_block_t const *>(block.data()), 0, 0);
+                }
+        }
+        writer->close_entry();
+
+        /* Rotation, as jrecord does it in a continuous recording: the next
+         * file made while idle, and the entry after the switch carrying on
+         * from the last one in the old file at the very next frame. */
+        std::cout << "entry 6 (next file)" << std::endl;
+        arf->prepare_rotation();
+        writer->idle();
+        writer->rotate();
+        writer->new_entry(300000 + 4 * PERIOD);
+        write_periods(*writer, 300000 + 4 * PERIOD, 2);
+        writer->close_entry();
+
         writer->flush();
         std::cout << "done" << std::endl;
         return 0;